@@ -87,6 +87,7 @@ std::string highlightExpression(const std::string& expression, IEnvironment* env
                     color = Colors::COMMA;
                     break;
                 case TokenType::BOOLEAN:
+                case TokenType::NULL_VALUE:
                     color = Colors::BOOLEAN;
                     break;
                 case TokenType::WHITESPACE:
@@ -1152,3 +1152,2040 @@ TEST_CASE("String In Operator", "[strings]") {
         REQUIRE_THROWS_AS(Expression::Eval("true in \"hello\"", nullptr), ExprException);
     }
 }
+
+TEST_CASE("Evaluation Budgets and Cancellation", "[budget]") {
+    SECTION("Unlimited context evaluates normally") {
+        EvaluationContext context;
+        REQUIRE(Expression::Eval("1 + 2 * 3", nullptr, context).asNumber() == 7.0);
+        REQUIRE(context.GetStepCount() == 5);
+    }
+
+    SECTION("Step limit aborts with a distinct error") {
+        EvaluationBudget budget;
+        budget.maxSteps = 4;
+        EvaluationContext context(budget);
+        REQUIRE(Expression::Eval("1 + 2", nullptr, context).asNumber() == 3.0);
+        try {
+            Expression::Eval("1 + 2 + 3 + 4", nullptr, context);
+            FAIL("Expected ExprAbortedException");
+        } catch (const ExprAbortedException& e) {
+            REQUIRE(e.reason() == AbortReason::STEP_LIMIT);
+        }
+    }
+
+    SECTION("Aborts are still ExprExceptions") {
+        EvaluationBudget budget;
+        budget.maxSteps = 1;
+        EvaluationContext context(budget);
+        REQUIRE_THROWS_AS(Expression::Eval("1 + 2", nullptr, context), ExprException);
+    }
+
+    SECTION("String byte limit") {
+        EvaluationBudget budget;
+        budget.maxStringBytes = 8;
+        EvaluationContext context(budget);
+        REQUIRE(Expression::Eval("\"abc\" + \"def\"", nullptr, context).asString() == "abcdef");
+        try {
+            Expression::Eval("(\"abc\" + \"def\") + \"ghi\"", nullptr, context);
+            FAIL("Expected ExprAbortedException");
+        } catch (const ExprAbortedException& e) {
+            REQUIRE(e.reason() == AbortReason::STRING_LIMIT);
+        }
+    }
+
+    SECTION("Depth limit") {
+        EvaluationBudget budget;
+        budget.maxDepth = 3;
+        EvaluationContext context(budget);
+        REQUIRE(Expression::Eval("1 + 2", nullptr, context).asNumber() == 3.0);
+        REQUIRE_THROWS_AS(Expression::Eval("-(-(-1))", nullptr, context), ExprAbortedException);
+    }
+
+    SECTION("Cancellation is observed around host calls") {
+        CancellationToken token;
+        EvaluationContext context(EvaluationBudget(), token);
+        TestEnvironment environment;
+        REQUIRE(Expression::Eval("add(1, 2)", &environment, context).asNumber() == 3.0);
+        token.Cancel();
+        try {
+            Expression::Eval("add(1, 2)", &environment, context);
+            FAIL("Expected ExprAbortedException");
+        } catch (const ExprAbortedException& e) {
+            REQUIRE(e.reason() == AbortReason::CANCELLED);
+        }
+    }
+
+    SECTION("Expired deadline") {
+        EvaluationBudget budget;
+        budget.deadline = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+        EvaluationContext context(budget);
+        TestEnvironment environment;
+        try {
+            Expression::Eval("add(1, 2)", &environment, context);
+            FAIL("Expected ExprAbortedException");
+        } catch (const ExprAbortedException& e) {
+            REQUIRE(e.reason() == AbortReason::DEADLINE);
+        }
+    }
+
+    SECTION("Counters accumulate across direct evaluations until reset") {
+        EvaluationBudget budget;
+        budget.maxSteps = 6;
+        EvaluationContext context(budget);
+        auto ast = Expression::Parse("1 + 2");
+        ast->evaluate(nullptr, &context);
+        ast->evaluate(nullptr, &context);
+        REQUIRE_THROWS_AS(ast->evaluate(nullptr, &context), ExprAbortedException);
+        context.Reset();
+        REQUIRE(ast->evaluate(nullptr, &context).asNumber() == 3.0);
+    }
+}
+
+TEST_CASE("Batch Evaluation", "[batch]") {
+    Batch batch(4);
+    batch.Add("x", Column::Numbers({1, 2, 3, 4}));
+    batch.Add("flag", Column::Booleans({1, 0, 1, 0}));
+    batch.Add("name", Column::Strings({"a", "b", "c", "d"}));
+
+    SECTION("Numeric and logical kernels") {
+        auto result = Expression::EvaluateBatch(Expression::Parse("x * 2 + 1"), batch);
+        REQUIRE(result.getKind() == Column::Kind::NUMBER);
+        REQUIRE(result.numberAt(0) == 3.0);
+        REQUIRE(result.numberAt(3) == 9.0);
+
+        auto predicate = Expression::EvaluateBatch(Expression::Parse("x > 1 && !flag"), batch);
+        REQUIRE(predicate.getKind() == Column::Kind::BOOLEAN);
+        REQUIRE(predicate.booleanAt(0) == false);
+        REQUIRE(predicate.booleanAt(1) == true);
+        REQUIRE(predicate.booleanAt(3) == true);
+    }
+
+    SECTION("Row-wise fallback matches scalar semantics") {
+        TestEnvironment environment;
+        environment.set("y", Value(10.0));
+        auto result = Expression::EvaluateBatch(Expression::Parse("name + \"!\""), batch);
+        REQUIRE(result.at(2).asString() == "c!");
+        auto mixed = Expression::EvaluateBatch(Expression::Parse("flag ? add(x, y) : sqrt(x)"), batch, &environment);
+        REQUIRE(mixed.at(0).asNumber() == 11.0);
+        REQUIRE(mixed.at(3).asNumber() == 2.0);
+    }
+
+    SECTION("Errors surface as in scalar evaluation") {
+        REQUIRE_THROWS_AS(Expression::EvaluateBatch(Expression::Parse("1 / (x - 2)"), batch), ExprException);
+        REQUIRE_THROWS_AS(Expression::EvaluateBatch(Expression::Parse("missing + 1"), batch), ExprException);
+    }
+}
+
+TEST_CASE("Top-K Scoring", "[batch][topk]") {
+    const size_t rows = 5000;
+    std::vector<double> a(rows), b(rows), c(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        a[i] = static_cast<double>((i * 7919) % 1000) / 10.0;
+        b[i] = static_cast<double>((i * 104729) % 97);
+        c[i] = static_cast<double>(i % 13);
+    }
+    Batch batch(rows);
+    batch.Add("a", Column::Numbers(a)).Add("b", Column::Numbers(b)).Add("c", Column::Numbers(c));
+
+    const auto check = [&](const std::string& expression, size_t k) {
+        auto ast = Expression::Parse(expression);
+        TopKStats stats;
+        auto top = TopK(ast, batch, k, nullptr, nullptr, &stats);
+
+        auto all = Expression::EvaluateBatch(ast, batch);
+        std::vector<ScoredRow> expected;
+        for (size_t i = 0; i < rows; ++i) expected.push_back({i, all.numberAt(i)});
+        std::stable_sort(expected.begin(), expected.end(),
+                         [](const ScoredRow& x, const ScoredRow& y) { return x.score > y.score; });
+        expected.resize(k);
+
+        REQUIRE(top.size() == k);
+        for (size_t i = 0; i < k; ++i) {
+            REQUIRE(top[i].row == expected[i].row);
+            REQUIRE(top[i].score == expected[i].score);
+        }
+        return stats;
+    };
+
+    SECTION("Additive scores prune candidates") {
+        auto stats = check("a * 2 + sqrt(b) - c", 10);
+        REQUIRE(stats.prunedRows > 0);
+        REQUIRE(stats.termEvaluations < rows * 3);
+    }
+
+    SECTION("Non-decomposable scores evaluate every row") {
+        auto stats = check("a * b", 7);
+        REQUIRE(stats.prunedRows == 0);
+    }
+
+    SECTION("Edge cases") {
+        REQUIRE(TopK(Expression::Parse("a"), batch, 0).empty());
+        REQUIRE(TopK(Expression::Parse("a + b"), Batch(0), 3).empty());
+        REQUIRE(check("a + b", rows).prunedRows == 0);
+        REQUIRE_THROWS_AS(TopK(Expression::Parse("a > b"), batch, 3), ExprException);
+    }
+}
+
+TEST_CASE("Interval Analysis", "[analysis]") {
+    IntervalMap ranges{{"x", Interval(1, 4)}, {"y", Interval(-2, 3)}};
+    auto r = ComputeInterval(Expression::Parse("x * y + 1"), ranges);
+    REQUIRE(r.lower == -7.0);
+    REQUIRE(r.upper == 13.0);
+    REQUIRE(ComputeInterval(Expression::Parse("sqrt(x) - sin(y)"), ranges).upper == 3.0);
+    REQUIRE_FALSE(ComputeInterval(Expression::Parse("x / y"), ranges).isBounded());
+    // sqrt of a negative number is a host call, so any negative part leaves the result unknown
+    REQUIRE_FALSE(ComputeInterval(Expression::Parse("sqrt(y)"), ranges).isBounded());
+    REQUIRE(ComputeInterval(Expression::Parse("sqrt(x - 1)"), ranges).lower == 0.0);
+    REQUIRE_FALSE(ComputeInterval(Expression::Parse("z + 1"), ranges).isBounded());
+}
+
+TEST_CASE("Fused Projection", "[batch][projection]") {
+    class CountingEnvironment final : public IEnvironment {
+    public:
+        int reads = 0;
+        Value Get(const std::string& name) override {
+            ++reads;
+            if (name == "tax") return Value(0.5);
+            throw ExprException("Variable not defined: " + name);
+        }
+        Value Call(const std::string& name, const std::vector<Value>&) override {
+            throw ExprException("Function not defined: " + name);
+        }
+    };
+
+    const size_t rows = 10000;
+    std::vector<double> price(rows), qty(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        price[i] = 1.0 + static_cast<double>(i % 50);
+        qty[i] = static_cast<double>(i % 7);
+    }
+    Batch batch(rows);
+    batch.Add("price", Column::Numbers(price)).Add("qty", Column::Numbers(qty));
+
+    const std::vector<std::string> expressions = {
+        "price * qty",
+        "price * qty * tax",
+        "price * qty > 100 ? \"big\" : \"small\"",
+        "sqrt(price) + sqrt(price)"
+    };
+    Projection projection(expressions, 1000);
+    REQUIRE(projection.getSharedNodeCount() >= 3);
+
+    CountingEnvironment environment;
+    auto outputs = projection.Evaluate(batch, &environment);
+    REQUIRE(outputs.size() == expressions.size());
+    // One environment read of "tax" per chunk, not per row
+    REQUIRE(environment.reads == 10);
+
+    for (size_t e = 0; e < expressions.size(); ++e) {
+        auto expected = Expression::EvaluateBatch(Expression::Parse(expressions[e]), batch, &environment);
+        REQUIRE(outputs[e].size() == rows);
+        for (size_t i = 0; i < rows; i += 997) {
+            REQUIRE(outputs[e].at(i) == expected.at(i));
+        }
+    }
+
+    SECTION("Common subexpression elimination merges identical trees") {
+        auto ast = EliminateCommonSubexpressions(Expression::Parse("(a + b) * (a + b)"));
+        auto product = std::dynamic_pointer_cast<BinaryOpNode>(ast);
+        REQUIRE(product);
+        REQUIRE(product->getLeft() == product->getRight());
+
+        // Every node type merges through its structural key; host calls never do
+        auto matches = EliminateCommonSubexpressions(Expression::Parse("matches(s, \"^a\") && matches(s, \"^a\")"));
+        REQUIRE(matches->getChildren()[0] == matches->getChildren()[1]);
+        auto host = EliminateCommonSubexpressions(Expression::Parse("add(a, b) + add(a, b)"));
+        REQUIRE(host->getChildren()[0] != host->getChildren()[1]);
+        REQUIRE(host->getChildren()[0]->getChildren()[0] == host->getChildren()[1]->getChildren()[0]);
+    }
+}
+
+TEST_CASE("Group-By Aggregation", "[batch][aggregate]") {
+    const size_t rows = 20000;
+    const std::vector<std::string> regions = {"north", "south", "east", "west", "central"};
+    std::vector<std::string> region(rows);
+    std::vector<double> price(rows), qty(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        region[i] = regions[(i * 31) % regions.size()];
+        price[i] = static_cast<double>(i % 100) + 0.5;
+        qty[i] = static_cast<double>(i % 9);
+    }
+    Batch batch(rows);
+    batch.Add("region", Column::Strings(region)).Add("price", Column::Numbers(price)).Add("qty", Column::Numbers(qty));
+
+    const std::vector<AggregateSpec> aggregates = {
+        {AggregateFunction::SUM, Expression::Parse("price * qty")},
+        {AggregateFunction::COUNT, nullptr},
+        {AggregateFunction::MIN, Expression::Parse("price")},
+        {AggregateFunction::MAX, Expression::Parse("price")},
+        {AggregateFunction::AVG, Expression::Parse("qty")}
+    };
+
+    // Reference aggregation with std::map
+    std::map<std::string, std::vector<double>> expected;
+    for (size_t i = 0; i < rows; ++i) {
+        auto& e = expected[region[i]];
+        if (e.empty()) e = {0, 0, 1e300, -1e300, 0};
+        e[0] += price[i] * qty[i];
+        e[1] += 1;
+        e[2] = std::min(e[2], price[i]);
+        e[3] = std::max(e[3], price[i]);
+        e[4] += qty[i];
+    }
+
+    for (size_t threads : {1, 4}) {
+        auto groups = GroupBy(Expression::Parse("region"), aggregates, batch, nullptr, nullptr, threads);
+        REQUIRE(groups.size() == regions.size());
+        REQUIRE(groups[0].key.asString() == region[0]);
+        for (const auto& group : groups) {
+            const auto& e = expected.at(group.key.asString());
+            REQUIRE(group.values[0] == Approx(e[0]));
+            REQUIRE(group.values[1] == e[1]);
+            REQUIRE(group.rows == static_cast<size_t>(e[1]));
+            REQUIRE(group.values[2] == e[2]);
+            REQUIRE(group.values[3] == e[3]);
+            REQUIRE(group.values[4] == Approx(e[4] / e[1]));
+        }
+    }
+
+    SECTION("Computed numeric keys") {
+        auto groups = GroupBy(Expression::Parse("qty > 4"), {{AggregateFunction::COUNT, nullptr}}, batch);
+        REQUIRE(groups.size() == 2);
+        REQUIRE(groups[0].rows + groups[1].rows == rows);
+    }
+
+    SECTION("Groups whose values are all null") {
+        const ASTNodePtr value = Expression::Parse("region == \"north\" ? null : price");
+        const auto groups = GroupBy(Expression::Parse("region"),
+                                    {{AggregateFunction::SUM, value}, {AggregateFunction::MIN, value},
+                                     {AggregateFunction::MAX, value}, {AggregateFunction::AVG, value}},
+                                    batch);
+        REQUIRE(groups.size() == regions.size());
+        for (const auto& group : groups) {
+            if (group.key.asString() != "north") {
+                REQUIRE(group.values[1] <= group.values[2]);
+                continue;
+            }
+            REQUIRE(group.values[0] == 0.0);
+            REQUIRE(std::isnan(group.values[1]));
+            REQUIRE(std::isnan(group.values[2]));
+            REQUIRE(std::isnan(group.values[3]));
+        }
+    }
+
+    SECTION("Non-numeric values are rejected") {
+        REQUIRE_THROWS_AS(GroupBy(Expression::Parse("qty"), {{AggregateFunction::SUM, Expression::Parse("region")}}, batch),
+                          ExprException);
+    }
+}
+
+TEST_CASE("Streaming Window Functions", "[streaming]") {
+    TestEnvironment environment;
+    EvaluationState state;
+    EvaluationContext context;
+    context.SetState(&state);
+
+    const std::vector<double> events = {5, 1, 4, 8, 2, 7, 3, 3, 9, 0};
+    auto sum = Expression::Parse("rolling_sum(x, 3)");
+    auto maximum = Expression::Parse("rolling_max(x, 3)");
+    auto minimum = Expression::Parse("rolling_min(x, 3)");
+    auto average = Expression::Parse("ema(x, 0.5)");
+    auto change = Expression::Parse("delta(x)");
+
+    double expectedEma = 0.0;
+    for (size_t i = 0; i < events.size(); ++i) {
+        environment.set("x", Value(events[i]));
+        const size_t first = i >= 2 ? i - 2 : 0;
+        double expectedSum = 0.0, expectedMax = -1e300, expectedMin = 1e300;
+        for (size_t j = first; j <= i; ++j) {
+            expectedSum += events[j];
+            expectedMax = std::max(expectedMax, events[j]);
+            expectedMin = std::min(expectedMin, events[j]);
+        }
+        expectedEma = i == 0 ? events[0] : 0.5 * events[i] + 0.5 * expectedEma;
+
+        REQUIRE(sum->evaluate(&environment, &context).asNumber() == Approx(expectedSum));
+        REQUIRE(maximum->evaluate(&environment, &context).asNumber() == expectedMax);
+        REQUIRE(minimum->evaluate(&environment, &context).asNumber() == expectedMin);
+        REQUIRE(average->evaluate(&environment, &context).asNumber() == Approx(expectedEma));
+        REQUIRE(change->evaluate(&environment, &context).asNumber() == (i == 0 ? 0.0 : events[i] - events[i - 1]));
+    }
+    REQUIRE(state.size() == 5);
+
+    SECTION("Each call site has its own window") {
+        EvaluationState fresh;
+        EvaluationContext other;
+        other.SetState(&fresh);
+        auto rule = Expression::Parse("rolling_sum(x, 2) + rolling_sum(x, 4)");
+        for (double v : {1.0, 2.0, 3.0}) {
+            environment.set("x", Value(v));
+            rule->evaluate(&environment, &other);
+        }
+        REQUIRE(rule->evaluate(&environment, &other).asNumber() == 6.0 + 9.0);
+    }
+
+    SECTION("Batch rows are pushed in order") {
+        EvaluationState batchState;
+        EvaluationContext batchContext;
+        batchContext.SetState(&batchState);
+        Batch batch(events.size());
+        batch.Add("x", Column::Numbers(events));
+        auto result = Expression::EvaluateBatch(maximum, batch, nullptr, &batchContext);
+        REQUIRE(result.numberAt(3) == 8.0);
+        REQUIRE(result.numberAt(6) == 7.0);
+        REQUIRE(result.numberAt(9) == 9.0);
+    }
+
+    SECTION("Calls without a state or with other types go to the host") {
+        REQUIRE_THROWS_AS(Expression::Eval("delta(1)"), ExprException);
+        REQUIRE_THROWS_WITH(change->evaluate(&environment), "Function not defined: delta");
+        environment.set("s", Value("a"));
+        REQUIRE_THROWS_WITH(Expression::Parse("rolling_sum(s, 3)")->evaluate(&environment, &context),
+                            "Function not defined: rolling_sum");
+
+        class Host : public IEnvironment {
+        public:
+            Value Get(const std::string&) override { return Value("up"); }
+            Value Call(const std::string& name, const std::vector<Value>& args) override {
+                return Value(name + ":" + std::to_string(args.size()));
+            }
+        } host;
+        REQUIRE(average->evaluate(&host).asString() == "ema:2");
+        REQUIRE(change->evaluate(&host).asString() == "delta:1");
+        REQUIRE(sum->evaluate(&host, &context).asString() == "rolling_sum:2");
+        Batch batch(2);
+        batch.Add("x", Column::Numbers({1.0, 2.0}));
+        const Column hosted = Expression::EvaluateBatch(maximum, batch, &host);
+        REQUIRE(hosted.at(1).asString() == "rolling_max:2");
+    }
+
+    SECTION("Errors") {
+        // Calls that do not fit a streaming built-in are left to the host
+        environment.set("y", Value(2.0));
+        for (const char* source : {"rolling_sum(x, y)", "rolling_max(x, 0)", "ema(x, 2)", "ema(1, x)", "delta(1, 2)"}) {
+            INFO(source);
+            const auto call = Expression::Parse(source);
+            REQUIRE(std::dynamic_pointer_cast<FunctionCallNode>(call));
+            const std::string name(source, std::strchr(source, '('));
+            REQUIRE_THROWS_WITH(call->evaluate(&environment), "Function not defined: " + name);
+        }
+    }
+}
+
+TEST_CASE("Regular Expression Matching", "[regex]") {
+    SECTION("Syntax") {
+        REQUIRE(Regex("abc").Matches("xxabcxx"));
+        REQUIRE_FALSE(Regex("^abc").Matches("xxabc"));
+        REQUIRE_FALSE(Regex("abc$").Matches("abcx"));
+        REQUIRE(Regex("^a(b|cd)*e$").Matches("abcdbe"));
+        REQUIRE_FALSE(Regex("^a(b|cd)*e$").Matches("acbe"));
+        REQUIRE(Regex("^\\d{3}-\\d{4}$").Matches("555-1234"));
+        REQUIRE_FALSE(Regex("^\\d{3}-\\d{4}$").Matches("55-1234"));
+        REQUIRE(Regex("^[a-c]{2,3}$").Matches("cab"));
+        REQUIRE_FALSE(Regex("^[a-c]{2,3}$").Matches("abca"));
+        REQUIRE(Regex("^x{2,}$").Matches("xxxxx"));
+        REQUIRE(Regex("^[^0-9]+$").Matches("abc"));
+        REQUIRE_FALSE(Regex("^[^0-9]+$").Matches("a1c"));
+        REQUIRE(Regex("^a.c\\.$").Matches("abc."));
+        REQUIRE(Regex("").Matches("anything"));
+    }
+
+    SECTION("Anchors apply to their own branch") {
+        REQUIRE(Regex("^abc|xyz$").Matches("abc123"));
+        REQUIRE(Regex("^abc|xyz$").Matches("123xyz"));
+        REQUIRE_FALSE(Regex("^abc|xyz$").Matches("1abc"));
+        REQUIRE_FALSE(Regex("^abc|xyz$").Matches("xyz1"));
+        REQUIRE(Regex("a|^b").Matches("xa"));
+        REQUIRE(Regex("a|^b").Matches("bx"));
+        REQUIRE_FALSE(Regex("a|^b").Matches("xb"));
+        REQUIRE(Regex("(^a)").Matches("ab"));
+        REQUIRE_FALSE(Regex("(^a)").Matches("ba"));
+        REQUIRE(Regex("(^|,)x(,|$)").Matches("a,x,b"));
+        REQUIRE(Regex("(^|,)x(,|$)").Matches("x"));
+        REQUIRE_FALSE(Regex("(^|,)x(,|$)").Matches("ax"));
+        REQUIRE(Regex("^$").Matches(""));
+        REQUIRE_FALSE(Regex("^$").Matches("a"));
+        REQUIRE(Regex("ab\\$").Matches("ab$"));
+        REQUIRE_FALSE(Regex("ab\\$").Matches("ab"));
+        // An anchor that cannot hold makes its branch unmatchable
+        REQUIRE_FALSE(Regex("a^b").Matches("ab"));
+        REQUIRE_FALSE(Regex("a$b").Matches("ab"));
+    }
+
+    SECTION("Pathological patterns stay linear") {
+        const std::string subject(10000, 'a');
+        REQUIRE_FALSE(Regex("^(a|a)*(a|aa)*b$").Matches(subject));
+        REQUIRE(Regex("(a+)+").Matches(subject));
+    }
+
+    SECTION("Built-in") {
+        TestEnvironment environment;
+        environment.set("email", Value("user@example.com"));
+        REQUIRE(Expression::Eval("matches(email, \"^\\w+@\\w+\\.com$\")", &environment).asBoolean());
+        REQUIRE_FALSE(Expression::Eval("matches(email, \"\\.org$\")", &environment).asBoolean());
+        REQUIRE(Expression::Eval("matches(\"a\" + \"b\", \"a\" + \"b\")").asBoolean());
+
+        auto ast = Expression::Parse("matches(email, \"^[a-z]+@\")");
+        REQUIRE(std::dynamic_pointer_cast<RegexMatchNode>(ast)->getCompiled() != nullptr);
+
+        Batch batch(4);
+        batch.Add("email", Column::Strings({"a@x", "B@x", "cc@", "@"}));
+        auto result = Expression::EvaluateBatch(ast, batch);
+        REQUIRE(result.getKind() == Column::Kind::BOOLEAN);
+        REQUIRE(result.booleanAt(0));
+        REQUIRE_FALSE(result.booleanAt(1));
+        REQUIRE(result.booleanAt(2));
+        REQUIRE_FALSE(result.booleanAt(3));
+    }
+
+    SECTION("Errors") {
+        REQUIRE_THROWS_AS(Expression::Parse("matches(s, \"(ab\")"), ExprException);
+        REQUIRE_THROWS_AS(Expression::Parse("matches(s, \"[ab\")"), ExprException);
+        REQUIRE_THROWS_AS(Expression::Parse("matches(s, \"*a\")"), ExprException);
+        REQUIRE_THROWS_AS(Expression::Eval("matches(1, \"a\")"), ExprException);
+    }
+
+    SECTION("Arguments that are not strings go to the host") {
+        class HostEnvironment final : public IEnvironment {
+        public:
+            Value Get(const std::string&) override { return Value(7.0); }
+            Value Call(const std::string& name, const std::vector<Value>& args) override {
+                REQUIRE(name == "matches");
+                REQUIRE(args[1] == Value("a"));
+                return Value(args[0].asNumber() + 100);
+            }
+        } host;
+        REQUIRE(std::dynamic_pointer_cast<FunctionCallNode>(Expression::Parse("matches(1, 2)")));
+        const auto ast = Expression::Parse("matches(x, \"a\")");
+        REQUIRE(std::dynamic_pointer_cast<RegexMatchNode>(ast));
+        REQUIRE(ast->evaluate(&host).asNumber() == 107.0);
+        Batch batch(2);
+        batch.Add("x", Column::Numbers({1, 2}));
+        const Column result = Expression::EvaluateBatch(ast, batch, &host);
+        REQUIRE(result.at(1).asNumber() == 102.0);
+    }
+}
+
+TEST_CASE("Dictionary-Encoded Columns", "[batch][dictionary]") {
+    const std::vector<std::string> status = {"ok", "error", "ok", "timeout", "ok", "error"};
+    const Column encoded = Column::Encode(status);
+    REQUIRE(encoded.getKind() == Column::Kind::DICTIONARY);
+    REQUIRE(encoded.getDictionary()->size() == 3);
+    REQUIRE(encoded.codeAt(2) == encoded.codeAt(0));
+    REQUIRE(encoded.stringAt(3) == "timeout");
+    REQUIRE(encoded.at(1).asString() == "error");
+
+    Batch batch(status.size());
+    batch.Add("status", encoded).Add("plain", Column::Strings(status));
+
+    SECTION("Literal comparisons match the plain string path") {
+        for (const char* rule : {"status == \"ok\"", "\"error\" != status", "status > \"p\"", "\"me\" in status"}) {
+            std::string plain = rule;
+            plain.replace(plain.find("status"), 6, "plain");
+            auto dictionaryResult = Expression::EvaluateBatch(Expression::Parse(rule), batch);
+            auto plainResult = Expression::EvaluateBatch(Expression::Parse(plain), batch);
+            REQUIRE(dictionaryResult.getKind() == Column::Kind::BOOLEAN);
+            for (size_t i = 0; i < status.size(); ++i) {
+                REQUIRE(dictionaryResult.booleanAt(i) == plainResult.at(i).asBoolean());
+            }
+        }
+        auto matched = Expression::EvaluateBatch(Expression::Parse("matches(status, \"^t\")"), batch);
+        REQUIRE(matched.booleanAt(3));
+        REQUIRE_FALSE(matched.booleanAt(0));
+    }
+
+    SECTION("Slicing, selection and grouping keep the encoding") {
+        REQUIRE(encoded.slice(3, 2).stringAt(0) == "timeout");
+        Batch selected = batch.Select({5, 1});
+        REQUIRE(selected.Find("status")->getKind() == Column::Kind::DICTIONARY);
+        REQUIRE(selected.Find("status")->stringAt(0) == "error");
+
+        auto groups = GroupBy(Expression::Parse("status"), {{AggregateFunction::COUNT, nullptr}}, batch);
+        REQUIRE(groups.size() == 3);
+        REQUIRE(groups[0].key.asString() == "ok");
+        REQUIRE(groups[0].rows == 3);
+    }
+
+    SECTION("Invalid codes") {
+        REQUIRE_THROWS_AS(Column::Dictionary({0, 2}, std::vector<std::string>{"a", "b"}), ExprException);
+    }
+}
+
+TEST_CASE("Arrow C Data Interface", "[batch][arrow]") {
+    // Record batch {price: float64, qty: int32 (row 2 null), region: utf8}
+    const double price[] = {0.0, 10.0, 20.0, 30.0, 40.0};   // row 0 is skipped through the array offset
+    const int32_t qty[] = {1, 2, 0, 4};
+    const uint8_t qtyValidity[] = {0x0B};
+    const int32_t regionOffsets[] = {0, 2, 4, 6, 8};
+    const char regionChars[] = "euususeu";
+
+    const void* priceBuffers[] = {nullptr, price};
+    const void* qtyBuffers[] = {qtyValidity, qty};
+    const void* regionBuffers[] = {nullptr, regionOffsets, regionChars};
+    ArrowArray priceArray{4, 0, 1, 2, 0, priceBuffers, nullptr, nullptr, nullptr, nullptr};
+    ArrowArray qtyArray{4, 1, 0, 2, 0, qtyBuffers, nullptr, nullptr, nullptr, nullptr};
+    ArrowArray regionArray{4, 0, 0, 3, 0, regionBuffers, nullptr, nullptr, nullptr, nullptr};
+    ArrowArray* childArrays[] = {&priceArray, &qtyArray, &regionArray};
+    const void* structBuffers[] = {nullptr};
+    ArrowArray input{4, 0, 0, 1, 3, structBuffers, childArrays, nullptr, nullptr, nullptr};
+
+    ArrowSchema priceSchema{"g", "price", nullptr, 0, 0, nullptr, nullptr, nullptr, nullptr};
+    ArrowSchema qtySchema{"i", "qty", nullptr, ARROW_FLAG_NULLABLE, 0, nullptr, nullptr, nullptr, nullptr};
+    ArrowSchema regionSchema{"u", "region", nullptr, 0, 0, nullptr, nullptr, nullptr, nullptr};
+    ArrowSchema* childSchemas[] = {&priceSchema, &qtySchema, &regionSchema};
+    ArrowSchema inputSchema{"+s", "", nullptr, 0, 3, childSchemas, nullptr, nullptr, nullptr};
+
+    SECTION("Import borrows numeric buffers") {
+        Batch batch = ImportArrow(inputSchema, input);
+        REQUIRE(batch.size() == 4);
+        REQUIRE(batch.Find("price")->numberData() == price + 1);
+        REQUIRE(batch.Find("qty")->numberAt(3) == 4.0);
+        REQUIRE_FALSE(batch.Find("qty")->isValid(2));
+        REQUIRE(batch.Find("qty")->isValid(3));
+        REQUIRE(batch.Find("region")->stringAt(2) == "us");
+    }
+
+    SECTION("Evaluate and export with null propagation") {
+        ArrowSchema outSchema;
+        ArrowArray out;
+        EvaluateArrow(Expression::Parse("price * qty"), inputSchema, input, &outSchema, &out);
+        REQUIRE(std::string(outSchema.format) == "g");
+        REQUIRE(out.length == 4);
+        REQUIRE(out.null_count == 1);
+        const auto* values = static_cast<const double*>(out.buffers[1]);
+        const auto* validity = static_cast<const uint8_t*>(out.buffers[0]);
+        REQUIRE(values[0] == 10.0);
+        REQUIRE(values[1] == 40.0);
+        REQUIRE(values[3] == 160.0);
+        REQUIRE((validity[0] & 0x04) == 0);
+        out.release(&out);
+        outSchema.release(&outSchema);
+        REQUIRE(out.release == nullptr);
+
+        EvaluateArrow(Expression::Parse("region == \"eu\""), inputSchema, input, &outSchema, &out);
+        REQUIRE(std::string(outSchema.format) == "b");
+        REQUIRE(out.null_count == 0);
+        REQUIRE(static_cast<const uint8_t*>(out.buffers[1])[0] == 0x09);
+        out.release(&out);
+        outSchema.release(&outSchema);
+    }
+
+    SECTION("Round trip") {
+        ArrowSchema schema;
+        ArrowArray array;
+        ExportArrow(Column::Strings({"a", "", "xyz"}), &schema, &array, "s");
+        REQUIRE(std::string(schema.name) == "s");
+        Column back = ImportArrowColumn(schema, array);
+        REQUIRE(back.stringAt(0) == "a");
+        REQUIRE(back.stringAt(1).empty());
+        REQUIRE(back.stringAt(2) == "xyz");
+        array.release(&array);
+        schema.release(&schema);
+
+        ArrowSchema unsupported{"tss:", "t", nullptr, 0, 0, nullptr, nullptr, nullptr, nullptr};
+        REQUIRE_THROWS_AS(ImportArrowColumn(unsupported, priceArray), ExprException);
+    }
+
+    SECTION("Exported numbers outlive borrowed input") {
+        ArrowSchema outSchema;
+        ArrowArray out;
+        EvaluateArrow(Expression::Parse("price"), inputSchema, input, &outSchema, &out);
+        const auto* values = static_cast<const double*>(out.buffers[1]);
+        REQUIRE(values != price + 1);
+        REQUIRE(values[0] == 10.0);
+        REQUIRE(values[3] == 40.0);
+        out.release(&out);
+        outSchema.release(&outSchema);
+    }
+
+    SECTION("Dictionary codes must index the dictionary") {
+        const int32_t entryOffsets[] = {0, 2, 4};
+        const char entryChars[] = "euus";
+        const void* entryBuffers[] = {nullptr, entryOffsets, entryChars};
+        ArrowArray entries{2, 0, 0, 3, 0, entryBuffers, nullptr, nullptr, nullptr, nullptr};
+        ArrowSchema entrySchema{"u", "", nullptr, 0, 0, nullptr, nullptr, nullptr, nullptr};
+
+        const int64_t codes[] = {1, 0, 4294967296LL};
+        const void* codeBuffers[] = {nullptr, codes};
+        ArrowArray coded{2, 0, 0, 2, 0, codeBuffers, nullptr, &entries, nullptr, nullptr};
+        ArrowSchema codedSchema{"l", "region", nullptr, 0, 0, nullptr, &entrySchema, nullptr, nullptr};
+        Column column = ImportArrowColumn(codedSchema, coded);
+        REQUIRE(column.stringAt(0) == "us");
+        REQUIRE(column.stringAt(1) == "eu");
+
+        coded.length = 3;   // 2^32 would wrap to code 0 if truncated
+        REQUIRE_THROWS_WITH(ImportArrowColumn(codedSchema, coded), "Dictionary code out of range");
+        const int64_t pastEnd[] = {2};
+        codeBuffers[1] = pastEnd;
+        coded.length = 1;
+        REQUIRE_THROWS_WITH(ImportArrowColumn(codedSchema, coded), "Dictionary code out of range");
+    }
+}
+
+TEST_CASE("Null Values", "[null]") {
+    TestEnvironment environment;
+    environment.set("missing", Value::Null());
+    environment.set("x", Value(2.0));
+
+    SECTION("Scalar semantics") {
+        REQUIRE(Expression::Eval("null").isNull());
+        REQUIRE(Expression::Eval("missing + 1", &environment).isNull());
+        REQUIRE(Expression::Eval("-missing", &environment).isNull());
+        REQUIRE(Expression::Eval("missing == null", &environment).isNull());
+        REQUIRE(Expression::Eval("sqrt(missing)", &environment).isNull());
+        REQUIRE(Expression::Eval("missing + \"a\"", &environment).isNull());
+
+        // Three-valued logic
+        REQUIRE(Expression::Eval("missing && false", &environment) == Value(false));
+        REQUIRE(Expression::Eval("true || missing", &environment) == Value(true));
+        REQUIRE(Expression::Eval("missing && true", &environment).isNull());
+        REQUIRE(Expression::Eval("false || missing", &environment).isNull());
+        REQUIRE(Expression::Eval("!missing", &environment).isNull());
+        REQUIRE(Expression::Eval("missing ? 1 : 2", &environment).asNumber() == 2.0);
+
+        REQUIRE(Expression::Eval("isnull(missing)", &environment).asBoolean());
+        REQUIRE_FALSE(Expression::Eval("isnull(x)", &environment).asBoolean());
+        REQUIRE(Expression::Eval("coalesce(missing, null, x)", &environment).asNumber() == 2.0);
+        REQUIRE(Value::Null().asString() == "null");
+        REQUIRE_THROWS_AS(Value::Null().asNumber(), ExprException);
+
+        std::vector<Token> tokens;
+        Expression::Parse("null", &tokens);
+        REQUIRE(tokens[0].type == TokenType::NULL_VALUE);
+    }
+
+    SECTION("Batch kernels combine validity bitmaps") {
+        const size_t rows = 200;
+        std::vector<Value> a(rows), b(rows);
+        for (size_t i = 0; i < rows; ++i) {
+            a[i] = i % 3 == 0 ? Value::Null() : Value(static_cast<double>(i));
+            b[i] = i % 5 == 0 ? Value::Null() : Value(i % 2 == 0);
+        }
+        Batch batch(rows);
+        batch.Add("a", Column::Values(a)).Add("b", Column::Values(b));
+        REQUIRE(batch.Find("a")->getKind() == Column::Kind::NUMBER);
+        REQUIRE(batch.Find("a")->hasValidity());
+
+        for (const char* rule : {"a * 2 + 1", "a > 50 && b", "a > 50 || b", "!b", "a / (a + 1)", "1 / a",
+                                 "sqrt(a)", "coalesce(a, 0)", "b xor true"}) {
+            auto ast = Expression::Parse(rule);
+            const Column result = Expression::EvaluateBatch(ast, batch);
+            for (size_t i = 0; i < rows; ++i) {
+                environment.set("a", a[i]);
+                environment.set("b", b[i]);
+                const Value expected = ast->evaluate(&environment);
+                INFO(rule << " row " << i);
+                REQUIRE(result.at(i) == expected);
+            }
+        }
+        // A constant zero divisor fails for any valid row, not only the first (row 0 of a is null)
+        REQUIRE_THROWS_WITH(Expression::EvaluateBatch(Expression::Parse("a / 0"), batch), "Division by zero");
+    }
+
+    SECTION("Aggregates skip nulls") {
+        Batch batch(4);
+        batch.Add("k", Column::Strings({"a", "a", "b", "b"}))
+             .Add("v", Column::Values({Value(1.0), Value::Null(), Value::Null(), Value(4.0)}));
+        auto groups = GroupBy(Expression::Parse("k"),
+                              {{AggregateFunction::AVG, Expression::Parse("v")}, {AggregateFunction::COUNT, nullptr}}, batch);
+        REQUIRE(groups[0].values[0] == 1.0);
+        REQUIRE(groups[0].values[1] == 2.0);
+        REQUIRE(groups[1].values[0] == 4.0);
+    }
+}
+
+TEST_CASE("Bit-Packed Predicates", "[batch][bits]") {
+    const size_t rows = 333;   // Not a multiple of 64, so tail words are exercised
+    std::vector<double> x(rows), y(rows);
+    std::vector<uint8_t> flag(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        x[i] = static_cast<double>((i * 37) % 101);
+        y[i] = i % 7 == 0 ? std::nan("") : static_cast<double>((i * 11) % 53);
+        flag[i] = (i % 3) == 0;
+    }
+    Batch batch(rows);
+    batch.Add("x", Column::Numbers(x)).Add("y", Column::Numbers(y)).Add("flag", Column::Booleans(flag));
+
+    TestEnvironment environment;
+    for (const char* rule : {"x > y", "x < 50", "x >= y || flag", "x <= 20 && !flag", "x == y xor flag",
+                             "x != y", "!(x > 10 && y < 30) == flag", "30 > x"}) {
+        auto ast = Expression::Parse(rule);
+        const Column result = Expression::EvaluateBatch(ast, batch);
+        REQUIRE(result.getKind() == Column::Kind::BOOLEAN);
+        REQUIRE(result.isBitPacked());
+        for (size_t i = 0; i < rows; ++i) {
+            environment.set("x", Value(x[i]));
+            environment.set("y", Value(y[i]));
+            environment.set("flag", Value(flag[i] != 0));
+            INFO(rule << " row " << i);
+            REQUIRE(result.booleanAt(i) == ast->evaluate(&environment).asBoolean());
+        }
+    }
+
+    SECTION("Unaligned slices read across word boundaries") {
+        const Column bits = Expression::EvaluateBatch(Expression::Parse("x < 50"), batch);
+        const Column tail = bits.slice(70, 100);
+        for (size_t i = 0; i < 100; ++i) REQUIRE(tail.booleanAt(i) == (x[70 + i] < 50));
+        const uint64_t word = tail.booleanWord(1);
+        for (size_t i = 0; i < 36; ++i) REQUIRE(((word >> i) & 1) == (x[134 + i] < 50 ? 1u : 0u));
+    }
+}
+
+#if EXPRESSIONKIT_HAS_PROCESS_POOL
+TEST_CASE("Process Pool", "[batch][process]") {
+    const size_t rows = 20000;
+    std::vector<double> price(rows), qty(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        price[i] = static_cast<double>(i % 250);
+        qty[i] = static_cast<double>(i % 7);
+    }
+    Batch batch(rows);
+    batch.Add("price", Column::Numbers(price)).Add("qty", Column::Numbers(qty));
+
+    const std::vector<ASTNodePtr> rules = {
+        Expression::Parse("price * qty"), Expression::Parse("price * qty > 500"), Expression::Parse("sqrt(price) + qty")
+    };
+    // A small arena forces the batch through several rounds
+    ProcessPool pool(rules, {"price", "qty"}, 3, nullptr, 3 * 5000 * sizeof(double) * 5);
+    REQUIRE(pool.getWorkerCount() == 3);
+
+    for (int repeat = 0; repeat < 2; ++repeat) {
+        const std::vector<Column> results = pool.Evaluate(batch);
+        REQUIRE(results.size() == rules.size());
+        for (size_t r = 0; r < rules.size(); ++r) {
+            const Column expected = Expression::EvaluateBatch(rules[r], batch);
+            for (size_t i = 0; i < rows; ++i) REQUIRE(results[r].numberAt(i) == expected.at(i).asNumber());
+        }
+    }
+
+    SECTION("Null inputs stay null") {
+        std::vector<Value> sparse(rows);
+        for (size_t i = 0; i < rows; ++i) sparse[i] = i % 11 == 0 ? Value::Null() : Value(qty[i]);
+        Batch nulls(rows);
+        nulls.Add("price", Column::Numbers(price)).Add("qty", Column::Values(sparse));
+        REQUIRE(nulls.Find("qty")->hasValidity());
+        const ASTNodePtr rule = Expression::Parse("coalesce(qty, 100) + price");
+        ProcessPool nullable({rule}, {"price", "qty"}, 2, nullptr, 3 * 5000 * sizeof(double) * 5);
+        const Column result = nullable.Evaluate(nulls)[0];
+        const Column expected = Expression::EvaluateBatch(rule, nulls);
+        for (size_t i = 0; i < rows; ++i) REQUIRE(result.numberAt(i) == expected.at(i).asNumber());
+    }
+
+    SECTION("Errors are reported by the coordinator") {
+        ProcessPool failing({Expression::Parse("price / qty")}, {"price", "qty"}, 2);
+        REQUIRE_THROWS_WITH(failing.Evaluate(batch), "Division by zero");
+        Batch wrong(1);
+        wrong.Add("price", Column::Strings({"x"})).Add("qty", Column::Numbers({1.0}));
+        REQUIRE_THROWS_AS(failing.Evaluate(wrong), ExprException);
+    }
+}
+#endif
+
+TEST_CASE("Streaming Pipeline", "[pipeline]") {
+    std::vector<StageResult> received;
+    std::vector<int> inputs(1000);
+    StageOptions options;
+    options.queueCapacity = 64;
+    options.maxBatchRows = 16;
+    options.maxLatency = std::chrono::microseconds(200);
+    options.workers = 3;
+
+    {
+        // Downstream stage doubles the first rule of the upstream stage
+        StreamingStage downstream({Expression::Parse("v * 2")}, {"v"}, options,
+                                  [&](const StageResult& result) { received.push_back(result); });
+        StreamingStage upstream({Expression::Parse("a + b"), Expression::Parse("10 / b")}, {"a", "b"}, options,
+                                [&](const StageResult& result) {
+                                    downstream.Push({result.error.empty() ? result.values[0] : Value(-1.0)});
+                                });
+
+        // Several producers share the input queue; sequence numbers define the output order
+        std::vector<std::thread> producers;
+        std::atomic<int> next{0};
+        for (int p = 0; p < 4; ++p) {
+            producers.emplace_back([&] {
+                for (int i = next++; i < 1000; i = next++) {
+                    inputs[upstream.Push({Value(static_cast<double>(i)), Value(static_cast<double>(i % 5))})] = i;
+                }
+            });
+        }
+        for (auto& producer : producers) producer.join();
+        upstream.Close();
+        downstream.Close();
+
+        const StageMetrics metrics = upstream.GetMetrics();
+        REQUIRE(metrics.eventsIn == 1000);
+        REQUIRE(metrics.eventsOut == 1000);
+        REQUIRE(metrics.errors == 200);
+        REQUIRE(metrics.batches >= 1000 / options.maxBatchRows);
+        REQUIRE(metrics.averageBatchRows() <= static_cast<double>(options.maxBatchRows));
+        REQUIRE(metrics.LatencyPercentile(0.5) <= metrics.LatencyPercentile(0.99));
+        REQUIRE(metrics.LatencyPercentile(1.0) <= metrics.maxLatency);
+        REQUIRE_THROWS_AS(upstream.Push({Value(1.0), Value(1.0)}), ExprException);
+    }
+
+    // Results arrive in push order; division by zero only fails its own event
+    REQUIRE(received.size() == 1000);
+    for (size_t s = 0; s < received.size(); ++s) {
+        const int i = inputs[s];
+        REQUIRE(received[s].sequence == s);
+        const double expected = i % 5 == 0 ? -2.0 : 2.0 * (i + i % 5);
+        REQUIRE(received[s].values[0].asNumber() == expected);
+    }
+
+    SECTION("TryPush reports a full queue") {
+        StageOptions tiny;
+        tiny.queueCapacity = 1;
+        tiny.maxLatency = std::chrono::microseconds(0);
+        tiny.workers = 1;
+        std::mutex gate;
+        std::unique_lock<std::mutex> hold(gate);
+        std::atomic<int> seen{0};
+        StreamingStage stage({Expression::Parse("x")}, {"x"}, tiny, [&](const StageResult&) {
+            std::lock_guard<std::mutex> wait(gate);
+            ++seen;
+        });
+        REQUIRE(stage.Push({Value(1.0)}) == 0);
+        // Once the worker holds event 0 in the sink, one more event fits in the queue
+        while (!stage.TryPush({Value(2.0)})) std::this_thread::yield();
+        REQUIRE_FALSE(stage.TryPush({Value(3.0)}));
+        REQUIRE_THROWS_AS(stage.Push({Value(1.0), Value(2.0)}), ExprException);
+        hold.unlock();
+        stage.Close();
+        REQUIRE(seen == 2);
+    }
+
+    SECTION("A throwing sink does not stop the stage") {
+        std::vector<uint64_t> delivered;
+        StreamingStage stage({Expression::Parse("x")}, {"x"}, options, [&](const StageResult& result) {
+            if (result.values[0].asNumber() < 0) throw std::runtime_error("sink failed");
+            delivered.push_back(result.sequence);
+        });
+        for (int i = 0; i < 100; ++i) stage.Push({Value(i % 10 == 0 ? -1.0 : 1.0)});
+        stage.Close();
+        const StageMetrics metrics = stage.GetMetrics();
+        REQUIRE(metrics.eventsOut == 100);
+        REQUIRE(metrics.sinkErrors == 10);
+        REQUIRE(metrics.errors == 0);
+        REQUIRE(delivered.size() == 90);
+    }
+}
+
+TEST_CASE("NUMA Rule Replication", "[numa]") {
+    REQUIRE(NumaTopology::ParseCpuList("0-2,5,8-9\n") == std::vector<int>{0, 1, 2, 5, 8, 9});
+    REQUIRE_THROWS_AS(NumaTopology::ParseCpuList("3-1"), ExprException);
+    REQUIRE_THROWS_AS(NumaTopology::ParseCpuList("x"), ExprException);
+    REQUIRE_THROWS_AS(NumaTopology::ParseCpuList("2-"), ExprException);
+    REQUIRE_THROWS_AS(NumaTopology::ParseCpuList("-1"), ExprException);
+    REQUIRE_THROWS_AS(NumaTopology::ParseCpuList("99999999999"), ExprException);
+    const NumaTopology detected = NumaTopology::Detect();
+    REQUIRE(detected.size() >= 1);
+    REQUIRE(detected.NodeOf(detected.nodes.back().front()) == detected.size() - 1);
+
+    SECTION("Clones are independent but equivalent") {
+        const ASTNodePtr rule = Expression::Parse("matches(name, \"^a.*z$\") ? max(x, 2) : -x");
+        const ASTNodePtr copy = CloneExpression(rule);
+        REQUIRE(copy != rule);
+        REQUIRE(copy->getChildren()[0] != rule->getChildren()[0]);
+        TestEnvironment env;
+        env.set("x", Value(5.0));
+        env.set("name", Value("abcz"));
+        REQUIRE(copy->evaluate(&env).asNumber() == rule->evaluate(&env).asNumber());
+        env.set("name", Value("abc"));
+        REQUIRE(copy->evaluate(&env).asNumber() == -5.0);
+    }
+
+    // Two logical nodes over the CPUs of the first real one, so the test runs anywhere
+    NumaTopology twoNodes;
+    twoNodes.nodes = {detected.nodes[0], detected.nodes[0]};
+
+    SECTION("Each pinned thread sees its own node's replica") {
+        RuleRegistry registry(true, twoNodes);
+        registry.Add("score", "x * 2 + 1");
+        REQUIRE(registry.getReplicaCount() == 2);
+        REQUIRE(registry.Contains("score"));
+        REQUIRE(registry.Get("score", 0) != registry.Get("score", 1));
+        REQUIRE_THROWS_AS(registry.Get("missing", 0), ExprException);
+
+        std::vector<ASTNodePtr> seen(4);
+        std::vector<double> results(4);
+        registry.RunPinned(2, [&](const size_t node, const size_t thread) {
+            TestEnvironment env;
+            env.set("x", Value(static_cast<double>(node * 2 + thread)));
+            seen[node * 2 + thread] = registry.Get("score");
+            results[node * 2 + thread] = seen[node * 2 + thread]->evaluate(&env).asNumber();
+        });
+        for (size_t i = 0; i < 4; ++i) {
+            REQUIRE(seen[i] == registry.Get("score", i / 2));
+            REQUIRE(results[i] == static_cast<double>(i) * 2 + 1);
+        }
+        REQUIRE_THROWS_WITH(registry.RunPinned(1, [&](size_t, size_t) { registry.Get("missing"); }),
+                            "Unknown rule: missing");
+    }
+
+    SECTION("Without replication every node shares one tree") {
+        RuleRegistry registry(false, twoNodes);
+        const ASTNodePtr rule = Expression::Parse("x + 1");
+        registry.Add("r", rule);
+        REQUIRE(registry.getReplicaCount() == 1);
+        REQUIRE(registry.Get("r", 0) == rule);
+        REQUIRE(registry.Get("r", 1) == rule);
+    }
+}
+
+TEST_CASE("Automatic Differentiation", "[gradient]") {
+    TestEnvironment env;
+    env.set("x", Value(0.7));
+    env.set("y", Value(2.5));
+    env.set("k", Value(3.0));
+
+    // Central differences as the reference
+    auto numeric = [&](const ASTNodePtr& ast, const std::string& name) {
+        const double h = 1e-6;
+        const double x0 = env.Get(name).asNumber();
+        env.set(name, Value(x0 + h));
+        const double up = ast->evaluate(&env).asNumber();
+        env.set(name, Value(x0 - h));
+        const double down = ast->evaluate(&env).asNumber();
+        env.set(name, Value(x0));
+        return (up - down) / (2 * h);
+    };
+
+    const std::vector<std::string> expressions = {
+        "x * y + k", "x / y - y / x", "-sin(x) * cos(y) + tan(x)", "exp(x * y) + log(y) * sqrt(x)",
+        "pow(x, 3) + pow(y, x) + pow(2, y)", "abs(x - y) + min(x, y) * max(x * k, y)",
+        "x > 0.5 ? x * x * y : y - x", "(x + y) * (x + y) / k"
+    };
+    for (const auto& expression : expressions) {
+        const ASTNodePtr ast = Expression::Parse(expression);
+        GradientTape tape(ast, {"x", "y"});
+        const Gradient g = tape.Evaluate(&env);
+        REQUIRE(g.value == Approx(ast->evaluate(&env).asNumber()));
+        REQUIRE(g.partials.size() == 2);
+        REQUIRE(g.partials[0] == Approx(numeric(ast, "x")).epsilon(1e-5));
+        REQUIRE(g.partials[1] == Approx(numeric(ast, "y")).epsilon(1e-5));
+    }
+
+    SECTION("Shared subtrees and unused variables") {
+        const ASTNodePtr ast = EliminateCommonSubexpressions(Expression::Parse("(x * y) * (x * y) + k"));
+        GradientTape tape(ast, {"x", "z"});
+        REQUIRE(tape.size() == 6);  // x, y, x * y (once), square, k, +
+        const Gradient g = tape.Evaluate(&env);
+        REQUIRE(g.partials[0] == Approx(2 * 0.7 * 2.5 * 2.5));
+        REQUIRE(g.partials[1] == 0.0);
+    }
+
+    SECTION("Batch mode") {
+        const size_t rows = 3000;
+        std::vector<double> xs(rows), ys(rows);
+        for (size_t i = 0; i < rows; ++i) {
+            xs[i] = 0.1 + static_cast<double>(i) / 1000.0;
+            ys[i] = 1.0 + static_cast<double>(i % 17);
+        }
+        Batch batch(rows);
+        batch.Add("x", Column::Numbers(xs)).Add("y", Column::Numbers(ys));
+        const ASTNodePtr ast = Expression::Parse("k * log(x) + y / x + (y > 8 ? y * x : 0)");
+        GradientTape tape(ast, {"x", "y"});
+        const BatchGradient g = tape.EvaluateBatch(batch, &env);
+        for (size_t i = 0; i < rows; ++i) {
+            const double x = xs[i], y = ys[i];
+            REQUIRE(g.value.numberAt(i) == Approx(3 * std::log(x) + y / x + (y > 8 ? y * x : 0)));
+            REQUIRE(g.partials[0].numberAt(i) == Approx(3 / x - y / (x * x) + (y > 8 ? y : 0)));
+            REQUIRE(g.partials[1].numberAt(i) == Approx(1 / x + (y > 8 ? x : 0)));
+        }
+    }
+
+    SECTION("Errors") {
+        REQUIRE_THROWS_WITH(GradientTape(Expression::Parse("floor(x)"), {"x"}), "Function is not differentiable: floor");
+        REQUIRE_THROWS_AS(GradientTape(Expression::Parse("x > 1"), {"x"}), ExprException);
+        REQUIRE_NOTHROW(GradientTape(Expression::Parse("floor(k) * x"), {"x"}));
+        REQUIRE_THROWS_WITH(GradientTape(Expression::Parse("x / (y - 2.5)"), {"x"}).Evaluate(&env), "Division by zero");
+        REQUIRE_THROWS_WITH(GradientTape(Expression::Parse("log(-x)"), {"x"}).Evaluate(&env), "log argument out of domain");
+    }
+
+    SECTION("Untaken arms are not evaluated") {
+        TestEnvironment local;
+        local.set("k", Value(3.0));
+        const auto check = [&](const std::string& expression, const double x, const double value, const double slope) {
+            local.set("x", Value(x));
+            const Gradient g = GradientTape(Expression::Parse(expression), {"x"}).Evaluate(&local);
+            REQUIRE(g.value == Approx(value));
+            REQUIRE(g.partials[0] == Approx(slope));
+        };
+        check("x > 0 ? log(x) : 0", -1.0, 0.0, 0.0);
+        check("x > 0 ? log(x) : 0", 2.0, std::log(2.0), 0.5);
+        check("x >= 0 ? sqrt(x) : -x", -1.0, 1.0, -1.0);
+        check("x >= 0 ? sqrt(x) : -x", 4.0, 2.0, 0.25);
+        check("x != 0 ? 1 / x : 0", 0.0, 0.0, 0.0);
+        check("x != 0 ? 1 / x : 0", 2.0, 0.5, -0.25);
+        // A constant subtree inside the untaken arm is skipped too
+        check("x > 0 ? x * (1 / (k - 3)) : x", -1.0, -1.0, 1.0);
+
+        // In a batch each row evaluates only its own arm
+        Batch batch(4);
+        batch.Add("x", Column::Numbers({-2.0, 0.0, 1.0, 4.0}));
+        const BatchGradient g = GradientTape(Expression::Parse("x > 0 ? log(x) + sqrt(x) : x * x"), {"x"}).EvaluateBatch(batch);
+        const double expectedValue[] = {4.0, 0.0, 1.0, std::log(4.0) + 2.0};
+        const double expectedSlope[] = {-4.0, 0.0, 1.5, 0.25 + 0.25};
+        for (size_t i = 0; i < 4; ++i) {
+            REQUIRE(g.value.numberAt(i) == Approx(expectedValue[i]));
+            REQUIRE(g.partials[0].numberAt(i) == Approx(expectedSlope[i]));
+        }
+    }
+}
+
+TEST_CASE("Symbolic Differentiation", "[gradient][symbolic]") {
+    TestEnvironment env;
+    env.set("x", Value(0.7));
+    env.set("y", Value(2.5));
+    env.set("k", Value(3.0));
+
+    SECTION("Derivatives agree with the gradient tape") {
+        const std::vector<std::string> expressions = {
+            "x * y + k", "x / y - y / x", "-sin(x) * cos(y) + tan(x)", "exp(x * y) + log(y) * sqrt(x)",
+            "pow(x, 3) + pow(y, x) + pow(2, y)", "abs(x - y) + min(x, y) * max(x * k, y)",
+            "x > 0.5 ? x * x * y : y - x", "(x + y) * (x + y) / k", "-(-x) * (0 + y * 1)"
+        };
+        for (const auto& expression : expressions) {
+            const ASTNodePtr ast = Expression::Parse(expression);
+            const Gradient expected = GradientTape(ast, {"x", "y"}).Evaluate(&env);
+            REQUIRE(Differentiate(ast, "x")->evaluate(&env).asNumber() == Approx(expected.partials[0]));
+            REQUIRE(Differentiate(ast, "y")->evaluate(&env).asNumber() == Approx(expected.partials[1]));
+        }
+    }
+
+    SECTION("Results are simplified") {
+        const ASTNodePtr slope = Differentiate(Expression::Parse("3 * pow(x, 2) + y"), "x");
+        auto product = std::dynamic_pointer_cast<BinaryOpNode>(slope);
+        REQUIRE(product);
+        REQUIRE(product->getOperator() == OperatorType::MUL);
+        REQUIRE(std::dynamic_pointer_cast<NumberNode>(product->getLeft())->getValue() == 6.0);
+        REQUIRE(std::dynamic_pointer_cast<VariableNode>(product->getRight())->getName() == "x");
+
+        auto zero = std::dynamic_pointer_cast<NumberNode>(Differentiate(Expression::Parse("sin(k) * floor(y)"), "x"));
+        REQUIRE(zero);
+        REQUIRE(zero->getValue() == 0.0);
+
+        // Shared factors of the derivative are merged
+        const ASTNodePtr d = Differentiate(Expression::Parse("exp(x * y)"), "x");
+        CommonSubexpressionEliminator eliminator;
+        REQUIRE(eliminator.Intern(d) == d);
+    }
+
+    SECTION("Simplify folds constants") {
+        const ASTNodePtr folded = Simplify(Expression::Parse("2 * 3 + sqrt(16) + (1 > 2 ? x : y * 1) - 0"));
+        REQUIRE(Expression::Parse("10 + y")->evaluate(&env).asNumber() == folded->evaluate(&env).asNumber());
+        auto sum = std::dynamic_pointer_cast<BinaryOpNode>(folded);
+        REQUIRE(sum);
+        REQUIRE(std::dynamic_pointer_cast<NumberNode>(sum->getLeft())->getValue() == 10.0);
+        // y might be a string, so y * 1 is kept
+        auto product = std::dynamic_pointer_cast<BinaryOpNode>(sum->getRight());
+        REQUIRE(product);
+        REQUIRE(product->getOperator() == OperatorType::MUL);
+        REQUIRE(std::dynamic_pointer_cast<BinaryOpNode>(Simplify(Expression::Parse("(y - 1) * 1 + 0")))->getOperator() ==
+                OperatorType::SUB);
+        // Failing operations are left for evaluation to report
+        REQUIRE_THROWS_WITH(Simplify(Expression::Parse("1 / 0"))->evaluate(nullptr), "Division by zero");
+    }
+
+    SECTION("Simplify leaves strings and booleans alone") {
+        TestEnvironment local;
+        local.set("s", Value("a"));
+        local.set("b", Value(true));
+        for (const char* source : {"s + 0", "0 + s", "s + -s", "s - 0", "s * 1", "1 * s", "b * 1", "b / 1", "--s", "--b",
+                                   "pow(s, 1)", "s - -s"}) {
+            INFO(source);
+            const ASTNodePtr original = Expression::Parse(source);
+            const ASTNodePtr simplified = Simplify(original);
+            try {
+                const Value expected = original->evaluate(&local);
+                REQUIRE(simplified->evaluate(&local) == expected);
+            } catch (const ExprException& e) {
+                REQUIRE_THROWS_WITH(simplified->evaluate(&local), e.what());
+            }
+        }
+        REQUIRE(Simplify(Expression::Parse("s + 0"))->evaluate(&local).asString() == "a0.000000");
+    }
+
+    SECTION("Simplify keeps operands that can be null or NaN") {
+        TestEnvironment local;
+        local.set("n", Value::Null());
+        local.set("nan", Value(std::nan("")));
+        local.set("zero", Value(0.0));
+        REQUIRE(Simplify(Expression::Parse("n * 0"))->evaluate(&local).isNull());
+        REQUIRE(Simplify(Expression::Parse("0 * n"))->evaluate(&local).isNull());
+        REQUIRE(Simplify(Expression::Parse("0 / n"))->evaluate(&local).isNull());
+        REQUIRE(Simplify(Expression::Parse("pow(n, 0)"))->evaluate(&local).isNull());
+        REQUIRE(std::isnan(Simplify(Expression::Parse("nan * 0"))->evaluate(&local).asNumber()));
+        REQUIRE_THROWS_WITH(Simplify(Expression::Parse("0 / zero"))->evaluate(&local), "Division by zero");
+        // Literal operands still fold
+        auto folded = std::dynamic_pointer_cast<NumberNode>(Simplify(Expression::Parse("0 * 5 + 0 / 2")));
+        REQUIRE(folded);
+        REQUIRE(folded->getValue() == 0.0);
+    }
+
+    SECTION("Errors") {
+        REQUIRE_THROWS_WITH(Differentiate(Expression::Parse("round(x)"), "x"), "Function is not differentiable: round");
+        REQUIRE_THROWS_AS(Differentiate(Expression::Parse("x == 1 ? 1 : 2 && x"), "x"), ExprException);
+        REQUIRE_NOTHROW(Differentiate(Expression::Parse("x == 1 ? x : 2 * x"), "x"));
+    }
+}
+
+TEST_CASE("Binary Decision Diagrams", "[bdd]") {
+    // Interleaved pairs: small only when each a_i is next to its b_i
+    const ASTNodePtr rule = Expression::Parse(
+        "(a1 > 0 && b1 > 0) || (a2 > 0 && b2 > 0) || (a3 > 0 && b3 > 0) || (a4 > 0 && b4 > 0)");
+    const DecisionDiagram diagram(rule);
+    REQUIRE(diagram.getAtoms().size() == 8);
+    REQUIRE(diagram.getNodeCount() == 8);
+
+    const char* const names[] = {"a1", "b1", "a2", "b2", "a3", "b3", "a4", "b4"};
+    size_t tested = 0;
+    for (int mask = 0; mask < 256; ++mask) {
+        TestEnvironment env;
+        for (int bit = 0; bit < 8; ++bit) env.set(names[bit], Value((mask >> bit) & 1 ? 1.0 : 0.0));
+        size_t path = 0;
+        REQUIRE(diagram.Evaluate(&env, nullptr, &path) == rule->evaluate(&env).asBoolean());
+        REQUIRE(path <= 8);
+        tested += path;
+    }
+    // A tree walk tests all 8 atoms; the diagram tests about half of them on average
+    REQUIRE(tested < 256 * 8 * 6 / 10);
+
+    SECTION("Connectives, shared atoms and ternaries") {
+        const ASTNodePtr mixed = Expression::Parse(
+            "!(x > 1 xor y < 2) && (x > 1 ? z == 3 : !(y < 2)) || (name == \"vip\" && true)");
+        const DecisionDiagram compiled(mixed);
+        REQUIRE(compiled.getAtoms().size() == 4);  // x > 1 and y < 2 appear twice
+        for (int mask = 0; mask < 16; ++mask) {
+            TestEnvironment env;
+            env.set("x", Value(mask & 1 ? 5.0 : 0.0));
+            env.set("y", Value(mask & 2 ? 0.0 : 5.0));
+            env.set("z", Value(mask & 4 ? 3.0 : 4.0));
+            env.set("name", Value(mask & 8 ? "vip" : "guest"));
+            REQUIRE(compiled.Evaluate(&env) == mixed->evaluate(&env).asBoolean());
+        }
+        REQUIRE(DecisionDiagram(Expression::Parse("x > 1 || !(x > 1)")).getNodeCount() == 0);
+        REQUIRE(DecisionDiagram(Expression::Parse("x > 1 && false")).getNodeCount() == 0);
+    }
+
+    SECTION("Null atoms keep three-valued semantics") {
+        const ASTNodePtr nullable = Expression::Parse("x > 1 || y > 1");
+        const DecisionDiagram compiled(nullable);
+        TestEnvironment env;
+        env.set("x", Value::Null());
+        env.set("y", Value(5.0));
+        REQUIRE(compiled.Evaluate(&env));
+        env.set("y", Value(0.0));
+        REQUIRE_FALSE(compiled.Evaluate(&env));
+    }
+}
+
+TEST_CASE("Rule Set Analysis", "[rules]") {
+    const std::vector<ASTNodePtr> rules = {
+        Expression::Parse("x > 10"),
+        Expression::Parse("x > 5 && x > 10"),                       // Equivalent to rule 0
+        Expression::Parse("x > 3 && x < 2"),                        // Unsatisfiable
+        Expression::Parse("x > 20 && country == \"NZ\""),           // Implies rule 0
+        Expression::Parse("country == \"NZ\" && country == \"AU\""), // Unsatisfiable
+        Expression::Parse("!(y <= 1) && y >= 0 && abs(id) > 5"),    // Simplifies to y > 1 && abs(id) > 5
+        Expression::Parse("abs(id) > 5 && y > 2"),                  // Implies rule 5
+        Expression::Parse("z != 4 || z == 4"),                      // Covers every number
+        Expression::Parse("tier != \"gold\" && tier == \"silver\"")  // Simplifies to tier == "silver"
+    };
+
+    const RuleSetReport report = AnalyzeRules(rules);
+    auto find = [&](const size_t rule) -> const RuleFinding* {
+        for (const auto& finding : report.findings) {
+            if (finding.rule == rule) return &finding;
+        }
+        return nullptr;
+    };
+    REQUIRE(find(0) == nullptr);
+    REQUIRE(find(1)->kind == RuleFinding::Kind::EQUIVALENT);
+    REQUIRE(find(1)->other == 0);
+    REQUIRE(find(2)->kind == RuleFinding::Kind::UNSATISFIABLE);
+    REQUIRE(find(3)->kind == RuleFinding::Kind::SUBSUMED);
+    REQUIRE(find(3)->other == 0);
+    REQUIRE(find(4)->kind == RuleFinding::Kind::UNSATISFIABLE);
+    REQUIRE(find(5)->kind == RuleFinding::Kind::SIMPLIFIED);
+    REQUIRE(find(6)->kind == RuleFinding::Kind::SUBSUMED);
+    REQUIRE(find(6)->other == 5);
+    REQUIRE(find(8)->kind == RuleFinding::Kind::SIMPLIFIED);
+    REQUIRE(report.sources == std::vector<size_t>{0, 5, 7, 8});
+
+    // Kept rules behave like the originals
+    TestEnvironment env;
+    for (int i = 0; i < 200; ++i) {
+        env.set("x", Value(static_cast<double>(i % 25)));
+        env.set("y", Value(static_cast<double>(i % 7) - 2));
+        env.set("z", Value(static_cast<double>(i % 9)));
+        env.set("id", Value(static_cast<double>(i % 11)));
+        env.set("tier", Value(i % 3 == 0 ? "gold" : i % 3 == 1 ? "silver" : "bronze"));
+        env.set("country", Value(i % 2 ? "NZ" : "AU"));
+        for (size_t k = 0; k < report.rules.size(); ++k) {
+            REQUIRE(report.rules[k]->evaluate(&env).asBoolean() == rules[report.sources[k]]->evaluate(&env).asBoolean());
+        }
+        // Dropped rules never match unless a kept rule does
+        bool any = false, anyKept = false;
+        for (const auto& rule : rules) any = any || rule->evaluate(&env).asBoolean();
+        for (const auto& rule : report.rules) anyKept = anyKept || rule->evaluate(&env).asBoolean();
+        REQUIRE(any == anyKept);
+    }
+    REQUIRE(RuleNormalizer::CountAtoms(report.rules[1]) == 2);
+
+    SECTION("Subsumed rules can be kept") {
+        const RuleSetReport independent = AnalyzeRules(rules, false);
+        REQUIRE(independent.sources == std::vector<size_t>{0, 3, 5, 6, 7, 8});
+        REQUIRE(independent.findings.size() == report.findings.size());
+    }
+}
+
+TEST_CASE("Borrowed String Values", "[string][borrow]") {
+    // Environment exposing strings it owns without copying them
+    class DocumentEnvironment final : public IEnvironment {
+    public:
+        std::map<std::string, std::string> fields;
+        Value Get(const std::string& name) override {
+            const auto it = fields.find(name);
+            if (it == fields.end()) throw ExprException("Variable not defined: " + name);
+            return Value::Borrow(it->second);
+        }
+        Value Call(const std::string& name, const std::vector<Value>&) override {
+            throw ExprException("Function not defined: " + name);
+        }
+    };
+
+    DocumentEnvironment env;
+    env.fields["url"] = "https://example.com/checkout?session=" + std::string(200, 'x');
+    env.fields["host"] = "example.com";
+    env.fields["method"] = "POST";
+
+    const Value borrowed = env.Get("url");
+    REQUIRE(borrowed.isString());
+    REQUIRE(borrowed.isBorrowed());
+    REQUIRE(borrowed.stringValue.empty());
+    REQUIRE(borrowed.asStringView().data() == env.fields["url"].data());
+    REQUIRE(borrowed == Value(env.fields["url"]));
+    REQUIRE(borrowed.asString() == env.fields["url"]);
+
+    REQUIRE(Expression::Parse("host in url && method == \"POST\"")->evaluate(&env).asBoolean());
+    REQUIRE(Expression::Parse("method != \"GET\" && method < \"PUT\"")->evaluate(&env).asBoolean());
+    REQUIRE(Expression::Parse("matches(url, \"^https://[a-z.]+/checkout\")")->evaluate(&env).asBoolean());
+    REQUIRE(Expression::Parse("method + \"/\" + host")->evaluate(&env).asString() == "POST/example.com");
+    REQUIRE(Value::Borrow("no").asBoolean() == false);
+    REQUIRE(Value::Borrow("2.5").asNumber() == 2.5);
+
+    SECTION("Escaping results own their strings") {
+        std::string scratch = "temporary";
+        DocumentEnvironment local;
+        local.fields["s"] = scratch;
+        const Value result = Expression::Eval("s", &local);
+        REQUIRE_FALSE(result.isBorrowed());
+        local.fields["s"] = "overwritten";
+        REQUIRE(result.asString() == "temporary");
+
+        const Value owned = Value::Borrow(scratch).Owned();
+        scratch.assign("changed");
+        REQUIRE_FALSE(owned.isBorrowed());
+        REQUIRE(owned.asString() == "temporary");
+
+        const Column column = Column::Values({Value::Borrow(scratch), Value(1.0)});
+        scratch.assign("changed again");
+        REQUIRE(column.at(0).asString() == "changed");
+        REQUIRE_FALSE(column.at(0).isBorrowed());
+    }
+
+    SECTION("Batch rows are borrowed from string columns") {
+        Batch batch(3);
+        batch.Add("name", Column::Strings({"alpha", "beta", "gamma"}));
+        BatchRowEnvironment row(batch, nullptr);
+        row.SetRow(1);
+        const Value cell = row.Get("name");
+        REQUIRE(cell.isBorrowed());
+        REQUIRE(cell.asStringView().data() == batch.Find("name")->stringAt(1).data());
+        const Column upper = Expression::EvaluateBatch(Expression::Parse("name + \"!\""), batch);
+        REQUIRE(upper.stringAt(2) == "gamma!");
+
+        AggregationTable table(0);
+        const size_t group = table.Group(cell);
+        REQUIRE_FALSE(table.KeyAt(group).isBorrowed());
+        REQUIRE(table.Group(Value("beta")) == group);
+    }
+}
+
+TEST_CASE("String Functions", "[string]") {
+    TestEnvironment env;
+    env.set("path", Value("  /api/v2/users/42?debug=1  "));
+    env.set("host", Value("API.Example.COM"));
+
+    REQUIRE(Expression::Eval("len(\"hello\")").asNumber() == 5.0);
+    REQUIRE(Expression::Eval("trim(path)", &env).asString() == "/api/v2/users/42?debug=1");
+    REQUIRE(Expression::Eval("substr(trim(path), 1, 3)", &env).asString() == "api");
+    REQUIRE(Expression::Eval("substr(\"abc\", 1)").asString() == "bc");
+    REQUIRE(Expression::Eval("substr(\"abc\", -4, 2)").asString() == "ab");
+    REQUIRE(Expression::Eval("substr(\"abc\", 7, 2)").asString().empty());
+    REQUIRE(Expression::Eval("lower(host) == \"api.example.com\"", &env).asBoolean());
+    REQUIRE(Expression::Eval("upper(\"MiXed 1\")").asString() == "MIXED 1");
+    REQUIRE(Expression::Eval("starts_with(trim(path), \"/api/\") && ends_with(lower(host), \".com\")", &env).asBoolean());
+    REQUIRE_FALSE(Expression::Eval("ends_with(\"a\", \"abc\")").asBoolean());
+    REQUIRE(Expression::Eval("isnull(len(null))").asBoolean());
+    env.set("nan", Value(std::nan("")));
+    env.set("inf", Value(std::numeric_limits<double>::infinity()));
+    REQUIRE_THROWS_WITH(Expression::Eval("substr(\"abc\", nan)", &env), "substr requires a finite start and length");
+    REQUIRE_THROWS_WITH(Expression::Eval("substr(\"abc\", 1, inf)", &env), "substr requires a finite start and length");
+
+    // Arguments of other types are left to the host
+    REQUIRE_THROWS_WITH(Expression::Eval("len(5)"), "len requires string arguments");
+    REQUIRE_THROWS_WITH(Expression::Eval("lower(1 > 0)", &env), "Function not defined: lower");
+    REQUIRE_THROWS_WITH(Expression::Eval("substr(\"abc\", \"1\")", &env), "Function not defined: substr");
+    REQUIRE_THROWS_WITH(Expression::Eval("ends_with(\"abc\", host == host)", &env), "Function not defined: ends_with");
+    REQUIRE_THROWS_WITH(Expression::Eval("starts_with(5, \"x\")"), "starts_with requires string arguments");
+    {
+        class Host : public IEnvironment {
+        public:
+            Value Get(const std::string&) override { return Value(12345.0); }
+            Value Call(const std::string& name, const std::vector<Value>& args) override {
+                return Value(name + ":" + std::to_string(args.size()));
+            }
+        } host;
+        REQUIRE(Expression::Eval("len(x)", &host).asString() == "len:1");
+        REQUIRE(Expression::Eval("trim(x)", &host).asString() == "trim:1");
+        REQUIRE(Expression::Eval("starts_with(x, \"12\")", &host).asString() == "starts_with:2");
+        REQUIRE(Expression::Eval("ends_with(x, \"45\")", &host).asString() == "ends_with:2");
+        Batch batch(2);
+        batch.Add("x", Column::Numbers({1.0, 2.0}));
+        const Column hosted = Expression::EvaluateBatch(Expression::Parse("ends_with(x, \"1\")"), batch, &host);
+        REQUIRE(hosted.at(1).asString() == "ends_with:2");
+    }
+
+    // Literal prefixes and suffixes get their own node
+    REQUIRE(std::dynamic_pointer_cast<AffixMatchNode>(Expression::Parse("starts_with(path, \"/api\")")));
+    REQUIRE(std::dynamic_pointer_cast<FunctionCallNode>(Expression::Parse("starts_with(path, host)")));
+
+    SECTION("Slices and case conversion avoid copies") {
+        const std::string text = "  padded value  ";
+        Value argument = Value::Borrow(text);
+        Value result;
+        REQUIRE(CallStringFunctions("trim", {argument}, nullptr, result));
+        REQUIRE(result.isBorrowed());
+        REQUIRE(result.asStringView() == "padded value");
+        REQUIRE(result.asStringView().data() == text.data() + 2);
+
+        REQUIRE(CallStringFunctions("substr", {Value(text), Value(2.0), Value(6.0)}, nullptr, result));
+        REQUIRE_FALSE(result.isBorrowed());
+        REQUIRE(result.asString() == "padded");
+
+        EvaluationContext context;
+        REQUIRE(CallStringFunctions("upper", {argument}, &context, result));
+        REQUIRE(result.isBorrowed());
+        REQUIRE(result.asStringView() == "  PADDED VALUE  ");
+        REQUIRE(context.GetStringBytes() == text.size());
+        const char* first = result.asStringView().data();
+        context.Reset();
+        REQUIRE(CallStringFunctions("lower", {argument}, &context, result));
+        REQUIRE(result.asStringView().data() == first);  // Scratch is reused after Reset()
+
+        const std::string big(10000, 'q');
+        REQUIRE(CallStringFunctions("upper", {Value::Borrow(big)}, &context, result));
+        REQUIRE(result.asStringView() == std::string(10000, 'Q'));
+        REQUIRE_FALSE(CallStringFunctions("len", {}, nullptr, result));
+    }
+
+    SECTION("Batch evaluation") {
+        Batch batch(6);
+        batch.Add("route", Column::Encode({"/api/a", "/web/b", "/api/c", "/static/x.css", "/api/a", "/web/b"}))
+             .Add("file", Column::Strings({"a.css", "b.js", "c.CSS", "d", "e.css", "f.js"}));
+        const Column api = Expression::EvaluateBatch(Expression::Parse("starts_with(route, \"/api/\")"), batch);
+        const Column css = Expression::EvaluateBatch(Expression::Parse("ends_with(lower(file), \".css\")"), batch);
+        const Column size = Expression::EvaluateBatch(Expression::Parse("len(substr(route, 1))"), batch);
+        const bool expectedApi[] = {true, false, true, false, true, false};
+        const bool expectedCss[] = {true, false, true, false, true, false};
+        const double expectedSize[] = {5, 5, 5, 12, 5, 5};
+        for (size_t i = 0; i < 6; ++i) {
+            REQUIRE(api.booleanAt(i) == expectedApi[i]);
+            REQUIRE(css.at(i).asBoolean() == expectedCss[i]);
+            REQUIRE(size.at(i).asNumber() == expectedSize[i]);
+        }
+    }
+
+    SECTION("Batch evaluation reuses the context scratch") {
+        Batch batch(3);
+        batch.Add("file", Column::Strings({"a.css", "b.js", std::string(5000, 'c')}));
+        EvaluationContext context;
+        const auto before = context.MarkScratch();
+        const auto ast = Expression::Parse("upper(file)");
+        for (int pass = 0; pass < 3; ++pass) {
+            const Column upper = Expression::EvaluateBatch(ast, batch, nullptr, &context);
+            REQUIRE(upper.at(0).asString() == "A.CSS");
+            REQUIRE(upper.at(1).asString() == "B.JS");
+            REQUIRE(upper.at(2).asString() == std::string(5000, 'C'));
+            const auto after = context.MarkScratch();
+            REQUIRE(after.block == before.block);
+            REQUIRE(after.used == before.used);
+        }
+    }
+}
+
+TEST_CASE("Case-Insensitive Matching", "[string][simd]") {
+    TestEnvironment env;
+    env.set("agent", Value("Mozilla/5.0 (compatible; GoogleBot/2.1; +http://www.google.com/bot.html)"));
+    env.set("header", Value("Content-TYPE"));
+
+    REQUIRE(Expression::Eval("ieq(header, \"content-type\")", &env).asBoolean());
+    REQUIRE(Expression::Eval("ieq(\"CONTENT-type\", header)", &env).asBoolean());
+    REQUIRE_FALSE(Expression::Eval("ieq(header, \"content-typ\")", &env).asBoolean());
+    REQUIRE(Expression::Eval("icontains(agent, \"googlebot\")", &env).asBoolean());
+    REQUIRE(Expression::Eval("icontains(agent, \"BOT.HTML)\")", &env).asBoolean());
+    REQUIRE_FALSE(Expression::Eval("icontains(agent, \"bingbot\")", &env).asBoolean());
+    REQUIRE(Expression::Eval("icontains(agent, \"\")", &env).asBoolean());
+    REQUIRE(Expression::Eval("icontains(agent, header) == false", &env).asBoolean());
+    REQUIRE(Expression::Eval("isnull(ieq(null, \"x\"))").asBoolean());
+    // Arguments of other types are left to the host
+    REQUIRE_THROWS_WITH(Expression::Eval("icontains(agent, 1)", &env), "Function not defined: icontains");
+    REQUIRE_THROWS_WITH(Expression::Eval("ieq(1, \"a\")"), "ieq requires string arguments");
+    REQUIRE_THROWS_WITH(Expression::Eval("ieq(1 > 0, \"a\")", &env), "Function not defined: ieq");
+    {
+        class Host : public IEnvironment {
+        public:
+            Value Get(const std::string&) override { return Value(7.0); }
+            Value Call(const std::string& name, const std::vector<Value>& args) override {
+                return Value(name + ":" + (args[0].isString() ? args[0].asString() : "n") + "," +
+                             (args[1].isString() ? args[1].asString() : "n"));
+            }
+        } host;
+        REQUIRE(Expression::Eval("icontains(x, \"Bot\")", &host).asString() == "icontains:n,Bot");
+        REQUIRE(Expression::Eval("ieq(\"Abc\", x)", &host).asString() == "ieq:Abc,n");
+        REQUIRE(Expression::Eval("ieq(x, \"Abc\")", &host).asString() == "ieq:n,Abc");
+        Batch batch(2);
+        batch.Add("x", Column::Numbers({1.0, 2.0}));
+        const Column hosted = Expression::EvaluateBatch(Expression::Parse("icontains(x, \"b\")"), batch, &host);
+        REQUIRE(hosted.at(1).asString() == "icontains:n,b");
+    }
+
+    // Literal needles are folded once into their own node
+    auto node = std::dynamic_pointer_cast<CaseInsensitiveMatchNode>(Expression::Parse("icontains(agent, \"GoogleBot\")"));
+    REQUIRE(node);
+    REQUIRE(node->getNeedle() == "googlebot");
+    REQUIRE(std::dynamic_pointer_cast<FunctionCallNode>(Expression::Parse("icontains(\"bot\", agent)")));
+
+    SECTION("Vector and scalar paths agree") {
+        // Lengths cross the 16-byte block boundary; bytes include non-ASCII and the
+        // neighbours of 'A'..'Z' that must not be folded
+        const std::string alphabet = "aZ@[`{\xC3\x89\xE9xY0 ";
+        uint32_t seed = 7;
+        const auto next = [&seed]() { seed = seed * 1103515245u + 12345u; return seed >> 16; };
+        for (int round = 0; round < 2000; ++round) {
+            std::string haystack(next() % 48, ' ');
+            for (char& c : haystack) c = alphabet[next() % alphabet.size()];
+            std::string needle = haystack.substr(haystack.empty() ? 0 : next() % haystack.size(), 1 + next() % 5);
+            if (next() % 3 == 0) needle = std::string(1 + next() % 3, alphabet[next() % alphabet.size()]);
+            for (char& c : needle) {
+                if (next() % 2) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            }
+
+            std::string lowerHaystack = haystack, lowerNeedle = needle;
+            for (char& c : lowerHaystack) c = AsciiCase::Fold(c);
+            for (char& c : lowerNeedle) c = AsciiCase::Fold(c);
+            REQUIRE(AsciiCase::ContainsFolded(haystack, AsciiCase::Fold(needle)) ==
+                    (lowerHaystack.find(lowerNeedle) != std::string::npos));
+            std::string shuffled = haystack;
+            for (char& c : shuffled) {
+                if (next() % 2) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            }
+            REQUIRE(AsciiCase::Equals(haystack, shuffled));
+            if (!shuffled.empty()) {
+                shuffled[next() % shuffled.size()] ^= 0x40;
+                REQUIRE(AsciiCase::Equals(haystack, shuffled) == (lowerHaystack == AsciiCase::Fold(shuffled)));
+            }
+        }
+        REQUIRE_FALSE(AsciiCase::Equals("@", "`"));
+        REQUIRE_FALSE(AsciiCase::Equals("[", "{"));
+        REQUIRE_FALSE(AsciiCase::Equals("\xC3\x89", "\xC3\xA9"));
+    }
+
+    SECTION("Batch evaluation") {
+        Batch batch(5);
+        batch.Add("method", Column::Encode({"GET", "post", "Get", "PUT", "get"}))
+             .Add("agent", Column::Strings({"curl/8.0", "Mozilla Firefox", "python-REQUESTS", "SomeBot", "mozilla"}));
+        const Column get = Expression::EvaluateBatch(Expression::Parse("ieq(method, \"get\")"), batch);
+        const Column bot = Expression::EvaluateBatch(Expression::Parse("icontains(agent, \"BOT\") || icontains(agent, \"requests\")"), batch);
+        const Column both = Expression::EvaluateBatch(Expression::Parse("icontains(agent, method)"), batch);
+        const bool expectedGet[] = {true, false, true, false, true};
+        const bool expectedBot[] = {false, false, true, true, false};
+        for (size_t i = 0; i < 5; ++i) {
+            REQUIRE(get.at(i).asBoolean() == expectedGet[i]);
+            REQUIRE(bot.at(i).asBoolean() == expectedBot[i]);
+            REQUIRE_FALSE(both.at(i).asBoolean());
+        }
+    }
+}
+
+TEST_CASE("Hash Functions", "[hash]") {
+    TestEnvironment env;
+    env.set("user", Value("user-42"));
+    env.set("id", Value(42.0));
+
+    // Values are pinned so a change to the hash is caught: assignments must not move
+    REQUIRE(StableHash::String("") == 290873116282709081ULL);
+    REQUIRE(StableHash::String("user-42") == 5920384170201156578ULL);
+    REQUIRE(StableHash::String("user-42", 7) == 8576418107070394579ULL);
+    REQUIRE(StableHash::String("0123456789abcdef0123456789abcdef0123456789abcdef0123456789") == 17316826463253119515ULL);
+    REQUIRE(StableHash::Number(42.0) == 3432788146909067790ULL);
+    REQUIRE(Expression::Eval("hash64(user)", &env).asNumber() == 2890812583106033.0);
+    REQUIRE(Expression::Eval("bucket(user, 100)", &env).asNumber() == 32.0);
+
+    // Numbers hash like their little-endian bytes; -0 and 0 agree
+    const double value = 12345.678;
+    unsigned char bytes[8];
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (int b = 0; b < 8; ++b) bytes[b] = static_cast<unsigned char>(bits >> (8 * b));
+    REQUIRE(StableHash::Number(value, 3) == StableHash::Bytes(bytes, 8, 3));
+    REQUIRE(StableHash::Number(-0.0) == StableHash::Number(0.0));
+    REQUIRE(Expression::Eval("hash64(true) == hash64(1)").asBoolean());
+    REQUIRE(Expression::Eval("hash64(id) != hash64(\"42\")", &env).asBoolean());
+    REQUIRE(Expression::Eval("hash64(user, 1) != hash64(user, 2)", &env).asBoolean());
+    REQUIRE(Expression::Eval("isnull(bucket(null, 10))").asBoolean());
+    REQUIRE(Expression::Eval("hash64(user, -9223372036854775808)", &env).isNumber());
+    REQUIRE(std::dynamic_pointer_cast<HashNode>(Expression::Parse("bucket(user, 10, 3)")));
+    // Calls that do not fit are left to the host, at parse time or on evaluation
+    for (const char* source : {"bucket(user)", "bucket(user, 0)", "bucket(user, 2.5)", "hash64(user, \"s\")",
+                               "hash64(user, 9223372036854775808)"}) {
+        INFO(source);
+        REQUIRE(std::dynamic_pointer_cast<FunctionCallNode>(Expression::Parse(source)));
+    }
+    REQUIRE_THROWS_WITH(Expression::Eval("bucket(\"u\", 1 - 1)"), "bucket requires a positive integer bucket count");
+    REQUIRE_THROWS_WITH(Expression::Eval("hash64(\"u\", \"s\" + \"\")"), "hash64 requires a numeric seed");
+    REQUIRE_THROWS_WITH(Expression::Eval("hash64(\"u\", 9223372036854775808 * 1)"), "hash64 requires a numeric seed");
+    REQUIRE_THROWS_WITH(Expression::Eval("bucket(user, 1 - 1)", &env), "Function not defined: bucket");
+
+    SECTION("Buckets are uniform") {
+        std::vector<int> counts(100);
+        for (int i = 0; i < 100000; ++i) {
+            const uint64_t hash = StableHash::String("user-" + std::to_string(i));
+            ++counts[StableHash::Bucket(hash, 100)];
+        }
+        for (const int count : counts) {
+            REQUIRE(count > 850);
+            REQUIRE(count < 1150);
+        }
+    }
+
+    SECTION("Batch evaluation matches scalar") {
+        Batch batch(6);
+        batch.Add("user", Column::Encode({"a", "b", "a", "c", "d", "b"}))
+             .Add("name", Column::Strings({"x", "yy", "zzz", "", "long name over sixteen bytes", "x"}))
+             .Add("id", Column::Numbers({1, 2, 3, -0.0, 1e300, 7}))
+             .Add("flag", Column::Booleans({1, 0, 1, 1, 0, 0}))
+             .Add("mixed", Column::Values({Value(1.0), Value("s"), Value::Null(), Value(true), Value(2.0), Value("t")}))
+             .Add("seed", Column::Numbers({1, 2, 3, 4, 5, 6}));
+        for (const char* source : {"bucket(user, 10)", "hash64(name, 99)", "bucket(id, 1000, 5)", "hash64(flag)",
+                                   "hash64(mixed)", "hash64(user, seed)", "bucket(\"k\", 7)"}) {
+            const auto ast = Expression::Parse(source);
+            const Column column = Expression::EvaluateBatch(ast, batch);
+            for (size_t row = 0; row < 6; ++row) {
+                BatchRowEnvironment rowEnvironment(batch, nullptr);
+                rowEnvironment.SetRow(row);
+                const Value expected = ast->evaluate(&rowEnvironment);
+                if (expected.isNull()) REQUIRE(column.at(row).isNull());
+                else REQUIRE(column.at(row).asNumber() == expected.asNumber());
+            }
+        }
+    }
+}
+
+TEST_CASE("Lookup Tables", "[lookup]") {
+    TestEnvironment env;  // Has no rate() or label() host functions
+    env.set("country", Value("DE"));
+    env.set("category", Value(3.0));
+    env.set("price", Value(100.0));
+
+    LookupTables tables;
+    tables.Add("rate", LookupTable({{Value("US"), Value(0.07)}, {Value("DE"), Value(0.19)}, {Value("FR"), Value(0.2)}}, Value(0.0)));
+    tables.Add("label", LookupTable({{Value(1.0), Value("books")}, {Value(3.0), Value("toys")}, {Value(-0.0), Value("none")}}));
+
+    const auto rule = BindLookupTables(Expression::Parse("price * rate(country) + (label(category) == \"toys\" ? 1 : 0)"), tables);
+    REQUIRE(rule->evaluate(&env).asNumber() == Approx(20.0));
+    env.set("country", Value("JP"));
+    REQUIRE(rule->evaluate(&env).asNumber() == Approx(1.0));
+    env.set("category", Value(0.0));
+    REQUIRE(BindLookupTables(Expression::Parse("label(category)"), tables)->evaluate(&env).asString() == "none");
+    REQUIRE(BindLookupTables(Expression::Parse("isnull(label(7))"), tables)->evaluate(&env).asBoolean());
+    REQUIRE(BindLookupTables(Expression::Parse("isnull(rate(null))"), tables)->evaluate(&env).asBoolean());
+
+    // Constant keys are folded away; unknown names and built-ins stay calls
+    const auto folded = BindLookupTables(Expression::Parse("rate(\"FR\")"), tables);
+    REQUIRE(std::dynamic_pointer_cast<NumberNode>(folded));
+    REQUIRE(folded->evaluate(nullptr).asNumber() == 0.2);
+    REQUIRE(std::dynamic_pointer_cast<StringNode>(BindLookupTables(Expression::Parse("label(1)"), tables)));
+    REQUIRE(std::dynamic_pointer_cast<LookupNode>(BindLookupTables(Expression::Parse("rate(upper(country))"), tables)));
+    REQUIRE(std::dynamic_pointer_cast<FunctionCallNode>(BindLookupTables(Expression::Parse("rate(country, 1)"), tables)));
+    tables.Add("abs", LookupTable({{Value(1.0), Value(5.0)}}));
+    REQUIRE(BindLookupTables(Expression::Parse("abs(-1)"), tables)->evaluate(nullptr).asNumber() == 1.0);
+
+    // Shared subtrees stay shared, and bound lookups (unlike host calls) can be merged
+    const auto shared = EliminateCommonSubexpressions(Expression::Parse("rate(upper(country)) * len(upper(country))"));
+    const auto children = BindLookupTables(shared, tables)->getChildren();
+    REQUIRE(children[0]->getChildren()[0] == children[1]->getChildren()[0]);
+    const auto merged = EliminateCommonSubexpressions(BindLookupTables(Expression::Parse("rate(country) * rate(country)"), tables));
+    REQUIRE(std::dynamic_pointer_cast<LookupNode>(merged->getChildren()[0]));
+    REQUIRE(merged->getChildren()[0] == merged->getChildren()[1]);
+
+    REQUIRE_THROWS_WITH(LookupTable({{Value("a"), Value(1.0)}, {Value("a"), Value(2.0)}}), "Duplicate lookup key");
+    REQUIRE_THROWS_WITH(LookupTable({{Value(true), Value(1.0)}}), "Lookup keys must be strings or numbers");
+
+    SECTION("Large tables") {
+        std::vector<std::pair<Value, Value>> entries;
+        for (int i = 0; i < 5000; ++i) {
+            entries.emplace_back(Value("key" + std::to_string(i)), Value(static_cast<double>(i)));
+            entries.emplace_back(Value(i * 0.5), Value(static_cast<double>(-i)));
+        }
+        const LookupTable table(std::move(entries));
+        REQUIRE(table.size() == 10000);
+        for (int i = 0; i < 5000; i += 7) {
+            REQUIRE(table.Find("key" + std::to_string(i))->asNumber() == i);
+            REQUIRE(table.Find(i * 0.5)->asNumber() == -i);
+        }
+        REQUIRE(table.Find("key5000") == nullptr);
+        REQUIRE(table.Find(0.25) == nullptr);
+    }
+
+    SECTION("Batch evaluation") {
+        Batch batch(5);
+        batch.Add("country", Column::Encode({"US", "DE", "US", "XX", "FR"}))
+             .Add("category", Column::Values({Value(1.0), Value(3.0), Value::Null(), Value(2.0), Value(1.0)}))
+             .Add("name", Column::Strings({"DE", "US", "FR", "", "DE"}));
+        const auto rates = BindLookupTables(Expression::Parse("rate(country) + rate(name)"), tables);
+        const auto labels = BindLookupTables(Expression::Parse("label(category)"), tables);
+        const Column r = Expression::EvaluateBatch(rates, batch);
+        const Column l = Expression::EvaluateBatch(labels, batch);
+        const double expectedRates[] = {0.26, 0.26, 0.27, 0.0, 0.39};
+        for (size_t i = 0; i < 5; ++i) REQUIRE(r.at(i).asNumber() == Approx(expectedRates[i]));
+        REQUIRE(l.at(0).asString() == "books");
+        REQUIRE(l.at(1).asString() == "toys");
+        REQUIRE(l.at(2).isNull());
+        REQUIRE(l.at(3).isNull());
+    }
+}
+
+TEST_CASE("IP Address Matching", "[ip]") {
+    TestEnvironment env;
+    env.set("client", Value("10.20.30.40"));
+    env.set("client6", Value("2001:DB8::1"));
+    env.set("packed", Value(3232235777.0));  // 192.168.1.1
+
+    REQUIRE(Expression::Eval("ip_in(client, \"10.0.0.0/8\")", &env).asBoolean());
+    REQUIRE(Expression::Eval("ip_in(client, \"192.168.0.0/16, 172.16.0.0/12\", \"10.20.30.40\")", &env).asBoolean());
+    REQUIRE_FALSE(Expression::Eval("ip_in(client, \"10.20.30.41 10.20.31.0/24\")", &env).asBoolean());
+    REQUIRE(Expression::Eval("ip_in(client6, \"2001:db8::/32\")", &env).asBoolean());
+    REQUIRE_FALSE(Expression::Eval("ip_in(client6, \"10.0.0.0/8\")", &env).asBoolean());
+    REQUIRE(Expression::Eval("ip_in(packed, \"192.168.1.0/24\")", &env).asBoolean());
+    REQUIRE(Expression::Eval("ip_in(\"::ffff:10.1.1.1\", \"10.0.0.0/8\")").asBoolean());
+    REQUIRE(Expression::Eval("ip_in(\"8.8.8.8\", \"0.0.0.0/0\")").asBoolean());
+    REQUIRE_FALSE(Expression::Eval("ip_in(\"2001::1\", \"0.0.0.0/0\")").asBoolean());
+    REQUIRE(Expression::Eval("ip_in(\"2001::1\", \"::/0\")").asBoolean());
+    REQUIRE_FALSE(Expression::Eval("ip_in(\"not an ip\", \"0.0.0.0/0\")").asBoolean());
+    REQUIRE(Expression::Eval("isnull(ip_in(null, \"10.0.0.0/8\"))").asBoolean());
+    REQUIRE(Expression::Eval("ip_in(client, lower(\"10.0.0.0/8\"))", &env).asBoolean());
+    REQUIRE_THROWS_WITH(Expression::Parse("ip_in(client, \"10.0.0.0/33\")"), "Invalid CIDR range: 10.0.0.0/33");
+    REQUIRE_THROWS_WITH(Expression::Parse("ip_in(client, \"10.0.0/8\")"), "Invalid CIDR range: 10.0.0/8");
+    REQUIRE_THROWS_WITH(Expression::Eval("ip_in(1 > 0, \"10.0.0.0/8\")"), "ip_in requires a string or integer address");
+    REQUIRE_THROWS_WITH(Expression::Eval("ip_in(client, 1 + 1)", &env), "Function not defined: ip_in");
+    REQUIRE(std::dynamic_pointer_cast<FunctionCallNode>(Expression::Parse("ip_in(true, \"10.0.0.0/8\")")));
+    REQUIRE(std::dynamic_pointer_cast<FunctionCallNode>(Expression::Parse("ip_in(client, 8)")));
+
+    SECTION("Arguments of other types go to the host") {
+        class HostEnvironment final : public IEnvironment {
+        public:
+            Value Get(const std::string& name) override { return name == "x" ? Value(1.0) : Value(2.0); }
+            Value Call(const std::string& name, const std::vector<Value>& args) override {
+                REQUIRE(name == "ip_in");
+                return Value(args[0].asNumber() + args[1].asNumber());
+            }
+        } host;
+        REQUIRE(Expression::Eval("ip_in(x, y)", &host).asNumber() == 3.0);
+    }
+
+    SECTION("Address parsing") {
+        IpAddress address;
+        for (const char* valid : {"0.0.0.0", "255.255.255.255", "::", "::1", "1::", "fe80::1:2", "1:2:3:4:5:6:7:8",
+                                  "::ffff:1.2.3.4", "1:2:3:4:5:6:1.2.3.4", "ABCD:ef01::"}) {
+            INFO(valid);
+            REQUIRE(IpAddress::Parse(valid, address));
+        }
+        for (const char* invalid : {"", "1.2.3", "1.2.3.4.5", "256.1.1.1", "01.2.3.4", "1.2.3.4 ", ":", ":::", "1:::2",
+                                    "1::2::3", "1:2:3:4:5:6:7:8:9", "1:2:3:4:5:6:7", "12345::", "1:2:3:4:5:6:7:1.2.3.4",
+                                    "1:", ":1", "g::", "::1.2.3"}) {
+            INFO(invalid);
+            REQUIRE_FALSE(IpAddress::Parse(invalid, address));
+        }
+        REQUIRE(IpAddress::Parse("1.2.3.4", address));
+        REQUIRE(address.isIPv4());
+        IpAddress mapped;
+        REQUIRE(IpAddress::Parse("::FFFF:102:304", mapped));
+        REQUIRE((mapped.high == address.high && mapped.low == address.low));
+        REQUIRE(IpAddress::Parse("2001:db8:0:0:1::", address));
+        REQUIRE(address.high == 0x20010db800000000ULL);
+        REQUIRE(address.low == 0x0001000000000000ULL);
+    }
+
+    SECTION("Trie agrees with a linear scan") {
+        uint32_t seed = 99;
+        const auto next = [&seed]() { seed = seed * 1664525u + 1013904223u; return seed; };
+        std::vector<std::pair<uint32_t, uint32_t>> ranges;  // Network, prefix length
+        std::string specs;
+        for (int r = 0; r < 400; ++r) {
+            const uint32_t length = 8 + next() % 25;
+            const uint32_t network = (next() & 0x0F0F0000u) & (length == 0 ? 0 : ~0u << (32 - length));
+            ranges.emplace_back(network, length);
+            specs += std::to_string(network >> 24) + "." + std::to_string((network >> 16) & 255) + "." +
+                     std::to_string((network >> 8) & 255) + "." + std::to_string(network & 255) + "/" + std::to_string(length) + ",";
+        }
+        const CidrSet set({specs});
+        REQUIRE(set.size() == 400);
+        for (int probe = 0; probe < 20000; ++probe) {
+            const uint32_t address = next() & 0x0F0F0F0Fu;
+            bool expected = false;
+            for (const auto& range : ranges) {
+                expected = expected || (address & ~0u << (32 - range.second)) == range.first;
+            }
+            REQUIRE(set.Contains(static_cast<double>(address)) == expected);
+        }
+    }
+
+    SECTION("Batch evaluation") {
+        Batch batch(5);
+        batch.Add("ip", Column::Encode({"10.0.0.1", "8.8.8.8", "10.0.0.1", "fd00::5", "bogus"}))
+             .Add("raw", Column::Strings({"172.16.5.4", "172.32.0.1", "::1", "10.255.255.255", ""}))
+             .Add("v4", Column::Numbers({167772161.0, 134744072.0, -1.0, 0.5, 2886729729.0}));
+        const auto ast = Expression::Parse("ip_in(ip, \"10.0.0.0/8, fc00::/7\")");
+        const Column encoded = Expression::EvaluateBatch(ast, batch);
+        const Column plain = Expression::EvaluateBatch(Expression::Parse("ip_in(raw, \"10.0.0.0/8 172.16.0.0/12 ::1\")"), batch);
+        const Column numeric = Expression::EvaluateBatch(Expression::Parse("ip_in(v4, \"10.0.0.0/8\", \"172.16.0.0/12\")"), batch);
+        const bool expectedEncoded[] = {true, false, true, true, false};
+        const bool expectedPlain[] = {true, false, true, true, false};
+        const bool expectedNumeric[] = {true, false, false, false, true};
+        for (size_t i = 0; i < 5; ++i) {
+            REQUIRE(encoded.booleanAt(i) == expectedEncoded[i]);
+            REQUIRE(plain.booleanAt(i) == expectedPlain[i]);
+            REQUIRE(numeric.booleanAt(i) == expectedNumeric[i]);
+        }
+    }
+}
+
+TEST_CASE("Geospatial Functions", "[geo]") {
+    TestEnvironment env;
+    env.set("lat", Value(40.7128));
+    env.set("lon", Value(-74.0060));
+
+    // New York to London is about 5570 km
+    const double distance = Expression::Eval("geo_distance(lat, lon, 51.5074, -0.1278)", &env).asNumber();
+    REQUIRE(distance == Approx(5570e3).epsilon(0.005));
+    REQUIRE(GeoDistance(0, 0, 0, 0) == 0.0);
+    REQUIRE(GeoDistance(0, 0, 0, 180) == Approx(3.14159265358979 * 6371008.8));
+    REQUIRE(Expression::Eval("isnull(geo_distance(null, 0, 0, 0))").asBoolean());
+    REQUIRE_THROWS_WITH(Expression::Eval("geo_distance(lower(\"a\"), 0, 0, 0)"), "geo_distance requires numeric coordinates");
+    // Other argument types are left to the host
+    REQUIRE(std::dynamic_pointer_cast<FunctionCallNode>(Expression::Parse("geo_distance(\"a\", 0, 0, 0)")));
+    REQUIRE_THROWS_WITH(Expression::Eval("geo_distance(lower(\"a\"), 0, 0, 0)", &env), "Function not defined: geo_distance");
+
+    GeoZones zones;
+    // An L-shaped zone: the square (0..10, 0..10) without the quadrant (5..10, 5..10)
+    zones.Add("ell", {{0, 0}, {0, 10}, {5, 10}, {5, 5}, {10, 5}, {10, 0}});
+    const auto rule = BindGeoZones(Expression::Parse("within(lat, lon, \"ell\")"), zones);
+    REQUIRE(std::dynamic_pointer_cast<GeoWithinNode>(rule));
+    env.set("lat", Value(2.0));
+    env.set("lon", Value(8.0));
+    REQUIRE(rule->evaluate(&env).asBoolean());
+    env.set("lat", Value(7.0));
+    REQUIRE_FALSE(rule->evaluate(&env).asBoolean());
+    env.set("lon", Value(-1.0));
+    REQUIRE_FALSE(rule->evaluate(&env).asBoolean());
+    REQUIRE_THROWS_WITH(BindGeoZones(Expression::Parse("within(lat, lon, \"nowhere\")"), zones), "Unknown zone: nowhere");
+    REQUIRE(std::dynamic_pointer_cast<FunctionCallNode>(BindGeoZones(Expression::Parse("within(lat, lon, name)"), zones)));
+    REQUIRE_THROWS_WITH(GeoZone({{0, 0}, {1, 1}}), "Zone requires at least 3 vertices");
+
+    SECTION("Grid index agrees with a full ray cast") {
+        // A star with many vertices, so most grid cells are fully inside or outside
+        std::vector<std::pair<double, double>> star;
+        for (int v = 0; v < 200; ++v) {
+            const double angle = v * 2 * 3.14159265358979 / 200;
+            const double radius = v % 2 ? 1.0 : 0.45;
+            star.emplace_back(48.0 + radius * std::sin(angle), 11.0 + radius * std::cos(angle));
+        }
+        const GeoZone zone(star);
+        const auto reference = [&star](const double lat, const double lon) {
+            bool inside = false;
+            for (size_t i = 0, j = star.size() - 1; i < star.size(); j = i++) {
+                const double yi = star[i].first, yj = star[j].first, xi = star[i].second, xj = star[j].second;
+                if ((yi > lat) != (yj > lat) && lon < (xj - xi) * (lat - yi) / (yj - yi) + xi) inside = !inside;
+            }
+            return inside;
+        };
+        uint32_t seed = 5;
+        const auto next = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0; };
+        for (int probe = 0; probe < 20000; ++probe) {
+            const double lat = 46.8 + next() * 2.4, lon = 9.8 + next() * 2.4;
+            REQUIRE(zone.Contains(lat, lon) == reference(lat, lon));
+        }
+    }
+
+    SECTION("Batch evaluation") {
+        Batch batch(4);
+        batch.Add("lat", Column::Numbers({1, 7, 7, 40.7128}))
+             .Add("lon", Column::Numbers({1, 2, 7, -74.0060}))
+             .Add("lat2", Column::Numbers({0, 0, 51.5074, 40.7128}))
+             .Add("lon2", Column::Numbers({0, 0, -0.1278, -74.0060}));
+        for (const char* source : {"geo_distance(lat, lon, 51.5074, -0.1278)", "geo_distance(lat, lon, lat2, lon2)",
+                                   "geo_distance(0, 0, lat, lon)"}) {
+            const auto ast = Expression::Parse(source);
+            const Column column = Expression::EvaluateBatch(ast, batch);
+            for (size_t row = 0; row < 4; ++row) {
+                BatchRowEnvironment rowEnvironment(batch, nullptr);
+                rowEnvironment.SetRow(row);
+                REQUIRE(column.numberAt(row) == Approx(ast->evaluate(&rowEnvironment).asNumber()));
+            }
+        }
+        const Column inside = Expression::EvaluateBatch(BindGeoZones(Expression::Parse("within(lat, lon, \"ell\")"), zones), batch);
+        const bool expected[] = {true, true, false, false};
+        for (size_t row = 0; row < 4; ++row) REQUIRE(inside.booleanAt(row) == expected[row]);
+    }
+}
+
+TEST_CASE("Polynomial Rewriting", "[polynomial]") {
+    TestEnvironment env;
+    env.set("x", Value(1.5));
+    env.set("a", Value(2.0));
+    env.set("b", Value(-3.0));
+
+    const char* sources[] = {
+        "0.5*x*x*x - 2*pow(x, 2) + 3*x + 1",
+        "a*x*x*x + b*x*x + 4*x - a",
+        "(x*x*x + 2*x*x - x - 2) / 4",
+        "-(x*x) + pow(x, 3) - 3*a*x*x + 3*x*pow(a, 2) - pow(a, 3)",
+        "pow(2 * x, 4) + sqrt(a) * x * x",
+    };
+    for (const char* source : sources) {
+        INFO(source);
+        const auto original = Expression::Parse(source);
+        const auto optimized = OptimizePolynomials(original);
+        REQUIRE(std::dynamic_pointer_cast<PolynomialNode>(optimized));
+        for (const double x : {-2.0, 0.0, 1.5, 3.25}) {
+            env.set("x", Value(x));
+            REQUIRE(optimized->evaluate(&env).asNumber() == Approx(original->evaluate(&env).asNumber()));
+        }
+    }
+
+    auto curve = std::dynamic_pointer_cast<PolynomialNode>(OptimizePolynomials(Expression::Parse("0.5*x*x*x - 2*pow(x, 2) + 3*x + 1")));
+    REQUIRE(curve->getDegree() == 3);
+    const double expected[] = {1, 3, -2, 0.5};
+    for (size_t k = 0; k < 4; ++k) REQUIRE(curve->getConstantCoefficient(k) == expected[k]);
+    // a*x^3 + b*x^2 is cubic in x, so x is the variable and a, b are coefficients
+    auto mixed = std::dynamic_pointer_cast<PolynomialNode>(OptimizePolynomials(Expression::Parse("a*x*x*x + b*x*x")));
+    REQUIRE(std::dynamic_pointer_cast<VariableNode>(mixed->getVariable())->getName() == "x");
+
+    // Polynomials nested in other expressions are rewritten in place; non-polynomials are kept
+    const auto nested = OptimizePolynomials(Expression::Parse("sin(x*x + 1) > 0 && x / (x*x) < 2"));
+    const auto sine = std::dynamic_pointer_cast<FunctionCallNode>(nested->getChildren()[0]->getChildren()[0]);
+    REQUIRE(std::dynamic_pointer_cast<PolynomialNode>(sine->getArguments()[0]));
+    REQUIRE(std::dynamic_pointer_cast<BinaryOpNode>(OptimizePolynomials(Expression::Parse("3*x + 1"))));
+    REQUIRE(std::dynamic_pointer_cast<BinaryOpNode>(OptimizePolynomials(Expression::Parse("x / (x*x)"))));
+    REQUIRE(std::dynamic_pointer_cast<BinaryOpNode>(OptimizePolynomials(Expression::Parse("pow(x, 2.5) + x"))));
+
+    // Products and powers of sums keep their factored form, which does not cancel
+    env.set("x", Value(1000.001));
+    for (const char* source : {"pow(x - 1000, 3)", "(x - 1000) * (x - 1000)", "x * (x - 1000) + 1"}) {
+        INFO(source);
+        const auto original = Expression::Parse(source);
+        const auto optimized = OptimizePolynomials(original);
+        REQUIRE_FALSE(std::dynamic_pointer_cast<PolynomialNode>(optimized));
+        REQUIRE(optimized->evaluate(&env).asNumber() == original->evaluate(&env).asNumber());
+    }
+    REQUIRE(OptimizePolynomials(Expression::Parse("pow(x - 1000, 3)"))->evaluate(&env).asNumber() == Approx(1e-9).epsilon(1e-6));
+    // A constant factor may still scale a sum, and polynomials inside a factored form are rewritten
+    REQUIRE(std::dynamic_pointer_cast<PolynomialNode>(OptimizePolynomials(Expression::Parse("3 * (x*x + x)"))));
+    const auto factored = OptimizePolynomials(Expression::Parse("(x*x + 1) * (x - 2)"));
+    REQUIRE(std::dynamic_pointer_cast<PolynomialNode>(factored->getChildren()[0]));
+    env.set("x", Value(1.5));
+
+    // Non-numeric inputs behave exactly as the original expression
+    const auto square = OptimizePolynomials(Expression::Parse("x*x + 1"));
+    env.set("x", Value::Null());
+    REQUIRE(square->evaluate(&env).isNull());
+    env.set("x", Value("s"));
+    REQUIRE_THROWS_AS(square->evaluate(&env), ExprException);
+    const auto concatenation = Expression::Parse("\"v\" + x*x");
+    env.set("x", Value(2.0));
+    REQUIRE(OptimizePolynomials(concatenation)->evaluate(&env) == concatenation->evaluate(&env));
+    // Atoms whose terms cancel still make the result null
+    const auto cancelled = OptimizePolynomials(Expression::Parse("x*x + a - a"));
+    REQUIRE(std::dynamic_pointer_cast<PolynomialNode>(cancelled)->getAtoms().size() == 1);
+    env.set("a", Value::Null());
+    REQUIRE(cancelled->evaluate(&env).isNull());
+    env.set("a", Value(2.0));
+
+    SECTION("Atoms are evaluated once") {
+        class CountingEnvironment final : public IEnvironment {
+        public:
+            int calls = 0;
+            Value Get(const std::string&) override { return Value(1.5); }
+            Value Call(const std::string&, const std::vector<Value>&) override {
+                ++calls;
+                return Value(2.0);
+            }
+        } counting;
+        const auto cube = OptimizePolynomials(Expression::Parse("f() * pow(x, 3) + 2 * x * x"));
+        REQUIRE(std::dynamic_pointer_cast<PolynomialNode>(cube)->getAtoms().size() == 1);
+        REQUIRE(cube->evaluate(&counting).asNumber() == Approx(11.25));
+        REQUIRE(counting.calls == 1);
+    }
+
+    SECTION("Expansion size is bounded") {
+        env.set("x", Value(1.5));
+        for (const int n : {22, 60}) {
+            const auto original = Expression::Parse("pow(x, " + std::to_string(n) + ") + a * x * x");
+            const auto optimized = std::dynamic_pointer_cast<PolynomialNode>(OptimizePolynomials(original));
+            REQUIRE(optimized);
+            REQUIRE(optimized->getDegree() == static_cast<size_t>(n));
+            REQUIRE(optimized->getTerms().size() == 2);
+            REQUIRE(optimized->evaluate(&env).asNumber() == Approx(original->evaluate(&env).asNumber()));
+        }
+        // Too many terms: the whole sum is not rewritten
+        std::string terms = "0";
+        for (int i = 0; i < 13; ++i) {
+            for (int j = 2; j < 13; ++j) terms += " + pow(a, " + std::to_string(i) + ") * pow(x, " + std::to_string(j) + ")";
+        }
+        const auto wide = Expression::Parse(terms);
+        const auto optimized = OptimizePolynomials(wide);
+        REQUIRE_FALSE(std::dynamic_pointer_cast<PolynomialNode>(optimized));
+        REQUIRE(optimized->evaluate(&env).asNumber() == Approx(wide->evaluate(&env).asNumber()));
+    }
+
+    SECTION("Shared and cloned trees") {
+        const auto shared = EliminateCommonSubexpressions(OptimizePolynomials(Expression::Parse("(x*x + 1) * (x*x + 1) > a")));
+        REQUIRE(std::dynamic_pointer_cast<PolynomialNode>(shared->getChildren()[0]->getChildren()[0]));
+        const auto copy = CloneExpression(shared);
+        env.set("x", Value(1.25));
+        REQUIRE(copy->evaluate(&env).asBoolean() == shared->evaluate(&env).asBoolean());
+    }
+
+    SECTION("Batch evaluation") {
+        Batch batch(4);
+        batch.Add("x", Column::Numbers({-1, 0, 0.5, 2}))
+             .Add("a", Column::Numbers({1, 2, 3, 4}))
+             .Add("b", Column::Values({Value(1.0), Value::Null(), Value(2.0), Value(3.0)}));
+        for (const char* source : {"0.5*x*x*x - 2*pow(x, 2) + 3*x + 1", "a*x*x + b*x + 1", "pow(x, 3) + a*x*x*x"}) {
+            INFO(source);
+            const auto original = Expression::Parse(source);
+            const Column column = Expression::EvaluateBatch(OptimizePolynomials(original), batch);
+            for (size_t row = 0; row < 4; ++row) {
+                BatchRowEnvironment rowEnvironment(batch, nullptr);
+                rowEnvironment.SetRow(row);
+                const Value value = original->evaluate(&rowEnvironment);
+                if (value.isNull()) REQUIRE(column.at(row).isNull());
+                else REQUIRE(column.at(row).asNumber() == Approx(value.asNumber()));
+            }
+        }
+    }
+}
@@ -41,6 +41,27 @@
  * - Comprehensive operator support (arithmetic, comparison, logical)
  * - Type-safe value system with automatic conversions
  * - Exception-based error handling
+ * - Evaluation budgets, deadlines and cooperative cancellation
+ * - Columnar batch evaluation with interval analysis and top-k ranking
+ * - Fused multi-expression projection with common subexpression elimination
+ * - Multi-threaded group-by aggregation over expression results
+ * - Stateful streaming built-ins (ema, rolling_sum, rolling_max, rolling_min, delta)
+ * - DFA-based regular expression matching with patterns compiled at parse time
+ * - Dictionary-encoded string columns with per-entry comparison kernels
+ * - Zero-copy Apache Arrow C Data Interface import and export
+ * - Null values with SQL three-valued logic and validity bitmaps in batch mode
+ * - Bit-packed boolean columns with SIMD comparison kernels
+ * - Multi-process evaluation over shared memory (POSIX)
+ * - Streaming pipeline stages with micro-batching, backpressure and latency metrics
+ * - NUMA-aware rule registry with per-node replicas and pinned worker threads
+ * - Reverse-mode automatic differentiation for scalar and batch evaluation
+ * - Symbolic differentiation and algebraic simplification of expression trees
+ * - Boolean rules compiled into reduced ordered binary decision diagrams
+ * - Rule set analysis for unsatisfiable, equivalent and subsumed rules
+ * - Immutable host lookup tables bound into expressions at compile time
+ * - IPv4/IPv6 CIDR membership tests compiled into radix tries
+ * - Great-circle distances and grid-indexed geofence zones
+ * - Polynomial recognition with Horner-form evaluation
  *
  * The library is designed to be embedded in larger applications where expressions
  * need to be evaluated against dynamic data sources.
@@ -50,18 +71,96 @@
 #define EXPRESSION_KIT_HPP
 
 #include <string>
+#include <string_view>
 #include <memory>
 #include <stdexcept>
 #include <vector>
 #include <iostream>
 #include <cmath>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <set>
+#include <array>
+#include <cctype>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EXPRESSIONKIT_HAS_SSE2 1
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <csignal>
+#include <ctime>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define EXPRESSIONKIT_HAS_PROCESS_POOL 1
+#endif
+
+#if defined(__linux__)
+#include <fstream>
+#include <pthread.h>
+#define EXPRESSIONKIT_HAS_THREAD_AFFINITY 1
+#endif
+
+// Apache Arrow C Data Interface (https://arrow.apache.org/docs/format/CDataInterface.html).
+// The definitions are ABI-stable and guarded so they coexist with Arrow's own headers.
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+    void (*release)(struct ArrowSchema*);
+    void* private_data;
+};
+
+struct ArrowArray {
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+    void (*release)(struct ArrowArray*);
+    void* private_data;
+};
+
+#endif // ARROW_C_DATA_INTERFACE
 
 namespace ExpressionKit {
 
     // Forward declarations for internal use
     class ASTNode;
     class Expression;
+    class BatchEvaluation;
     using ASTNodePtr = std::shared_ptr<ASTNode>;
 
     /**
@@ -80,7 +179,8 @@ namespace ExpressionKit {
         PARENTHESIS,  // Parentheses: (, )
         COMMA,        // Function argument separator: ,
         WHITESPACE,   // Spaces, tabs (optional for highlighting)
-        UNKNOWN       // Unrecognized tokens
+        UNKNOWN,      // Unrecognized tokens
+        NULL_VALUE    // Null literal: null
     };
 
     /**
@@ -102,11 +202,284 @@ namespace ExpressionKit {
     /**
      * @brief Exception type for expression parsing and evaluation errors
      */
-    class ExprException final : public std::runtime_error {
+    class ExprException : public std::runtime_error {
     public:
         explicit ExprException(const std::string& msg) : std::runtime_error(msg) {}
     };
 
+    /**
+     * @brief Reasons an evaluation can be aborted by its EvaluationContext
+     */
+    enum class AbortReason {
+        STEP_LIMIT,     // More nodes were evaluated than EvaluationBudget::maxSteps
+        STRING_LIMIT,   // String results exceeded EvaluationBudget::maxStringBytes
+        DEPTH_LIMIT,    // Nesting exceeded EvaluationBudget::maxDepth
+        DEADLINE,       // The wall-clock deadline has passed
+        CANCELLED       // The CancellationToken was cancelled
+    };
+
+    /**
+     * @brief Exception thrown when an evaluation exceeds its budget or is cancelled
+     *
+     * Derives from ExprException so existing error handling keeps working, while
+     * callers that need to tell aborts apart from ordinary errors can catch this
+     * type first and inspect reason().
+     */
+    class ExprAbortedException final : public ExprException {
+        AbortReason abortReason;
+    public:
+        ExprAbortedException(const AbortReason r, const std::string& msg) : ExprException(msg), abortReason(r) {}
+        AbortReason reason() const { return abortReason; }
+    };
+
+    /**
+     * @brief Shared flag used to cooperatively cancel running evaluations
+     *
+     * Copies share the same underlying flag, so a token can be handed to an
+     * EvaluationContext on a worker thread and cancelled from any other thread.
+     */
+    class CancellationToken {
+        std::shared_ptr<std::atomic<bool>> flag;
+    public:
+        CancellationToken() : flag(std::make_shared<std::atomic<bool>>(false)) {}
+
+        void Cancel() { flag->store(true, std::memory_order_relaxed); }
+        void Reset() { flag->store(false, std::memory_order_relaxed); }
+        bool IsCancelled() const { return flag->load(std::memory_order_relaxed); }
+    };
+
+    /**
+     * @brief Resource limits for a single evaluation
+     *
+     * A limit of 0 means unlimited. The deadline defaults to "never".
+     */
+    struct EvaluationBudget {
+        size_t maxSteps = 0;          // Maximum number of AST nodes evaluated
+        size_t maxStringBytes = 0;    // Maximum bytes produced by string concatenation
+        size_t maxDepth = 0;          // Maximum evaluation nesting depth
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+        /**
+         * @brief Set the deadline relative to now
+         */
+        EvaluationBudget& WithTimeout(const std::chrono::steady_clock::duration timeout) {
+            deadline = std::chrono::steady_clock::now() + timeout;
+            return *this;
+        }
+    };
+
+    /**
+     * @brief Base class for state that an AST node keeps across evaluations
+     */
+    class NodeState {
+    public:
+        virtual ~NodeState() = default;
+    };
+
+    /**
+     * @brief Storage for stateful built-ins (such as rolling windows) across evaluations
+     *
+     * Each stateful node keeps its own NodeState here, keyed by the node, so one
+     * parsed expression can be evaluated over several independent streams by
+     * giving each stream its own EvaluationState. Attach it to an
+     * EvaluationContext with SetState().
+     *
+     * @note The ASTs evaluated with a state must outlive it (or Reset() must be
+     *       called before they are destroyed), since nodes are identified by address.
+     */
+    class EvaluationState {
+        std::unordered_map<const ASTNode*, std::unique_ptr<NodeState>> states;
+    public:
+        /**
+         * @brief Get the state of a node, constructing it from args on first use
+         */
+        template <typename T, typename... Args>
+        T& Get(const ASTNode* owner, Args&&... args) {
+            auto& slot = states[owner];
+            if (!slot) slot.reset(new T(std::forward<Args>(args)...));
+            return static_cast<T&>(*slot);
+        }
+
+        /**
+         * @brief Forget all accumulated state
+         */
+        void Reset() { states.clear(); }
+
+        size_t size() const { return states.size(); }
+    };
+
+    /**
+     * @brief Per-evaluation bookkeeping for budgets and cancellation
+     *
+     * Pass an EvaluationContext to ASTNode::evaluate() (or Expression::Eval()) to
+     * enforce an EvaluationBudget. The step counter is compared against a single
+     * precomputed threshold on every node, so the hot path costs one increment and
+     * one comparison; the deadline and cancellation token are only polled every
+     * CHECK_INTERVAL steps and around host function calls.
+     *
+     * Counters accumulate across evaluate() calls until Reset() is called, which
+     * lets a caller budget a whole batch of evaluations at once.
+     *
+     * @note A context is not thread-safe; use one per thread. The cancellation
+     *       token may be shared freely.
+     */
+    class EvaluationContext {
+        EvaluationBudget budget;
+        CancellationToken token;
+        size_t steps = 0;
+        size_t nextCheck = 0;
+        size_t stringBytes = 0;
+        size_t depth = 0;
+        EvaluationState* state = nullptr;
+
+        // Scratch arena for string results; blocks are reused after Reset()
+        struct ScratchBlock {
+            std::unique_ptr<char[]> data;
+            size_t size;
+        };
+        std::vector<ScratchBlock> scratch;
+        size_t scratchBlock = 0;
+        size_t scratchUsed = 0;
+
+        void scheduleNextCheck() {
+            nextCheck = steps + CHECK_INTERVAL;
+            if (budget.maxSteps != 0 && budget.maxSteps + 1 < nextCheck) nextCheck = budget.maxSteps + 1;
+        }
+
+    public:
+        static constexpr size_t CHECK_INTERVAL = 1024;
+
+        explicit EvaluationContext(EvaluationBudget b = EvaluationBudget(), CancellationToken t = CancellationToken())
+            : budget(b), token(std::move(t)) {
+            scheduleNextCheck();
+        }
+
+        /**
+         * @brief Clear all counters so the context can be reused for a new evaluation
+         */
+        void Reset() {
+            steps = 0;
+            stringBytes = 0;
+            depth = 0;
+            scratchBlock = 0;
+            scratchUsed = 0;
+            scheduleNextCheck();
+        }
+
+        const EvaluationBudget& GetBudget() const { return budget; }
+        void SetBudget(const EvaluationBudget& b) { budget = b; scheduleNextCheck(); }
+        const CancellationToken& GetCancellationToken() const { return token; }
+        /**
+         * @brief Attach state for stateful built-ins; not reset by Reset()
+         */
+        void SetState(EvaluationState* s) { state = s; }
+        EvaluationState* GetState() const { return state; }
+
+        size_t GetStepCount() const { return steps; }
+        size_t GetStringBytes() const { return stringBytes; }
+
+        /**
+         * @brief Count one evaluation step (called once per evaluated node)
+         */
+        void Step() {
+            if (++steps >= nextCheck) Check();
+        }
+
+        /**
+         * @brief Check every limit immediately
+         * @throws ExprAbortedException if any limit is exceeded
+         */
+        void Check() {
+            if (budget.maxSteps != 0 && steps > budget.maxSteps) {
+                throw ExprAbortedException(AbortReason::STEP_LIMIT, "Evaluation aborted: step limit exceeded");
+            }
+            if (token.IsCancelled()) {
+                throw ExprAbortedException(AbortReason::CANCELLED, "Evaluation aborted: cancelled");
+            }
+            if (budget.deadline != std::chrono::steady_clock::time_point::max() &&
+                std::chrono::steady_clock::now() >= budget.deadline) {
+                throw ExprAbortedException(AbortReason::DEADLINE, "Evaluation aborted: deadline exceeded");
+            }
+            scheduleNextCheck();
+        }
+
+        /**
+         * @brief Account for bytes about to be allocated for a string result
+         * @throws ExprAbortedException if the string budget would be exceeded
+         */
+        void ChargeString(const size_t bytes) {
+            stringBytes += bytes;
+            if (budget.maxStringBytes != 0 && stringBytes > budget.maxStringBytes) {
+                throw ExprAbortedException(AbortReason::STRING_LIMIT, "Evaluation aborted: string size limit exceeded");
+            }
+        }
+
+        /**
+         * @brief Reserve bytes that stay valid until Reset() or destruction
+         *
+         * Used by string built-ins to build results without a heap allocation per call.
+         */
+        char* AllocateScratch(const size_t bytes) {
+            static constexpr size_t BLOCK_SIZE = 4096;
+            for (; scratchBlock < scratch.size(); ++scratchBlock, scratchUsed = 0) {
+                ScratchBlock& block = scratch[scratchBlock];
+                if (block.size - scratchUsed >= bytes) {
+                    char* out = block.data.get() + scratchUsed;
+                    scratchUsed += bytes;
+                    return out;
+                }
+            }
+            const size_t size = std::max(bytes, BLOCK_SIZE);
+            scratch.push_back(ScratchBlock{std::unique_ptr<char[]>(new char[size]), size});
+            scratchBlock = scratch.size() - 1;
+            scratchUsed = bytes;
+            return scratch.back().data.get();
+        }
+
+        /**
+         * @brief Position in the scratch arena, to be passed to RewindScratch()
+         */
+        struct ScratchMark {
+            size_t block;
+            size_t used;
+        };
+
+        ScratchMark MarkScratch() const { return ScratchMark{scratchBlock, scratchUsed}; }
+
+        /**
+         * @brief Reuse the scratch reserved since a mark
+         *
+         * Borrowed values pointing into that scratch become invalid, so only call
+         * this once every result built since the mark has been copied with Owned().
+         */
+        void RewindScratch(const ScratchMark& mark) {
+            scratchBlock = mark.block;
+            scratchUsed = mark.used;
+        }
+
+        /**
+         * @brief RAII guard counting one step and one level of nesting
+         *
+         * Every AST node opens a Frame at the start of evaluate(); with a null
+         * context the guard does nothing.
+         */
+        class Frame {
+            EvaluationContext* context;
+        public:
+            explicit Frame(EvaluationContext* c) : context(c) {
+                if (!context) return;
+                context->Step();
+                if (++context->depth > context->budget.maxDepth && context->budget.maxDepth != 0) {
+                    --context->depth;
+                    throw ExprAbortedException(AbortReason::DEPTH_LIMIT, "Evaluation aborted: nesting depth exceeded");
+                }
+            }
+            ~Frame() { if (context) --context->depth; }
+            Frame(const Frame&) = delete;
+            Frame& operator=(const Frame&) = delete;
+        };
+    };
+
     /**
      * @brief Simplified Value type that directly uses the C bridge structure
      * 
@@ -114,7 +487,7 @@ namespace ExpressionKit {
      * while providing C++ convenience methods and operators.
      */
     struct Value {
-        enum Type : int { NUMBER = 0, BOOLEAN = 1, STRING = 2 } type;
+        enum Type : int { NUMBER = 0, BOOLEAN = 1, STRING = 2, NIL = 3 } type;
         
         union Data {
             double number;
@@ -129,6 +502,10 @@ namespace ExpressionKit {
         // String data stored separately from union
         std::string stringValue;
 
+        // Borrowed string (see Borrow()); stringValue is unused while this is set
+        bool borrowed = false;
+        std::string_view view;
+
         // Constructors
         Value() : type(NUMBER) { data.number = 0.0; }
         Value(double n) : type(NUMBER) { data.number = n; }
@@ -138,41 +515,93 @@ namespace ExpressionKit {
         Value(const std::string& s) : type(STRING), stringValue(s) {}
         Value(const char* s) : type(STRING), stringValue(s) {}
 
+        /**
+         * @brief The null (missing) value
+         *
+         * Null propagates through arithmetic, comparison and most functions, and
+         * follows SQL three-valued logic in &&, || and !.
+         */
+        static Value Null() {
+            Value value;
+            value.type = NIL;
+            return value;
+        }
+
+        /**
+         * @brief A string value that refers to characters owned by someone else
+         *
+         * Environments can return strings they already hold without copying them.
+         * The characters must stay alive while the evaluation that reads them runs;
+         * results that outlive it (Expression::Eval, columns, group keys) are
+         * converted to owned strings with Owned().
+         */
+        static Value Borrow(const std::string_view s) {
+            Value value;
+            value.type = STRING;
+            value.borrowed = true;
+            value.view = s;
+            return value;
+        }
+
+        /**
+         * @brief This value with a borrowed string copied into owned storage
+         */
+        Value Owned() const {
+            if (!borrowed) return *this;
+            return Value(std::string(view));
+        }
+
         // Type checking
         bool isNumber() const { return type == NUMBER; }
         bool isBoolean() const { return type == BOOLEAN; }
         bool isString() const { return type == STRING; }
+        bool isNull() const { return type == NIL; }
+        bool isBorrowed() const { return borrowed; }
+
+        /**
+         * @brief The characters of a string value, owned or borrowed, without copying
+         * @throws ExprException If the value is not a string
+         */
+        std::string_view asStringView() const {
+            if (!isString()) throw ExprException("Type error: expected string");
+            return borrowed ? view : std::string_view(stringValue);
+        }
 
         // Safe value extraction
         double asNumber() const {
             if (isNumber()) return data.number;
             if (isString()) {
                 // Try to convert string to number
+                const std::string text(asStringView());
                 try {
                     size_t pos;
-                    double result = std::stod(stringValue, &pos);
+                    double result = std::stod(text, &pos);
                     // Check if entire string was consumed
-                    if (pos == stringValue.length()) return result;
+                    if (pos == text.length()) return result;
                 } catch (...) {
                     // Fall through to throw exception
                 }
-                throw ExprException("Cannot convert string '" + stringValue + "' to number");
+                throw ExprException("Cannot convert string '" + text + "' to number");
             }
             if (isBoolean()) return data.boolean ? 1.0 : 0.0;
+            if (isNull()) throw ExprException("Type error: value is null");
             throw ExprException("Type error: expected number");
         }
 
+        // Null is treated as false, so a null condition takes the false branch
         bool asBoolean() const {
             if (isBoolean()) return data.boolean;
             if (isNumber()) return data.number != 0.0;
+            if (isNull()) return false;
             if (isString()) {
                 // Convert string to boolean with more intuitive rules
-                if (stringValue.empty()) return false;
+                const std::string_view text = asStringView();
+                if (text.empty()) return false;
                 
                 // Check for explicit false values (case-insensitive)
-                if (stringValue == "false" || stringValue == "False" || stringValue == "FALSE" ||
-                    stringValue == "no" || stringValue == "No" || stringValue == "NO" ||
-                    stringValue == "0") {
+                if (text == "false" || text == "False" || text == "FALSE" ||
+                    text == "no" || text == "No" || text == "NO" ||
+                    text == "0") {
                     return false;
                 }
                 
@@ -183,9 +612,10 @@ namespace ExpressionKit {
         }
         
         std::string asString() const {
-            if (isString()) return stringValue;
+            if (isString()) return std::string(asStringView());
             if (isNumber()) return std::to_string(data.number);
             if (isBoolean()) return data.boolean ? "true" : "false";
+            if (isNull()) return "null";
             throw ExprException("Type error: expected string");
         }
 
@@ -199,7 +629,8 @@ namespace ExpressionKit {
             if (type == other.type) {
                 if (isNumber()) return data.number == other.data.number;
                 if (isBoolean()) return data.boolean == other.data.boolean;
-                if (isString()) return stringValue == other.stringValue;
+                if (isString()) return asStringView() == other.asStringView();
+                if (isNull()) return true;
             }
             return false;
         }
@@ -244,745 +675,7760 @@ namespace ExpressionKit {
     };
 
     /**
-     * @brief Abstract base class for all AST (Abstract Syntax Tree) nodes
-     *
-     * This is the foundation of the expression evaluation system. Every element
-     * in an expression (numbers, variables, operators, functions) is represented
-     * as an AST node that can be evaluated against an environment.
+     * @brief A closed numeric range [lower, upper] used by interval analysis
      *
-     * @note This is an internal implementation detail. Users typically work
-     *       with compiled expressions through the ExpressionKit interface.
+     * Infinite bounds mean the range is unknown on that side.
      */
-    class ASTNode {
-    public:
-        virtual ~ASTNode() = default;
+    struct Interval {
+        double lower = -std::numeric_limits<double>::infinity();
+        double upper = std::numeric_limits<double>::infinity();
 
-        /**
-         * @brief Evaluate this node and return its value
-         * @param environment Environment for variable and function resolution (can be null for constants)
-         * @return The computed value of this node
-         * @throws ExprException If evaluation fails
-         */
-        virtual Value evaluate(IEnvironment* environment) const = 0;
+        Interval() = default;
+        Interval(const double lo, const double hi) : lower(lo), upper(hi) {}
+        static Interval Point(const double v) { return Interval(v, v); }
+
+        bool isBounded() const { return std::isfinite(lower) && std::isfinite(upper); }
+        bool contains(const double v) const { return v >= lower && v <= upper; }
     };
 
+    using IntervalMap = std::unordered_map<std::string, Interval>;
+
     /**
-     * @brief AST node representing a numeric literal
+     * @brief A typed, immutable column of values used by batch evaluation
      *
-     * This node holds a constant numeric value and returns it during evaluation.
-     * Examples: 42, 3.14, -2.5
+     * Columns are cheap to copy: the data is shared and only released when the
+     * last copy goes away. A constant column stores a single value that applies
+     * to every row, which lets literals and row-invariant variables participate
+     * in batch kernels without being broadcast.
+     *
+     * A column may carry an Arrow-style validity bitmap marking null rows; at()
+     * returns null for them. Typed kernels compute over the stored values and
+     * combine the bitmaps 64 rows at a time.
+     *
+     * DICTIONARY columns hold strings as integer codes into a shared dictionary,
+     * which suits low-cardinality fields. Kernels that see one can evaluate an
+     * operation once per dictionary entry and then map codes per row.
      */
-    class NumberNode final : public ASTNode {
-        double value;
+    class Column {
     public:
-        explicit NumberNode(const double v) : value(v) {}
-        Value evaluate(IEnvironment*) const override {
-            return Value(value);
+        enum class Kind { NUMBER, BOOLEAN, STRING, VALUE, DICTIONARY };
+
+    private:
+        Kind kind = Kind::NUMBER;
+        size_t rows = 0;
+        bool constant = false;
+        const double* numbers = nullptr;
+        const uint8_t* booleans = nullptr;
+        const std::string* strings = nullptr;
+        const Value* values = nullptr;
+        const uint32_t* codes = nullptr;
+        const uint64_t* bitWords = nullptr;
+        size_t bitOffset = 0;
+        const uint8_t* validity = nullptr;
+        size_t validityOffset = 0;
+        std::shared_ptr<const void> storage;
+        std::shared_ptr<const void> validityStorage;
+        std::shared_ptr<const std::vector<std::string>> dictionary;
+
+        template <typename T>
+        static std::shared_ptr<const std::vector<T>> share(std::vector<T> data) {
+            return std::make_shared<const std::vector<T>>(std::move(data));
         }
-    };
 
-    /**
-     * @brief AST node representing a boolean literal
-     *
-     * This node holds a constant boolean value and returns it during evaluation.
-     * Examples: true, false
-     */
-    class BooleanNode final : public ASTNode {
-        bool value;
+        size_t index(const size_t row) const { return constant ? 0 : row; }
+
     public:
-        explicit BooleanNode(const bool v) : value(v) {}
-        Value evaluate(IEnvironment*) const override {
-            return Value(value);
+        Column() = default;
+
+        static Column Numbers(std::vector<double> data) {
+            Column column;
+            auto shared = share(std::move(data));
+            column.kind = Kind::NUMBER;
+            column.rows = shared->size();
+            column.numbers = shared->data();
+            column.storage = shared;
+            return column;
         }
-    };
 
-    /**
-     * @brief AST node representing a string literal
-     *
-     * This node holds a constant string value and returns it during evaluation.
-     * Examples: "hello", "world", "Hello, \"World\"!"
-     */
-    class StringNode final : public ASTNode {
-        std::string value;
-    public:
-        explicit StringNode(const std::string& v) : value(v) {}
-        Value evaluate(IEnvironment*) const override {
-            return Value(value);
+        /**
+         * @brief Wrap numeric data owned elsewhere without copying it
+         * @param owner Keeps the data alive; when null the caller must outlive the column
+         */
+        static Column Borrow(const double* data, const size_t rowCount, std::shared_ptr<const void> owner = nullptr) {
+            Column column;
+            column.kind = Kind::NUMBER;
+            column.rows = rowCount;
+            column.numbers = data;
+            column.storage = std::move(owner);
+            return column;
         }
-    };
 
-    /**
-     * @brief AST node representing a variable reference
-     *
-     * This node stores a variable name and delegates to the IEnvironment during
-     * evaluation to resolve the variable's current value.
-     * Examples: x, pos.x, player_health
-     */
-    class VariableNode final : public ASTNode {
-        std::string name;
-    public:
-        explicit VariableNode(const std::string& n) : name(n) {}
-        Value evaluate(IEnvironment* environment) const override {
-            if (!environment) throw ExprException("Variable access requires IEnvironment");
-            return environment->Get(name);
+        static Column Booleans(std::vector<uint8_t> data) {
+            Column column;
+            auto shared = share(std::move(data));
+            column.kind = Kind::BOOLEAN;
+            column.rows = shared->size();
+            column.booleans = shared->data();
+            column.storage = shared;
+            return column;
         }
-    };
 
-    /**
-     * @brief Call standard mathematical functions
-     * 
-     * This function handles built-in mathematical functions:
-     * - min(a, b): Returns the smaller of two numbers
-     * - max(a, b): Returns the larger of two numbers
-     * - sqrt(x): Returns the square root of x
-     * - sin(x): Returns the sine of x (in radians)
-     * - cos(x): Returns the cosine of x (in radians)
-     * - tan(x): Returns the tangent of x (in radians)
-     * - abs(x): Returns the absolute value of x
-     * - pow(x, y): Returns x raised to the power of y
-     * - log(x): Returns the natural logarithm of x
-     * - exp(x): Returns e raised to the power of x
-     * - floor(x): Returns the largest integer less than or equal to x
-     * - ceil(x): Returns the smallest integer greater than or equal to x
-     * - round(x): Returns x rounded to the nearest integer
-     */
-    inline bool CallStandardFunctions(const std::string& functionName,
-                              const std::vector<Value>& args,
-                              Value& outResult) {
-        try {
-            // Two-argument functions
-            if (functionName == "min" && args.size() == 2) {
-                if (!args[0].isNumber() || !args[1].isNumber()) return false;
-                outResult = Value(std::min(args[0].asNumber(), args[1].asNumber()));
-                return true;
-            }
-            if (functionName == "max" && args.size() == 2) {
-                if (!args[0].isNumber() || !args[1].isNumber()) return false;
-                outResult = Value(std::max(args[0].asNumber(), args[1].asNumber()));
-                return true;
-            }
-            if (functionName == "pow" && args.size() == 2) {
-                if (!args[0].isNumber() || !args[1].isNumber()) return false;
-                outResult = Value(std::pow(args[0].asNumber(), args[1].asNumber()));
-                return true;
+        /**
+         * @brief Build a bit-packed boolean column: row i is bit i % 64 of words[i / 64]
+         */
+        static Column Bits(std::vector<uint64_t> words, const size_t rowCount) {
+            if (words.size() * 64 < rowCount) throw ExprException("Bit-packed column is too short");
+            Column column;
+            auto shared = share(std::move(words));
+            column.kind = Kind::BOOLEAN;
+            column.rows = rowCount;
+            column.bitWords = shared->data();
+            column.storage = shared;
+            return column;
+        }
+
+        static Column Strings(std::vector<std::string> data) {
+            Column column;
+            auto shared = share(std::move(data));
+            column.kind = Kind::STRING;
+            column.rows = shared->size();
+            column.strings = shared->data();
+            column.storage = shared;
+            return column;
+        }
+
+        /**
+         * @brief Build a dictionary-encoded string column
+         * @param data Per-row indices into the dictionary
+         * @param entries Distinct strings; may be shared between columns
+         * @throws ExprException if a code is outside the dictionary
+         */
+        static Column Dictionary(std::vector<uint32_t> data, std::shared_ptr<const std::vector<std::string>> entries) {
+            if (!entries) throw ExprException("Dictionary column requires a dictionary");
+            for (const uint32_t code : data) {
+                if (code >= entries->size()) throw ExprException("Dictionary code out of range");
             }
+            Column column;
+            auto shared = share(std::move(data));
+            column.kind = Kind::DICTIONARY;
+            column.rows = shared->size();
+            column.codes = shared->data();
+            column.storage = shared;
+            column.dictionary = std::move(entries);
+            return column;
+        }
 
-            // Single-argument functions
-            if (args.size() == 1 && args[0].isNumber()) {
-                double x = args[0].asNumber();
+        static Column Dictionary(std::vector<uint32_t> data, std::vector<std::string> entries) {
+            return Dictionary(std::move(data), share(std::move(entries)));
+        }
 
-                if (functionName == "sqrt") {
-                    if (x < 0) return false; // Domain error
-                    outResult = Value(std::sqrt(x));
+        /**
+         * @brief Dictionary-encode plain strings, assigning codes in order of first appearance
+         */
+        static Column Encode(const std::vector<std::string>& data) {
+            std::unordered_map<std::string, uint32_t> lookup;
+            std::vector<std::string> entries;
+            std::vector<uint32_t> out(data.size());
+            for (size_t i = 0; i < data.size(); ++i) {
+                const auto inserted = lookup.emplace(data[i], static_cast<uint32_t>(entries.size()));
+                if (inserted.second) entries.push_back(data[i]);
+                out[i] = inserted.first->second;
+            }
+            return Dictionary(std::move(out), std::move(entries));
+        }
+
+        /**
+         * @brief Build a column from boxed values, choosing the narrowest kind that fits
+         */
+        static Column Values(std::vector<Value> data) {
+            // Nulls do not break uniformity; they become a validity bitmap on the typed column
+            auto type = Value::NIL;
+            bool uniform = true;
+            size_t nulls = 0;
+            for (const auto& value : data) {
+                if (value.isNull()) {
+                    ++nulls;
+                } else if (type == Value::NIL) {
+                    type = value.type;
+                } else if (value.type != type) {
+                    uniform = false;
+                    break;
+                }
+            }
+            if (uniform && type != Value::NIL) {
+                Column column;
+                if (type == Value::NUMBER) {
+                    std::vector<double> out(data.size(), 0.0);
+                    for (size_t i = 0; i < data.size(); ++i) if (!data[i].isNull()) out[i] = data[i].data.number;
+                    column = Numbers(std::move(out));
+                } else if (type == Value::BOOLEAN) {
+                    std::vector<uint8_t> out(data.size(), 0);
+                    for (size_t i = 0; i < data.size(); ++i) if (!data[i].isNull()) out[i] = data[i].data.boolean ? 1 : 0;
+                    column = Booleans(std::move(out));
+                } else {
+                    std::vector<std::string> out(data.size());
+                    for (size_t i = 0; i < data.size(); ++i) {
+                        if (data[i].isBorrowed()) out[i] = std::string(data[i].view);
+                        else out[i] = std::move(data[i].stringValue);
+                    }
+                    column = Strings(std::move(out));
+                }
+                if (nulls == 0) return column;
+                auto bits = std::make_shared<std::vector<uint8_t>>((data.size() + 7) / 8, 0);
+                for (size_t i = 0; i < data.size(); ++i) {
+                    if (!data[i].isNull()) (*bits)[i >> 3] |= static_cast<uint8_t>(1u << (i & 7));
+                }
+                return column.withValidity(bits->data(), 0, bits);
+            }
+            // Boxed columns outlive the evaluation, so they own their strings
+            for (auto& value : data) {
+                if (value.isBorrowed()) value = value.Owned();
+            }
+            Column column;
+            auto shared = share(std::move(data));
+            column.kind = Kind::VALUE;
+            column.rows = shared->size();
+            column.values = shared->data();
+            column.storage = shared;
+            return column;
+        }
+
+        /**
+         * @brief Build a column holding the same value in every row
+         */
+        static Column Constant(const Value& value, const size_t rowCount) {
+            Column column = Values(std::vector<Value>{value});
+            column.rows = rowCount;
+            column.constant = true;
+            return column;
+        }
+
+        Kind getKind() const { return kind; }
+        size_t size() const { return rows; }
+        bool isConstant() const { return constant; }
+        // False for Borrow() without an owner: the data may not outlive the caller's buffer
+        bool ownsData() const { return storage != nullptr; }
+
+        // Typed access; the caller is responsible for checking getKind() first
+        double numberAt(const size_t row) const { return numbers[index(row)]; }
+        bool booleanAt(const size_t row) const {
+            const size_t i = index(row);
+            if (!bitWords) return booleans[i] != 0;
+            return ((bitWords[(bitOffset + i) >> 6] >> ((bitOffset + i) & 63)) & 1) != 0;
+        }
+        const std::string& stringAt(const size_t row) const {
+            return kind == Kind::DICTIONARY ? (*dictionary)[codes[index(row)]] : strings[index(row)];
+        }
+        uint32_t codeAt(const size_t row) const { return codes[index(row)]; }
+
+        /**
+         * @brief Raw numeric data (one element for constant columns)
+         */
+        const double* numberData() const { return numbers; }
+        // Byte-per-row booleans; null for bit-packed columns, which are read with booleanWord()
+        const uint8_t* booleanData() const { return booleans; }
+        bool isBitPacked() const { return bitWords != nullptr; }
+
+        /**
+         * @brief Rows [64 * word, 64 * word + 64) of a boolean column as one mask (bit i is row 64 * word + i)
+         *
+         * Bits past the last row are unspecified.
+         */
+        uint64_t booleanWord(const size_t word) const {
+            if (constant) return booleanAt(0) ? ~uint64_t(0) : 0;
+            const size_t count = std::min<size_t>(64, rows - word * 64);
+            if (bitWords) {
+                const size_t first = bitOffset + word * 64;
+                const size_t shift = first & 63;
+                const uint64_t* source = bitWords + (first >> 6);
+                if (shift == 0) return source[0];
+                uint64_t bits = source[0] >> shift;
+                if (count > 64 - shift) bits |= source[1] << (64 - shift);
+                return bits;
+            }
+            const uint8_t* data = booleans + word * 64;
+            uint64_t bits = 0;
+            for (size_t i = 0; i < count; ++i) bits |= static_cast<uint64_t>(data[i] & 1) << i;
+            return bits;
+        }
+        const uint32_t* codeData() const { return codes; }
+
+        /**
+         * @brief Attach a validity bitmap in the Arrow layout (LSB first, set bit = valid)
+         * @param bits Bitmap, or null to mark every row valid
+         * @param bitOffset Bit position of row 0
+         * @param owner Keeps the bitmap alive; when null the caller must outlive the column
+         */
+        Column withValidity(const uint8_t* bits, const size_t bitOffset = 0, std::shared_ptr<const void> owner = nullptr) const {
+            Column column = *this;
+            column.validity = bits;
+            column.validityOffset = bitOffset;
+            column.validityStorage = std::move(owner);
+            return column;
+        }
+
+        bool hasValidity() const { return validity != nullptr; }
+        bool isValid(const size_t row) const {
+            if (!validity) return true;
+            const size_t bit = validityOffset + index(row);
+            return ((validity[bit >> 3] >> (bit & 7)) & 1) != 0;
+        }
+        const uint8_t* validityData() const { return validity; }
+        size_t getValidityOffset() const { return validityOffset; }
+
+        /**
+         * @brief Validity of rows [64 * word, 64 * word + 64) as one mask (bit i is row 64 * word + i)
+         *
+         * Bits past the last row are unspecified.
+         */
+        uint64_t validityWord(const size_t word) const {
+            if (!validity) return ~uint64_t(0);
+            if (constant) return isValid(0) ? ~uint64_t(0) : 0;
+            const size_t first = validityOffset + word * 64;
+            const size_t shift = first & 7;
+            const uint8_t* bytes = validity + (first >> 3);
+            const size_t needed = (std::min<size_t>(rows - word * 64, 64) + shift + 7) / 8;
+            uint64_t bits = 0;
+            for (size_t k = 0; k < std::min<size_t>(needed, 8); ++k) bits |= static_cast<uint64_t>(bytes[k]) << (8 * k);
+            bits >>= shift;
+            if (shift != 0 && needed > 8) bits |= static_cast<uint64_t>(bytes[8]) << (64 - shift);
+            return bits;
+        }
+
+        /**
+         * @brief Attach the combined validity of the given columns: a row is valid only if valid in all of them
+         */
+        Column withValidityOf(const std::vector<const Column*>& sources) const {
+            const Column* single = nullptr;
+            size_t count = 0;
+            for (const Column* source : sources) {
+                if (source->hasValidity()) {
+                    single = source;
+                    ++count;
+                }
+            }
+            if (count == 0) return *this;
+            if (count == 1 && !single->constant) {
+                return withValidity(single->validity, single->validityOffset, single->validityStorage);
+            }
+            const size_t words = (rows + 63) / 64;
+            auto bits = std::make_shared<std::vector<uint8_t>>(words * 8);
+            for (size_t w = 0; w < words; ++w) {
+                uint64_t word = ~uint64_t(0);
+                for (const Column* source : sources) word &= source->validityWord(w);
+                for (size_t k = 0; k < 8; ++k) (*bits)[w * 8 + k] = static_cast<uint8_t>(word >> (8 * k));
+            }
+            return withValidity(bits->data(), 0, bits);
+        }
+
+        /**
+         * @brief The dictionary of a DICTIONARY column (null for other kinds)
+         */
+        const std::shared_ptr<const std::vector<std::string>>& getDictionary() const { return dictionary; }
+
+        /**
+         * @brief Box the value of a single row
+         */
+        Value at(const size_t row) const {
+            if (!isValid(row)) return Value::Null();
+            const size_t i = index(row);
+            switch (kind) {
+                case Kind::NUMBER: return Value(numbers[i]);
+                case Kind::BOOLEAN: return Value(booleanAt(row));
+                case Kind::STRING: return Value(strings[i]);
+                case Kind::VALUE: return values[i];
+                case Kind::DICTIONARY: return Value((*dictionary)[codes[i]]);
+            }
+            return Value();
+        }
+
+        /**
+         * @brief Join columns end to end, keeping the typed representation when all parts agree
+         */
+        static Column Concat(const std::vector<Column>& parts) {
+            if (parts.size() == 1 && !parts[0].isConstant()) return parts[0];
+            size_t total = 0;
+            bool numbers = true;
+            for (const auto& part : parts) {
+                total += part.size();
+                numbers = numbers && part.getKind() == Kind::NUMBER && !part.hasValidity();
+            }
+            if (numbers) {
+                std::vector<double> out;
+                out.reserve(total);
+                for (const auto& part : parts) {
+                    for (size_t i = 0; i < part.size(); ++i) out.push_back(part.numberAt(i));
+                }
+                return Numbers(std::move(out));
+            }
+            std::vector<Value> out;
+            out.reserve(total);
+            for (const auto& part : parts) {
+                for (size_t i = 0; i < part.size(); ++i) out.push_back(part.at(i));
+            }
+            return Values(std::move(out));
+        }
+
+        /**
+         * @brief A view of rows [offset, offset + count) sharing this column's data
+         */
+        Column slice(const size_t offset, const size_t count) const {
+            if (offset + count > rows) throw ExprException("Column slice out of range");
+            Column column = *this;
+            column.rows = count;
+            if (constant) return column;
+            if (numbers) column.numbers += offset;
+            if (booleans) column.booleans += offset;
+            if (strings) column.strings += offset;
+            if (values) column.values += offset;
+            if (codes) column.codes += offset;
+            if (bitWords) column.bitOffset += offset;
+            if (validity) column.validityOffset += offset;
+            return column;
+        }
+    };
+
+    /**
+     * @brief A set of named, equally sized columns evaluated together
+     *
+     * Batch evaluation resolves variables against these columns first and falls
+     * back to the IEnvironment for names the batch does not contain.
+     */
+    class Batch {
+        size_t rows;
+        std::vector<std::pair<std::string, Column>> columns;
+
+    public:
+        explicit Batch(const size_t rowCount = 0) : rows(rowCount) {}
+
+        /**
+         * @brief Add (or replace) a named column
+         * @throws ExprException if the column length does not match the batch
+         */
+        Batch& Add(const std::string& name, Column column) {
+            if (column.size() != rows) throw ExprException("Column '" + name + "' has wrong number of rows");
+            for (auto& entry : columns) {
+                if (entry.first == name) {
+                    entry.second = std::move(column);
+                    return *this;
+                }
+            }
+            columns.emplace_back(name, std::move(column));
+            return *this;
+        }
+
+        const Column* Find(const std::string& name) const {
+            for (const auto& entry : columns) {
+                if (entry.first == name) return &entry.second;
+            }
+            return nullptr;
+        }
+
+        size_t size() const { return rows; }
+        const std::vector<std::pair<std::string, Column>>& getColumns() const { return columns; }
+
+        /**
+         * @brief Minimum and maximum of every numeric column
+         *
+         * Columns containing NaN are left out, since they have no meaningful range.
+         */
+        IntervalMap ComputeRanges() const {
+            IntervalMap ranges;
+            for (const auto& entry : columns) {
+                const Column& column = entry.second;
+                if (column.getKind() != Column::Kind::NUMBER || rows == 0) continue;
+                const double* data = column.numberData();
+                const size_t n = column.isConstant() ? 1 : rows;
+                Interval range(std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity());
+                bool valid = true;
+                for (size_t i = 0; i < n; ++i) {
+                    if (!column.isValid(i)) continue;
+                    if (std::isnan(data[i])) { valid = false; break; }
+                    range.lower = std::min(range.lower, data[i]);
+                    range.upper = std::max(range.upper, data[i]);
+                }
+                if (valid && range.lower <= range.upper) ranges[entry.first] = range;
+            }
+            return ranges;
+        }
+
+        /**
+         * @brief Copy the given rows (in order) into a new batch
+         * @param selection Row indices to copy
+         * @param names Columns to copy; all columns when null
+         */
+        Batch Select(const std::vector<size_t>& selection, const std::vector<std::string>* names = nullptr) const {
+            Batch result(selection.size());
+            for (const auto& entry : columns) {
+                if (names && std::find(names->begin(), names->end(), entry.first) == names->end()) continue;
+                const Column& column = entry.second;
+                if (column.isConstant()) {
+                    result.Add(entry.first, Column::Constant(column.at(0), selection.size()));
+                    continue;
+                }
+                Column selected;
+                switch (column.getKind()) {
+                    case Column::Kind::NUMBER: {
+                        std::vector<double> out(selection.size());
+                        for (size_t i = 0; i < selection.size(); ++i) out[i] = column.numberAt(selection[i]);
+                        selected = Column::Numbers(std::move(out));
+                        break;
+                    }
+                    case Column::Kind::BOOLEAN: {
+                        std::vector<uint8_t> out(selection.size());
+                        for (size_t i = 0; i < selection.size(); ++i) out[i] = column.booleanAt(selection[i]) ? 1 : 0;
+                        selected = Column::Booleans(std::move(out));
+                        break;
+                    }
+                    case Column::Kind::DICTIONARY: {
+                        std::vector<uint32_t> out(selection.size());
+                        for (size_t i = 0; i < selection.size(); ++i) out[i] = column.codeAt(selection[i]);
+                        selected = Column::Dictionary(std::move(out), column.getDictionary());
+                        break;
+                    }
+                    default: {
+                        std::vector<Value> out(selection.size());
+                        for (size_t i = 0; i < selection.size(); ++i) out[i] = column.at(selection[i]);
+                        selected = Column::Values(std::move(out));
+                        break;
+                    }
+                }
+                if (column.hasValidity()) {
+                    auto bits = std::make_shared<std::vector<uint8_t>>((selection.size() + 7) / 8, 0);
+                    for (size_t i = 0; i < selection.size(); ++i) {
+                        if (column.isValid(selection[i])) (*bits)[i >> 3] |= static_cast<uint8_t>(1u << (i & 7));
+                    }
+                    selected = selected.withValidity(bits->data(), 0, bits);
+                }
+                result.Add(entry.first, std::move(selected));
+            }
+            return result;
+        }
+    };
+
+    /**
+     * @brief IEnvironment exposing one row of a Batch
+     *
+     * Used by batch evaluation for nodes that have no columnar kernel. Names not
+     * present in the batch, and all function calls, go to the fallback environment.
+     */
+    class BatchRowEnvironment final : public IEnvironment {
+        const Batch& batch;
+        IEnvironment* fallback;
+        size_t row = 0;
+
+    public:
+        BatchRowEnvironment(const Batch& b, IEnvironment* environment) : batch(b), fallback(environment) {}
+
+        void SetRow(const size_t r) { row = r; }
+        size_t GetRow() const { return row; }
+
+        // String cells are borrowed from the column, which outlives the evaluation
+        Value Get(const std::string& name) override {
+            if (const Column* column = batch.Find(name)) {
+                const auto kind = column->getKind();
+                if ((kind == Column::Kind::STRING || kind == Column::Kind::DICTIONARY) && column->isValid(row)) {
+                    return Value::Borrow(column->stringAt(row));
+                }
+                return column->at(row);
+            }
+            if (!fallback) throw ExprException("Variable not defined: " + name);
+            return fallback->Get(name);
+        }
+
+        Value Call(const std::string& name, const std::vector<Value>& args) override {
+            if (!fallback) throw ExprException("Function call requires IEnvironment");
+            return fallback->Call(name, args);
+        }
+    };
+
+    /**
+     * @brief Abstract base class for all AST (Abstract Syntax Tree) nodes
+     *
+     * This is the foundation of the expression evaluation system. Every element
+     * in an expression (numbers, variables, operators, functions) is represented
+     * as an AST node that can be evaluated against an environment.
+     *
+     * @note This is an internal implementation detail. Users typically work
+     *       with compiled expressions through the ExpressionKit interface.
+     */
+    class ASTNode {
+    public:
+        virtual ~ASTNode() = default;
+
+        /**
+         * @brief Evaluate this node and return its value
+         * @param environment Environment for variable and function resolution (can be null for constants)
+         * @param context Optional budget and cancellation bookkeeping (null for unlimited evaluation)
+         * @return The computed value of this node
+         * @throws ExprException If evaluation fails
+         * @throws ExprAbortedException If the context's budget is exceeded or it is cancelled
+         */
+        virtual Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const = 0;
+
+        /**
+         * @brief Evaluate this node for every row of a batch
+         * @param evaluation The batch, row range, environment and context being evaluated
+         * @return A column with one value per row in the evaluation's range
+         * @throws ExprException If evaluation of any row fails
+         *
+         * The default implementation evaluates row by row through a BatchRowEnvironment.
+         * Nodes override this with columnar kernels where they can. Children should be
+         * evaluated through BatchEvaluation::Evaluate() rather than directly.
+         */
+        virtual Column evaluateBatch(BatchEvaluation& evaluation) const;
+
+        /**
+         * @brief Direct sub-expressions of this node, in evaluation order
+         *
+         * Used by analysis passes that only need to walk the tree.
+         */
+        virtual std::vector<ASTNodePtr> getChildren() const { return {}; }
+
+        /**
+         * @brief Copy of this node with its children replaced
+         * @param children New sub-expressions, in getChildren() order
+         * @return The new node, or null if this node type cannot be rebuilt
+         *
+         * Used by the passes that rewrite trees (cloning, subexpression merging,
+         * call binding). Nodes without children return a fresh copy of themselves.
+         */
+        virtual ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const {
+            (void)children;
+            return nullptr;
+        }
+
+        /**
+         * @brief Key for this node apart from its children
+         *
+         * Two nodes with equal keys and equal children always compute the same
+         * value, so they may be merged. An empty key (the default) marks a node
+         * that must never be merged with another one.
+         */
+        virtual std::string structuralKey() const { return {}; }
+    };
+
+    /**
+     * @brief Identity of an object, for the keys of nodes that hold shared state
+     */
+    inline std::string IdentityKey(const void* object) {
+        return std::to_string(reinterpret_cast<uintptr_t>(object));
+    }
+
+    /**
+     * @brief State of one batch evaluation over a row range of a Batch
+     *
+     * Created by Expression::EvaluateBatch(); nodes receive it in evaluateBatch()
+     * and use Evaluate() to compute their children.
+     */
+    class BatchEvaluation {
+        const Batch& batch;
+        IEnvironment* environment;
+        EvaluationContext* context;
+        size_t begin;
+        size_t count;
+        const std::unordered_set<const ASTNode*>* memoized = nullptr;
+        std::unordered_map<const ASTNode*, Column> memo;
+        EvaluationContext::ScratchMark scratchMark{};
+
+    public:
+        BatchEvaluation(const Batch& b, IEnvironment* env, EvaluationContext* ctx)
+            : BatchEvaluation(b, env, ctx, 0, b.size()) {}
+        BatchEvaluation(const Batch& b, IEnvironment* env, EvaluationContext* ctx, const size_t offset, const size_t rows)
+            : batch(b), environment(env), context(ctx), begin(offset), count(rows) {
+            if (offset + rows > b.size()) throw ExprException("Batch range out of bounds");
+            if (context) scratchMark = context->MarkScratch();
+        }
+
+        // Columns own their strings, so scratch used by this evaluation can be reused by the next one
+        ~BatchEvaluation() {
+            if (context) context->RewindScratch(scratchMark);
+        }
+
+        BatchEvaluation(const BatchEvaluation&) = delete;
+        BatchEvaluation& operator=(const BatchEvaluation&) = delete;
+
+        /**
+         * @brief Compute each of the given (shared) nodes at most once in this evaluation
+         * @param nodes Nodes to memoize; must outlive this evaluation
+         */
+        void SetMemoized(const std::unordered_set<const ASTNode*>* nodes) {
+            memoized = nodes;
+            memo.clear();
+        }
+
+        const Batch& getBatch() const { return batch; }
+        IEnvironment* getEnvironment() const { return environment; }
+        EvaluationContext* getContext() const { return context; }
+        size_t getBegin() const { return begin; }
+        size_t size() const { return count; }
+
+        /**
+         * @brief Evaluate a node over this range, counting one budget step per node
+         */
+        Column Evaluate(const ASTNode& node) {
+            if (memoized && memoized->count(&node)) {
+                const auto it = memo.find(&node);
+                if (it != memo.end()) return it->second;
+            }
+            EvaluationContext::Frame frame(context);
+            if (context) context->Check();
+            Column result = node.evaluateBatch(*this);
+            if (memoized && memoized->count(&node)) memo.emplace(&node, result);
+            return result;
+        }
+
+        Column Evaluate(const ASTNodePtr& node) { return Evaluate(*node); }
+
+        /**
+         * @brief Look up a batch column restricted to this range
+         * @return false if the batch has no column with this name
+         */
+        bool FindColumn(const std::string& name, Column& out) const {
+            const Column* column = batch.Find(name);
+            if (!column) return false;
+            out = column->slice(begin, count);
+            return true;
+        }
+    };
+
+    inline Column ASTNode::evaluateBatch(BatchEvaluation& evaluation) const {
+        BatchRowEnvironment rowEnvironment(evaluation.getBatch(), evaluation.getEnvironment());
+        EvaluationContext* context = evaluation.getContext();
+        const auto mark = context ? context->MarkScratch() : EvaluationContext::ScratchMark{};
+        std::vector<Value> results(evaluation.size());
+        for (size_t i = 0; i < results.size(); ++i) {
+            rowEnvironment.SetRow(evaluation.getBegin() + i);
+            results[i] = evaluate(&rowEnvironment, context).Owned();
+            // Each row's scratch is dead once its result is owned
+            if (context) context->RewindScratch(mark);
+        }
+        return Column::Values(std::move(results));
+    }
+
+    /**
+     * @brief AST node representing a numeric literal
+     *
+     * This node holds a constant numeric value and returns it during evaluation.
+     * Examples: 42, 3.14, -2.5
+     */
+    class NumberNode final : public ASTNode {
+        double value;
+    public:
+        explicit NumberNode(const double v) : value(v) {}
+        Value evaluate(IEnvironment*, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            return Value(value);
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            return Column::Constant(Value(value), evaluation.size());
+        }
+
+        double getValue() const { return value; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr>) const override { return std::make_shared<NumberNode>(value); }
+        std::string structuralKey() const override {
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            return "N" + std::to_string(bits);
+        }
+    };
+
+    /**
+     * @brief AST node representing a boolean literal
+     *
+     * This node holds a constant boolean value and returns it during evaluation.
+     * Examples: true, false
+     */
+    class BooleanNode final : public ASTNode {
+        bool value;
+    public:
+        explicit BooleanNode(const bool v) : value(v) {}
+        Value evaluate(IEnvironment*, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            return Value(value);
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            return Column::Constant(Value(value), evaluation.size());
+        }
+
+        bool getValue() const { return value; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr>) const override { return std::make_shared<BooleanNode>(value); }
+        std::string structuralKey() const override { return value ? "T" : "F"; }
+    };
+
+    /**
+     * @brief AST node representing the null literal
+     *
+     * Example: null
+     */
+    class NullNode final : public ASTNode {
+    public:
+        Value evaluate(IEnvironment*, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            return Value::Null();
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            return Column::Constant(Value::Null(), evaluation.size());
+        }
+
+        ASTNodePtr withChildren(std::vector<ASTNodePtr>) const override { return std::make_shared<NullNode>(); }
+        std::string structuralKey() const override { return "Z"; }
+    };
+
+    /**
+     * @brief AST node representing a string literal
+     *
+     * This node holds a constant string value and returns it during evaluation.
+     * Examples: "hello", "world", "Hello, \"World\"!"
+     */
+    class StringNode final : public ASTNode {
+        std::string value;
+    public:
+        explicit StringNode(const std::string& v) : value(v) {}
+        Value evaluate(IEnvironment*, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            return Value(value);
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            return Column::Constant(Value(value), evaluation.size());
+        }
+
+        const std::string& getValue() const { return value; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr>) const override { return std::make_shared<StringNode>(value); }
+        std::string structuralKey() const override { return "S" + std::to_string(value.size()) + ":" + value; }
+    };
+
+    /**
+     * @brief AST node representing a variable reference
+     *
+     * This node stores a variable name and delegates to the IEnvironment during
+     * evaluation to resolve the variable's current value.
+     * Examples: x, pos.x, player_health
+     */
+    class VariableNode final : public ASTNode {
+        std::string name;
+    public:
+        explicit VariableNode(const std::string& n) : name(n) {}
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            if (!environment) throw ExprException("Variable access requires IEnvironment");
+            return environment->Get(name);
+        }
+
+        // Variables missing from the batch are row-invariant and read once per batch
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            Column column;
+            if (evaluation.FindColumn(name, column)) return column;
+            return Column::Constant(evaluate(evaluation.getEnvironment(), evaluation.getContext()), evaluation.size());
+        }
+
+        const std::string& getName() const { return name; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr>) const override { return std::make_shared<VariableNode>(name); }
+        std::string structuralKey() const override { return "V" + name; }
+    };
+
+    /**
+     * @brief Call standard mathematical functions
+     * 
+     * This function handles built-in mathematical functions:
+     * - min(a, b): Returns the smaller of two numbers
+     * - max(a, b): Returns the larger of two numbers
+     * - sqrt(x): Returns the square root of x
+     * - sin(x): Returns the sine of x (in radians)
+     * - cos(x): Returns the cosine of x (in radians)
+     * - tan(x): Returns the tangent of x (in radians)
+     * - abs(x): Returns the absolute value of x
+     * - pow(x, y): Returns x raised to the power of y
+     * - log(x): Returns the natural logarithm of x
+     * - exp(x): Returns e raised to the power of x
+     * - floor(x): Returns the largest integer less than or equal to x
+     * - ceil(x): Returns the smallest integer greater than or equal to x
+     * - round(x): Returns x rounded to the nearest integer
+     * - isnull(x): Returns whether x is null
+     * - coalesce(a, b, ...): Returns the first argument that is not null
+     */
+    inline bool CallStandardFunctions(const std::string& functionName,
+                              const std::vector<Value>& args,
+                              Value& outResult) {
+        try {
+            // Null handling
+            if (functionName == "isnull" && args.size() == 1) {
+                outResult = Value(args[0].isNull());
+                return true;
+            }
+            if (functionName == "coalesce" && !args.empty()) {
+                outResult = Value::Null();
+                for (const auto& arg : args) {
+                    if (!arg.isNull()) {
+                        outResult = arg;
+                        break;
+                    }
+                }
+                return true;
+            }
+
+            // Two-argument functions
+            if (functionName == "min" && args.size() == 2) {
+                if (!args[0].isNumber() || !args[1].isNumber()) return false;
+                outResult = Value(std::min(args[0].asNumber(), args[1].asNumber()));
+                return true;
+            }
+            if (functionName == "max" && args.size() == 2) {
+                if (!args[0].isNumber() || !args[1].isNumber()) return false;
+                outResult = Value(std::max(args[0].asNumber(), args[1].asNumber()));
+                return true;
+            }
+            if (functionName == "pow" && args.size() == 2) {
+                if (!args[0].isNumber() || !args[1].isNumber()) return false;
+                outResult = Value(std::pow(args[0].asNumber(), args[1].asNumber()));
+                return true;
+            }
+
+            // Single-argument functions
+            if (args.size() == 1 && args[0].isNumber()) {
+                double x = args[0].asNumber();
+
+                if (functionName == "sqrt") {
+                    if (x < 0) return false; // Domain error
+                    outResult = Value(std::sqrt(x));
+                    return true;
+                }
+                if (functionName == "sin") {
+                    outResult = Value(std::sin(x));
+                    return true;
+                }
+                if (functionName == "cos") {
+                    outResult = Value(std::cos(x));
+                    return true;
+                }
+                if (functionName == "tan") {
+                    outResult = Value(std::tan(x));
+                    return true;
+                }
+                if (functionName == "abs") {
+                    outResult = Value(std::abs(x));
+                    return true;
+                }
+                if (functionName == "log") {
+                    if (x <= 0) return false; // Domain error
+                    outResult = Value(std::log(x));
+                    return true;
+                }
+                if (functionName == "exp") {
+                    outResult = Value(std::exp(x));
+                    return true;
+                }
+                if (functionName == "floor") {
+                    outResult = Value(std::floor(x));
+                    return true;
+                }
+                if (functionName == "ceil") {
+                    outResult = Value(std::ceil(x));
+                    return true;
+                }
+                if (functionName == "round") {
+                    outResult = Value(std::round(x));
+                    return true;
+                }
+            }
+
+            return false; // Function not found or invalid arguments
+        } catch (...) {
+            return false; // Error occurred
+        }
+    }
+
+    /**
+     * @brief Check whether a name and arity refer to one of the built-in standard functions
+     */
+    inline bool IsStandardFunction(const std::string& functionName, const size_t arity) {
+        if (arity == 2) return functionName == "min" || functionName == "max" || functionName == "pow";
+        if (arity != 1) return false;
+        static const char* const unary[] = {
+            "sqrt", "sin", "cos", "tan", "abs", "log", "exp", "floor", "ceil", "round"
+        };
+        for (const char* candidate : unary) {
+            if (functionName == candidate) return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief ASCII case-insensitive comparison and search
+     *
+     * Bytes are folded to lower case on the fly, 16 at a time with SSE2 where
+     * available; needles known in advance are folded once with Fold() and passed
+     * to the *Folded functions. Non-ASCII bytes compare exactly.
+     */
+    struct AsciiCase {
+        static char Fold(const char c) {
+            return (c >= 'A' && c <= 'Z') ? static_cast<char>(c | 0x20) : c;
+        }
+
+        static std::string Fold(const std::string_view s) {
+            std::string out(s.size(), '\0');
+            std::transform(s.begin(), s.end(), out.begin(), [](const char c) { return Fold(c); });
+            return out;
+        }
+
+        /**
+         * @brief Whether a and b are equal ignoring ASCII case
+         */
+        static bool Equals(const std::string_view a, const std::string_view b) {
+            if (a.size() != b.size()) return false;
+            size_t i = 0;
+#if EXPRESSIONKIT_HAS_SSE2
+            for (; i + 16 <= a.size(); i += 16) {
+                const __m128i x = fold16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a.data() + i)));
+                const __m128i y = fold16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b.data() + i)));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF) return false;
+            }
+#endif
+            for (; i < a.size(); ++i) {
+                if (Fold(a[i]) != Fold(b[i])) return false;
+            }
+            return true;
+        }
+
+        /**
+         * @brief Equals() against a needle already passed through Fold()
+         */
+        static bool EqualsFolded(const std::string_view s, const std::string_view folded) {
+            if (s.size() != folded.size()) return false;
+            size_t i = 0;
+#if EXPRESSIONKIT_HAS_SSE2
+            for (; i + 16 <= s.size(); i += 16) {
+                const __m128i x = fold16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + i)));
+                const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(folded.data() + i));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF) return false;
+            }
+#endif
+            for (; i < s.size(); ++i) {
+                if (Fold(s[i]) != folded[i]) return false;
+            }
+            return true;
+        }
+
+        /**
+         * @brief Whether haystack contains a needle already passed through Fold(), ignoring ASCII case
+         *
+         * Candidate positions are those where both the first and the last needle
+         * byte match, found 16 positions per step; each is then verified.
+         */
+        static bool ContainsFolded(const std::string_view haystack, const std::string_view folded) {
+            const size_t n = folded.size();
+            if (n == 0) return true;
+            if (n > haystack.size()) return false;
+            const size_t last = haystack.size() - n;  // Last candidate position
+            size_t i = 0;
+#if EXPRESSIONKIT_HAS_SSE2
+            const __m128i first = _mm_set1_epi8(folded[0]);
+            const __m128i lastByte = _mm_set1_epi8(folded[n - 1]);
+            for (; i + 16 <= last + 1; i += 16) {
+                const __m128i head = fold16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack.data() + i)));
+                const __m128i tail = fold16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack.data() + i + n - 1)));
+                auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, lastByte))));
+                while (mask) {
+                    const unsigned bit = static_cast<unsigned>(lowestBit(mask));
+                    if (EqualsFolded(haystack.substr(i + bit + 1, n - 1), folded.substr(1))) return true;
+                    mask &= mask - 1;
+                }
+            }
+#endif
+            for (; i <= last; ++i) {
+                if (Fold(haystack[i]) == folded[0] && EqualsFolded(haystack.substr(i, n), folded)) return true;
+            }
+            return false;
+        }
+
+    private:
+#if EXPRESSIONKIT_HAS_SSE2
+        // Set bit 0x20 in every byte between 'A' and 'Z' (bytes >= 0x80 compare as negative)
+        static __m128i fold16(const __m128i bytes) {
+            const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)),
+                                                _mm_cmplt_epi8(bytes, _mm_set1_epi8('Z' + 1)));
+            return _mm_or_si128(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+        }
+
+        static int lowestBit(const unsigned mask) {
+#if defined(__GNUC__) || defined(__clang__)
+            return __builtin_ctz(mask);
+#else
+            int bit = 0;
+            while (!(mask & (1u << bit))) ++bit;
+            return bit;
+#endif
+        }
+#endif
+    };
+
+    /**
+     * @brief Fast, seedable 64-bit hash that is stable across processes and platforms
+     *
+     * A wyhash-style function: input is read as little-endian words and mixed
+     * with 64x64->128-bit multiplies. Numbers hash their IEEE-754 bits (with -0
+     * and NaN canonicalized) exactly as Bytes() would hash them in little-endian
+     * order; booleans hash like 1 and 0. Not suitable for cryptographic use.
+     */
+    struct StableHash {
+        static uint64_t Bytes(const void* data, const size_t length, uint64_t seed = 0) {
+            const auto* p = static_cast<const uint8_t*>(data);
+            seed ^= mix(seed ^ SECRET[0], SECRET[1]);
+            uint64_t a = 0, b = 0;
+            if (length <= 16) {
+                if (length >= 4) {
+                    const size_t shift = (length >> 3) << 2;
+                    a = (read32(p) << 32) | read32(p + shift);
+                    b = (read32(p + length - 4) << 32) | read32(p + length - 4 - shift);
+                } else if (length > 0) {
+                    a = (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[length >> 1]) << 8) | p[length - 1];
+                }
+            } else {
+                size_t i = length;
+                if (i > 48) {
+                    uint64_t lane1 = seed, lane2 = seed;
+                    do {
+                        seed = mix(read64(p) ^ SECRET[1], read64(p + 8) ^ seed);
+                        lane1 = mix(read64(p + 16) ^ SECRET[2], read64(p + 24) ^ lane1);
+                        lane2 = mix(read64(p + 32) ^ SECRET[3], read64(p + 40) ^ lane2);
+                        p += 48;
+                        i -= 48;
+                    } while (i > 48);
+                    seed ^= lane1 ^ lane2;
+                }
+                while (i > 16) {
+                    seed = mix(read64(p) ^ SECRET[1], read64(p + 8) ^ seed);
+                    p += 16;
+                    i -= 16;
+                }
+                a = read64(p + i - 16);
+                b = read64(p + i - 8);
+            }
+            return finish(a, b, seed, length);
+        }
+
+        static uint64_t String(const std::string_view s, const uint64_t seed = 0) { return Bytes(s.data(), s.size(), seed); }
+
+        static uint64_t Number(double v, uint64_t seed = 0) {
+            if (v == 0.0) v = 0.0;
+            if (std::isnan(v)) v = std::numeric_limits<double>::quiet_NaN();
+            uint64_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            // The 8-byte case of Bytes() with the words already in register order
+            seed ^= mix(seed ^ SECRET[0], SECRET[1]);
+            return finish((bits << 32) | (bits >> 32), bits, seed, sizeof(bits));
+        }
+
+        /**
+         * @brief Hash a string, number or boolean
+         * @throws ExprException For null
+         */
+        static uint64_t Of(const Value& value, const uint64_t seed = 0) {
+            if (value.isNumber()) return Number(value.data.number, seed);
+            if (value.isBoolean()) return Number(value.data.boolean ? 1.0 : 0.0, seed);
+            if (value.isString()) return String(value.asStringView(), seed);
+            throw ExprException("Cannot hash null");
+        }
+
+        /**
+         * @brief Map a hash onto [0, buckets) without division, using its high bits
+         */
+        static uint64_t Bucket(const uint64_t hash, const uint64_t buckets) {
+            uint64_t low, high;
+            multiply(hash, buckets, low, high);
+            return high;
+        }
+
+    private:
+        static constexpr uint64_t SECRET[4] = {
+            0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+        };
+
+        static void multiply(const uint64_t a, const uint64_t b, uint64_t& low, uint64_t& high) {
+#if defined(__SIZEOF_INT128__)
+            const unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+            low = static_cast<uint64_t>(product);
+            high = static_cast<uint64_t>(product >> 64);
+#else
+            const uint64_t aHigh = a >> 32, aLow = static_cast<uint32_t>(a);
+            const uint64_t bHigh = b >> 32, bLow = static_cast<uint32_t>(b);
+            const uint64_t hh = aHigh * bHigh, hl = aHigh * bLow, lh = aLow * bHigh, ll = aLow * bLow;
+            const uint64_t middle = (ll >> 32) + static_cast<uint32_t>(hl) + static_cast<uint32_t>(lh);
+            low = (middle << 32) | static_cast<uint32_t>(ll);
+            high = hh + (hl >> 32) + (lh >> 32) + (middle >> 32);
+#endif
+        }
+
+        static uint64_t mix(const uint64_t a, const uint64_t b) {
+            uint64_t low, high;
+            multiply(a, b, low, high);
+            return low ^ high;
+        }
+
+        static uint64_t finish(uint64_t a, uint64_t b, const uint64_t seed, const size_t length) {
+            multiply(a ^ SECRET[1], b ^ seed, a, b);
+            return mix(a ^ SECRET[0] ^ length, b ^ SECRET[1]);
+        }
+
+        static uint64_t read64(const uint8_t* p) {
+            uint64_t v;
+            std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            v = __builtin_bswap64(v);
+#endif
+            return v;
+        }
+
+        static uint64_t read32(const uint8_t* p) {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            v = __builtin_bswap32(v);
+#endif
+            return v;
+        }
+    };
+
+    /**
+     * @brief Check whether a name and arity refer to hash64(value[, seed]) or bucket(value, n[, seed])
+     */
+    inline bool IsHashFunction(const std::string& functionName, const size_t arity) {
+        if (functionName == "hash64") return arity == 1 || arity == 2;
+        return functionName == "bucket" && (arity == 2 || arity == 3);
+    }
+
+    /**
+     * @brief Check whether a name and arity refer to one of the built-in string functions
+     */
+    inline bool IsStringFunction(const std::string& functionName, const size_t arity) {
+        if (arity == 1) {
+            return functionName == "len" || functionName == "lower" || functionName == "upper" || functionName == "trim";
+        }
+        if (arity == 2) {
+            return functionName == "starts_with" || functionName == "ends_with" || functionName == "substr" ||
+                   functionName == "ieq" || functionName == "icontains";
+        }
+        return arity == 3 && functionName == "substr";
+    }
+
+    /**
+     * @brief Call the built-in string functions
+     *
+     * - len(s): Returns the length of s in bytes
+     * - substr(s, start[, length]): Returns the bytes of s from start (0-based), clamped to the string
+     * - starts_with(s, prefix), ends_with(s, suffix): Return whether s begins or ends with the given string
+     * - lower(s), upper(s): Return s with ASCII letters converted
+     * - trim(s): Returns s without leading and trailing ASCII whitespace
+     * - ieq(a, b): Returns whether a equals b ignoring ASCII case
+     * - icontains(s, needle): Returns whether s contains needle ignoring ASCII case
+     *
+     * substr and trim return views into a borrowed argument instead of copies.
+     * With a context, lower and upper write into its scratch buffer and return a
+     * view of it, which stays valid until the context is reset. Callers that
+     * evaluate many rows with one context must Reset() it between rows (batch
+     * evaluation rewinds the scratch itself) or the buffer keeps growing.
+     *
+     * @return false if the name and arity are not a string function or an
+     *         argument has another type; such calls are left to the host
+     * @throws ExprException If substr gets a start or length that is not finite
+     */
+    inline bool CallStringFunctions(const std::string& functionName, const std::vector<Value>& args,
+                                    EvaluationContext* context, Value& outResult) {
+        if (!IsStringFunction(functionName, args.size()) || !args[0].isString()) return false;
+        const std::string_view s = args[0].asStringView();
+        // An owned argument dies with the caller's argument list, so only borrowed ones can be sliced
+        const auto slice = [&](const std::string_view part) {
+            return args[0].isBorrowed() ? Value::Borrow(part) : Value(std::string(part));
+        };
+
+        if (functionName == "len") {
+            outResult = Value(static_cast<double>(s.size()));
+        } else if (functionName == "trim") {
+            const auto space = [](const char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; };
+            size_t begin = 0, end = s.size();
+            while (begin < end && space(s[begin])) ++begin;
+            while (end > begin && space(s[end - 1])) --end;
+            outResult = slice(s.substr(begin, end - begin));
+        } else if (functionName == "substr") {
+            for (size_t a = 1; a < args.size(); ++a) {
+                if (!args[a].isNumber()) return false;
+                if (!std::isfinite(args[a].data.number)) throw ExprException("substr requires a finite start and length");
+            }
+            const double start = args[1].data.number;
+            const size_t begin = start <= 0 ? 0 : static_cast<size_t>(std::min(start, static_cast<double>(s.size())));
+            size_t count = s.size() - begin;
+            if (args.size() == 3) {
+                const double length = args[2].data.number;
+                count = length <= 0 ? 0 : static_cast<size_t>(std::min(length, static_cast<double>(count)));
+            }
+            outResult = slice(s.substr(begin, count));
+        } else if (functionName == "starts_with" || functionName == "ends_with") {
+            if (!args[1].isString()) return false;
+            const std::string_view affix = args[1].asStringView();
+            const size_t offset = functionName == "ends_with" ? s.size() - std::min(s.size(), affix.size()) : 0;
+            outResult = Value(s.size() >= affix.size() && std::memcmp(s.data() + offset, affix.data(), affix.size()) == 0);
+        } else if (functionName == "ieq" || functionName == "icontains") {
+            if (!args[1].isString()) return false;
+            const std::string_view other = args[1].asStringView();
+            outResult = Value(functionName == "ieq" ? AsciiCase::Equals(s, other)
+                                                    : AsciiCase::ContainsFolded(s, AsciiCase::Fold(other)));
+        } else {
+            const bool upper = functionName == "upper";
+            const auto convert = [upper](const char c) {
+                const auto u = static_cast<unsigned char>(c);
+                return static_cast<char>(upper ? std::toupper(u) : std::tolower(u));
+            };
+            if (context) {
+                context->ChargeString(s.size());
+                char* out = context->AllocateScratch(s.size());
+                std::transform(s.begin(), s.end(), out, convert);
+                outResult = Value::Borrow(std::string_view(out, s.size()));
+            } else {
+                std::string out(s.size(), '\0');
+                std::transform(s.begin(), s.end(), out.begin(), convert);
+                outResult = Value(std::move(out));
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Enumeration of all supported operators
+     *
+     * This enum defines all arithmetic, comparison, and logical operators
+     * supported by the expression system. Operators are grouped by category
+     * for easier understanding and implementation.
+     */
+    enum class OperatorType {
+        ADD, SUB, MUL, DIV,           // 算术运算符: +, -, *, /
+        EQ, NE, GT, LT, GE, LE,       // 比较运算符: ==, !=, >, <, >=, <=
+        IN,                           // 包含运算符: in
+        AND, OR, XOR, NOT,            // 逻辑运算符: &&, ||, xor, !
+        TERNARY                       // 三元运算符: ? :
+    };
+
+    /**
+     * @brief AST node representing binary operations (operations with two operands)
+     *
+     * This node handles all binary operators including arithmetic, comparison,
+     * and logical operations. It evaluates both operands and applies the
+     * specified operator according to type compatibility rules.
+     *
+     * Supported operations:
+     * - Arithmetic: 2 + 3, 5 * 4, 10 / 2, 7 - 1
+     * - Comparison: x == 5, age >= 18, score != 0
+     * - Logical: a && b, x || y, p xor q
+     */
+    class BinaryOpNode final : public ASTNode {
+        ASTNodePtr left, right;
+        OperatorType op;
+    public:
+        BinaryOpNode(ASTNodePtr l, const OperatorType o, ASTNodePtr r)
+            : left(std::move(l)), right(std::move(r)), op(o) {}
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            const Value lhs = left->evaluate(environment, context);
+            const Value rhs = right->evaluate(environment, context);
+            return Apply(op, lhs, rhs, context);
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            const Column lhs = evaluation.Evaluate(left);
+            const Column rhs = evaluation.Evaluate(right);
+            const size_t n = evaluation.size();
+            const bool constant = lhs.isConstant() && rhs.isConstant();
+            const size_t m = constant ? 1 : n;
+            const auto wrap = [&](Column column) {
+                column = column.withValidityOf({&lhs, &rhs});
+                return constant ? Column::Constant(column.at(0), n) : column;
+            };
+
+            // Numeric kernels
+            if (lhs.getKind() == Column::Kind::NUMBER && rhs.getKind() == Column::Kind::NUMBER) {
+                switch (op) {
+                    case OperatorType::ADD: return wrap(mapNumbers(lhs, rhs, m, [](double a, double b) { return a + b; }));
+                    case OperatorType::SUB: return wrap(mapNumbers(lhs, rhs, m, [](double a, double b) { return a - b; }));
+                    case OperatorType::MUL: return wrap(mapNumbers(lhs, rhs, m, [](double a, double b) { return a * b; }));
+                    case OperatorType::DIV: {
+                        // As in scalar evaluation, any row dividing a value by a zero fails
+                        const double* b = rhs.numberData();
+                        const size_t sb = rhs.isConstant() ? 0 : 1;
+                        if (!rhs.isConstant() || (b[0] == 0 && rhs.isValid(0))) {
+                            for (size_t i = 0; i < m; ++i) {
+                                if (b[i * sb] == 0 && rhs.isValid(i) && lhs.isValid(i)) throw ExprException("Division by zero");
+                            }
+                        }
+                        return wrap(mapNumbers(lhs, rhs, m, [](double x, double y) { return x / y; }));
+                    }
+                    case OperatorType::GT: return wrap(compareNumbers<OperatorType::GT>(lhs, rhs, m));
+                    case OperatorType::LT: return wrap(compareNumbers<OperatorType::LT>(lhs, rhs, m));
+                    case OperatorType::GE: return wrap(compareNumbers<OperatorType::GE>(lhs, rhs, m));
+                    case OperatorType::LE: return wrap(compareNumbers<OperatorType::LE>(lhs, rhs, m));
+                    case OperatorType::EQ: return wrap(compareNumbers<OperatorType::EQ>(lhs, rhs, m));
+                    case OperatorType::NE: return wrap(compareNumbers<OperatorType::NE>(lhs, rhs, m));
+                    default: break;
+                }
+            }
+
+            // Logical kernels over boolean columns
+            if (lhs.getKind() == Column::Kind::BOOLEAN && rhs.getKind() == Column::Kind::BOOLEAN) {
+                if ((lhs.hasValidity() || rhs.hasValidity()) && !constant &&
+                    (op == OperatorType::AND || op == OperatorType::OR)) {
+                    return mapThreeValued(lhs, rhs, n, op == OperatorType::OR);
+                }
+                switch (op) {
+                    case OperatorType::AND: return wrap(mapLogical(lhs, rhs, m, [](uint64_t a, uint64_t b) { return a & b; }));
+                    case OperatorType::OR: return wrap(mapLogical(lhs, rhs, m, [](uint64_t a, uint64_t b) { return a | b; }));
+                    case OperatorType::XOR:
+                    case OperatorType::NE: return wrap(mapLogical(lhs, rhs, m, [](uint64_t a, uint64_t b) { return a ^ b; }));
+                    case OperatorType::EQ: return wrap(mapLogical(lhs, rhs, m, [](uint64_t a, uint64_t b) { return ~(a ^ b); }));
+                    default: break;
+                }
+            }
+
+            // Comparisons of dictionary-encoded strings with a constant: once per entry, then by code
+            if (isComparison(op) && n > 0) {
+                if (lhs.getKind() == Column::Kind::DICTIONARY && !lhs.isConstant() && rhs.isConstant()) {
+                    return compareDictionary(lhs, rhs.at(0), false, evaluation.getContext());
+                }
+                if (rhs.getKind() == Column::Kind::DICTIONARY && !rhs.isConstant() && lhs.isConstant()) {
+                    return compareDictionary(rhs, lhs.at(0), true, evaluation.getContext());
+                }
+            }
+
+            // Everything else combines the child columns row by row with the scalar semantics
+            std::vector<Value> results(m);
+            for (size_t i = 0; i < m; ++i) {
+                results[i] = Apply(op, lhs.at(i), rhs.at(i), evaluation.getContext());
+            }
+            return constant ? Column::Constant(results[0], n) : Column::Values(std::move(results));
+        }
+
+        ASTNodePtr getLeft() const { return left; }
+        ASTNodePtr getRight() const { return right; }
+        OperatorType getOperator() const { return op; }
+        std::vector<ASTNodePtr> getChildren() const override { return {left, right}; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            return std::make_shared<BinaryOpNode>(std::move(children[0]), op, std::move(children[1]));
+        }
+        std::string structuralKey() const override { return "B" + std::to_string(static_cast<int>(op)); }
+
+        /**
+         * @brief Apply a binary operator to two already evaluated operands
+         */
+        static Value Apply(const OperatorType op, const Value& lhs, const Value& rhs, EvaluationContext* context = nullptr) {
+            // Null propagates, except where a known operand decides && (false) or || (true)
+            if (lhs.isNull() || rhs.isNull()) {
+                if (op == OperatorType::AND || op == OperatorType::OR) {
+                    const bool decisive = op == OperatorType::OR;
+                    if ((!lhs.isNull() && lhs.asBoolean() == decisive) || (!rhs.isNull() && rhs.asBoolean() == decisive)) {
+                        return Value(decisive);
+                    }
+                }
+                return Value::Null();
+            }
+
+            // Boolean logical operations - allow any types and convert to boolean
+            if (op == OperatorType::AND || op == OperatorType::OR || op == OperatorType::XOR) {
+                const bool a = lhs.asBoolean();
+                const bool b = rhs.asBoolean();
+                switch (op) {
+                    case OperatorType::AND: return Value(a && b);
+                    case OperatorType::OR: return Value(a || b);
+                    case OperatorType::XOR: return Value(a != b);
+                    default: break; // Should not reach here
+                }
+            }
+
+            // String operations
+            if (lhs.isString() || rhs.isString()) {
+                switch (op) {
+                    case OperatorType::ADD: {
+                        // 字符串连接：将两个操作数都转换为字符串
+                        std::string result = lhs.asString();
+                        const std::string tail = rhs.asString();
+                        if (context) context->ChargeString(result.size() + tail.size());
+                        result += tail;
+                        return Value(result);
+                    }
+                    case OperatorType::EQ: {
+                        // 字符串相等比较
+                        if (lhs.isString() && rhs.isString()) {
+                            return Value(lhs.asStringView() == rhs.asStringView());
+                        }
+                        // 类型不同时为不相等
+                        return Value(false);
+                    }
+                    case OperatorType::NE: {
+                        // 字符串不等比较
+                        if (lhs.isString() && rhs.isString()) {
+                            return Value(lhs.asStringView() != rhs.asStringView());
+                        }
+                        // 类型不同时为不相等
+                        return Value(true);
+                    }
+                    case OperatorType::GT:
+                    case OperatorType::LT:
+                    case OperatorType::GE:
+                    case OperatorType::LE: {
+                        // 字符串比较：两个操作数都必须是字符串
+                        if (lhs.isString() && rhs.isString()) {
+                            const std::string_view a = lhs.asStringView();
+                            const std::string_view b = rhs.asStringView();
+                            switch (op) {
+                                case OperatorType::GT: return Value(a > b);
+                                case OperatorType::LT: return Value(a < b);
+                                case OperatorType::GE: return Value(a >= b);
+                                case OperatorType::LE: return Value(a <= b);
+                                default: break;
+                            }
+                        }
+                        throw ExprException("String comparison operators require two string operands");
+                    }
+                    case OperatorType::IN: {
+                        // 字符串包含检查：检查左操作数是否包含在右操作数中
+                        if (lhs.isString() && rhs.isString()) {
+                            const std::string_view needle = lhs.asStringView();
+                            const std::string_view haystack = rhs.asStringView();
+                            return Value(haystack.find(needle) != std::string_view::npos);
+                        }
+                        throw ExprException("in operator requires two string operands");
+                    }
+                    default:
+                        throw ExprException("Unsupported string operator");
+                }
+            }
+
+            // 数值运算
+            if (lhs.isNumber() && rhs.isNumber()) {
+                const double a = lhs.asNumber();
+                const double b = rhs.asNumber();
+                switch (op) {
+                    case OperatorType::ADD: return Value(a + b);
+                    case OperatorType::SUB: return Value(a - b);
+                    case OperatorType::MUL: return Value(a * b);
+                    case OperatorType::DIV:
+                        if (b == 0) throw ExprException("Division by zero");
+                        return Value(a / b);
+                    case OperatorType::GT: return Value(a > b);
+                    case OperatorType::LT: return Value(a < b);
+                    case OperatorType::GE: return Value(a >= b);
+                    case OperatorType::LE: return Value(a <= b);
+                    case OperatorType::EQ: return Value(a == b);
+                    case OperatorType::NE: return Value(a != b);
+                    default:
+                        throw ExprException("Unsupported numeric operator");
+                }
+            }
+            // Strict boolean operations (equality/inequality) require both to be boolean
+            else if (lhs.isBoolean() && rhs.isBoolean()) {
+                const bool a = lhs.asBoolean();
+                const bool b = rhs.asBoolean();
+                switch (op) {
+                    case OperatorType::EQ: return Value(a == b);
+                    case OperatorType::NE: return Value(a != b);
+                    default:
+                        throw ExprException("Unsupported boolean operator");
+                }
+            }
+
+            throw ExprException("Unsupported operand types");
+        }
+
+    private:
+        template <typename F>
+        static Column mapNumbers(const Column& lhs, const Column& rhs, const size_t n, F f) {
+            std::vector<double> out(n);
+            const double* a = lhs.numberData();
+            const double* b = rhs.numberData();
+            if (lhs.isConstant()) {
+                const double x = a[0];
+                for (size_t i = 0; i < n; ++i) out[i] = f(x, b[i]);
+            } else if (rhs.isConstant()) {
+                const double y = b[0];
+                for (size_t i = 0; i < n; ++i) out[i] = f(a[i], y);
+            } else {
+                for (size_t i = 0; i < n; ++i) out[i] = f(a[i], b[i]);
+            }
+            return Column::Numbers(std::move(out));
+        }
+
+        template <OperatorType Op>
+        static bool compareScalar(const double a, const double b) {
+            if constexpr (Op == OperatorType::GT) return a > b;
+            else if constexpr (Op == OperatorType::LT) return a < b;
+            else if constexpr (Op == OperatorType::GE) return a >= b;
+            else if constexpr (Op == OperatorType::LE) return a <= b;
+            else if constexpr (Op == OperatorType::EQ) return a == b;
+            else return a != b;
+        }
+
+#if EXPRESSIONKIT_HAS_SSE2
+        template <OperatorType Op>
+        static __m128d compareVector(const __m128d a, const __m128d b) {
+            if constexpr (Op == OperatorType::GT) return _mm_cmpgt_pd(a, b);
+            else if constexpr (Op == OperatorType::LT) return _mm_cmplt_pd(a, b);
+            else if constexpr (Op == OperatorType::GE) return _mm_cmpge_pd(a, b);
+            else if constexpr (Op == OperatorType::LE) return _mm_cmple_pd(a, b);
+            else if constexpr (Op == OperatorType::EQ) return _mm_cmpeq_pd(a, b);
+            else return _mm_cmpneq_pd(a, b);
+        }
+#endif
+
+        /**
+         * Numeric comparison into a bit-packed column, 64 rows per output word. With
+         * SSE2 two rows are compared per instruction and gathered with movemask.
+         */
+        template <OperatorType Op>
+        static Column compareNumbers(const Column& lhs, const Column& rhs, const size_t n) {
+            const double* a = lhs.numberData();
+            const double* b = rhs.numberData();
+            const bool constantA = lhs.isConstant();
+            const bool constantB = rhs.isConstant();
+            std::vector<uint64_t> words((n + 63) / 64, 0);
+            for (size_t w = 0; w < words.size(); ++w) {
+                const size_t base = w * 64;
+                const size_t count = std::min<size_t>(64, n - base);
+                uint64_t bits = 0;
+                size_t i = 0;
+#if EXPRESSIONKIT_HAS_SSE2
+                const __m128d splatA = _mm_set1_pd(a[0]);
+                const __m128d splatB = _mm_set1_pd(b[0]);
+                for (; i + 2 <= count; i += 2) {
+                    const __m128d x = constantA ? splatA : _mm_loadu_pd(a + base + i);
+                    const __m128d y = constantB ? splatB : _mm_loadu_pd(b + base + i);
+                    bits |= static_cast<uint64_t>(_mm_movemask_pd(compareVector<Op>(x, y))) << i;
+                }
+#endif
+                for (; i < count; ++i) {
+                    const bool result = compareScalar<Op>(a[constantA ? 0 : base + i], b[constantB ? 0 : base + i]);
+                    bits |= static_cast<uint64_t>(result) << i;
+                }
+                words[w] = bits;
+            }
+            return Column::Bits(std::move(words), n);
+        }
+
+        // Word-wise logical operator over boolean columns, 64 rows per step
+        template <typename F>
+        static Column mapLogical(const Column& lhs, const Column& rhs, const size_t n, F f) {
+            std::vector<uint64_t> words((n + 63) / 64);
+            for (size_t w = 0; w < words.size(); ++w) words[w] = f(lhs.booleanWord(w), rhs.booleanWord(w));
+            return Column::Bits(std::move(words), n);
+        }
+
+        /**
+         * SQL && / || over nullable boolean columns, 64 rows per step: the result is
+         * known when both sides are, or when either side is the deciding value
+         * (false for &&, true for ||).
+         */
+        static Column mapThreeValued(const Column& lhs, const Column& rhs, const size_t n, const bool isOr) {
+            const size_t words = (n + 63) / 64;
+            std::vector<uint64_t> out(words);
+            auto bits = std::make_shared<std::vector<uint8_t>>(words * 8);
+            for (size_t w = 0; w < words; ++w) {
+                const uint64_t a = lhs.booleanWord(w), b = rhs.booleanWord(w);
+                const uint64_t va = lhs.validityWord(w), vb = rhs.validityWord(w);
+                uint64_t value, valid;
+                if (isOr) {
+                    valid = (va & vb) | (va & a) | (vb & b);
+                    value = ((va & a) | (vb & b));
+                } else {
+                    valid = (va & vb) | (va & ~a) | (vb & ~b);
+                    value = (a & b) & va & vb;
+                }
+                out[w] = value;
+                for (size_t k = 0; k < 8; ++k) (*bits)[w * 8 + k] = static_cast<uint8_t>(valid >> (8 * k));
+            }
+            return Column::Bits(std::move(out), n).withValidity(bits->data(), 0, bits);
+        }
+
+        static bool isComparison(const OperatorType op) {
+            switch (op) {
+                case OperatorType::EQ: case OperatorType::NE:
+                case OperatorType::GT: case OperatorType::LT:
+                case OperatorType::GE: case OperatorType::LE:
+                case OperatorType::IN:
                     return true;
+                default:
+                    return false;
+            }
+        }
+
+        Column compareDictionary(const Column& encoded, const Value& constant, const bool swapped,
+                                 EvaluationContext* context) const {
+            if (constant.isNull()) return Column::Constant(Value::Null(), encoded.size());
+            const auto& entries = *encoded.getDictionary();
+            std::vector<uint8_t> table(entries.size());
+            for (size_t code = 0; code < entries.size(); ++code) {
+                const Value entry(entries[code]);
+                table[code] = (swapped ? Apply(op, constant, entry, context) : Apply(op, entry, constant, context)).asBoolean() ? 1 : 0;
+            }
+            const uint32_t* data = encoded.codeData();
+            std::vector<uint8_t> out(encoded.size());
+            for (size_t i = 0; i < out.size(); ++i) out[i] = table[data[i]];
+            return Column::Booleans(std::move(out)).withValidityOf({&encoded});
+        }
+    };
+
+    /**
+     * @brief AST node representing unary operations (operations with one operand)
+     *
+     * This node handles unary operators that operate on a single value:
+     * - Logical NOT: !condition, not flag
+     * - Arithmetic negation: -number, -expression
+     *
+     * Examples: !true, -42, -(x + y), not visible
+     */
+    class UnaryOpNode final : public ASTNode {
+        ASTNodePtr operand;
+        OperatorType op;
+    public:
+        UnaryOpNode(const OperatorType o, ASTNodePtr operand)
+            : operand(std::move(operand)), op(o) {}
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            return Apply(op, operand->evaluate(environment, context));
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            const Column value = evaluation.Evaluate(operand);
+            const size_t n = value.isConstant() ? 1 : value.size();
+            Column result;
+            if (op == OperatorType::SUB && value.getKind() == Column::Kind::NUMBER) {
+                std::vector<double> out(n);
+                const double* a = value.numberData();
+                for (size_t i = 0; i < n; ++i) out[i] = -a[i];
+                result = Column::Numbers(std::move(out));
+            } else if (op == OperatorType::NOT && value.getKind() == Column::Kind::BOOLEAN) {
+                std::vector<uint64_t> words((n + 63) / 64);
+                for (size_t w = 0; w < words.size(); ++w) words[w] = ~value.booleanWord(w);
+                result = Column::Bits(std::move(words), n);
+            } else {
+                std::vector<Value> out(n);
+                for (size_t i = 0; i < n; ++i) out[i] = Apply(op, value.at(i));
+                return value.isConstant() ? Column::Constant(out[0], value.size()) : Column::Values(std::move(out));
+            }
+            return value.isConstant() ? Column::Constant(result.at(0), value.size()) : result.withValidityOf({&value});
+        }
+
+        ASTNodePtr getOperand() const { return operand; }
+        OperatorType getOperator() const { return op; }
+        std::vector<ASTNodePtr> getChildren() const override { return {operand}; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            return std::make_shared<UnaryOpNode>(op, std::move(children[0]));
+        }
+        std::string structuralKey() const override { return "U" + std::to_string(static_cast<int>(op)); }
+
+        /**
+         * @brief Apply a unary operator to an already evaluated operand
+         */
+        static Value Apply(const OperatorType op, const Value& val) {
+            switch (op) {
+                case OperatorType::NOT:
+                    // NOT operator can work with any type - convert to boolean first
+                    if (val.isNull()) return Value::Null();
+                    return Value(!val.asBoolean());
+                case OperatorType::SUB: // Negation
+                    if (val.isNull()) return Value::Null();
+                    if (!val.isNumber()) throw ExprException("Negation can only be used with numbers");
+                    return Value(-val.asNumber());
+                default:
+                    throw ExprException("Unsupported unary operator");
+            }
+        }
+    };
+
+    /**
+     * @brief AST node representing ternary operations (condition ? true_expr : false_expr)
+     *
+     * This node handles the ternary conditional operator (? :).
+     * The condition is evaluated using asBoolean() to support any value type.
+     *
+     * Example: 
+     * - condition ? value1 : value2
+     */
+    class TernaryOpNode final : public ASTNode {
+        ASTNodePtr condition;
+        ASTNodePtr trueExpr;
+        ASTNodePtr falseExpr;
+        OperatorType op;
+    public:
+        TernaryOpNode(ASTNodePtr cond, ASTNodePtr trueExpr, ASTNodePtr falseExpr, OperatorType op)
+            : condition(std::move(cond)), trueExpr(std::move(trueExpr)), falseExpr(std::move(falseExpr)), op(op) {}
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            switch (op) {
+                case OperatorType::TERNARY: {
+                    // Standard ternary: condition ? trueExpr : falseExpr
+                    const Value condValue = condition->evaluate(environment, context);
+                    if (condValue.asBoolean()) {
+                        return trueExpr->evaluate(environment, context);
+                    } else {
+                        return falseExpr->evaluate(environment, context);
+                    }
+                }
+                default:
+                    throw ExprException("Unsupported ternary operator");
+            }
+        }
+
+        // A constant condition selects one branch for the whole batch; otherwise only the
+        // taken branch is evaluated for each row, preserving the scalar short-circuit
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            if (op != OperatorType::TERNARY) return ASTNode::evaluateBatch(evaluation);
+            const Column condValue = evaluation.Evaluate(condition);
+            if (condValue.isConstant()) {
+                return evaluation.Evaluate(condValue.at(0).asBoolean() ? trueExpr : falseExpr);
+            }
+            BatchRowEnvironment rowEnvironment(evaluation.getBatch(), evaluation.getEnvironment());
+            std::vector<Value> results(evaluation.size());
+            for (size_t i = 0; i < results.size(); ++i) {
+                rowEnvironment.SetRow(evaluation.getBegin() + i);
+                const auto& branch = condValue.at(i).asBoolean() ? trueExpr : falseExpr;
+                results[i] = branch->evaluate(&rowEnvironment, evaluation.getContext());
+            }
+            return Column::Values(std::move(results));
+        }
+
+        ASTNodePtr getCondition() const { return condition; }
+        ASTNodePtr getTrueExpr() const { return trueExpr; }
+        ASTNodePtr getFalseExpr() const { return falseExpr; }
+        OperatorType getOperator() const { return op; }
+        std::vector<ASTNodePtr> getChildren() const override { return {condition, trueExpr, falseExpr}; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            return std::make_shared<TernaryOpNode>(std::move(children[0]), std::move(children[1]), std::move(children[2]), op);
+        }
+        std::string structuralKey() const override { return "?" + std::to_string(static_cast<int>(op)); }
+    };
+
+    /**
+     * @brief Call a host function through the environment
+     *
+     * Host calls may be slow, so the context's deadline and cancellation are
+     * polled on both sides of the call. Built-ins with their own node types also
+     * use this for arguments they do not take, just as the standard functions
+     * leave such calls to the host.
+     * @param unavailable Error message if there is no environment
+     * @throws ExprException If there is no environment
+     */
+    inline Value CallHostFunction(const std::string& name, const std::vector<Value>& args, IEnvironment* environment,
+                                  EvaluationContext* context, const char* unavailable = "Function call requires IEnvironment") {
+        if (!environment) throw ExprException(unavailable);
+        if (!context) return environment->Call(name, args);
+        context->Check();
+        Value result = environment->Call(name, args);
+        context->Check();
+        return result;
+    }
+
+    /**
+     * @brief AST node representing function calls
+     *
+     * This node stores a function name and a list of argument expressions.
+     * During evaluation, it evaluates all arguments and delegates to the
+     * IEnvironment to perform the actual function Call.
+     *
+     * Examples: max(a, b), sqrt(x), distance(x1, y1, x2, y2)
+     */
+    class FunctionCallNode final : public ASTNode {
+        std::string name;
+        std::vector<ASTNodePtr> args;
+    public:
+        FunctionCallNode(const std::string& n, std::vector<ASTNodePtr> a)
+            : name(n), args(std::move(a)) {}
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            std::vector<Value> evaluatedArgs;
+            for (const auto& arg : args) {
+                evaluatedArgs.push_back(arg->evaluate(environment, context));
+            }
+            return invoke(evaluatedArgs, environment, context);
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            std::vector<Column> columns;
+            bool numeric = true;
+            bool constant = true;
+            for (const auto& arg : args) {
+                columns.push_back(evaluation.Evaluate(arg));
+                numeric = numeric && columns.back().getKind() == Column::Kind::NUMBER;
+                constant = constant && columns.back().isConstant();
+            }
+            const size_t n = evaluation.size();
+
+            // Standard functions over numeric columns run as kernels; rows outside the
+            // function's domain fall through to the generic path below
+            if (numeric && !constant && IsStandardFunction(name, args.size())) {
+                std::vector<double> out(n);
+                if (applyStandardKernel(columns, out)) {
+                    std::vector<const Column*> sources;
+                    for (const auto& column : columns) sources.push_back(&column);
+                    return Column::Numbers(std::move(out)).withValidityOf(sources);
+                }
+            }
+
+            const size_t m = constant ? 1 : n;
+            std::vector<Value> results(m);
+            std::vector<Value> evaluatedArgs(args.size());
+            for (size_t i = 0; i < m; ++i) {
+                for (size_t a = 0; a < columns.size(); ++a) evaluatedArgs[a] = columns[a].at(i);
+                results[i] = invoke(evaluatedArgs, evaluation.getEnvironment(), evaluation.getContext());
+            }
+            if (constant) return Column::Constant(results[0], n);
+            return Column::Values(std::move(results));
+        }
+
+        const std::string& getName() const { return name; }
+        const std::vector<ASTNodePtr>& getArguments() const { return args; }
+        std::vector<ASTNodePtr> getChildren() const override { return args; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            return std::make_shared<FunctionCallNode>(name, std::move(children));
+        }
+
+        // Host calls are never merged, since the environment may not be pure; the standard functions are
+        std::string structuralKey() const override {
+            if (!IsStandardFunction(name, args.size()) && !IsStringFunction(name, args.size())) return {};
+            return "C" + name;
+        }
+
+    private:
+        Value invoke(const std::vector<Value>& evaluatedArgs, IEnvironment* environment, EvaluationContext* context) const {
+            // Standard functions return null for null arguments; host functions see the nulls
+            if (IsStandardFunction(name, evaluatedArgs.size()) || IsStringFunction(name, evaluatedArgs.size())) {
+                for (const auto& arg : evaluatedArgs) {
+                    if (arg.isNull()) return Value::Null();
+                }
+            }
+
+            // First try the standard mathematical and string functions (work without environment)
+            Value standardResult;
+            if (CallStringFunctions(name, evaluatedArgs, context, standardResult)) return standardResult;
+            if (CallStandardFunctions(name, evaluatedArgs, standardResult)) {
+                return standardResult;
+            }
+            
+            if (IsStringFunction(name, evaluatedArgs.size())) {
+                const std::string unavailable = name + " requires string arguments";
+                return CallHostFunction(name, evaluatedArgs, environment, context, unavailable.c_str());
+            }
+            return CallHostFunction(name, evaluatedArgs, environment, context);
+        }
+
+        bool applyStandardKernel(const std::vector<Column>& columns, std::vector<double>& out) const {
+            const size_t n = out.size();
+            if (columns.size() == 2) {
+                const Column& a = columns[0];
+                const Column& b = columns[1];
+                if (name == "min") {
+                    for (size_t i = 0; i < n; ++i) out[i] = std::min(a.numberAt(i), b.numberAt(i));
+                } else if (name == "max") {
+                    for (size_t i = 0; i < n; ++i) out[i] = std::max(a.numberAt(i), b.numberAt(i));
+                } else {
+                    for (size_t i = 0; i < n; ++i) out[i] = std::pow(a.numberAt(i), b.numberAt(i));
+                }
+                return true;
+            }
+            const double* x = columns[0].numberData();
+            if (name == "sqrt" || name == "log") {
+                for (size_t i = 0; i < n; ++i) {
+                    if (name == "sqrt" ? x[i] < 0 : x[i] <= 0) return false; // Domain error
+                }
+            }
+            double (*f)(double) = nullptr;
+            if (name == "sqrt") f = [](double v) { return std::sqrt(v); };
+            else if (name == "sin") f = [](double v) { return std::sin(v); };
+            else if (name == "cos") f = [](double v) { return std::cos(v); };
+            else if (name == "tan") f = [](double v) { return std::tan(v); };
+            else if (name == "abs") f = [](double v) { return std::abs(v); };
+            else if (name == "log") f = [](double v) { return std::log(v); };
+            else if (name == "exp") f = [](double v) { return std::exp(v); };
+            else if (name == "floor") f = [](double v) { return std::floor(v); };
+            else if (name == "ceil") f = [](double v) { return std::ceil(v); };
+            else if (name == "round") f = [](double v) { return std::round(v); };
+            if (!f) return false;
+            for (size_t i = 0; i < n; ++i) out[i] = f(x[i]);
+            return true;
+        }
+    };
+
+    /**
+     * @brief Exponential moving average: ema = alpha * x + (1 - alpha) * ema
+     *
+     * The first value seeds the average.
+     */
+    class ExponentialMovingAverage final : public NodeState {
+        double alpha;
+        double value = 0.0;
+        bool initialized = false;
+    public:
+        explicit ExponentialMovingAverage(const double a) : alpha(a) {}
+
+        double Push(const double x) {
+            value = initialized ? alpha * x + (1.0 - alpha) * value : x;
+            initialized = true;
+            return value;
+        }
+    };
+
+    /**
+     * @brief Sum of the last n values, kept in a ring buffer
+     *
+     * The running sum is updated in O(1) per value and recomputed from the
+     * buffer once every n values, which bounds floating-point drift while
+     * keeping the amortized cost constant.
+     */
+    class RollingSum final : public NodeState {
+        std::vector<double> ring;
+        size_t head = 0;
+        size_t count = 0;
+        size_t sinceRecompute = 0;
+        double sum = 0.0;
+    public:
+        explicit RollingSum(const size_t n) : ring(n, 0.0) {}
+
+        double Push(const double x) {
+            if (count == ring.size()) {
+                sum -= ring[head];
+            } else {
+                ++count;
+            }
+            ring[head] = x;
+            head = (head + 1) % ring.size();
+            sum += x;
+            if (++sinceRecompute == ring.size()) {
+                sinceRecompute = 0;
+                sum = 0.0;
+                for (size_t i = 0; i < count; ++i) sum += ring[i];
+            }
+            return sum;
+        }
+    };
+
+    /**
+     * @brief Maximum (or minimum) of the last n values using a monotonic deque
+     *
+     * The deque holds only values that can still become the extremum, so each
+     * value is pushed and popped at most once: O(1) amortized per value.
+     */
+    class RollingExtremum final : public NodeState {
+        size_t window;
+        bool maximum;
+        size_t index = 0;
+        std::deque<std::pair<size_t, double>> candidates;
+    public:
+        RollingExtremum(const size_t n, const bool isMaximum) : window(n), maximum(isMaximum) {}
+
+        double Push(const double x) {
+            while (!candidates.empty() &&
+                   (maximum ? candidates.back().second <= x : candidates.back().second >= x)) {
+                candidates.pop_back();
+            }
+            candidates.emplace_back(index, x);
+            if (candidates.front().first + window <= index) candidates.pop_front();
+            ++index;
+            return candidates.front().second;
+        }
+    };
+
+    /**
+     * @brief Difference from the previous value (0 for the first value)
+     */
+    class Delta final : public NodeState {
+        double previous = 0.0;
+        bool initialized = false;
+    public:
+        double Push(const double x) {
+            const double result = initialized ? x - previous : 0.0;
+            previous = x;
+            initialized = true;
+            return result;
+        }
+    };
+
+    /**
+     * @brief AST node for the stateful streaming built-ins
+     *
+     * - ema(x, alpha): exponential moving average with constant 0 < alpha <= 1
+     * - rolling_sum(x, n): sum of the last n values of x
+     * - rolling_max(x, n) / rolling_min(x, n): extremum of the last n values of x
+     * - delta(x): change of x since the previous evaluation
+     *
+     * Each call site keeps its window in the EvaluationState attached to the
+     * EvaluationContext, and every evaluation pushes one value in O(1). In batch
+     * mode rows are pushed in order, so a batch behaves like that many events.
+     * Without an EvaluationState, or for input that is not a number, the call
+     * goes to the host function of the same name, as it would if the built-in
+     * did not exist.
+     */
+    class WindowFunctionNode final : public ASTNode {
+    public:
+        enum class Kind { EMA, ROLLING_SUM, ROLLING_MAX, ROLLING_MIN, DELTA };
+
+    private:
+        std::string name;
+        Kind kind;
+        ASTNodePtr input;
+        double parameter;
+
+        // Without an EvaluationState, or for non-numeric input, the call goes to the host
+        Value push(IEnvironment* environment, EvaluationContext* context, const Value& x) const {
+            if (!context || !context->GetState() || !(x.isNumber() || x.isNull())) {
+                std::vector<Value> args{x};
+                if (kind != Kind::DELTA) args.emplace_back(parameter);
+                return CallHostFunction(name, args, environment, context,
+                                        x.isNumber() || x.isNull() ? (name + " requires an EvaluationState").c_str()
+                                                                   : (name + " requires a numeric argument").c_str());
+            }
+            if (x.isNull()) return Value::Null();   // Missing events leave the window untouched
+            EvaluationState& state = *context->GetState();
+            const size_t n = static_cast<size_t>(parameter);
+            switch (kind) {
+                case Kind::EMA: return Value(state.Get<ExponentialMovingAverage>(this, parameter).Push(x.data.number));
+                case Kind::ROLLING_SUM: return Value(state.Get<RollingSum>(this, n).Push(x.data.number));
+                case Kind::ROLLING_MAX: return Value(state.Get<RollingExtremum>(this, n, true).Push(x.data.number));
+                case Kind::ROLLING_MIN: return Value(state.Get<RollingExtremum>(this, n, false).Push(x.data.number));
+                case Kind::DELTA: return Value(state.Get<Delta>(this).Push(x.data.number));
+            }
+            return Value(0.0);
+        }
+
+    public:
+        WindowFunctionNode(std::string n, const Kind k, ASTNodePtr x, const double p)
+            : name(std::move(n)), kind(k), input(std::move(x)), parameter(p) {}
+
+        /**
+         * @brief Create a window node if the call is a streaming built-in
+         * @return The node, or null if the name is not a streaming built-in or the
+         *         arguments do not fit one (parameters must be valid constants); such
+         *         calls are left to the host like any other function
+         */
+        static ASTNodePtr Create(const std::string& name, const std::vector<ASTNodePtr>& args) {
+            Kind kind;
+            if (name == "ema") kind = Kind::EMA;
+            else if (name == "rolling_sum") kind = Kind::ROLLING_SUM;
+            else if (name == "rolling_max") kind = Kind::ROLLING_MAX;
+            else if (name == "rolling_min") kind = Kind::ROLLING_MIN;
+            else if (name == "delta") kind = Kind::DELTA;
+            else return nullptr;
+
+            if (kind == Kind::DELTA) {
+                if (args.size() != 1) return nullptr;
+                return std::make_shared<WindowFunctionNode>(name, kind, args[0], 0.0);
+            }
+            const auto constant = args.size() == 2 ? std::dynamic_pointer_cast<NumberNode>(args[1]) : nullptr;
+            if (!constant) return nullptr;
+            const double p = constant->getValue();
+            if (kind == Kind::EMA) {
+                if (!(p > 0.0 && p <= 1.0)) return nullptr;
+            } else if (p < 1.0 || p != std::floor(p)) {
+                return nullptr;
+            }
+            return std::make_shared<WindowFunctionNode>(name, kind, args[0], p);
+        }
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            return push(environment, context, input->evaluate(environment, context));
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            const Column values = evaluation.Evaluate(input);
+            std::vector<Value> out(evaluation.size());
+            for (size_t i = 0; i < out.size(); ++i) {
+                out[i] = push(evaluation.getEnvironment(), evaluation.getContext(), values.at(i));
+            }
+            return Column::Values(std::move(out));
+        }
+
+        const std::string& getName() const { return name; }
+        Kind getKind() const { return kind; }
+        ASTNodePtr getInput() const { return input; }
+        double getParameter() const { return parameter; }
+        std::vector<ASTNodePtr> getChildren() const override { return {input}; }
+
+        // Each node carries its own stream state, so windows are never merged
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            return std::make_shared<WindowFunctionNode>(name, kind, std::move(children[0]), parameter);
+        }
+    };
+
+    /**
+     * @brief Regular expression compiled ahead of time into a deterministic automaton
+     *
+     * Supported syntax: literals, `.`, character classes (`[a-z]`, `[^0-9]`), the
+     * escapes `\d \w \s \D \W \S \n \t \r`, grouping with `(...)` or `(?:...)`,
+     * alternation `|`, the quantifiers `* + ?` and `{m}`, `{m,}`, `{m,n}`, and the
+     * anchors `^` and `$`, which match the start and end of the subject wherever
+     * they appear (so `^abc|xyz$` anchors each branch on its own). There are no
+     * backreferences or lookaround, so every pattern has a DFA.
+     *
+     * The pattern is parsed, translated into a Thompson NFA and determinized by
+     * subset construction over byte equivalence classes in the constructor.
+     * Matching is then one table lookup per input byte with no backtracking, and
+     * the compiled object is immutable and safe to share between threads.
+     * Unanchored patterns search for a match anywhere in the subject.
+     */
+    class Regex {
+    public:
+        static constexpr size_t MAX_STATES = 4096;
+
+        /**
+         * @brief Compile a pattern
+         * @throws ExprException If the pattern is malformed or its DFA exceeds MAX_STATES
+         */
+        explicit Regex(const std::string& pattern) : source(pattern) {
+            compile();
+        }
+
+        /**
+         * @brief Check whether the pattern matches (anywhere in) the subject
+         */
+        bool Matches(const char* data, const size_t size) const {
+            if (size == 0) return matchesEmpty;
+            int32_t state = start;
+            if (accepting[state]) return true;
+            const auto* bytes = reinterpret_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; ++i) {
+                state = transitions[static_cast<size_t>(state) * classCount + classOf[bytes[i]]];
+                if (state == DEAD) return false;
+                if (accepting[state]) return true;
+            }
+            return acceptingAtEnd[state] != 0;
+        }
+
+        bool Matches(const std::string& subject) const { return Matches(subject.data(), subject.size()); }
+
+        const std::string& getPattern() const { return source; }
+        size_t getStateCount() const { return accepting.size(); }
+
+    private:
+        static constexpr int32_t DEAD = 0;
+        using CharSet = std::vector<bool>;
+
+        struct Node {
+            enum Type { SET, CONCAT, ALTERNATE, REPEAT, EMPTY, START, END } type;
+            int set = -1;
+            int first = -1;
+            int second = -1;
+            int min = 0;
+            int max = 0;   // -1 means unbounded
+        };
+
+        struct NfaState {
+            std::vector<int> epsilon;
+            int set = -1;
+            int next = -1;
+            Node::Type anchor = Node::EMPTY;  // START or END: continues at `next` only at that end of the subject
+        };
+
+        std::string source;
+        uint8_t classOf[256] = {};
+        size_t classCount = 0;
+        int32_t start = 0;
+        bool matchesEmpty = false;
+        std::vector<int32_t> transitions;
+        std::vector<uint8_t> accepting;       // A match ends here whatever follows
+        std::vector<uint8_t> acceptingAtEnd;  // A match ends here if the subject ends here
+
+        // Parsing and NFA construction state, only used while compiling
+        std::string body;
+        size_t pos = 0;
+        std::vector<Node> nodes;
+        std::vector<CharSet> sets;
+        std::vector<NfaState> nfa;
+
+        [[noreturn]] void fail(const std::string& message) const {
+            throw ExprException("Invalid regular expression '" + source + "': " + message);
+        }
+
+        int addNode(Node node) {
+            nodes.push_back(node);
+            return static_cast<int>(nodes.size() - 1);
+        }
+
+        int addSet(const CharSet& set) {
+            sets.push_back(set);
+            Node node{Node::SET};
+            node.set = static_cast<int>(sets.size() - 1);
+            return addNode(node);
+        }
+
+        static CharSet escapeSet(const char c, bool& isClass) {
+            CharSet set(256, false);
+            isClass = true;
+            const auto fill = [&](bool (*test)(int)) { for (int b = 0; b < 256; ++b) set[b] = test(b); };
+            switch (c) {
+                case 'd': fill([](int b) { return b >= '0' && b <= '9'; }); break;
+                case 'D': fill([](int b) { return !(b >= '0' && b <= '9'); }); break;
+                case 'w': fill([](int b) { return std::isalnum(b) != 0 || b == '_'; }); break;
+                case 'W': fill([](int b) { return !(std::isalnum(b) != 0 || b == '_'); }); break;
+                case 's': fill([](int b) { return b == ' ' || (b >= '\t' && b <= '\r'); }); break;
+                case 'S': fill([](int b) { return !(b == ' ' || (b >= '\t' && b <= '\r')); }); break;
+                default: {
+                    isClass = false;
+                    const char literal = c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c;
+                    set[static_cast<unsigned char>(literal)] = true;
+                }
+            }
+            return set;
+        }
+
+        int parseAlternation() {
+            int left = parseConcatenation();
+            while (pos < body.size() && body[pos] == '|') {
+                ++pos;
+                Node node{Node::ALTERNATE};
+                node.first = left;
+                node.second = parseConcatenation();
+                left = addNode(node);
+            }
+            return left;
+        }
+
+        int parseConcatenation() {
+            int result = -1;
+            while (pos < body.size() && body[pos] != '|' && body[pos] != ')') {
+                const int item = parseRepeat();
+                if (result < 0) {
+                    result = item;
+                } else {
+                    Node node{Node::CONCAT};
+                    node.first = result;
+                    node.second = item;
+                    result = addNode(node);
+                }
+            }
+            return result < 0 ? addNode(Node{Node::EMPTY}) : result;
+        }
+
+        int parseNumber() {
+            if (pos >= body.size() || !std::isdigit(static_cast<unsigned char>(body[pos]))) fail("expected a number");
+            int value = 0;
+            while (pos < body.size() && std::isdigit(static_cast<unsigned char>(body[pos]))) {
+                value = value * 10 + (body[pos++] - '0');
+                if (value > 1000) fail("repetition count too large");
+            }
+            return value;
+        }
+
+        int parseRepeat() {
+            int atom = parseAtom();
+            while (pos < body.size()) {
+                Node node{Node::REPEAT};
+                node.first = atom;
+                const char c = body[pos];
+                if (c == '*') { node.min = 0; node.max = -1; ++pos; }
+                else if (c == '+') { node.min = 1; node.max = -1; ++pos; }
+                else if (c == '?') { node.min = 0; node.max = 1; ++pos; }
+                else if (c == '{') {
+                    ++pos;
+                    node.min = parseNumber();
+                    node.max = node.min;
+                    if (pos < body.size() && body[pos] == ',') {
+                        ++pos;
+                        node.max = (pos < body.size() && body[pos] == '}') ? -1 : parseNumber();
+                    }
+                    if (pos >= body.size() || body[pos] != '}') fail("missing '}'");
+                    ++pos;
+                    if (node.max >= 0 && node.max < node.min) fail("invalid repetition range");
+                } else {
+                    break;
+                }
+                atom = addNode(node);
+            }
+            return atom;
+        }
+
+        int parseClass() {
+            CharSet set(256, false);
+            bool negate = false;
+            if (pos < body.size() && body[pos] == '^') { negate = true; ++pos; }
+            bool firstItem = true;
+            while (pos < body.size() && (body[pos] != ']' || firstItem)) {
+                firstItem = false;
+                int low;
+                if (body[pos] == '\\' && pos + 1 < body.size()) {
+                    bool isClass;
+                    const CharSet escaped = escapeSet(body[pos + 1], isClass);
+                    pos += 2;
+                    if (isClass) {
+                        for (int b = 0; b < 256; ++b) set[b] = set[b] || escaped[b];
+                        continue;
+                    }
+                    low = static_cast<int>(std::find(escaped.begin(), escaped.end(), true) - escaped.begin());
+                } else {
+                    low = static_cast<unsigned char>(body[pos++]);
+                }
+                int high = low;
+                if (pos + 1 < body.size() && body[pos] == '-' && body[pos + 1] != ']') {
+                    ++pos;
+                    if (body[pos] == '\\' && pos + 1 < body.size()) {
+                        bool isClass;
+                        const CharSet escaped = escapeSet(body[pos + 1], isClass);
+                        if (isClass) fail("invalid class range");
+                        high = static_cast<int>(std::find(escaped.begin(), escaped.end(), true) - escaped.begin());
+                        pos += 2;
+                    } else {
+                        high = static_cast<unsigned char>(body[pos++]);
+                    }
+                    if (high < low) fail("invalid class range");
+                }
+                for (int b = low; b <= high; ++b) set[b] = true;
+            }
+            if (pos >= body.size()) fail("missing ']'");
+            ++pos;
+            if (negate) set.flip();
+            return addSet(set);
+        }
+
+        int parseAtom() {
+            const char c = body[pos];
+            if (c == '(') {
+                ++pos;
+                if (body.compare(pos, 2, "?:") == 0) pos += 2;
+                const int inner = parseAlternation();
+                if (pos >= body.size() || body[pos] != ')') fail("missing ')'");
+                ++pos;
+                return inner;
+            }
+            if (c == '[') {
+                ++pos;
+                return parseClass();
+            }
+            if (c == '*' || c == '+' || c == '?' || c == '{') fail("nothing to repeat");
+            ++pos;
+            if (c == '^' || c == '$') return addNode(Node{c == '^' ? Node::START : Node::END});
+            if (c == '.') {
+                CharSet set(256, true);
+                set['\n'] = false;
+                return addSet(set);
+            }
+            if (c == '\\') {
+                if (pos >= body.size()) fail("trailing backslash");
+                bool isClass;
+                return addSet(escapeSet(body[pos++], isClass));
+            }
+            CharSet set(256, false);
+            set[static_cast<unsigned char>(c)] = true;
+            return addSet(set);
+        }
+
+        int addState() {
+            if (nfa.size() >= MAX_STATES * 16) fail("pattern is too complex");
+            nfa.emplace_back();
+            return static_cast<int>(nfa.size() - 1);
+        }
+
+        // Build NFA states for a node so that a match continues at `out`; returns the entry state
+        int build(const int index, const int out) {
+            const Node node = nodes[index];
+            switch (node.type) {
+                case Node::EMPTY: return out;
+                case Node::START:
+                case Node::END: {
+                    const int state = addState();
+                    nfa[state].anchor = node.type;
+                    nfa[state].next = out;
+                    return state;
+                }
+                case Node::SET: {
+                    const int state = addState();
+                    nfa[state].set = node.set;
+                    nfa[state].next = out;
+                    return state;
+                }
+                case Node::CONCAT: return build(node.first, build(node.second, out));
+                case Node::ALTERNATE: {
+                    const int a = build(node.first, out);
+                    const int b = build(node.second, out);
+                    const int state = addState();
+                    nfa[state].epsilon = {a, b};
+                    return state;
+                }
+                case Node::REPEAT: {
+                    int tail = out;
+                    if (node.max < 0) {
+                        const int loop = addState();
+                        const int body = build(node.first, loop);
+                        nfa[loop].epsilon = {body, out};
+                        tail = loop;
+                    } else {
+                        for (int i = node.min; i < node.max; ++i) {
+                            const int body = build(node.first, tail);
+                            const int state = addState();
+                            nfa[state].epsilon = {body, out};
+                            tail = state;
+                        }
+                    }
+                    for (int i = 0; i < node.min; ++i) tail = build(node.first, tail);
+                    return tail;
+                }
+            }
+            return out;
+        }
+
+        // Add the states reachable without reading a byte; anchors are crossed only where they hold
+        void closure(std::vector<int>& states, std::vector<uint8_t>& seen, const bool atStart, const bool atEnd) const {
+            const auto add = [&](const int next) {
+                if (!seen[next]) {
+                    seen[next] = 1;
+                    states.push_back(next);
+                }
+            };
+            for (size_t i = 0; i < states.size(); ++i) {
+                const NfaState& state = nfa[states[i]];
+                for (const int next : state.epsilon) add(next);
+                if ((state.anchor == Node::START && atStart) || (state.anchor == Node::END && atEnd)) add(state.next);
+            }
+            std::sort(states.begin(), states.end());
+        }
+
+        void compile() {
+            body = source;
+            const int root = parseAlternation();
+            if (pos != body.size()) fail("unmatched ')'");
+
+            const int match = addState();
+            const int entry = build(root, match);
+
+            // Partition bytes into classes that every character set treats alike
+            std::unordered_map<std::string, uint8_t> signatures;
+            for (int b = 0; b < 256; ++b) {
+                std::string signature(sets.size(), '0');
+                for (size_t s = 0; s < sets.size(); ++s) signature[s] = sets[s][b] ? '1' : '0';
+                const auto it = signatures.find(signature);
+                if (it != signatures.end()) {
+                    classOf[b] = it->second;
+                } else {
+                    classOf[b] = static_cast<uint8_t>(signatures.size());
+                    signatures.emplace(signature, classOf[b]);
+                }
+            }
+            classCount = signatures.size();
+            std::vector<int> representative(classCount, 0);
+            for (int b = 255; b >= 0; --b) representative[classOf[b]] = b;
+
+            // Subset construction; DFA state 0 is the dead (empty) state
+            std::vector<uint8_t> seen(nfa.size(), 0);
+            const auto closeOver = [&](std::vector<int> states, const bool atStart, const bool atEnd) {
+                std::fill(seen.begin(), seen.end(), 0);
+                for (const int s : states) seen[s] = 1;
+                closure(states, seen, atStart, atEnd);
+                return states;
+            };
+            const auto contains = [match](const std::vector<int>& states) {
+                return std::binary_search(states.begin(), states.end(), match);
+            };
+            // Only states that read a byte, wait for the end or accept matter once a byte was read
+            const auto productive = [&](std::vector<int> states) {
+                states.erase(std::remove_if(states.begin(), states.end(), [&](const int s) {
+                    return nfa[s].set < 0 && nfa[s].anchor != Node::END && s != match;
+                }), states.end());
+                return states;
+            };
+            // Matches may begin at every position, but only the first one satisfies `^`
+            const std::vector<int> startSet = productive(closeOver({entry}, true, false));
+            const std::vector<int> restartSet = productive(closeOver({entry}, false, false));
+            matchesEmpty = contains(closeOver({entry}, true, true));
+            std::map<std::vector<int>, int32_t> ids;
+            std::vector<std::vector<int>> pending;
+            const auto idOf = [&](const std::vector<int>& states) {
+                const auto it = ids.find(states);
+                if (it != ids.end()) return it->second;
+                if (ids.size() >= MAX_STATES) fail("pattern is too complex");
+                const auto id = static_cast<int32_t>(ids.size());
+                ids.emplace(states, id);
+                pending.push_back(states);
+                accepting.push_back(contains(states) ? 1 : 0);
+                acceptingAtEnd.push_back(contains(closeOver(states, false, true)) ? 1 : 0);
+                transitions.resize(accepting.size() * classCount, DEAD);
+                return id;
+            };
+            idOf({});
+            start = idOf(startSet);
+            for (size_t current = 1; current < pending.size(); ++current) {
+                const std::vector<int> states = pending[current];
+                for (size_t cls = 0; cls < classCount; ++cls) {
+                    const int byte = representative[cls];
+                    std::vector<int> next;
+                    for (const int s : states) {
+                        if (nfa[s].set >= 0 && sets[nfa[s].set][byte]) next.push_back(nfa[s].next);
+                    }
+                    next.insert(next.end(), restartSet.begin(), restartSet.end());
+                    std::sort(next.begin(), next.end());
+                    next.erase(std::unique(next.begin(), next.end()), next.end());
+                    next = next.empty() ? next : productive(closeOver(next, false, false));
+                    const int32_t target = next.empty() ? DEAD : idOf(next);
+                    transitions[current * classCount + cls] = target;
+                }
+            }
+
+            body.clear();
+            nodes.clear();
+            sets.clear();
+            nfa.clear();
+        }
+    };
+
+    /**
+     * @brief Batch kernel shared by the built-ins that test or hash strings
+     *
+     * Applies `map` to each dictionary entry once, or to each row of a string
+     * column, without boxing. Rows of other column kinds are passed to `fallback`
+     * as Values, and null rows stay null. Result is uint8_t for a boolean column
+     * or double for a numeric one.
+     */
+    template <typename Result, typename Map, typename Fallback>
+    Column MapStringColumn(const Column& values, const Map& map, const Fallback& fallback) {
+        const size_t n = values.isConstant() ? 1 : values.size();
+        std::vector<Result> out(n);
+        if (values.getKind() == Column::Kind::DICTIONARY && !values.isConstant()) {
+            const auto& entries = *values.getDictionary();
+            std::vector<Result> table(entries.size());
+            for (size_t code = 0; code < entries.size(); ++code) table[code] = static_cast<Result>(map(std::string_view(entries[code])));
+            for (size_t i = 0; i < n; ++i) out[i] = table[values.codeAt(i)];
+        } else if (values.getKind() == Column::Kind::STRING || values.getKind() == Column::Kind::DICTIONARY) {
+            for (size_t i = 0; i < n; ++i) out[i] = static_cast<Result>(map(std::string_view(values.stringAt(i))));
+        } else {
+            std::vector<Value> boxed(n);
+            for (size_t i = 0; i < n; ++i) {
+                const Value value = values.at(i);
+                boxed[i] = value.isNull() ? Value::Null() : fallback(value);
+            }
+            return values.isConstant() ? Column::Constant(boxed[0], values.size()) : Column::Values(std::move(boxed));
+        }
+        Column result;
+        if constexpr (std::is_same_v<Result, double>) {
+            result = Column::Numbers(std::move(out));
+        } else {
+            result = Column::Booleans(std::move(out));
+        }
+        return values.isConstant() ? Column::Constant(result.at(0), values.size()) : result.withValidityOf({&values});
+    }
+
+    /**
+     * @brief AST node for the `matches(subject, pattern)` built-in
+     *
+     * A literal pattern is compiled into a Regex once when the expression is
+     * parsed. Non-literal patterns are compiled on each evaluation. In batch mode
+     * string columns are scanned directly without boxing each row. Arguments that
+     * are not strings go to a host function named `matches`.
+     */
+    class RegexMatchNode final : public ASTNode {
+        ASTNodePtr subject;
+        ASTNodePtr pattern;
+        std::shared_ptr<const Regex> compiled;
+
+        Value apply(const Value& value, const Value& source, IEnvironment* environment, EvaluationContext* context) const {
+            if ((!value.isNull() && !value.isString()) || (!source.isNull() && !source.isString())) {
+                return CallHostFunction("matches", {value, source}, environment, context,
+                                        value.isString() || value.isNull() ? "matches requires a string pattern"
+                                                                           : "matches requires a string subject");
+            }
+            if (value.isNull() || source.isNull()) return Value::Null();
+            const std::string_view text = value.asStringView();
+            if (compiled) return Value(compiled->Matches(text.data(), text.size()));
+            return Value(Regex(std::string(source.asStringView())).Matches(text.data(), text.size()));
+        }
+
+    public:
+        RegexMatchNode(ASTNodePtr s, ASTNodePtr p) : subject(std::move(s)), pattern(std::move(p)) {
+            if (auto literal = std::dynamic_pointer_cast<StringNode>(pattern)) {
+                compiled = std::make_shared<const Regex>(literal->getValue());
+            }
+        }
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            const Value value = subject->evaluate(environment, context);
+            if (compiled && value.isString()) {
+                const std::string_view text = value.asStringView();
+                return Value(compiled->Matches(text.data(), text.size()));
+            }
+            return apply(value, pattern->evaluate(environment, context), environment, context);
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            if (!compiled) return ASTNode::evaluateBatch(evaluation);
+            const Value source = pattern->evaluate(nullptr, evaluation.getContext());
+            return MapStringColumn<uint8_t>(
+                evaluation.Evaluate(subject),
+                [&](const std::string_view s) { return compiled->Matches(s.data(), s.size()); },
+                [&](const Value& value) { return apply(value, source, evaluation.getEnvironment(), evaluation.getContext()); });
+        }
+
+        ASTNodePtr getSubject() const { return subject; }
+        ASTNodePtr getPattern() const { return pattern; }
+        std::shared_ptr<const Regex> getCompiled() const { return compiled; }
+        std::vector<ASTNodePtr> getChildren() const override { return {subject, pattern}; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            return std::make_shared<RegexMatchNode>(std::move(children[0]), std::move(children[1]));
+        }
+        std::string structuralKey() const override { return "R"; }
+    };
+
+    /**
+     * @brief AST node for starts_with / ends_with against a string literal
+     *
+     * The literal is stored in the node, so each test is a length check and one
+     * memcmp; batch evaluation tests each dictionary entry once. A subject that
+     * is not a string goes to the host function of the same name.
+     */
+    class AffixMatchNode final : public ASTNode {
+        ASTNodePtr subject;
+        std::string affix;
+        bool suffix;
+
+        bool test(const std::string_view s) const {
+            return s.size() >= affix.size() &&
+                   std::memcmp(s.data() + (suffix ? s.size() - affix.size() : 0), affix.data(), affix.size()) == 0;
+        }
+
+        Value apply(const Value& value, IEnvironment* environment, EvaluationContext* context) const {
+            if (value.isString()) return Value(test(value.asStringView()));
+            const std::string unavailable = getName() + " requires string arguments";
+            return CallHostFunction(getName(), {value, Value(affix)}, environment, context, unavailable.c_str());
+        }
+
+    public:
+        AffixMatchNode(ASTNodePtr s, std::string a, const bool isSuffix)
+            : subject(std::move(s)), affix(std::move(a)), suffix(isSuffix) {}
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            const Value value = subject->evaluate(environment, context);
+            if (value.isNull()) return Value::Null();
+            return apply(value, environment, context);
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            return MapStringColumn<uint8_t>(
+                evaluation.Evaluate(subject),
+                [this](const std::string_view s) { return test(s); },
+                [&](const Value& value) { return apply(value, evaluation.getEnvironment(), evaluation.getContext()); });
+        }
+
+        std::string getName() const { return suffix ? "ends_with" : "starts_with"; }
+        ASTNodePtr getSubject() const { return subject; }
+        const std::string& getAffix() const { return affix; }
+        bool isSuffix() const { return suffix; }
+        std::vector<ASTNodePtr> getChildren() const override { return {subject}; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            return std::make_shared<AffixMatchNode>(std::move(children[0]), affix, suffix);
+        }
+        std::string structuralKey() const override {
+            return std::string(suffix ? "E" : "P") + std::to_string(affix.size()) + ":" + affix;
+        }
+    };
+
+    /**
+     * @brief AST node for ieq / icontains against a string literal
+     *
+     * The literal is folded to lower case once when the node is built, so each
+     * test only folds the subject while comparing or scanning it. A subject that
+     * is not a string goes to the host function of the same name, with the
+     * arguments in their original order.
+     */
+    class CaseInsensitiveMatchNode final : public ASTNode {
+        ASTNodePtr subject;
+        std::string literal;
+        std::string needle;  // Folded with AsciiCase::Fold
+        bool contains;
+        bool literalFirst;   // ieq("literal", subject)
+
+        bool test(const std::string_view s) const {
+            return contains ? AsciiCase::ContainsFolded(s, needle) : AsciiCase::EqualsFolded(s, needle);
+        }
+
+        Value apply(const Value& value, IEnvironment* environment, EvaluationContext* context) const {
+            if (value.isString()) return Value(test(value.asStringView()));
+            const std::string unavailable = getName() + " requires string arguments";
+            return CallHostFunction(getName(), literalFirst ? std::vector<Value>{Value(literal), value}
+                                                            : std::vector<Value>{value, Value(literal)},
+                                    environment, context, unavailable.c_str());
+        }
+
+    public:
+        CaseInsensitiveMatchNode(ASTNodePtr s, const std::string_view l, const bool isContains, const bool isLiteralFirst = false)
+            : subject(std::move(s)), literal(l), needle(AsciiCase::Fold(l)), contains(isContains), literalFirst(isLiteralFirst) {}
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            const Value value = subject->evaluate(environment, context);
+            if (value.isNull()) return Value::Null();
+            return apply(value, environment, context);
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            return MapStringColumn<uint8_t>(
+                evaluation.Evaluate(subject),
+                [this](const std::string_view s) { return test(s); },
+                [&](const Value& value) { return apply(value, evaluation.getEnvironment(), evaluation.getContext()); });
+        }
+
+        std::string getName() const { return contains ? "icontains" : "ieq"; }
+        ASTNodePtr getSubject() const { return subject; }
+        const std::string& getNeedle() const { return needle; }
+        bool isContains() const { return contains; }
+        std::vector<ASTNodePtr> getChildren() const override { return {subject}; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            return std::make_shared<CaseInsensitiveMatchNode>(std::move(children[0]), literal, contains, literalFirst);
+        }
+        std::string structuralKey() const override {
+            // Keyed on the literal as written, since a host fallback sees it unfolded
+            return std::string(contains ? "K" : literalFirst ? "q" : "Q") + std::to_string(literal.size()) + ":" + literal;
+        }
+    };
+
+    /**
+     * @brief AST node for the hash64(value[, seed]) and bucket(value, n[, seed]) built-ins
+     *
+     * hash64 returns the top 53 bits of StableHash::Of, so the result is an exact
+     * integer; bucket maps the full hash onto [0, n). With a constant seed and
+     * bucket count, batch evaluation hashes number and string columns directly
+     * and each dictionary entry once. Seeds and bucket counts out of range go to
+     * a host function of the same name.
+     */
+    class HashNode final : public ASTNode {
+        std::string name;
+        std::vector<ASTNodePtr> args;  // value, [bucket count,] [seed]
+
+        struct Parameters {
+            uint64_t seed = 0;
+            uint64_t buckets = 0;
+        };
+
+        bool isBucket() const { return name == "bucket"; }
+
+        static bool validBuckets(const double n) {
+            return n >= 1.0 && n <= 9007199254740992.0 && n == std::floor(n);
+        }
+
+        // Seeds must fit an int64: [-2^63, 2^63)
+        static bool validSeed(const double seed) {
+            return seed >= -9223372036854775808.0 && seed < 9223372036854775808.0;
+        }
+
+        // Parameters from the evaluated arguments after the first; the error if they do not fit
+        std::string parameters(const Value* extra, const size_t count, Parameters& result) const {
+            size_t next = 0;
+            if (isBucket()) {
+                const Value& n = extra[next++];
+                if (!n.isNumber() || !validBuckets(n.data.number)) return "bucket requires a positive integer bucket count";
+                result.buckets = static_cast<uint64_t>(n.data.number);
+            }
+            if (next < count) {
+                const Value& seed = extra[next];
+                if (!seed.isNumber() || !validSeed(seed.data.number)) return name + " requires a numeric seed";
+                result.seed = static_cast<uint64_t>(static_cast<int64_t>(seed.data.number));
+            }
+            return {};
+        }
+
+        double finish(const uint64_t hash, const Parameters& p) const {
+            return static_cast<double>(isBucket() ? StableHash::Bucket(hash, p.buckets) : hash >> 11);
+        }
+
+    public:
+        HashNode(std::string n, std::vector<ASTNodePtr> a) : name(std::move(n)), args(std::move(a)) {
+            if (!IsHashFunction(name, args.size())) throw ExprException("Invalid arguments for " + name);
+        }
+
+        /**
+         * @brief Whether a call fits the built-in; non-literal parameters are checked on evaluation
+         */
+        static bool Accepts(const std::string& name, const std::vector<ASTNodePtr>& args) {
+            if (!IsHashFunction(name, args.size())) return false;
+            for (size_t a = 1; a < args.size(); ++a) {
+                if (std::dynamic_pointer_cast<StringNode>(args[a]) || std::dynamic_pointer_cast<BooleanNode>(args[a])) return false;
+                const auto number = std::dynamic_pointer_cast<NumberNode>(args[a]);
+                if (number && !(name == "bucket" && a == 1 ? validBuckets(number->getValue()) : validSeed(number->getValue()))) return false;
+            }
+            return true;
+        }
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            std::vector<Value> values;
+            values.reserve(args.size());
+            for (const auto& arg : args) {
+                values.push_back(arg->evaluate(environment, context));
+                if (values.back().isNull()) return Value::Null();
+            }
+            Parameters p;
+            const std::string error = parameters(values.data() + 1, values.size() - 1, p);
+            if (!error.empty()) return CallHostFunction(name, values, environment, context, error.c_str());
+            return Value(finish(StableHash::Of(values[0], p.seed), p));
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            std::vector<Value> extra;
+            for (size_t a = 1; a < args.size(); ++a) {
+                const Column column = evaluation.Evaluate(args[a]);
+                if (!column.isConstant()) return ASTNode::evaluateBatch(evaluation);
+                extra.push_back(column.at(0));
+                if (extra.back().isNull()) return Column::Constant(Value::Null(), evaluation.size());
+            }
+            Parameters p;
+            if (!parameters(extra.data(), extra.size(), p).empty()) return ASTNode::evaluateBatch(evaluation);
+
+            const Column values = evaluation.Evaluate(args[0]);
+            if (values.getKind() == Column::Kind::NUMBER || values.getKind() == Column::Kind::BOOLEAN) {
+                const size_t n = values.isConstant() ? 1 : values.size();
+                std::vector<double> out(n);
+                if (values.getKind() == Column::Kind::NUMBER) {
+                    const double* x = values.numberData();
+                    for (size_t i = 0; i < n; ++i) out[i] = finish(StableHash::Number(x[i], p.seed), p);
+                } else {
+                    const double results[2] = {finish(StableHash::Number(0.0, p.seed), p), finish(StableHash::Number(1.0, p.seed), p)};
+                    for (size_t i = 0; i < n; ++i) out[i] = results[values.booleanAt(i) ? 1 : 0];
+                }
+                Column result = Column::Numbers(std::move(out));
+                return values.isConstant() ? Column::Constant(result.at(0), values.size()) : result.withValidityOf({&values});
+            }
+            return MapStringColumn<double>(
+                values,
+                [&](const std::string_view s) { return finish(StableHash::String(s, p.seed), p); },
+                [&](const Value& value) { return Value(finish(StableHash::Of(value, p.seed), p)); });
+        }
+
+        const std::string& getName() const { return name; }
+        const std::vector<ASTNodePtr>& getArguments() const { return args; }
+        std::vector<ASTNodePtr> getChildren() const override { return args; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            return std::make_shared<HashNode>(name, std::move(children));
+        }
+        std::string structuralKey() const override { return "H" + name; }
+    };
+
+    /**
+     * @brief Immutable table from string or number keys to values
+     *
+     * Keys are kept in flat sorted arrays. String keys are found through an
+     * open-addressed index of their StableHash, number keys by binary search.
+     * Keys that are not in the table map to a default value (null unless given).
+     *
+     * Usage example:
+     * @code
+     * auto rates = std::make_shared<const LookupTable>(LookupTable({{Value("US"), Value(0.07)}, {Value("DE"), Value(0.19)}}));
+     * @endcode
+     */
+    class LookupTable {
+        std::vector<double> numberKeys;
+        std::vector<Value> numberValues;
+        std::vector<std::string> stringKeys;
+        std::vector<Value> stringValues;
+        std::vector<uint64_t> stringHashes;
+        std::vector<uint32_t> slots;  // 1 + index into stringKeys, 0 when empty
+        Value fallback;
+
+        static uint64_t hash(const std::string_view key) { return StableHash::String(key, 0x6c6f6f6b7570ULL); }
+
+    public:
+        /**
+         * @param entries Key-value pairs; keys must be unique strings or non-NaN numbers
+         * @param defaultValue Result for keys that are not in the table
+         * @throws ExprException For invalid or duplicate keys
+         */
+        explicit LookupTable(std::vector<std::pair<Value, Value>> entries, Value defaultValue = Value::Null())
+            : fallback(defaultValue.Owned()) {
+            std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+                if (a.first.isNumber() != b.first.isNumber()) return a.first.isNumber();
+                if (a.first.isNumber()) return a.first.data.number < b.first.data.number;
+                return a.first.isString() && b.first.isString() && a.first.asStringView() < b.first.asStringView();
+            });
+            for (auto& entry : entries) {
+                const Value& key = entry.first;
+                if (key.isNumber() && !std::isnan(key.data.number)) {
+                    const double number = key.data.number == 0.0 ? 0.0 : key.data.number;
+                    if (!numberKeys.empty() && numberKeys.back() == number) throw ExprException("Duplicate lookup key");
+                    numberKeys.push_back(number);
+                    numberValues.push_back(entry.second.Owned());
+                } else if (key.isString()) {
+                    if (!stringKeys.empty() && stringKeys.back() == key.asStringView()) throw ExprException("Duplicate lookup key");
+                    stringKeys.emplace_back(key.asStringView());
+                    stringValues.push_back(entry.second.Owned());
+                } else {
+                    throw ExprException("Lookup keys must be strings or numbers");
+                }
+            }
+            size_t capacity = 16;
+            while (capacity < stringKeys.size() * 2) capacity *= 2;
+            slots.assign(capacity, 0);
+            stringHashes.resize(stringKeys.size());
+            for (size_t k = 0; k < stringKeys.size(); ++k) {
+                stringHashes[k] = hash(stringKeys[k]);
+                size_t i = stringHashes[k] & (capacity - 1);
+                while (slots[i] != 0) i = (i + 1) & (capacity - 1);
+                slots[i] = static_cast<uint32_t>(k + 1);
+            }
+        }
+
+        /**
+         * @brief The value for a string key, or null if it is not in the table
+         */
+        const Value* Find(const std::string_view key) const {
+            const uint64_t h = hash(key);
+            const size_t mask = slots.size() - 1;
+            for (size_t i = h & mask; slots[i] != 0; i = (i + 1) & mask) {
+                const size_t k = slots[i] - 1;
+                if (stringHashes[k] == h && stringKeys[k] == key) return &stringValues[k];
+            }
+            return nullptr;
+        }
+
+        /**
+         * @brief The value for a number key, or null if it is not in the table
+         */
+        const Value* Find(const double key) const {
+            const auto it = std::lower_bound(numberKeys.begin(), numberKeys.end(), key);
+            if (it == numberKeys.end() || *it != key) return nullptr;
+            return &numberValues[static_cast<size_t>(it - numberKeys.begin())];
+        }
+
+        /**
+         * @brief Look up a key, returning the default value for missing keys
+         *
+         * String results are borrowed from the table and stay valid while it exists.
+         */
+        Value Get(const Value& key) const {
+            const Value* found = nullptr;
+            if (key.isString()) found = Find(key.asStringView());
+            else if (key.isNumber()) found = Find(key.data.number);
+            const Value& result = found ? *found : fallback;
+            return result.isString() ? Value::Borrow(result.asStringView()) : result;
+        }
+
+        size_t size() const { return numberKeys.size() + stringKeys.size(); }
+        const Value& getDefault() const { return fallback; }
+    };
+
+    /**
+     * @brief AST node for a call to a lookup table bound by BindLookupTables()
+     *
+     * The table is referenced directly, so evaluation does no name resolution and
+     * no host call. Batch evaluation looks each dictionary entry up once.
+     */
+    class LookupNode final : public ASTNode {
+        std::string name;
+        std::shared_ptr<const LookupTable> table;
+        ASTNodePtr key;
+
+    public:
+        LookupNode(std::string n, std::shared_ptr<const LookupTable> t, ASTNodePtr k)
+            : name(std::move(n)), table(std::move(t)), key(std::move(k)) {
+            if (!table) throw ExprException("Lookup node requires a table");
+        }
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            const Value value = key->evaluate(environment, context);
+            if (value.isNull()) return Value::Null();
+            return table->Get(value);
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            const Column keys = evaluation.Evaluate(key);
+            const size_t n = keys.isConstant() ? 1 : keys.size();
+            std::vector<Value> out(n, Value::Null());
+            if (keys.getKind() == Column::Kind::DICTIONARY && !keys.isConstant()) {
+                const auto& entries = *keys.getDictionary();
+                std::vector<Value> results(entries.size());
+                for (size_t code = 0; code < entries.size(); ++code) {
+                    const Value* found = table->Find(std::string_view(entries[code]));
+                    results[code] = found ? *found : table->getDefault();
+                }
+                for (size_t i = 0; i < n; ++i) out[i] = keys.isValid(i) ? results[keys.codeAt(i)] : Value::Null();
+            } else if (keys.getKind() == Column::Kind::NUMBER || keys.getKind() == Column::Kind::STRING) {
+                const bool numeric = keys.getKind() == Column::Kind::NUMBER;
+                for (size_t i = 0; i < n; ++i) {
+                    if (!keys.isValid(i)) continue;
+                    const Value* found = numeric ? table->Find(keys.numberAt(i)) : table->Find(std::string_view(keys.stringAt(i)));
+                    out[i] = found ? *found : table->getDefault();
+                }
+            } else {
+                for (size_t i = 0; i < n; ++i) {
+                    const Value value = keys.at(i);
+                    if (!value.isNull()) out[i] = table->Get(value);
+                }
+            }
+            return keys.isConstant() ? Column::Constant(out[0], keys.size()) : Column::Values(std::move(out));
+        }
+
+        const std::string& getName() const { return name; }
+        const std::shared_ptr<const LookupTable>& getTable() const { return table; }
+        ASTNodePtr getKey() const { return key; }
+        std::vector<ASTNodePtr> getChildren() const override { return {key}; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            return std::make_shared<LookupNode>(name, table, std::move(children[0]));
+        }
+        std::string structuralKey() const override { return "L" + name + "@" + IdentityKey(table.get()); }
+    };
+
+    /**
+     * @brief An IPv4 or IPv6 address as 128 bits; IPv4 addresses are stored IPv4-mapped (::ffff:a.b.c.d)
+     */
+    struct IpAddress {
+        uint64_t high = 0;  // Bits 0..63, most significant first
+        uint64_t low = 0;   // Bits 64..127
+
+        static IpAddress FromIPv4(const uint32_t address) {
+            IpAddress result;
+            result.low = 0x0000ffff00000000ULL | address;
+            return result;
+        }
+
+        /**
+         * @brief Parse dotted IPv4 or RFC 4291 IPv6 text (including "::" and an IPv4 tail)
+         * @return false if the text is not an address
+         */
+        static bool Parse(const std::string_view text, IpAddress& out) {
+            uint32_t v4;
+            if (parseIPv4(text, v4)) {
+                out = FromIPv4(v4);
+                return true;
+            }
+            return parseIPv6(text, out);
+        }
+
+        bool isIPv4() const { return high == 0 && (low >> 32) == 0xffffULL; }
+
+        bool bit(const size_t index) const {
+            return ((index < 64 ? high >> (63 - index) : low >> (127 - index)) & 1) != 0;
+        }
+
+        /**
+         * @brief Whether the first length bits of both addresses are equal
+         */
+        bool SharesPrefix(const IpAddress& other, const size_t length) const {
+            return CommonPrefix(other) >= length;
+        }
+
+        size_t CommonPrefix(const IpAddress& other) const {
+            if (const uint64_t x = high ^ other.high) return leadingZeros(x);
+            if (const uint64_t x = low ^ other.low) return 64 + leadingZeros(x);
+            return 128;
+        }
+
+        /**
+         * @brief This address with every bit from length onwards cleared
+         */
+        IpAddress Truncated(const size_t length) const {
+            IpAddress result = *this;
+            if (length < 64) {
+                result.high = length == 0 ? 0 : high & (~0ULL << (64 - length));
+                result.low = 0;
+            } else if (length < 128) {
+                result.low = length == 64 ? 0 : low & (~0ULL << (128 - length));
+            }
+            return result;
+        }
+
+    private:
+        static size_t leadingZeros(const uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+            return static_cast<size_t>(__builtin_clzll(x));
+#else
+            size_t count = 0;
+            while (!(x & (1ULL << (63 - count)))) ++count;
+            return count;
+#endif
+        }
+
+        static bool parseIPv4(const std::string_view text, uint32_t& out) {
+            uint32_t address = 0;
+            size_t i = 0;
+            for (int part = 0; part < 4; ++part) {
+                if (part > 0) {
+                    if (i >= text.size() || text[i] != '.') return false;
+                    ++i;
+                }
+                const size_t start = i;
+                uint32_t octet = 0;
+                while (i < text.size() && i - start < 3 && text[i] >= '0' && text[i] <= '9') octet = octet * 10 + static_cast<uint32_t>(text[i++] - '0');
+                // Leading zeros are rejected because some parsers read them as octal
+                if (i == start || octet > 255 || (text[start] == '0' && i - start > 1)) return false;
+                address = (address << 8) | octet;
+            }
+            if (i != text.size()) return false;
+            out = address;
+            return true;
+        }
+
+        static bool parseIPv6(const std::string_view text, IpAddress& out) {
+            uint16_t groups[8] = {};
+            size_t count = 0;
+            int gap = -1;  // Group index where "::" was seen
+            size_t i = 0;
+            if (text.size() >= 2 && text[0] == ':' && text[1] == ':') {
+                gap = 0;
+                i = 2;
+            } else if (text.empty() || text[0] == ':') {
+                return false;
+            }
+            while (i < text.size()) {
+                size_t end = i;
+                while (end < text.size() && text[end] != ':') ++end;
+                const std::string_view token = text.substr(i, end - i);
+                if (token.find('.') != std::string_view::npos) {
+                    uint32_t v4;
+                    if (end != text.size() || count > 6 || !parseIPv4(token, v4)) return false;
+                    groups[count++] = static_cast<uint16_t>(v4 >> 16);
+                    groups[count++] = static_cast<uint16_t>(v4);
+                    break;
+                }
+                if (token.empty() || token.size() > 4 || count == 8) return false;
+                uint16_t group = 0;
+                for (const char c : token) {
+                    int digit;
+                    if (c >= '0' && c <= '9') digit = c - '0';
+                    else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+                    else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+                    else return false;
+                    group = static_cast<uint16_t>((group << 4) | digit);
+                }
+                groups[count++] = group;
+                if (end == text.size()) break;
+                if (end + 1 < text.size() && text[end + 1] == ':') {
+                    if (gap >= 0) return false;
+                    gap = static_cast<int>(count);
+                    i = end + 2;
+                } else {
+                    i = end + 1;
+                    if (i == text.size()) return false;
+                }
+            }
+            if (gap < 0 ? count != 8 : count > 7) return false;
+            uint16_t expanded[8] = {};
+            const size_t tail = gap < 0 ? 0 : count - static_cast<size_t>(gap);
+            for (size_t g = 0; g < count - tail; ++g) expanded[g] = groups[g];
+            for (size_t g = 0; g < tail; ++g) expanded[8 - tail + g] = groups[count - tail + g];
+            out = IpAddress();
+            for (size_t g = 0; g < 4; ++g) out.high = (out.high << 16) | expanded[g];
+            for (size_t g = 4; g < 8; ++g) out.low = (out.low << 16) | expanded[g];
+            return true;
+        }
+    };
+
+    /**
+     * @brief Set of CIDR ranges stored as a path-compressed binary radix trie
+     *
+     * Each trie node holds a whole prefix, so a lookup visits at most one node per
+     * distinct prefix length on the address's path and stops at the first range
+     * that contains it. IPv4 ranges are stored IPv4-mapped and so also match
+     * IPv4-mapped IPv6 addresses.
+     *
+     * Usage example:
+     * @code
+     * CidrSet internal({"10.0.0.0/8, 172.16.0.0/12", "fc00::/7"});
+     * bool hit = internal.Contains("10.1.2.3");
+     * @endcode
+     */
+    class CidrSet {
+        struct Node {
+            IpAddress prefix;
+            uint32_t length = 0;
+            bool terminal = false;
+            uint32_t children[2] = {0, 0};  // Index into nodes; 0 (the root) means none
+        };
+        std::vector<Node> nodes;
+        size_t ranges = 0;
+
+        uint32_t append(const IpAddress& prefix, const uint32_t length, const bool terminal) {
+            Node node;
+            node.prefix = prefix;
+            node.length = length;
+            node.terminal = terminal;
+            nodes.push_back(node);
+            return static_cast<uint32_t>(nodes.size() - 1);
+        }
+
+        void insert(const IpAddress& address, const uint32_t length) {
+            uint32_t current = 0;
+            while (true) {
+                if (nodes[current].terminal) return;  // Already covered by a shorter range
+                if (nodes[current].length == length) {
+                    nodes[current].terminal = true;
+                    nodes[current].children[0] = nodes[current].children[1] = 0;  // Everything below is covered
+                    return;
+                }
+                const int side = address.bit(nodes[current].length) ? 1 : 0;
+                const uint32_t child = nodes[current].children[side];
+                if (child == 0) {
+                    const uint32_t leaf = append(address, length, true);
+                    nodes[current].children[side] = leaf;
+                    return;
+                }
+                const auto common = static_cast<uint32_t>(std::min<size_t>(address.CommonPrefix(nodes[child].prefix),
+                                                                          std::min(nodes[child].length, length)));
+                if (common == nodes[child].length) {
+                    current = child;
+                    continue;
+                }
+                // Split the edge at the first differing bit
+                const uint32_t split = append(address.Truncated(common), common, common == length);
+                if (common != length) {  // Otherwise the new range covers the old subtree
+                    const uint32_t leaf = append(address, length, true);
+                    nodes[split].children[nodes[child].prefix.bit(common) ? 1 : 0] = child;
+                    nodes[split].children[address.bit(common) ? 1 : 0] = leaf;
+                }
+                nodes[current].children[side] = split;
+                return;
+            }
+        }
+
+    public:
+        CidrSet() { nodes.emplace_back(); }
+
+        /**
+         * @param specs Ranges such as "10.0.0.0/8" or "2001:db8::/32"; each string may hold several
+         *              separated by commas or whitespace, and an address without a length is a single host
+         * @throws ExprException For malformed ranges
+         */
+        explicit CidrSet(const std::vector<std::string>& specs) : CidrSet() {
+            for (const auto& spec : specs) Add(spec);
+        }
+
+        /**
+         * @brief Add one or more ranges (see the constructor)
+         * @throws ExprException For malformed ranges
+         */
+        void Add(const std::string_view specs) {
+            size_t i = 0;
+            while (i < specs.size()) {
+                const auto separator = [](const char c) { return c == ',' || std::isspace(static_cast<unsigned char>(c)); };
+                while (i < specs.size() && separator(specs[i])) ++i;
+                size_t end = i;
+                while (end < specs.size() && !separator(specs[end])) ++end;
+                if (end > i) addRange(specs.substr(i, end - i));
+                i = end;
+            }
+        }
+
+        bool Contains(const IpAddress& address) const {
+            uint32_t current = 0;
+            while (!nodes[current].terminal) {
+                const uint32_t child = nodes[current].children[address.bit(nodes[current].length) ? 1 : 0];
+                if (child == 0 || !address.SharesPrefix(nodes[child].prefix, nodes[child].length)) return false;
+                current = child;
+            }
+            return true;
+        }
+
+        /**
+         * @brief Whether the text is an address inside one of the ranges; malformed addresses are in none
+         */
+        bool Contains(const std::string_view text) const {
+            IpAddress address;
+            return IpAddress::Parse(text, address) && Contains(address);
+        }
+
+        /**
+         * @brief Whether an IPv4 address given as a 32-bit integer is inside one of the ranges
+         */
+        bool Contains(const double v4) const {
+            if (!(v4 >= 0.0 && v4 <= 4294967295.0) || v4 != std::floor(v4)) return false;
+            return Contains(IpAddress::FromIPv4(static_cast<uint32_t>(v4)));
+        }
+
+        size_t size() const { return ranges; }
+        size_t getNodeCount() const { return nodes.size(); }
+
+    private:
+        void addRange(const std::string_view range) {
+            const size_t slash = range.find('/');
+            IpAddress address;
+            if (!IpAddress::Parse(range.substr(0, slash), address)) throw ExprException("Invalid CIDR range: " + std::string(range));
+            const uint32_t offset = address.isIPv4() && range.substr(0, slash).find(':') == std::string_view::npos ? 96 : 0;
+            uint32_t length = 128;
+            if (slash != std::string_view::npos) {
+                const std::string_view digits = range.substr(slash + 1);
+                uint32_t bits = 0;
+                if (digits.empty() || digits.size() > 3) throw ExprException("Invalid CIDR range: " + std::string(range));
+                for (const char c : digits) {
+                    if (c < '0' || c > '9') throw ExprException("Invalid CIDR range: " + std::string(range));
+                    bits = bits * 10 + static_cast<uint32_t>(c - '0');
+                }
+                if (bits > 128 - offset) throw ExprException("Invalid CIDR range: " + std::string(range));
+                length = offset + bits;
+            }
+            insert(address.Truncated(length), length);
+            ++ranges;
+        }
+    };
+
+    /**
+     * @brief AST node for the `ip_in(address, ranges...)` built-in
+     *
+     * The address is an IPv4/IPv6 string or an IPv4 address as a 32-bit integer;
+     * each range argument is a string of CIDR ranges (see CidrSet). Literal ranges
+     * are compiled into one CidrSet when the expression is parsed, others on each
+     * evaluation. Batch evaluation parses each dictionary entry once. Addresses or
+     * ranges of other types go to a host function named `ip_in`.
+     */
+    class CidrMatchNode final : public ASTNode {
+        ASTNodePtr subject;
+        std::vector<ASTNodePtr> ranges;
+        std::shared_ptr<const CidrSet> compiled;
+
+        static bool test(const CidrSet& set, const Value& value) {
+            return value.isString() ? set.Contains(value.asStringView()) : set.Contains(value.data.number);
+        }
+
+        Value apply(const Value& value, const std::vector<Value>& sources, IEnvironment* environment, EvaluationContext* context) const {
+            const bool address = value.isNull() || value.isString() || value.isNumber();
+            bool strings = true, null = value.isNull();
+            for (const auto& source : sources) {
+                strings = strings && (source.isNull() || source.isString());
+                null = null || source.isNull();
+            }
+            if (!address || !strings) {
+                std::vector<Value> args{value};
+                args.insert(args.end(), sources.begin(), sources.end());
+                return CallHostFunction("ip_in", args, environment, context,
+                                        address ? "ip_in requires string CIDR ranges" : "ip_in requires a string or integer address");
+            }
+            if (null) return Value::Null();
+            if (compiled) return Value(test(*compiled, value));
+            CidrSet set;
+            for (const auto& source : sources) set.Add(source.asStringView());
+            return Value(test(set, value));
+        }
+
+        std::vector<Value> evaluateRanges(IEnvironment* environment, EvaluationContext* context) const {
+            std::vector<Value> sources;
+            for (const auto& range : ranges) sources.push_back(range->evaluate(environment, context));
+            return sources;
+        }
+
+    public:
+        CidrMatchNode(ASTNodePtr s, std::vector<ASTNodePtr> r, std::shared_ptr<const CidrSet> set = nullptr)
+            : subject(std::move(s)), ranges(std::move(r)), compiled(std::move(set)) {
+            if (compiled) return;
+            auto literals = std::make_shared<CidrSet>();
+            for (const auto& range : ranges) {
+                auto literal = std::dynamic_pointer_cast<StringNode>(range);
+                if (!literal) return;
+                literals->Add(literal->getValue());
+            }
+            compiled = std::move(literals);
+        }
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            const Value value = subject->evaluate(environment, context);
+            if (compiled && (value.isString() || value.isNumber())) return Value(test(*compiled, value));
+            return apply(value, evaluateRanges(environment, context), environment, context);
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            if (!compiled) return ASTNode::evaluateBatch(evaluation);
+            const Column values = evaluation.Evaluate(subject);
+            if (values.getKind() == Column::Kind::NUMBER) {
+                const size_t n = values.isConstant() ? 1 : values.size();
+                const double* x = values.numberData();
+                std::vector<uint8_t> out(n);
+                for (size_t i = 0; i < n; ++i) out[i] = compiled->Contains(x[i]) ? 1 : 0;
+                Column result = Column::Booleans(std::move(out));
+                return values.isConstant() ? Column::Constant(result.at(0), values.size()) : result.withValidityOf({&values});
+            }
+            const std::vector<Value> sources = evaluateRanges(nullptr, evaluation.getContext());
+            return MapStringColumn<uint8_t>(
+                values,
+                [&](const std::string_view s) { return compiled->Contains(s); },
+                [&](const Value& value) { return apply(value, sources, evaluation.getEnvironment(), evaluation.getContext()); });
+        }
+
+        ASTNodePtr getSubject() const { return subject; }
+        const std::vector<ASTNodePtr>& getRanges() const { return ranges; }
+        std::shared_ptr<const CidrSet> getCompiled() const { return compiled; }
+        std::vector<ASTNodePtr> getChildren() const override {
+            std::vector<ASTNodePtr> children{subject};
+            children.insert(children.end(), ranges.begin(), ranges.end());
+            return children;
+        }
+
+        // The compiled set is kept while the ranges are unchanged; new literal ranges are compiled again
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            std::vector<ASTNodePtr> newRanges(std::make_move_iterator(children.begin() + 1), std::make_move_iterator(children.end()));
+            bool same = compiled != nullptr;
+            for (size_t i = 0; same && i < ranges.size(); ++i) {
+                auto before = std::dynamic_pointer_cast<StringNode>(ranges[i]);
+                auto after = std::dynamic_pointer_cast<StringNode>(newRanges[i]);
+                same = newRanges[i] == ranges[i] || (before && after && before->getValue() == after->getValue());
+            }
+            return std::make_shared<CidrMatchNode>(std::move(children[0]), std::move(newRanges), same ? compiled : nullptr);
+        }
+        std::string structuralKey() const override { return "A"; }
+    };
+
+    /**
+     * @brief Great-circle distance in meters between two latitude/longitude points in degrees (haversine)
+     */
+    inline double GeoDistance(const double lat1, const double lon1, const double lat2, const double lon2) {
+        constexpr double radians = 3.14159265358979323846 / 180.0;
+        constexpr double earthRadius = 6371008.8;  // Mean radius in meters
+        const double sinLat = std::sin((lat2 - lat1) * (radians / 2));
+        const double sinLon = std::sin((lon2 - lon1) * (radians / 2));
+        const double h = sinLat * sinLat + std::cos(lat1 * radians) * std::cos(lat2 * radians) * sinLon * sinLon;
+        return 2.0 * earthRadius * std::asin(std::min(1.0, std::sqrt(h)));
+    }
+
+    /**
+     * @brief AST node for the `geo_distance(lat1, lon1, lat2, lon2)` built-in
+     *
+     * Batch evaluation runs over the raw coordinate arrays; when the second point
+     * is constant (distance to a fixed site) its cosine is computed once.
+     * Coordinates that are not numbers go to a host function named `geo_distance`.
+     */
+    class GeoDistanceNode final : public ASTNode {
+        std::vector<ASTNodePtr> args;  // lat1, lon1, lat2, lon2
+
+    public:
+        explicit GeoDistanceNode(std::vector<ASTNodePtr> a) : args(std::move(a)) {
+            if (args.size() != 4) throw ExprException("geo_distance requires 4 arguments");
+        }
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            std::vector<Value> values;
+            bool null = false, numeric = true;
+            for (const auto& arg : args) {
+                values.push_back(arg->evaluate(environment, context));
+                null = null || values.back().isNull();
+                numeric = numeric && (values.back().isNull() || values.back().isNumber());
+            }
+            if (!numeric) return CallHostFunction("geo_distance", values, environment, context, "geo_distance requires numeric coordinates");
+            if (null) return Value::Null();
+            return Value(GeoDistance(values[0].data.number, values[1].data.number, values[2].data.number, values[3].data.number));
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            std::vector<Column> columns;
+            for (const auto& arg : args) {
+                columns.push_back(evaluation.Evaluate(arg));
+                if (columns.back().getKind() != Column::Kind::NUMBER) return ASTNode::evaluateBatch(evaluation);
+            }
+            const size_t n = evaluation.size();
+            std::vector<double> out(n);
+            const double* lat1 = columns[0].numberData();
+            const double* lon1 = columns[1].numberData();
+            const double* lat2 = columns[2].numberData();
+            const double* lon2 = columns[3].numberData();
+            if (columns[2].isConstant() && columns[3].isConstant() && !columns[0].isConstant() && !columns[1].isConstant()) {
+                constexpr double radians = 3.14159265358979323846 / 180.0;
+                constexpr double earthRadius = 6371008.8;
+                const double cosLat2 = std::cos(lat2[0] * radians);
+                const double siteLat = lat2[0], siteLon = lon2[0];
+                for (size_t i = 0; i < n; ++i) {
+                    const double sinLat = std::sin((siteLat - lat1[i]) * (radians / 2));
+                    const double sinLon = std::sin((siteLon - lon1[i]) * (radians / 2));
+                    const double h = sinLat * sinLat + std::cos(lat1[i] * radians) * cosLat2 * sinLon * sinLon;
+                    out[i] = 2.0 * earthRadius * std::asin(std::min(1.0, std::sqrt(h)));
+                }
+            } else {
+                const size_t s0 = columns[0].isConstant() ? 0 : 1, s1 = columns[1].isConstant() ? 0 : 1;
+                const size_t s2 = columns[2].isConstant() ? 0 : 1, s3 = columns[3].isConstant() ? 0 : 1;
+                for (size_t i = 0; i < n; ++i) out[i] = GeoDistance(lat1[i * s0], lon1[i * s1], lat2[i * s2], lon2[i * s3]);
+            }
+            return Column::Numbers(std::move(out)).withValidityOf({&columns[0], &columns[1], &columns[2], &columns[3]});
+        }
+
+        const std::vector<ASTNodePtr>& getArguments() const { return args; }
+        std::vector<ASTNodePtr> getChildren() const override { return args; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            return std::make_shared<GeoDistanceNode>(std::move(children));
+        }
+        std::string structuralKey() const override { return "G"; }
+    };
+
+    /**
+     * @brief A polygon in latitude/longitude with a grid index for point-in-polygon tests
+     *
+     * The bounding box is divided into a grid. Cells that no edge touches are
+     * classified as inside or outside once, so most points are answered with one
+     * lookup; points in other cells are ray-cast against only the edges that
+     * overlap their grid row. The polygon is treated as planar in degrees and must
+     * not cross the antimeridian.
+     */
+    class GeoZone {
+        enum class Cell : uint8_t { OUTSIDE, INSIDE, MIXED };
+
+        std::vector<double> lats, lons;  // Vertices; edge i runs from vertex i to vertex i + 1 (wrapping)
+        double minLat, maxLat, minLon, maxLon;
+        size_t rows = 1, columns = 1;
+        double rowHeight = 1.0, columnWidth = 1.0;
+        std::vector<Cell> cells;
+        std::vector<std::vector<uint32_t>> bands;  // Edges overlapping each grid row
+
+        bool rayCast(const double lat, const double lon, const std::vector<uint32_t>& edges) const {
+            bool inside = false;
+            for (const uint32_t e : edges) {
+                const size_t next = e + 1 == lats.size() ? 0 : e + 1;
+                const double y1 = lats[e], y2 = lats[next];
+                if ((y1 > lat) != (y2 > lat) && lon < (lons[next] - lons[e]) * (lat - y1) / (y2 - y1) + lons[e]) inside = !inside;
+            }
+            return inside;
+        }
+
+        size_t rowOf(const double lat) const {
+            return std::min(rows - 1, static_cast<size_t>(std::max(0.0, (lat - minLat) / rowHeight)));
+        }
+
+        size_t columnOf(const double lon) const {
+            return std::min(columns - 1, static_cast<size_t>(std::max(0.0, (lon - minLon) / columnWidth)));
+        }
+
+    public:
+        /**
+         * @param vertices (latitude, longitude) pairs in degrees; the polygon closes itself
+         * @throws ExprException For fewer than 3 vertices or non-finite coordinates
+         */
+        explicit GeoZone(const std::vector<std::pair<double, double>>& vertices) {
+            if (vertices.size() < 3) throw ExprException("Zone requires at least 3 vertices");
+            for (const auto& vertex : vertices) {
+                if (!std::isfinite(vertex.first) || !std::isfinite(vertex.second)) throw ExprException("Zone vertices must be finite");
+                lats.push_back(vertex.first);
+                lons.push_back(vertex.second);
+            }
+            minLat = *std::min_element(lats.begin(), lats.end());
+            maxLat = *std::max_element(lats.begin(), lats.end());
+            minLon = *std::min_element(lons.begin(), lons.end());
+            maxLon = *std::max_element(lons.begin(), lons.end());
+
+            // About four cells per edge
+            rows = columns = std::min<size_t>(256, 2 * static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(lats.size())))));
+            if (maxLat > minLat) rowHeight = (maxLat - minLat) / static_cast<double>(rows);
+            if (maxLon > minLon) columnWidth = (maxLon - minLon) / static_cast<double>(columns);
+
+            cells.assign(rows * columns, Cell::OUTSIDE);
+            bands.resize(rows);
+            for (uint32_t e = 0; e < lats.size(); ++e) {
+                const size_t next = e + 1 == lats.size() ? 0 : e + 1;
+                const size_t r0 = rowOf(std::min(lats[e], lats[next])), r1 = rowOf(std::max(lats[e], lats[next]));
+                const size_t c0 = columnOf(std::min(lons[e], lons[next])), c1 = columnOf(std::max(lons[e], lons[next]));
+                for (size_t r = r0; r <= r1; ++r) {
+                    bands[r].push_back(e);
+                    for (size_t c = c0; c <= c1; ++c) cells[r * columns + c] = Cell::MIXED;
+                }
+            }
+            std::vector<uint32_t> all(lats.size());
+            for (uint32_t e = 0; e < all.size(); ++e) all[e] = e;
+            for (size_t r = 0; r < rows; ++r) {
+                for (size_t c = 0; c < columns; ++c) {
+                    Cell& cell = cells[r * columns + c];
+                    if (cell == Cell::MIXED) continue;
+                    const double lat = minLat + (static_cast<double>(r) + 0.5) * rowHeight;
+                    const double lon = minLon + (static_cast<double>(c) + 0.5) * columnWidth;
+                    cell = rayCast(lat, lon, all) ? Cell::INSIDE : Cell::OUTSIDE;
+                }
+            }
+        }
+
+        bool Contains(const double lat, const double lon) const {
+            if (!(lat >= minLat && lat <= maxLat && lon >= minLon && lon <= maxLon)) return false;
+            const size_t row = rowOf(lat);
+            const Cell cell = cells[row * columns + columnOf(lon)];
+            if (cell != Cell::MIXED) return cell == Cell::INSIDE;
+            return rayCast(lat, lon, bands[row]);
+        }
+
+        size_t getVertexCount() const { return lats.size(); }
+    };
+
+    /**
+     * @brief AST node for `within(lat, lon, "zone")` bound to a registered zone by BindGeoZones()
+     */
+    class GeoWithinNode final : public ASTNode {
+        ASTNodePtr lat, lon;
+        std::string name;
+        std::shared_ptr<const GeoZone> zone;
+
+    public:
+        GeoWithinNode(ASTNodePtr latitude, ASTNodePtr longitude, std::string zoneName, std::shared_ptr<const GeoZone> z)
+            : lat(std::move(latitude)), lon(std::move(longitude)), name(std::move(zoneName)), zone(std::move(z)) {
+            if (!zone) throw ExprException("within requires a zone");
+        }
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            const Value y = lat->evaluate(environment, context);
+            const Value x = lon->evaluate(environment, context);
+            if (y.isNull() || x.isNull()) return Value::Null();
+            if (!y.isNumber() || !x.isNumber()) throw ExprException("within requires numeric coordinates");
+            return Value(zone->Contains(y.data.number, x.data.number));
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            const Column y = evaluation.Evaluate(lat);
+            const Column x = evaluation.Evaluate(lon);
+            if (y.getKind() != Column::Kind::NUMBER || x.getKind() != Column::Kind::NUMBER) return ASTNode::evaluateBatch(evaluation);
+            const size_t n = evaluation.size();
+            const size_t sy = y.isConstant() ? 0 : 1, sx = x.isConstant() ? 0 : 1;
+            const double* lats = y.numberData();
+            const double* lons = x.numberData();
+            std::vector<uint8_t> out(n);
+            for (size_t i = 0; i < n; ++i) out[i] = zone->Contains(lats[i * sy], lons[i * sx]) ? 1 : 0;
+            return Column::Booleans(std::move(out)).withValidityOf({&y, &x});
+        }
+
+        ASTNodePtr getLatitude() const { return lat; }
+        ASTNodePtr getLongitude() const { return lon; }
+        const std::string& getZoneName() const { return name; }
+        const std::shared_ptr<const GeoZone>& getZone() const { return zone; }
+        std::vector<ASTNodePtr> getChildren() const override { return {lat, lon}; }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            return std::make_shared<GeoWithinNode>(std::move(children[0]), std::move(children[1]), name, zone);
+        }
+        std::string structuralKey() const override { return "W" + name + "@" + IdentityKey(zone.get()); }
+    };
+
+    /**
+     * @brief AST node for a polynomial c0 + c1*x + ... + cn*x^n evaluated in Horner form
+     *
+     * Built by OptimizePolynomials(). Each coefficient is a sum of terms, a
+     * constant times a product of powers of atoms: subexpressions that do not
+     * expand further, such as other variables or function calls. x and every
+     * atom are evaluated once, the coefficients are formed from them, and they
+     * are combined with n multiply-adds (fused when the platform has a fast fma).
+     * If x or an atom is not a finite number, the original expression is
+     * evaluated instead so errors, null and string semantics are unchanged.
+     */
+    class PolynomialNode final : public ASTNode {
+    public:
+        /**
+         * @brief One term: constant * x^degree * product of atom^exponent
+         */
+        struct Term {
+            size_t degree;
+            double constant;
+            std::vector<std::pair<size_t, unsigned>> powers;  // (atom index, exponent)
+        };
+
+    private:
+        ASTNodePtr variable;
+        std::vector<ASTNodePtr> atoms;  // Including atoms whose terms cancelled, for their null semantics
+        std::vector<Term> terms;
+        ASTNodePtr source;
+        size_t degree = 0;
+        std::vector<double> constants;  // The coefficients when there are no atoms
+
+        static double multiplyAdd(const double a, const double b, const double c) {
+#ifdef FP_FAST_FMA
+            return std::fma(a, b, c);
+#else
+            return a * b + c;
+#endif
+        }
+
+        static double power(double base, unsigned exponent) {
+            double result = 1.0;
+            for (; exponent; exponent >>= 1, base *= base) {
+                if (exponent & 1) result *= base;
+            }
+            return result;
+        }
+
+        // Coefficients from the atom values at(a), then the Horner form at x
+        template <typename AtomAt>
+        double horner(const double x, const AtomAt& at, std::vector<double>& c) const {
+            std::fill(c.begin(), c.end(), 0.0);
+            for (const auto& term : terms) {
+                double value = term.constant;
+                for (const auto& p : term.powers) value *= power(at(p.first), p.second);
+                c[term.degree] += value;
+            }
+            double result = c[degree];
+            for (size_t k = degree; k-- > 0;) result = multiplyAdd(result, x, c[k]);
+            return result;
+        }
+
+    public:
+        PolynomialNode(ASTNodePtr x, std::vector<ASTNodePtr> a, std::vector<Term> t, ASTNodePtr original)
+            : variable(std::move(x)), atoms(std::move(a)), terms(std::move(t)), source(std::move(original)) {
+            for (const auto& term : terms) {
+                for (const auto& p : term.powers) {
+                    if (p.first >= atoms.size()) throw ExprException("Polynomial term refers to a missing atom");
+                }
+                degree = std::max(degree, term.degree);
+            }
+            if (!atoms.empty()) return;
+            constants.assign(degree + 1, 0.0);
+            for (const auto& term : terms) constants[term.degree] += term.constant;
+        }
+
+        Value evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const override {
+            EvaluationContext::Frame frame(context);
+            const auto usable = [](const Value& value) { return value.isNull() || (value.isNumber() && std::isfinite(value.data.number)); };
+            const Value x = variable->evaluate(environment, context);
+            bool null = x.isNull();
+            if (!usable(x)) return source->evaluate(environment, context);
+            std::vector<double> values(atoms.size());
+            for (size_t a = 0; a < atoms.size(); ++a) {
+                const Value value = atoms[a]->evaluate(environment, context);
+                if (!usable(value)) return source->evaluate(environment, context);
+                null = null || value.isNull();
+                if (!value.isNull()) values[a] = value.data.number;
+            }
+            if (null) return Value::Null();
+            if (!constants.empty()) {
+                double result = constants[degree];
+                for (size_t k = degree; k-- > 0;) result = multiplyAdd(result, x.data.number, constants[k]);
+                return Value(result);
+            }
+            std::vector<double> c(degree + 1);
+            return Value(horner(x.data.number, [&](const size_t a) { return values[a]; }, c));
+        }
+
+        Column evaluateBatch(BatchEvaluation& evaluation) const override {
+            const size_t n = evaluation.size();
+            std::vector<Column> columns{evaluation.Evaluate(variable)};
+            for (const auto& atom : atoms) columns.push_back(evaluation.Evaluate(atom));
+            std::vector<const Column*> sources;
+            for (const auto& column : columns) {
+                if (column.getKind() != Column::Kind::NUMBER) return ASTNode::evaluateBatch(evaluation);
+                const double* data = column.numberData();
+                for (size_t i = 0, rows = column.isConstant() ? 1 : n; i < rows; ++i) {
+                    if (!std::isfinite(data[i]) && column.isValid(i)) return ASTNode::evaluateBatch(evaluation);
+                }
+                sources.push_back(&column);
+            }
+            const size_t sx = columns[0].isConstant() ? 0 : 1;
+            const double* xs = columns[0].numberData();
+            std::vector<double> out(n);
+            if (!constants.empty()) {
+                for (size_t i = 0; i < n; ++i) {
+                    double result = constants[degree];
+                    for (size_t k = degree; k-- > 0;) result = multiplyAdd(result, xs[i * sx], constants[k]);
+                    out[i] = result;
+                }
+            } else {
+                std::vector<double> c(degree + 1);
+                for (size_t i = 0; i < n; ++i) {
+                    out[i] = horner(xs[i * sx], [&](const size_t a) {
+                        const Column& column = columns[a + 1];
+                        return column.numberData()[column.isConstant() ? 0 : i];
+                    }, c);
+                }
+            }
+            return Column::Numbers(std::move(out)).withValidityOf(sources);
+        }
+
+        ASTNodePtr getVariable() const { return variable; }
+        const std::vector<ASTNodePtr>& getAtoms() const { return atoms; }
+        const std::vector<Term>& getTerms() const { return terms; }
+        ASTNodePtr getSource() const { return source; }
+        size_t getDegree() const { return degree; }
+
+        /**
+         * @brief The coefficient of x^k when it is a constant (no atoms), else NaN
+         */
+        double getConstantCoefficient(const size_t k) const {
+            double result = 0.0;
+            for (const auto& term : terms) {
+                if (term.degree != k) continue;
+                if (!term.powers.empty()) return std::numeric_limits<double>::quiet_NaN();
+                result += term.constant;
+            }
+            return result;
+        }
+
+        std::vector<ASTNodePtr> getChildren() const override {
+            std::vector<ASTNodePtr> children{variable};
+            children.insert(children.end(), atoms.begin(), atoms.end());
+            children.push_back(source);
+            return children;
+        }
+        ASTNodePtr withChildren(std::vector<ASTNodePtr> children) const override {
+            std::vector<ASTNodePtr> a(std::make_move_iterator(children.begin() + 1), std::make_move_iterator(children.end() - 1));
+            return std::make_shared<PolynomialNode>(std::move(children[0]), std::move(a), terms, std::move(children.back()));
+        }
+        std::string structuralKey() const override {
+            std::string key = "Y";
+            for (const auto& term : terms) {
+                uint64_t bits;
+                std::memcpy(&bits, &term.constant, sizeof(bits));
+                key += std::to_string(term.degree) + ":" + std::to_string(bits);
+                for (const auto& p : term.powers) key += "*" + std::to_string(p.first) + "^" + std::to_string(p.second);
+                key += ";";
+            }
+            return key;
+        }
+    };
+
+    /**
+     * @brief Create the AST node for a function call
+     *
+     * Built-ins that need their own node type (such as the stateful streaming
+     * functions, `matches`, `ip_in`, `geo_distance`, hashing and prefix/suffix or case-insensitive tests against literals) are recognized here; everything else becomes a
+     * FunctionCallNode.
+     */
+    inline ASTNodePtr MakeFunctionCallNode(const std::string& name, std::vector<ASTNodePtr> args) {
+        if (auto window = WindowFunctionNode::Create(name, args)) return window;
+        // Literal arguments of the wrong type leave the call to the host
+        const auto numeric = [](const ASTNodePtr& arg) {
+            return std::dynamic_pointer_cast<NumberNode>(arg) || std::dynamic_pointer_cast<BooleanNode>(arg);
+        };
+        if (name == "matches" && args.size() == 2 && !numeric(args[0]) && !numeric(args[1])) {
+            return std::make_shared<RegexMatchNode>(args[0], args[1]);
+        }
+        if (HashNode::Accepts(name, args)) return std::make_shared<HashNode>(name, std::move(args));
+        const auto nonNumeric = [](const ASTNodePtr& arg) {
+            return std::dynamic_pointer_cast<StringNode>(arg) || std::dynamic_pointer_cast<BooleanNode>(arg);
+        };
+        if (name == "geo_distance" && args.size() == 4 && std::none_of(args.begin(), args.end(), nonNumeric)) {
+            return std::make_shared<GeoDistanceNode>(std::move(args));
+        }
+        if (name == "ip_in" && args.size() >= 2 && !std::dynamic_pointer_cast<BooleanNode>(args[0]) &&
+            std::none_of(args.begin() + 1, args.end(), numeric)) {
+            ASTNodePtr subject = args[0];
+            return std::make_shared<CidrMatchNode>(std::move(subject), std::vector<ASTNodePtr>(args.begin() + 1, args.end()));
+        }
+        if ((name == "starts_with" || name == "ends_with") && args.size() == 2) {
+            if (auto literal = std::dynamic_pointer_cast<StringNode>(args[1])) {
+                return std::make_shared<AffixMatchNode>(args[0], literal->getValue(), name == "ends_with");
+            }
+        }
+        if ((name == "ieq" || name == "icontains") && args.size() == 2) {
+            if (auto literal = std::dynamic_pointer_cast<StringNode>(args[1])) {
+                return std::make_shared<CaseInsensitiveMatchNode>(args[0], literal->getValue(), name == "icontains");
+            }
+            // ieq is symmetric, so a literal on the left works too
+            if (auto literal = std::dynamic_pointer_cast<StringNode>(args[0]); literal && name == "ieq") {
+                return std::make_shared<CaseInsensitiveMatchNode>(args[1], literal->getValue(), false, true);
+            }
+        }
+        return std::make_shared<FunctionCallNode>(name, std::move(args));
+    }
+
+    /**
+     * @brief Recursive descent parser for expression strings
+     *
+     * This class implements a complete expression parser using the recursive
+     * descent parsing technique. It supports operator precedence, associativity,
+     * and proper error reporting.
+     *
+     * Grammar (in order of precedence, highest to lowest):
+     * - Primary: numbers, booleans, variables, function calls, parentheses
+     * - Unary: !, not, - (unary minus)
+     * - Multiplicative: *, /
+     * - Additive: +, -
+     * - Relational: <, >, <=, >=
+     * - Equality: ==, !=
+     * - Logical XOR: xor
+     * - Logical AND: &&, and
+     * - Logical OR: ||, or
+     * - Ternary conditional: ? :
+     *
+     * The parser is designed to be used once per expression string and
+     * produces an AST that can be evaluated multiple times efficiently.
+     */
+    class Parser {
+        std::string expr;
+        size_t pos = 0;
+        std::vector<Token>* tokens = nullptr;  // Optional token collection
+
+        void addToken(TokenType type, size_t start, size_t length, const std::string& text) {
+            if (tokens) {
+                tokens->emplace_back(type, start, length, text);
+            }
+        }
+
+        void addToken(TokenType type, size_t start, size_t length) {
+            if (tokens && start + length <= expr.length()) {
+                addToken(type, start, length, expr.substr(start, length));
+            }
+        }
+
+        void skipWhitespace() {
+            size_t start = pos;
+            while (pos < expr.size() && std::isspace(expr[pos])) ++pos;
+            if (tokens && pos > start) {
+                addToken(TokenType::WHITESPACE, start, pos - start);
+            }
+        }
+
+        bool match(const std::string& str) {
+            skipWhitespace();
+            if (pos + str.length() <= expr.size() &&
+                expr.substr(pos, str.length()) == str) {
+                addToken(TokenType::OPERATOR, pos, str.length(), str);
+                pos += str.length();
+                return true;
+            }
+            return false;
+        }
+
+        bool match(const char c) {
+            skipWhitespace();
+            if (pos < expr.size() && expr[pos] == c) {
+                TokenType type = (c == '(' || c == ')') ? TokenType::PARENTHESIS :
+                                (c == ',') ? TokenType::COMMA : TokenType::OPERATOR;
+                addToken(type, pos, 1, std::string(1, c));
+                ++pos;
+                return true;
+            }
+            return false;
+        }
+
+        char peek() {
+            skipWhitespace();
+            if (pos >= expr.size()) return '\0';
+            return expr[pos];
+        }
+
+        std::string peekString(const size_t len) {
+            skipWhitespace();
+            if (pos + len > expr.size()) return "";
+            return expr.substr(pos, len);
+        }
+
+        char consume() {
+            skipWhitespace();
+            if (pos >= expr.size()) throw ExprException("Unexpected end of expression");
+            char c = expr[pos];
+            addToken(TokenType::OPERATOR, pos, 1, std::string(1, c));
+            return expr[pos++];
+        }
+
+        // 解析三元表达式（最低优先级）
+        ASTNodePtr parseTernaryExpression() {
+            auto condition = parseOrExpression();
+            if (match("?")) {
+                auto trueExpr = parseTernaryExpression(); // Right associative
+                if (!match(":")) {
+                    throw ExprException("Expected ':' in ternary expression");
+                }
+                auto falseExpr = parseTernaryExpression(); // Right associative
+                return std::make_shared<TernaryOpNode>(condition, trueExpr, falseExpr, OperatorType::TERNARY);
+            }
+            return condition;
+        }
+
+        // 解析逻辑表达式（最低优先级）
+        ASTNodePtr parseOrExpression() {
+            auto left = parseAndExpression();
+            while (match("||") || match("or")) {
+                auto right = parseAndExpression();
+                left = std::make_shared<BinaryOpNode>(left, OperatorType::OR, right);
+            }
+            return left;
+        }
+
+        // 解析与表达式
+        ASTNodePtr parseAndExpression() {
+            auto left = parseXorExpression();
+            while (match("&&") || match("and")) {
+                auto right = parseXorExpression();
+                left = std::make_shared<BinaryOpNode>(left, OperatorType::AND, right);
+            }
+            return left;
+        }
+
+        // 解析异或表达式
+        ASTNodePtr parseXorExpression() {
+            auto left = parseEqualityExpression();
+            while (match("xor")) {
+                auto right = parseEqualityExpression();
+                left = std::make_shared<BinaryOpNode>(left, OperatorType::XOR, right);
+            }
+            return left;
+        }
+
+        // 解析相等性表达式
+        ASTNodePtr parseEqualityExpression() {
+            auto left = parseRelationalExpression();
+            while (true) {
+                if (match("==")) {
+                    auto right = parseRelationalExpression();
+                    left = std::make_shared<BinaryOpNode>(left, OperatorType::EQ, right);
+                } else if (match("!=")) {
+                    auto right = parseRelationalExpression();
+                    left = std::make_shared<BinaryOpNode>(left, OperatorType::NE, right);
+                } else {
+                    break;
+                }
+            }
+            return left;
+        }
+
+        // 解析关系表达式
+        ASTNodePtr parseRelationalExpression() {
+            auto left = parseAdditiveExpression();
+            while (true) {
+                if (match(">=")) {
+                    auto right = parseAdditiveExpression();
+                    left = std::make_shared<BinaryOpNode>(left, OperatorType::GE, right);
+                } else if (match("<=")) {
+                    auto right = parseAdditiveExpression();
+                    left = std::make_shared<BinaryOpNode>(left, OperatorType::LE, right);
+                } else if (match(">")) {
+                    auto right = parseAdditiveExpression();
+                    left = std::make_shared<BinaryOpNode>(left, OperatorType::GT, right);
+                } else if (match("<")) {
+                    auto right = parseAdditiveExpression();
+                    left = std::make_shared<BinaryOpNode>(left, OperatorType::LT, right);
+                } else if (match("in")) {
+                    auto right = parseAdditiveExpression();
+                    left = std::make_shared<BinaryOpNode>(left, OperatorType::IN, right);
+                } else {
+                    break;
+                }
+            }
+            return left;
+        }
+
+        // 解析加减表达式
+        ASTNodePtr parseAdditiveExpression() {
+            auto left = parseMultiplicativeExpression();
+            while (peek() == '+' || peek() == '-') {
+                const char op = consume();
+                auto right = parseMultiplicativeExpression();
+                OperatorType opType = (op == '+') ? OperatorType::ADD : OperatorType::SUB;
+                left = std::make_shared<BinaryOpNode>(left, opType, right);
+            }
+            return left;
+        }
+
+        // 解析乘除表达式
+        ASTNodePtr parseMultiplicativeExpression() {
+            auto left = parseUnaryExpression();
+            while (peek() == '*' || peek() == '/') {
+                const char op = consume();
+                auto right = parseUnaryExpression();
+                OperatorType opType = (op == '*') ? OperatorType::MUL : OperatorType::DIV;
+                left = std::make_shared<BinaryOpNode>(left, opType, right);
+            }
+            return left;
+        }
+
+        // 解析一元表达式
+        ASTNodePtr parseUnaryExpression() {
+            if (match("!") || match("not")) {
+                auto operand = parseUnaryExpression();
+                return std::make_shared<UnaryOpNode>(OperatorType::NOT, operand);
+            }
+
+            if (match("-")) {
+                auto operand = parseUnaryExpression();
+                return std::make_shared<UnaryOpNode>(OperatorType::SUB, operand);
+            }
+
+            return parsePrimaryExpression();
+        }
+
+        // 解析基本表达式
+        ASTNodePtr parsePrimaryExpression() {
+            if (match('(')) {
+                auto expr = parseTernaryExpression();
+                if (!match(')')) throw ExprException("Missing closing parenthesis");
+                return expr;
+            }
+
+            if (std::isdigit(peek()) || peek() == '.') {
+                size_t start = pos;
+                std::string num;
+                while (pos < expr.size() && (std::isdigit(expr[pos]) || expr[pos] == '.')) {
+                    num += expr[pos++];
+                }
+                addToken(TokenType::NUMBER, start, pos - start, num);
+                return std::make_shared<NumberNode>(std::stod(num));
+            }
+
+            // 解析字符串字面量
+            if (peek() == '"') {
+                size_t start = pos;
+                ++pos; // 跳过开始的引号
+                std::string str;
+                
+                while (pos < expr.size() && expr[pos] != '"') {
+                    if (expr[pos] == '\\' && pos + 1 < expr.size()) {
+                        // 处理转义序列
+                        ++pos; // 跳过反斜杠
+                        switch (expr[pos]) {
+                            case 'n': str += '\n'; break;
+                            case 't': str += '\t'; break;
+                            case 'r': str += '\r'; break;
+                            case '\\': str += '\\'; break;
+                            case '"': str += '"'; break;
+                            default:
+                                // 未知转义序列，保留原字符
+                                str += '\\';
+                                str += expr[pos];
+                                break;
+                        }
+                        ++pos;
+                    } else {
+                        str += expr[pos++];
+                    }
+                }
+                
+                if (pos >= expr.size()) {
+                    throw ExprException("Unterminated string literal");
+                }
+                
+                ++pos; // Skip the closing quote
+                addToken(TokenType::STRING, start, pos - start, "\"" + str + "\"");
+                return std::make_shared<StringNode>(str);
+            }
+
+            if (std::isalpha(peek())) {
+                size_t start = pos;
+                std::string ident;
+                while (pos < expr.size() && (std::isalnum(expr[pos]) || expr[pos] == '.' || expr[pos] == '_')) {
+                    ident += expr[pos++];
+                }
+
+                if (match('(')) {
+                    std::vector<ASTNodePtr> args;
+                    if (!match(')')) {
+                        do {
+                            args.push_back(parseTernaryExpression());
+                        } while (match(','));
+                        if (!match(')')) throw ExprException("Missing closing parenthesis in function call");
+                    }
+                    addToken(TokenType::IDENTIFIER, start, ident.length(), ident);
+                    return MakeFunctionCallNode(ident, args);
+                }
+
+                if (ident == "true") {
+                    addToken(TokenType::BOOLEAN, start, ident.length(), ident);
+                    return std::make_shared<BooleanNode>(true);
+                }
+                if (ident == "false") {
+                    addToken(TokenType::BOOLEAN, start, ident.length(), ident);
+                    return std::make_shared<BooleanNode>(false);
+                }
+                if (ident == "null") {
+                    addToken(TokenType::NULL_VALUE, start, ident.length(), ident);
+                    return std::make_shared<NullNode>();
+                }
+
+                addToken(TokenType::IDENTIFIER, start, ident.length(), ident);
+                return std::make_shared<VariableNode>(ident);
+            }
+
+            throw ExprException("Unrecognized expression");
+        }
+
+    public:
+        explicit Parser(const std::string& expression) : expr(expression) {}
+        explicit Parser(const std::string& expression, std::vector<Token>* tokenVector) 
+            : expr(expression), tokens(tokenVector) {}
+
+        ASTNodePtr parse() {
+            pos = 0;
+            auto result = parseTernaryExpression();
+            skipWhitespace();
+            if (pos < expr.size()) throw ExprException("Incomplete expression parsing");
+            return result;
+        }
+    };
+
+    /**
+     * @brief Collect the distinct variable names referenced by an expression
+     * @param node Root of the expression
+     * @param names Receives names in first-appearance order (existing entries are kept)
+     */
+    inline void CollectVariables(const ASTNodePtr& node, std::vector<std::string>& names) {
+        if (!node) return;
+        if (auto variable = std::dynamic_pointer_cast<VariableNode>(node)) {
+            if (std::find(names.begin(), names.end(), variable->getName()) == names.end()) {
+                names.push_back(variable->getName());
+            }
+            return;
+        }
+        for (const auto& child : node->getChildren()) CollectVariables(child, names);
+    }
+
+    /**
+     * @brief Bound the numeric value of an expression using interval arithmetic
+     * @param node Root of the expression
+     * @param ranges Known ranges of variables; unknown variables are unbounded
+     * @return A range guaranteed to contain every value the expression can produce
+     *
+     * Handles arithmetic operators, unary minus, the ternary operator and the
+     * monotone or bounded standard functions. Anything else (host functions,
+     * strings, booleans) yields an unbounded interval.
+     */
+    inline Interval ComputeInterval(const ASTNodePtr& node, const IntervalMap& ranges) {
+        constexpr double inf = std::numeric_limits<double>::infinity();
+        const Interval unbounded;
+        const auto sanitize = [&](const Interval& r) {
+            return (std::isnan(r.lower) || std::isnan(r.upper)) ? unbounded : r;
+        };
+
+        if (auto number = std::dynamic_pointer_cast<NumberNode>(node)) {
+            return Interval::Point(number->getValue());
+        }
+        if (auto variable = std::dynamic_pointer_cast<VariableNode>(node)) {
+            const auto it = ranges.find(variable->getName());
+            return it != ranges.end() ? it->second : unbounded;
+        }
+        if (auto unary = std::dynamic_pointer_cast<UnaryOpNode>(node)) {
+            if (unary->getOperator() != OperatorType::SUB) return unbounded;
+            const Interval a = ComputeInterval(unary->getOperand(), ranges);
+            return Interval(-a.upper, -a.lower);
+        }
+        if (auto ternary = std::dynamic_pointer_cast<TernaryOpNode>(node)) {
+            const Interval a = ComputeInterval(ternary->getTrueExpr(), ranges);
+            const Interval b = ComputeInterval(ternary->getFalseExpr(), ranges);
+            return Interval(std::min(a.lower, b.lower), std::max(a.upper, b.upper));
+        }
+        if (auto binary = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+            const Interval a = ComputeInterval(binary->getLeft(), ranges);
+            const Interval b = ComputeInterval(binary->getRight(), ranges);
+            switch (binary->getOperator()) {
+                case OperatorType::ADD: return sanitize(Interval(a.lower + b.lower, a.upper + b.upper));
+                case OperatorType::SUB: return sanitize(Interval(a.lower - b.upper, a.upper - b.lower));
+                case OperatorType::MUL:
+                case OperatorType::DIV: {
+                    Interval rhs = b;
+                    if (binary->getOperator() == OperatorType::DIV) {
+                        if (b.contains(0.0)) return unbounded;
+                        rhs = Interval(1.0 / b.upper, 1.0 / b.lower);
+                    }
+                    const double p[] = { a.lower * rhs.lower, a.lower * rhs.upper, a.upper * rhs.lower, a.upper * rhs.upper };
+                    Interval result(inf, -inf);
+                    for (const double v : p) {
+                        if (std::isnan(v)) return unbounded;
+                        result.lower = std::min(result.lower, v);
+                        result.upper = std::max(result.upper, v);
+                    }
+                    return result;
+                }
+                default: return unbounded;
+            }
+        }
+        if (auto call = std::dynamic_pointer_cast<FunctionCallNode>(node)) {
+            const auto& name = call->getName();
+            const auto& args = call->getArguments();
+            if (args.size() == 2 && (name == "min" || name == "max")) {
+                const Interval a = ComputeInterval(args[0], ranges);
+                const Interval b = ComputeInterval(args[1], ranges);
+                if (name == "min") return Interval(std::min(a.lower, b.lower), std::min(a.upper, b.upper));
+                return Interval(std::max(a.lower, b.lower), std::max(a.upper, b.upper));
+            }
+            if (args.size() == 2 && name == "pow") {
+                const Interval a = ComputeInterval(args[0], ranges);
+                const auto exponent = std::dynamic_pointer_cast<NumberNode>(args[1]);
+                if (!exponent || exponent->getValue() < 0 || a.lower < 0) return unbounded;
+                return sanitize(Interval(std::pow(a.lower, exponent->getValue()), std::pow(a.upper, exponent->getValue())));
+            }
+            if (args.size() != 1) return unbounded;
+            const Interval a = ComputeInterval(args[0], ranges);
+            if (name == "sin" || name == "cos") return Interval(-1.0, 1.0);
+            if (name == "abs") {
+                if (a.lower >= 0) return a;
+                if (a.upper <= 0) return Interval(-a.upper, -a.lower);
+                return Interval(0.0, std::max(-a.lower, a.upper));
+            }
+            // Negative arguments go to the host, which may return anything
+            if (name == "sqrt") return a.lower >= 0 ? Interval(std::sqrt(a.lower), std::sqrt(a.upper)) : unbounded;
+            if (name == "exp") return Interval(std::exp(a.lower), std::exp(a.upper));
+            if (name == "log") return a.lower > 0 ? Interval(std::log(a.lower), std::log(a.upper)) : unbounded;
+            if (name == "floor") return Interval(std::floor(a.lower), std::floor(a.upper));
+            if (name == "ceil") return Interval(std::ceil(a.lower), std::ceil(a.upper));
+            if (name == "round") return Interval(std::round(a.lower), std::round(a.upper));
+        }
+        return unbounded;
+    }
+
+    /**
+     * @brief A row of a batch together with its score, as returned by TopK()
+     */
+    struct ScoredRow {
+        size_t row;
+        double score;
+    };
+
+    /**
+     * @brief Counters describing how much work TopK() did
+     */
+    struct TopKStats {
+        size_t termEvaluations = 0;   // Rows times additive terms actually evaluated
+        size_t prunedRows = 0;        // Rows discarded before their score was complete
+    };
+
+    /**
+     * @brief Find the k rows of a batch with the highest score
+     * @param score Numeric scoring expression
+     * @param batch Candidate rows
+     * @param k Number of rows to keep
+     * @param environment Optional environment for variables not in the batch and host functions
+     * @param context Optional budget and cancellation context
+     * @param stats Optional counters describing the work done
+     * @return Up to k rows ordered by descending score; ties keep the lower row index
+     * @throws ExprException If the score is not numeric or evaluation fails
+     *
+     * The score is evaluated in batch mode into a bounded heap. When the score is a
+     * sum or difference of terms whose ranges interval analysis can bound (from the
+     * batch's own column ranges), terms are evaluated one at a time and rows whose
+     * partial score plus the best the remaining terms could add cannot beat the
+     * current k-th score are dropped before the remaining terms are evaluated.
+     * Rows scoring NaN or null are ignored.
+     */
+    inline std::vector<ScoredRow> TopK(const ASTNodePtr& score, const Batch& batch, const size_t k,
+                                       IEnvironment* environment = nullptr,
+                                       EvaluationContext* context = nullptr,
+                                       TopKStats* stats = nullptr) {
+        constexpr size_t CHUNK_SIZE = 1024;
+        TopKStats localStats;
+        TopKStats& counters = stats ? *stats : localStats;
+        if (k == 0 || batch.size() == 0) return {};
+
+        // Worse rows sort last under `better`, so the heap front is the current k-th row
+        const auto better = [](const ScoredRow& a, const ScoredRow& b) {
+            return a.score > b.score || (a.score == b.score && a.row < b.row);
+        };
+        std::vector<ScoredRow> heap;
+        heap.reserve(k);
+        const auto offer = [&](const size_t row, const double value) {
+            if (std::isnan(value)) return;
+            const ScoredRow candidate{row, value};
+            if (heap.size() < k) {
+                heap.push_back(candidate);
+                std::push_heap(heap.begin(), heap.end(), better);
+            } else if (better(candidate, heap.front())) {
+                std::pop_heap(heap.begin(), heap.end(), better);
+                heap.back() = candidate;
+                std::push_heap(heap.begin(), heap.end(), better);
+            }
+        };
+        const auto requireNumbers = [](const Column& column) {
+            if (column.getKind() != Column::Kind::NUMBER) throw ExprException("TopK requires a numeric score");
+        };
+
+        // Split the left spine of + and - into terms, so partial sums match tree evaluation exactly
+        struct Term { ASTNodePtr node; bool negate; std::vector<std::string> variables; };
+        std::vector<Term> terms;
+        ASTNodePtr spine = score;
+        while (auto binary = std::dynamic_pointer_cast<BinaryOpNode>(spine)) {
+            if (binary->getOperator() != OperatorType::ADD && binary->getOperator() != OperatorType::SUB) break;
+            terms.push_back({binary->getRight(), binary->getOperator() == OperatorType::SUB, {}});
+            spine = binary->getLeft();
+        }
+        terms.push_back({spine, false, {}});
+        std::reverse(terms.begin(), terms.end());
+
+        // remaining[j] bounds what terms j.. can still add to a partial score
+        const IntervalMap ranges = batch.ComputeRanges();
+        std::vector<double> remaining(terms.size() + 1, 0.0);
+        for (size_t j = terms.size(); j-- > 0;) {
+            const Interval range = ComputeInterval(terms[j].node, ranges);
+            remaining[j] = remaining[j + 1] + (terms[j].negate ? -range.lower : range.upper);
+            CollectVariables(terms[j].node, terms[j].variables);
+        }
+        const bool prunable = terms.size() > 1 && std::isfinite(remaining[1]);
+
+        if (!prunable) {
+            BatchEvaluation evaluation(batch, environment, context);
+            const Column scores = evaluation.Evaluate(score);
+            requireNumbers(scores);
+            counters.termEvaluations += batch.size();
+            for (size_t row = 0; row < batch.size(); ++row) {
+                if (scores.isValid(row)) offer(row, scores.numberAt(row));
+            }
+        } else {
+            std::vector<size_t> selection;
+            std::vector<double> partial;
+            for (size_t begin = 0; begin < batch.size(); begin += CHUNK_SIZE) {
+                const size_t count = std::min(CHUNK_SIZE, batch.size() - begin);
+                selection.resize(count);
+                partial.assign(count, 0.0);
+                for (size_t i = 0; i < count; ++i) selection[i] = begin + i;
+
+                for (size_t j = 0; j < terms.size() && !selection.empty(); ++j) {
+                    Column values;
+                    if (j == 0) {
+                        BatchEvaluation evaluation(batch, environment, context, begin, count);
+                        values = evaluation.Evaluate(terms[j].node);
+                    } else {
+                        const Batch selected = batch.Select(selection, &terms[j].variables);
+                        BatchEvaluation evaluation(selected, environment, context);
+                        values = evaluation.Evaluate(terms[j].node);
+                    }
+                    requireNumbers(values);
+                    counters.termEvaluations += selection.size();
+                    for (size_t i = 0; i < selection.size(); ++i) {
+                        const double v = values.numberAt(i);
+                        partial[i] = j == 0 ? v : (terms[j].negate ? partial[i] - v : partial[i] + v);
+                    }
+                    if (values.hasValidity()) {
+                        // A null term makes the score null, and null scores are not ranked
+                        size_t kept = 0;
+                        for (size_t i = 0; i < selection.size(); ++i) {
+                            if (!values.isValid(i)) continue;
+                            selection[kept] = selection[i];
+                            partial[kept] = partial[i];
+                            ++kept;
+                        }
+                        selection.resize(kept);
+                        partial.resize(kept);
+                    }
+
+                    // Drop rows that cannot beat the current k-th score, allowing for rounding
+                    if (heap.size() < k || j + 1 == terms.size()) continue;
+                    const double threshold = heap.front().score;
+                    size_t kept = 0;
+                    for (size_t i = 0; i < selection.size(); ++i) {
+                        const double bound = partial[i] + remaining[j + 1];
+                        const double slack = 1e-12 * (std::abs(bound) + std::abs(threshold));
+                        if (bound + slack <= threshold) continue;
+                        selection[kept] = selection[i];
+                        partial[kept] = partial[i];
+                        ++kept;
+                    }
+                    counters.prunedRows += selection.size() - kept;
+                    selection.resize(kept);
+                    partial.resize(kept);
+                }
+                for (size_t i = 0; i < selection.size(); ++i) offer(selection[i], partial[i]);
+            }
+        }
+
+        std::sort(heap.begin(), heap.end(), better);
+        return heap;
+    }
+
+    /**
+     * @brief Hash-consing pass that merges structurally identical subexpressions
+     *
+     * Interning expressions through the same eliminator turns them into a single
+     * DAG in which every distinct subexpression (and every variable read) is one
+     * node. Nodes are compared through ASTNode::structuralKey(), so calls to host
+     * functions (whose key is empty) are never merged; the standard functions are.
+     */
+    class CommonSubexpressionEliminator {
+        std::unordered_map<std::string, ASTNodePtr> table;
+        std::unordered_map<const ASTNode*, size_t> ids;
+        std::unordered_map<const ASTNode*, ASTNodePtr> canonical;
+
+        std::string idOf(const ASTNodePtr& node) {
+            return std::to_string(ids.at(node.get()));
+        }
+
+        ASTNodePtr record(const std::string& key, const ASTNodePtr& candidate) {
+            const auto it = table.find(key);
+            if (it != table.end()) return it->second;
+            table.emplace(key, candidate);
+            ids.emplace(candidate.get(), ids.size());
+            return candidate;
+        }
+
+        ASTNodePtr internUncached(const ASTNodePtr& node) {
+            auto children = node->getChildren();
+            bool changed = false;
+            std::string arguments = "(";
+            for (auto& child : children) {
+                auto interned = Intern(child);
+                changed = changed || interned != child;
+                arguments += idOf(interned) + ",";
+                child = std::move(interned);
+            }
+            arguments += ")";
+            ASTNodePtr rebuilt = changed ? node->withChildren(std::move(children)) : node;
+            // Node types that cannot be rebuilt are kept as they are
+            if (!rebuilt) return record("?" + IdentityKey(node.get()), node);
+            const std::string key = node->structuralKey();
+            if (key.empty()) return record("@" + IdentityKey(rebuilt.get()), rebuilt);
+            return record(key + arguments, rebuilt);
+        }
+
+    public:
+        /**
+         * @brief Return the canonical node for an expression, merging it with previously interned ones
+         */
+        ASTNodePtr Intern(const ASTNodePtr& node) {
+            const auto it = canonical.find(node.get());
+            if (it != canonical.end()) return it->second;
+            ASTNodePtr result = internUncached(node);
+            canonical.emplace(node.get(), result);
+            canonical.emplace(result.get(), result);
+            return result;
+        }
+
+        /**
+         * @brief Number of distinct nodes interned so far
+         */
+        size_t size() const { return table.size(); }
+    };
+
+    /**
+     * @brief Merge common subexpressions within a single expression
+     */
+    inline ASTNodePtr EliminateCommonSubexpressions(const ASTNodePtr& node) {
+        CommonSubexpressionEliminator eliminator;
+        return eliminator.Intern(node);
+    }
+
+    /**
+     * @brief Deep-copy an expression tree
+     *
+     * Every node is freshly allocated by the calling thread, so the copy lives in
+     * memory local to it (first-touch placement). Literal regex patterns are
+     * recompiled for the copy. Node types that cannot be rebuilt are shared, as
+     * nodes are immutable.
+     */
+    inline ASTNodePtr CloneExpression(const ASTNodePtr& node) {
+        auto children = node->getChildren();
+        for (auto& child : children) child = CloneExpression(child);
+        auto copy = node->withChildren(std::move(children));
+        return copy ? copy : node;
+    }
+
+    /**
+     * @brief Evaluate many expressions over a batch in one fused pass
+     *
+     * The expressions are compiled together: common subexpressions (including
+     * variable reads) are merged across all of them, and the batch is processed
+     * in cache-sized chunks where every shared node is computed once per chunk
+     * and reused by all outputs that need it.
+     *
+     * Usage example:
+     * @code
+     * Projection features({"price * qty", "price * qty * tax", "log(price)"});
+     * std::vector<Column> outputs = features.Evaluate(batch);
+     * @endcode
+     */
+    class Projection {
+        std::vector<ASTNodePtr> outputs;
+        std::unordered_set<const ASTNode*> shared;
+        size_t chunkSize;
+        size_t nodeCount = 0;
+
+        void countReferences(const ASTNodePtr& node, std::unordered_map<const ASTNode*, size_t>& references) {
+            if (references[node.get()]++ > 0) return;
+            for (const auto& child : node->getChildren()) countReferences(child, references);
+        }
+
+    public:
+        static constexpr size_t DEFAULT_CHUNK_SIZE = 4096;
+
+        /**
+         * @brief Compile parsed expressions into a fused projection
+         */
+        explicit Projection(const std::vector<ASTNodePtr>& expressions, const size_t chunk = DEFAULT_CHUNK_SIZE)
+            : chunkSize(chunk == 0 ? DEFAULT_CHUNK_SIZE : chunk) {
+            CommonSubexpressionEliminator eliminator;
+            for (const auto& expression : expressions) outputs.push_back(eliminator.Intern(expression));
+            nodeCount = eliminator.size();
+            std::unordered_map<const ASTNode*, size_t> references;
+            for (const auto& output : outputs) countReferences(output, references);
+            for (const auto& entry : references) {
+                if (entry.second > 1) shared.insert(entry.first);
+            }
+        }
+
+        /**
+         * @brief Parse and compile expression strings into a fused projection
+         * @throws ExprException If any expression fails to parse
+         */
+        explicit Projection(const std::vector<std::string>& expressions, const size_t chunk = DEFAULT_CHUNK_SIZE)
+            : Projection(parseAll(expressions), chunk) {}
+
+        /**
+         * @brief Evaluate every expression over the batch
+         * @return One output column per expression, in the order given
+         * @throws ExprException If evaluation of any row fails
+         */
+        std::vector<Column> Evaluate(const Batch& batch, IEnvironment* environment = nullptr,
+                                     EvaluationContext* context = nullptr) const {
+            return Evaluate(batch, 0, batch.size(), environment, context);
+        }
+
+        /**
+         * @brief Evaluate every expression over rows [begin, begin + count) of the batch
+         * @return One output column of `count` rows per expression, in the order given
+         * @throws ExprException If evaluation of any row fails
+         */
+        std::vector<Column> Evaluate(const Batch& batch, const size_t begin, const size_t count,
+                                     IEnvironment* environment = nullptr, EvaluationContext* context = nullptr) const {
+            if (begin + count > batch.size()) throw ExprException("Batch range out of bounds");
+            std::vector<std::vector<Column>> parts(outputs.size());
+            for (size_t offset = 0; offset < count || offset == 0; offset += chunkSize) {
+                const size_t rows = std::min(chunkSize, count - offset);
+                BatchEvaluation evaluation(batch, environment, context, begin + offset, rows);
+                evaluation.SetMemoized(&shared);
+                for (size_t i = 0; i < outputs.size(); ++i) {
+                    parts[i].push_back(evaluation.Evaluate(outputs[i]));
+                }
+                if (count == 0) break;
+            }
+            std::vector<Column> results;
+            results.reserve(outputs.size());
+            for (auto& columns : parts) results.push_back(Column::Concat(columns));
+            return results;
+        }
+
+        const std::vector<ASTNodePtr>& getOutputs() const { return outputs; }
+
+        /**
+         * @brief Number of distinct nodes after merging, across all outputs
+         */
+        size_t getNodeCount() const { return nodeCount; }
+
+        /**
+         * @brief Number of nodes used by more than one parent or output
+         */
+        size_t getSharedNodeCount() const { return shared.size(); }
+
+    private:
+        static std::vector<ASTNodePtr> parseAll(const std::vector<std::string>& expressions) {
+            std::vector<ASTNodePtr> parsed;
+            for (const auto& expression : expressions) parsed.push_back(Parser(expression).parse());
+            return parsed;
+        }
+    };
+
+    /**
+     * @brief Value and partial derivatives of an expression at one point
+     */
+    struct Gradient {
+        double value = 0.0;
+        std::vector<double> partials;  // One per differentiation variable, in order
+    };
+
+    /**
+     * @brief Values and partial derivatives of an expression for every row of a batch
+     */
+    struct BatchGradient {
+        Column value;
+        std::vector<Column> partials;  // One column per differentiation variable, in order
+    };
+
+    /**
+     * @brief Reverse-mode automatic differentiation of a numeric expression
+     *
+     * The expression is compiled once into a tape of primitive operations. Each
+     * evaluation runs one forward sweep for the values and one backward sweep that
+     * propagates adjoints, producing the gradient with respect to every selected
+     * variable at the cost of about two evaluations, independent of their number.
+     *
+     * Differentiable operations are +, -, *, /, unary minus, the ternary operator
+     * (through the taken branch) and the built-ins sin, cos, tan, exp, log, sqrt,
+     * pow, abs, min and max. Subexpressions that do not depend on a selected
+     * variable may use anything the evaluator supports; they are computed by the
+     * batch engine and enter the tape as constants. Shared subtrees are taped once.
+     * Each arm of a ternary is computed only for the rows that take it, so guards
+     * such as `x > 0 ? log(x) : 0` behave as in scalar evaluation.
+     *
+     * Usage example:
+     * @code
+     * GradientTape tape(Parse("pow(a * x - y, 2)"), {"a"});
+     * Gradient g = tape.Evaluate(&environment);         // g.value, g.partials[0] == d/da
+     * BatchGradient all = tape.EvaluateBatch(samples);  // Per-row values and derivatives
+     * @endcode
+     */
+    class GradientTape {
+    public:
+        /**
+         * @param expression Numeric expression to differentiate
+         * @param variables Names of the variables to differentiate with respect to
+         * @throws ExprException If the expression applies a non-differentiable operation to a selected variable
+         */
+        GradientTape(const ASTNodePtr& expression, std::vector<std::string> variables)
+            : names(std::move(variables)) {
+            std::unordered_map<const ASTNode*, uint32_t> slots;
+            std::unordered_map<const ASTNode*, bool> dependent;
+            output = compile(expression, slots, dependent);
+        }
+
+        /**
+         * @brief Evaluate the value and gradient at the point described by an environment
+         * @throws ExprException If evaluation fails or a value is not numeric
+         */
+        Gradient Evaluate(IEnvironment* environment, EvaluationContext* context = nullptr) const {
+            const Batch point(1);
+            const BatchGradient result = EvaluateBatch(point, environment, context);
+            Gradient gradient;
+            gradient.value = result.value.numberAt(0);
+            for (const auto& partial : result.partials) gradient.partials.push_back(partial.numberAt(0));
+            return gradient;
+        }
+
+        /**
+         * @brief Evaluate values and gradients for every row of a batch
+         *
+         * Variables missing from the batch are read from the environment.
+         * @throws ExprException If evaluation fails or a value is not numeric
+         */
+        BatchGradient EvaluateBatch(const Batch& batch, IEnvironment* environment = nullptr,
+                                    EvaluationContext* context = nullptr) const {
+            const size_t n = batch.size();
+            std::vector<double> value(n);
+            std::vector<std::vector<double>> partials(names.size(), std::vector<double>(n));
+            std::vector<std::vector<double>> values(tape.size());
+            std::vector<std::vector<double>> adjoints(tape.size());
+            for (size_t begin = 0; begin < n; begin += CHUNK_ROWS) {
+                const size_t rows = std::min(CHUNK_ROWS, n - begin);
+                Sweep sweep{batch, environment, context, begin, rows, values, std::vector<std::vector<uint8_t>>(tape.size())};
+                forward(sweep);
+                backward(rows, values, adjoints);
+                std::copy(values[output].begin(), values[output].begin() + rows, value.begin() + begin);
+                for (size_t v = 0; v < names.size(); ++v) {
+                    if (inputs[v] == NONE) continue;  // Does not occur: derivative is zero
+                    std::copy(adjoints[inputs[v]].begin(), adjoints[inputs[v]].begin() + rows, partials[v].begin() + begin);
+                }
+            }
+            BatchGradient result;
+            result.value = Column::Numbers(std::move(value));
+            for (auto& partial : partials) result.partials.push_back(Column::Numbers(std::move(partial)));
+            return result;
+        }
+
+        const std::vector<std::string>& getVariables() const { return names; }
+
+        /**
+         * @brief Number of operations on the tape
+         */
+        size_t size() const { return tape.size(); }
+
+    private:
+        static constexpr size_t CHUNK_ROWS = 1024;
+        static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+        enum class Op { INPUT, CONSTANT, CONDITION, ADD, SUB, MUL, DIV, NEG, SIN, COS, TAN, EXP, LOG, SQRT, ABS, POW, MIN, MAX, SELECT };
+
+        struct Instruction {
+            Op op;
+            uint32_t a = NONE;
+            uint32_t b = NONE;
+            uint32_t c = NONE;  // SELECT: slot of the condition
+            ASTNodePtr node;    // INPUT/CONSTANT/CONDITION: evaluated by the batch engine
+            std::vector<std::string> variables;  // Variables of node, copied when only some rows are evaluated
+        };
+
+        std::vector<std::string> names;
+        std::vector<Instruction> tape;
+        std::vector<uint32_t> inputs = std::vector<uint32_t>(names.size(), NONE);  // Tape slot of each variable
+        uint32_t output = NONE;
+
+        uint32_t push(const Op op, const uint32_t a = NONE, const uint32_t b = NONE, ASTNodePtr node = nullptr,
+                      const uint32_t c = NONE) {
+            Instruction ins{op, a, b, c, std::move(node), {}};
+            CollectVariables(ins.node, ins.variables);
+            tape.push_back(std::move(ins));
+            return static_cast<uint32_t>(tape.size() - 1);
+        }
+
+        bool dependsOnInput(const ASTNodePtr& node, std::unordered_map<const ASTNode*, bool>& memo) const {
+            const auto it = memo.find(node.get());
+            if (it != memo.end()) return it->second;
+            bool result = false;
+            if (auto variable = std::dynamic_pointer_cast<VariableNode>(node)) {
+                result = std::find(names.begin(), names.end(), variable->getName()) != names.end();
+            } else {
+                for (const auto& child : node->getChildren()) result = result || dependsOnInput(child, memo);
+            }
+            memo.emplace(node.get(), result);
+            return result;
+        }
+
+        uint32_t compile(const ASTNodePtr& node, std::unordered_map<const ASTNode*, uint32_t>& slots,
+                         std::unordered_map<const ASTNode*, bool>& dependent) {
+            const auto it = slots.find(node.get());
+            if (it != slots.end()) return it->second;
+            const uint32_t slot = compileUncached(node, slots, dependent);
+            slots.emplace(node.get(), slot);
+            return slot;
+        }
+
+        uint32_t compileUncached(const ASTNodePtr& node, std::unordered_map<const ASTNode*, uint32_t>& slots,
+                                 std::unordered_map<const ASTNode*, bool>& dependent) {
+            if (!dependsOnInput(node, dependent)) return push(Op::CONSTANT, NONE, NONE, node);
+
+            if (auto variable = std::dynamic_pointer_cast<VariableNode>(node)) {
+                const size_t index = std::find(names.begin(), names.end(), variable->getName()) - names.begin();
+                if (inputs[index] == NONE) inputs[index] = push(Op::INPUT, NONE, NONE, node);
+                return inputs[index];
+            }
+            if (auto binary = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+                Op op;
+                switch (binary->getOperator()) {
+                    case OperatorType::ADD: op = Op::ADD; break;
+                    case OperatorType::SUB: op = Op::SUB; break;
+                    case OperatorType::MUL: op = Op::MUL; break;
+                    case OperatorType::DIV: op = Op::DIV; break;
+                    default: throw ExprException("Operator is not differentiable");
+                }
+                const uint32_t a = compile(binary->getLeft(), slots, dependent);
+                const uint32_t b = compile(binary->getRight(), slots, dependent);
+                return push(op, a, b);
+            }
+            if (auto unary = std::dynamic_pointer_cast<UnaryOpNode>(node)) {
+                if (unary->getOperator() != OperatorType::SUB) throw ExprException("Operator is not differentiable");
+                return push(Op::NEG, compile(unary->getOperand(), slots, dependent));
+            }
+            if (auto ternary = std::dynamic_pointer_cast<TernaryOpNode>(node)) {
+                const uint32_t a = compile(ternary->getTrueExpr(), slots, dependent);
+                const uint32_t b = compile(ternary->getFalseExpr(), slots, dependent);
+                const uint32_t c = push(Op::CONDITION, NONE, NONE, ternary->getCondition());
+                return push(Op::SELECT, a, b, nullptr, c);
+            }
+            if (auto call = std::dynamic_pointer_cast<FunctionCallNode>(node)) {
+                static const std::unordered_map<std::string, Op> unaryFunctions = {
+                    {"sin", Op::SIN}, {"cos", Op::COS}, {"tan", Op::TAN}, {"exp", Op::EXP},
+                    {"log", Op::LOG}, {"sqrt", Op::SQRT}, {"abs", Op::ABS}
+                };
+                static const std::unordered_map<std::string, Op> binaryFunctions = {
+                    {"pow", Op::POW}, {"min", Op::MIN}, {"max", Op::MAX}
+                };
+                const auto& args = call->getArguments();
+                if (args.size() == 1) {
+                    const auto f = unaryFunctions.find(call->getName());
+                    if (f != unaryFunctions.end()) return push(f->second, compile(args[0], slots, dependent));
+                } else if (args.size() == 2) {
+                    const auto f = binaryFunctions.find(call->getName());
+                    if (f != binaryFunctions.end()) {
+                        const uint32_t a = compile(args[0], slots, dependent);
+                        const uint32_t b = compile(args[1], slots, dependent);
+                        return push(f->second, a, b);
+                    }
+                }
+                throw ExprException("Function is not differentiable: " + call->getName());
+            }
+            throw ExprException("Expression is not differentiable");
+        }
+
+        static double readNumber(const Column& column, const size_t row) {
+            if (column.getKind() == Column::Kind::NUMBER && column.isValid(row)) return column.numberAt(row);
+            const Value value = column.at(row);
+            if (!value.isNumber()) throw ExprException("Differentiation requires numeric values");
+            return value.data.number;
+        }
+
+        // State of one forward sweep over a chunk of rows
+        struct Sweep {
+            const Batch& batch;
+            IEnvironment* environment;
+            EvaluationContext* context;
+            size_t begin;
+            size_t rows;
+            std::vector<std::vector<double>>& values;
+            std::vector<std::vector<uint8_t>> done;  // Rows already computed, per slot
+        };
+
+        void forward(Sweep& sweep) const {
+            for (size_t s = 0; s < tape.size(); ++s) {
+                sweep.values[s].assign(sweep.rows, 0.0);
+                sweep.done[s].assign(sweep.rows, 0);
+            }
+            compute(output, std::vector<uint8_t>(sweep.rows, 1), sweep);
+        }
+
+        // Evaluate the node of an INPUT, CONSTANT or CONDITION slot on the wanted rows only
+        Column evaluateNode(const Instruction& ins, const std::vector<uint8_t>& wanted, const size_t count, Sweep& sweep) const {
+            if (count == sweep.rows) {
+                BatchEvaluation evaluation(sweep.batch, sweep.environment, sweep.context, sweep.begin, sweep.rows);
+                return evaluation.Evaluate(ins.node);
+            }
+            std::vector<size_t> selection;
+            selection.reserve(count);
+            for (size_t i = 0; i < sweep.rows; ++i) {
+                if (wanted[i]) selection.push_back(sweep.begin + i);
+            }
+            const Batch selected = sweep.batch.Select(selection, &ins.variables);
+            BatchEvaluation evaluation(selected, sweep.environment, sweep.context);
+            return evaluation.Evaluate(ins.node);
+        }
+
+        /**
+         * Compute a slot on the wanted rows it does not hold yet. Children are computed
+         * on demand, so each arm of a ternary only sees the rows that take it and
+         * cannot fail on the others.
+         */
+        void compute(const uint32_t s, std::vector<uint8_t> wanted, Sweep& sweep) const {
+            std::vector<uint8_t>& done = sweep.done[s];
+            size_t count = 0;
+            for (size_t i = 0; i < sweep.rows; ++i) {
+                wanted[i] = wanted[i] && !done[i];
+                count += wanted[i];
+            }
+            if (count == 0) return;
+
+            const Instruction& ins = tape[s];
+            if (ins.op == Op::SELECT) {
+                compute(ins.c, wanted, sweep);
+                const double* c = sweep.values[ins.c].data();
+                std::vector<uint8_t> whenTrue(sweep.rows), whenFalse(sweep.rows);
+                for (size_t i = 0; i < sweep.rows; ++i) {
+                    whenTrue[i] = wanted[i] && c[i] != 0.0;
+                    whenFalse[i] = wanted[i] && c[i] == 0.0;
+                }
+                compute(ins.a, std::move(whenTrue), sweep);
+                compute(ins.b, std::move(whenFalse), sweep);
+            } else {
+                if (ins.a != NONE) compute(ins.a, wanted, sweep);
+                if (ins.b != NONE) compute(ins.b, wanted, sweep);
+            }
+
+            std::vector<double>& v = sweep.values[s];
+            const double* a = ins.a == NONE ? nullptr : sweep.values[ins.a].data();
+            const double* b = ins.b == NONE ? nullptr : sweep.values[ins.b].data();
+            const auto each = [&](const auto& f) {
+                for (size_t i = 0; i < sweep.rows; ++i) {
+                    if (wanted[i]) v[i] = f(i);
+                }
+            };
+            switch (ins.op) {
+                case Op::INPUT:
+                case Op::CONSTANT: {
+                    const Column column = evaluateNode(ins, wanted, count, sweep);
+                    size_t k = 0;
+                    each([&](size_t) { return readNumber(column, k++); });
+                    break;
+                }
+                case Op::CONDITION: {
+                    const Column condition = evaluateNode(ins, wanted, count, sweep);
+                    size_t k = 0;
+                    each([&](size_t) { return condition.at(k++).asBoolean() ? 1.0 : 0.0; });
+                    break;
+                }
+                case Op::ADD: each([&](size_t i) { return a[i] + b[i]; }); break;
+                case Op::SUB: each([&](size_t i) { return a[i] - b[i]; }); break;
+                case Op::MUL: each([&](size_t i) { return a[i] * b[i]; }); break;
+                case Op::DIV:
+                    each([&](size_t i) {
+                        if (b[i] == 0.0) throw ExprException("Division by zero");
+                        return a[i] / b[i];
+                    });
+                    break;
+                case Op::NEG: each([&](size_t i) { return -a[i]; }); break;
+                case Op::SIN: each([&](size_t i) { return std::sin(a[i]); }); break;
+                case Op::COS: each([&](size_t i) { return std::cos(a[i]); }); break;
+                case Op::TAN: each([&](size_t i) { return std::tan(a[i]); }); break;
+                case Op::EXP: each([&](size_t i) { return std::exp(a[i]); }); break;
+                case Op::LOG:
+                    each([&](size_t i) {
+                        if (a[i] <= 0.0) throw ExprException("log argument out of domain");
+                        return std::log(a[i]);
+                    });
+                    break;
+                case Op::SQRT:
+                    each([&](size_t i) {
+                        if (a[i] < 0.0) throw ExprException("sqrt argument out of domain");
+                        return std::sqrt(a[i]);
+                    });
+                    break;
+                case Op::ABS: each([&](size_t i) { return std::abs(a[i]); }); break;
+                case Op::POW: each([&](size_t i) { return std::pow(a[i], b[i]); }); break;
+                case Op::MIN: each([&](size_t i) { return std::min(a[i], b[i]); }); break;
+                case Op::MAX: each([&](size_t i) { return std::max(a[i], b[i]); }); break;
+                case Op::SELECT: {
+                    const double* c = sweep.values[ins.c].data();
+                    each([&](size_t i) { return c[i] != 0.0 ? a[i] : b[i]; });
+                    break;
+                }
+            }
+            for (size_t i = 0; i < sweep.rows; ++i) done[i] = done[i] || wanted[i];
+        }
+
+        void backward(const size_t rows, const std::vector<std::vector<double>>& values,
+                      std::vector<std::vector<double>>& adjoints) const {
+            for (auto& adjoint : adjoints) adjoint.assign(rows, 0.0);
+            std::fill(adjoints[output].begin(), adjoints[output].end(), 1.0);
+            for (size_t s = tape.size(); s-- > 0;) {
+                const Instruction& ins = tape[s];
+                if (ins.op == Op::INPUT || ins.op == Op::CONSTANT || ins.op == Op::CONDITION) continue;
+                const double* g = adjoints[s].data();
+                const double* v = values[s].data();
+                const double* a = values[ins.a].data();
+                const double* b = ins.b == NONE ? nullptr : values[ins.b].data();
+                double* da = adjoints[ins.a].data();
+                double* db = ins.b == NONE ? nullptr : adjoints[ins.b].data();
+                // Rows with a zero adjoint contribute nothing, and rows an untaken arm never computed have one
+                const auto each = [&](const auto& f) {
+                    for (size_t i = 0; i < rows; ++i) {
+                        if (g[i] != 0.0) f(i);
+                    }
+                };
+                switch (ins.op) {
+                    case Op::ADD: each([&](size_t i) { da[i] += g[i]; db[i] += g[i]; }); break;
+                    case Op::SUB: each([&](size_t i) { da[i] += g[i]; db[i] -= g[i]; }); break;
+                    case Op::MUL: each([&](size_t i) { da[i] += g[i] * b[i]; db[i] += g[i] * a[i]; }); break;
+                    case Op::DIV: each([&](size_t i) { da[i] += g[i] / b[i]; db[i] -= g[i] * v[i] / b[i]; }); break;
+                    case Op::NEG: each([&](size_t i) { da[i] -= g[i]; }); break;
+                    case Op::SIN: each([&](size_t i) { da[i] += g[i] * std::cos(a[i]); }); break;
+                    case Op::COS: each([&](size_t i) { da[i] -= g[i] * std::sin(a[i]); }); break;
+                    case Op::TAN: each([&](size_t i) { da[i] += g[i] * (1.0 + v[i] * v[i]); }); break;
+                    case Op::EXP: each([&](size_t i) { da[i] += g[i] * v[i]; }); break;
+                    case Op::LOG: each([&](size_t i) { da[i] += g[i] / a[i]; }); break;
+                    case Op::SQRT: each([&](size_t i) { da[i] += g[i] / (2.0 * v[i]); }); break;
+                    case Op::ABS: each([&](size_t i) { da[i] += a[i] > 0.0 ? g[i] : a[i] < 0.0 ? -g[i] : 0.0; }); break;
+                    case Op::POW:
+                        each([&](size_t i) {
+                            if (b[i] != 0.0) da[i] += g[i] * b[i] * std::pow(a[i], b[i] - 1.0);
+                            if (a[i] > 0.0) db[i] += g[i] * v[i] * std::log(a[i]);
+                        });
+                        break;
+                    case Op::MIN: each([&](size_t i) { (a[i] <= b[i] ? da : db)[i] += g[i]; }); break;
+                    case Op::MAX: each([&](size_t i) { (a[i] >= b[i] ? da : db)[i] += g[i]; }); break;
+                    case Op::SELECT: {
+                        const double* c = values[ins.c].data();
+                        each([&](size_t i) { (c[i] != 0.0 ? da : db)[i] += g[i]; });
+                        break;
+                    }
+                    case Op::INPUT:
+                    case Op::CONSTANT:
+                    case Op::CONDITION: break;
+                }
+            }
+        }
+    };
+
+    /**
+     * @brief Algebraic simplification of expression trees
+     *
+     * The constructors fold operations whose operands are literals and apply the
+     * usual identities (x + 0, x * 1, x / 1, pow(x, 1), -(-x), ternaries with a
+     * literal condition). Identities that would drop x, such as x * 0, 0 / x and
+     * pow(x, 0), are left alone: they do not hold when x is null, NaN or infinite.
+     *
+     * The identities are numeric: "s" + 0 concatenates and true * 1 fails, so by
+     * default an identity only returns x when x is provably a number (a number
+     * literal or the result of arithmetic). A simplifier constructed with
+     * numericOperands applies them to any operand.
+     */
+    class Simplifier {
+        bool assumeNumeric;
+
+        static bool isLiteral(const ASTNodePtr& node) {
+            return std::dynamic_pointer_cast<NumberNode>(node) || std::dynamic_pointer_cast<BooleanNode>(node) ||
+                   std::dynamic_pointer_cast<StringNode>(node) || std::dynamic_pointer_cast<NullNode>(node);
+        }
+
+        static bool isNumber(const ASTNodePtr& node, const double value) {
+            auto number = std::dynamic_pointer_cast<NumberNode>(node);
+            return number && number->getValue() == value;
+        }
+
+        static ASTNodePtr literal(const Value& value) {
+            switch (value.type) {
+                case Value::NUMBER: return std::make_shared<NumberNode>(value.data.number);
+                case Value::BOOLEAN: return std::make_shared<BooleanNode>(value.data.boolean);
+                case Value::STRING: return std::make_shared<StringNode>(std::string(value.asStringView()));
+                default: return std::make_shared<NullNode>();
+            }
+        }
+
+        // Evaluate a node whose operands are all literals; operations that fail at runtime stay unfolded
+        static ASTNodePtr fold(const ASTNodePtr& node) {
+            try {
+                return literal(node->evaluate(nullptr));
+            } catch (const std::exception&) {
+                return node;
+            }
+        }
+
+        // Whether a node can only produce a number or null (or fail), so an identity may return it
+        static bool isNumeric(const ASTNodePtr& node) {
+            if (std::dynamic_pointer_cast<NumberNode>(node)) return true;
+            if (auto binary = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+                switch (binary->getOperator()) {
+                    case OperatorType::SUB:
+                    case OperatorType::MUL:
+                    case OperatorType::DIV: return true;
+                    case OperatorType::ADD: return isNumeric(binary->getLeft()) && isNumeric(binary->getRight());
+                    default: return false;
+                }
+            }
+            if (auto unary = std::dynamic_pointer_cast<UnaryOpNode>(node)) return unary->getOperator() == OperatorType::SUB;
+            if (auto ternary = std::dynamic_pointer_cast<TernaryOpNode>(node)) {
+                return isNumeric(ternary->getTrueExpr()) && isNumeric(ternary->getFalseExpr());
+            }
+            return false;
+        }
+
+        bool numeric(const ASTNodePtr& node) const { return assumeNumeric || isNumeric(node); }
+
+    public:
+        /**
+         * @param numericOperands Apply the identities to every operand, as when the whole
+         *        expression is known to be numeric (symbolic differentiation does this)
+         */
+        explicit Simplifier(const bool numericOperands = false) : assumeNumeric(numericOperands) {}
+
+        static ASTNodePtr Number(const double value) { return std::make_shared<NumberNode>(value); }
+
+        ASTNodePtr Binary(const OperatorType op, ASTNodePtr l, ASTNodePtr r) const {
+            if (isLiteral(l) && isLiteral(r)) return fold(std::make_shared<BinaryOpNode>(l, op, r));
+            switch (op) {
+                case OperatorType::ADD:
+                    // "s" + 0 concatenates, so x + 0 -> x needs a numeric x
+                    if (isNumber(l, 0.0) && numeric(r)) return r;
+                    if (isNumber(r, 0.0) && numeric(l)) return l;
+                    if (auto negated = std::dynamic_pointer_cast<UnaryOpNode>(r)) {
+                        if (negated->getOperator() == OperatorType::SUB && numeric(l) && numeric(negated->getOperand())) {
+                            return Binary(OperatorType::SUB, l, negated->getOperand());
+                        }
+                    }
+                    break;
+                case OperatorType::SUB:
+                    if (isNumber(r, 0.0) && numeric(l)) return l;
+                    if (isNumber(l, 0.0)) return Negate(r);
+                    if (auto negated = std::dynamic_pointer_cast<UnaryOpNode>(r)) {
+                        if (negated->getOperator() == OperatorType::SUB && numeric(l) && numeric(negated->getOperand())) {
+                            return Binary(OperatorType::ADD, l, negated->getOperand());
+                        }
+                    }
+                    break;
+                case OperatorType::MUL:
+                    if (isNumber(l, 1.0) && numeric(r)) return r;
+                    if (isNumber(r, 1.0) && numeric(l)) return l;
+                    if (isNumber(l, -1.0)) return Negate(r);
+                    if (isNumber(r, -1.0)) return Negate(l);
+                    // Keep constants on the left and merge them: c1 * (c2 * x) -> (c1 * c2) * x
+                    if (isLiteral(r)) std::swap(l, r);
+                    if (auto product = std::dynamic_pointer_cast<BinaryOpNode>(r)) {
+                        if (isLiteral(l) && product->getOperator() == OperatorType::MUL && isLiteral(product->getLeft())) {
+                            return Binary(OperatorType::MUL, Binary(OperatorType::MUL, l, product->getLeft()), product->getRight());
+                        }
+                    }
+                    break;
+                case OperatorType::DIV:
+                    if (isNumber(r, 1.0) && numeric(l)) return l;
+                    break;
+                default:
+                    break;
+            }
+            return std::make_shared<BinaryOpNode>(std::move(l), op, std::move(r));
+        }
+
+        ASTNodePtr Negate(ASTNodePtr operand) const {
+            if (isLiteral(operand)) return fold(std::make_shared<UnaryOpNode>(OperatorType::SUB, operand));
+            if (auto unary = std::dynamic_pointer_cast<UnaryOpNode>(operand)) {
+                if (unary->getOperator() == OperatorType::SUB && numeric(unary->getOperand())) return unary->getOperand();
+            }
+            return std::make_shared<UnaryOpNode>(OperatorType::SUB, std::move(operand));
+        }
+
+        ASTNodePtr Unary(const OperatorType op, ASTNodePtr operand) const {
+            if (op == OperatorType::SUB) return Negate(std::move(operand));
+            if (isLiteral(operand)) return fold(std::make_shared<UnaryOpNode>(op, operand));
+            return std::make_shared<UnaryOpNode>(op, std::move(operand));
+        }
+
+        ASTNodePtr Ternary(ASTNodePtr condition, ASTNodePtr whenTrue, ASTNodePtr whenFalse) const {
+            if (isLiteral(condition)) return condition->evaluate(nullptr).asBoolean() ? whenTrue : whenFalse;
+            if (whenTrue == whenFalse) return whenTrue;
+            if (isLiteral(whenTrue) && isLiteral(whenFalse) &&
+                whenTrue->evaluate(nullptr) == whenFalse->evaluate(nullptr)) {
+                return whenTrue;
+            }
+            return std::make_shared<TernaryOpNode>(std::move(condition), std::move(whenTrue), std::move(whenFalse),
+                                                   OperatorType::TERNARY);
+        }
+
+        ASTNodePtr Call(const std::string& name, std::vector<ASTNodePtr> args) const {
+            if (name == "pow" && args.size() == 2) {
+                if (isNumber(args[1], 1.0) && numeric(args[0])) return args[0];
+            }
+            const bool literals = std::all_of(args.begin(), args.end(), isLiteral);
+            ASTNodePtr call = MakeFunctionCallNode(name, std::move(args));
+            const size_t arity = call->getChildren().size();
+            if (literals && (IsStandardFunction(name, arity) || IsStringFunction(name, arity) || IsHashFunction(name, arity))) {
+                return fold(call);
+            }
+            return call;
+        }
+
+        /**
+         * @brief Rebuild a tree bottom-up through the simplifying constructors
+         */
+        ASTNodePtr Simplify(const ASTNodePtr& node) const {
+            if (auto binary = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+                return Binary(binary->getOperator(), Simplify(binary->getLeft()), Simplify(binary->getRight()));
+            }
+            if (auto unary = std::dynamic_pointer_cast<UnaryOpNode>(node)) {
+                return Unary(unary->getOperator(), Simplify(unary->getOperand()));
+            }
+            if (auto ternary = std::dynamic_pointer_cast<TernaryOpNode>(node)) {
+                return Ternary(Simplify(ternary->getCondition()), Simplify(ternary->getTrueExpr()),
+                               Simplify(ternary->getFalseExpr()));
+            }
+            if (auto call = std::dynamic_pointer_cast<FunctionCallNode>(node)) {
+                std::vector<ASTNodePtr> args;
+                for (const auto& arg : call->getArguments()) args.push_back(Simplify(arg));
+                return Call(call->getName(), std::move(args));
+            }
+            return node;
+        }
+    };
+
+    /**
+     * @brief Fold constants and apply algebraic identities (see Simplifier)
+     *
+     * The identities are numeric, so they are only applied where the operand they
+     * keep is known to be a number; variables and calls may hold strings or booleans.
+     */
+    inline ASTNodePtr Simplify(const ASTNodePtr& node) {
+        return Simplifier().Simplify(node);
+    }
+
+    /**
+     * @brief Rewrite polynomials into Horner form (PolynomialNode)
+     *
+     * A subtree that is already a sum of monomials is collected into terms over
+     * its atoms: variables and any other subexpressions (such as function calls),
+     * which stay opaque and are evaluated once. Monomials are built from *,
+     * division by nonzero number literals and pow(..., n) with a literal integer n;
+     * a constant factor may multiply a sum. Products and powers of sums, such as
+     * (x - 1000) * (x - 1000), are never multiplied out: the expanded form cancels
+     * away the digits the factored form keeps, so they are left as they are (any
+     * polynomials inside them are still rewritten). Equal atoms are merged as by
+     * EliminateCommonSubexpressions(), so host calls are never merged. The
+     * variable with the highest degree becomes x and the other atoms form the
+     * coefficients; only polynomials of degree 2 or more are rewritten. Sums
+     * beyond MAX_TERMS terms or MAX_DEGREE per atom are left as they are.
+     *
+     * Each subtree is expanded at most once, so the pass is linear in the size of
+     * the tree. Horner evaluation rounds differently from the sum of monomials,
+     * so results can differ in the last bits (or where that sum overflows).
+     */
+    class PolynomialRewriter {
+        using Monomial = std::vector<std::pair<size_t, unsigned>>;  // (atom, exponent), sorted by atom
+
+        struct Expansion {
+            std::map<Monomial, double> terms;
+            std::vector<size_t> atoms;  // Every atom read, sorted, including those that cancelled
+        };
+        using ExpansionPtr = std::shared_ptr<const Expansion>;
+
+        static constexpr unsigned MAX_DEGREE = 64;
+        static constexpr size_t MAX_TERMS = 128;
+
+        CommonSubexpressionEliminator eliminator;
+        std::vector<ASTNodePtr> atoms;
+        std::unordered_map<const ASTNode*, size_t> atomIndex;  // By canonical node
+        std::unordered_map<const ASTNode*, ExpansionPtr> expansions;  // Null if not a polynomial
+        std::unordered_map<const ASTNode*, ASTNodePtr> rewritten;
+
+        static std::vector<size_t> mergeAtoms(const std::vector<size_t>& a, const std::vector<size_t>& b) {
+            std::vector<size_t> merged;
+            std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(merged));
+            return merged;
+        }
+
+        static ExpansionPtr constant(const double value, std::vector<size_t> read = {}) {
+            auto result = std::make_shared<Expansion>();
+            if (value != 0.0) result->terms.emplace(Monomial{}, value);
+            result->atoms = std::move(read);
+            return result;
+        }
+
+        static ExpansionPtr scale(const Expansion& a, const double factor) {
+            auto result = std::make_shared<Expansion>(a);
+            for (auto& term : result->terms) term.second *= factor;
+            return result;
+        }
+
+        static ExpansionPtr sum(const Expansion& a, const Expansion& b, const double sign) {
+            auto result = std::make_shared<Expansion>(a);
+            for (const auto& term : b.terms) {
+                const auto it = result->terms.emplace(term.first, 0.0).first;
+                it->second += sign * term.second;
+                if (it->second == 0.0) result->terms.erase(it);
+            }
+            if (result->terms.size() > MAX_TERMS) return nullptr;
+            result->atoms = mergeAtoms(a.atoms, b.atoms);
+            return result;
+        }
+
+        static bool isConstant(const Expansion& e) {
+            return e.terms.empty() || (e.terms.size() == 1 && e.terms.begin()->first.empty());
+        }
+
+        static ExpansionPtr product(const Expansion& a, const Expansion& b) {
+            // Multiplying out a sum trades the factored form for one that cancels catastrophically
+            if (!isConstant(a) && !isConstant(b) && (a.terms.size() > 1 || b.terms.size() > 1)) return nullptr;
+            auto result = std::make_shared<Expansion>();
+            for (const auto& l : a.terms) {
+                for (const auto& r : b.terms) {
+                    Monomial m;
+                    size_t i = 0, j = 0;
+                    while (i < l.first.size() || j < r.first.size()) {
+                        if (j == r.first.size() || (i < l.first.size() && l.first[i].first < r.first[j].first)) {
+                            m.push_back(l.first[i++]);
+                        } else if (i == l.first.size() || r.first[j].first < l.first[i].first) {
+                            m.push_back(r.first[j++]);
+                        } else {
+                            m.emplace_back(l.first[i].first, l.first[i].second + r.first[j].second);
+                            ++i, ++j;
+                        }
+                        if (m.back().second > MAX_DEGREE) return nullptr;
+                    }
+                    result->terms[std::move(m)] += l.second * r.second;
+                    if (result->terms.size() > MAX_TERMS) return nullptr;
+                }
+            }
+            for (auto it = result->terms.begin(); it != result->terms.end();) {
+                it = it->second == 0.0 ? result->terms.erase(it) : std::next(it);
+            }
+            result->atoms = mergeAtoms(a.atoms, b.atoms);
+            return result;
+        }
+
+        // Exponentiation by squaring
+        static ExpansionPtr power(ExpansionPtr base, unsigned n) {
+            ExpansionPtr result = constant(1.0, base->atoms);
+            while (n) {
+                if (n & 1) result = product(*result, *base);
+                n >>= 1;
+                if (n && result) base = product(*base, *base);
+                if (!result || !base) return nullptr;
+            }
+            return result;
+        }
+
+        size_t atom(const ASTNodePtr& node) {
+            const ASTNode* key = eliminator.Intern(node).get();
+            const auto it = atomIndex.find(key);
+            if (it != atomIndex.end()) return it->second;
+            atoms.push_back(node);
+            atomIndex.emplace(key, atoms.size() - 1);
+            return atoms.size() - 1;
+        }
+
+        ExpansionPtr expand(const ASTNodePtr& node) {
+            const auto it = expansions.find(node.get());
+            if (it != expansions.end()) return it->second;
+            ExpansionPtr result = expandUncached(node);
+            expansions.emplace(node.get(), result);
+            return result;
+        }
+
+        ExpansionPtr expandUncached(const ASTNodePtr& node) {
+            if (auto number = std::dynamic_pointer_cast<NumberNode>(node)) return constant(number->getValue());
+            if (std::dynamic_pointer_cast<StringNode>(node) || std::dynamic_pointer_cast<BooleanNode>(node) ||
+                std::dynamic_pointer_cast<NullNode>(node)) {
+                return nullptr;
+            }
+            if (auto unary = std::dynamic_pointer_cast<UnaryOpNode>(node)) {
+                if (unary->getOperator() != OperatorType::SUB) return nullptr;
+                const auto operand = expand(unary->getOperand());
+                return operand ? scale(*operand, -1.0) : nullptr;
+            }
+            if (auto binary = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+                const OperatorType op = binary->getOperator();
+                if (op != OperatorType::ADD && op != OperatorType::SUB && op != OperatorType::MUL && op != OperatorType::DIV) return nullptr;
+                const auto l = expand(binary->getLeft());
+                if (!l) return nullptr;
+                if (op == OperatorType::DIV) {
+                    // Only division by a nonzero literal, so no division by zero can be hidden
+                    auto divisor = std::dynamic_pointer_cast<NumberNode>(binary->getRight());
+                    if (!divisor || divisor->getValue() == 0.0 || !std::isfinite(divisor->getValue())) return nullptr;
+                    return scale(*l, 1.0 / divisor->getValue());
+                }
+                const auto r = expand(binary->getRight());
+                if (!r) return nullptr;
+                if (op == OperatorType::MUL) return product(*l, *r);
+                return sum(*l, *r, op == OperatorType::ADD ? 1.0 : -1.0);
+            }
+            if (auto call = std::dynamic_pointer_cast<FunctionCallNode>(node)) {
+                const auto& args = call->getArguments();
+                auto exponent = args.size() == 2 ? std::dynamic_pointer_cast<NumberNode>(args[1]) : nullptr;
+                if (call->getName() == "pow" && exponent) {
+                    const double n = exponent->getValue();
+                    if (n >= 0.0 && n <= static_cast<double>(MAX_DEGREE) && n == std::floor(n)) {
+                        const auto base = expand(args[0]);
+                        return base ? power(base, static_cast<unsigned>(n)) : nullptr;
+                    }
+                }
+            }
+            // Anything else is an atom, evaluated once
+            const size_t index = atom(node);
+            auto result = std::make_shared<Expansion>();
+            result->terms.emplace(Monomial{{index, 1u}}, 1.0);
+            result->atoms = {index};
+            return result;
+        }
+
+        static bool isArithmetic(const ASTNodePtr& node) {
+            if (auto binary = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+                const OperatorType op = binary->getOperator();
+                return op == OperatorType::ADD || op == OperatorType::SUB || op == OperatorType::MUL || op == OperatorType::DIV;
+            }
+            if (auto unary = std::dynamic_pointer_cast<UnaryOpNode>(node)) return unary->getOperator() == OperatorType::SUB;
+            if (auto call = std::dynamic_pointer_cast<FunctionCallNode>(node)) return call->getName() == "pow";
+            return false;
+        }
+
+        // The PolynomialNode for an arithmetic node, or null if it is not a polynomial of degree 2 or more
+        ASTNodePtr polynomial(const ASTNodePtr& node) {
+            const auto expansion = expand(node);
+            if (!expansion) return nullptr;
+            // x is the variable with the highest degree, the first one read on ties
+            size_t x = 0;
+            unsigned best = 1;
+            for (const size_t a : expansion->atoms) {
+                if (!std::dynamic_pointer_cast<VariableNode>(atoms[a])) continue;
+                unsigned degree = 0;
+                for (const auto& term : expansion->terms) {
+                    for (const auto& p : term.first) {
+                        if (p.first == a) degree = std::max(degree, p.second);
+                    }
+                }
+                if (degree > best) {
+                    best = degree;
+                    x = a;
+                }
+            }
+            if (best < 2) return nullptr;
+
+            std::vector<ASTNodePtr> others;
+            std::unordered_map<size_t, size_t> local;
+            for (const size_t a : expansion->atoms) {
+                if (a == x) continue;
+                local.emplace(a, others.size());
+                others.push_back(Rewrite(atoms[a]));
+            }
+            std::vector<PolynomialNode::Term> terms;
+            for (const auto& term : expansion->terms) {
+                PolynomialNode::Term t{0, term.second, {}};
+                for (const auto& p : term.first) {
+                    if (p.first == x) t.degree = p.second;
+                    else t.powers.emplace_back(local.at(p.first), p.second);
+                }
+                terms.push_back(std::move(t));
+            }
+            std::stable_sort(terms.begin(), terms.end(), [](const auto& a, const auto& b) { return a.degree < b.degree; });
+            return std::make_shared<PolynomialNode>(atoms[x], std::move(others), std::move(terms), node);
+        }
+
+        ASTNodePtr rebuild(const ASTNodePtr& node) {
+            if (isArithmetic(node)) {
+                if (auto result = polynomial(node)) return result;
+            }
+            auto children = node->getChildren();
+            bool changed = false;
+            for (auto& child : children) {
+                auto replacement = Rewrite(child);
+                changed = changed || replacement != child;
+                child = std::move(replacement);
+            }
+            if (!changed) return node;
+            auto result = node->withChildren(std::move(children));
+            return result ? result : node;
+        }
+
+    public:
+        ASTNodePtr Rewrite(const ASTNodePtr& node) {
+            const auto it = rewritten.find(node.get());
+            if (it != rewritten.end()) return it->second;
+            ASTNodePtr result = rebuild(node);
+            rewritten.emplace(node.get(), result);
+            return result;
+        }
+    };
+
+    /**
+     * @brief Rewrite polynomials into Horner form (see PolynomialRewriter)
+     *
+     * Usage example:
+     * @code
+     * auto curve = OptimizePolynomials(Expression::Parse("0.5*x*x*x - 2*pow(x, 2) + 3*x + 1"));
+     * // curve is a PolynomialNode: ((0.5*x - 2)*x + 3)*x + 1
+     * @endcode
+     */
+    inline ASTNodePtr OptimizePolynomials(const ASTNodePtr& ast) {
+        return PolynomialRewriter().Rewrite(ast);
+    }
+
+    /**
+     * @brief Named lookup tables that BindLookupTables() resolves function calls against
+     *
+     * Usage example:
+     * @code
+     * LookupTables tables;
+     * tables.Add("rate", LookupTable({{Value("US"), Value(0.07)}, {Value("DE"), Value(0.19)}}, Value(0.0)));
+     * ASTNodePtr rule = BindLookupTables(Expression::Parse("price * rate(country)"), tables);
+     * @endcode
+     */
+    class LookupTables {
+        std::unordered_map<std::string, std::shared_ptr<const LookupTable>> tables;
+
+    public:
+        /**
+         * @brief Register a table under a name, replacing any previous table of that name
+         */
+        void Add(const std::string& name, std::shared_ptr<const LookupTable> table) {
+            if (!table) throw ExprException("Lookup table is null");
+            tables[name] = std::move(table);
+        }
+
+        void Add(const std::string& name, LookupTable table) {
+            Add(name, std::make_shared<const LookupTable>(std::move(table)));
+        }
+
+        /**
+         * @brief The table registered under a name, or null
+         */
+        std::shared_ptr<const LookupTable> Find(const std::string& name) const {
+            const auto it = tables.find(name);
+            return it == tables.end() ? nullptr : it->second;
+        }
+
+        size_t size() const { return tables.size(); }
+    };
+
+    /**
+     * @brief Rebind function calls throughout a tree
+     *
+     * Every FunctionCallNode is offered, with its arguments already rebound, to a
+     * callback that returns a replacement node or null to keep the call. Used to
+     * bind calls to host-registered data such as lookup tables and zones. Shared
+     * subtrees stay shared; the input tree is not modified.
+     */
+    class CallBinder {
+    public:
+        using Rebind = std::function<ASTNodePtr(const std::string& name, const std::vector<ASTNodePtr>& args)>;
+
+        explicit CallBinder(Rebind callback) : rebind(std::move(callback)) {}
+
+        ASTNodePtr Bind(const ASTNodePtr& node) {
+            const auto it = bound.find(node.get());
+            if (it != bound.end()) return it->second;
+            ASTNodePtr result = rebuild(node);
+            bound.emplace(node.get(), result);
+            return result;
+        }
+
+        /**
+         * @brief The literal node for a value
+         */
+        static ASTNodePtr Literal(const Value& value) {
+            if (value.isNull()) return std::make_shared<NullNode>();
+            if (value.isBoolean()) return std::make_shared<BooleanNode>(value.data.boolean);
+            if (value.isString()) return std::make_shared<StringNode>(std::string(value.asStringView()));
+            return std::make_shared<NumberNode>(value.data.number);
+        }
+
+        static bool IsLiteral(const ASTNodePtr& node) {
+            return std::dynamic_pointer_cast<NumberNode>(node) || std::dynamic_pointer_cast<StringNode>(node) ||
+                   std::dynamic_pointer_cast<BooleanNode>(node) || std::dynamic_pointer_cast<NullNode>(node);
+        }
+
+    private:
+        Rebind rebind;
+        std::unordered_map<const ASTNode*, ASTNodePtr> bound;
+
+        ASTNodePtr rebuild(const ASTNodePtr& node) {
+            auto children = node->getChildren();
+            bool changed = false;
+            for (auto& child : children) {
+                auto replacement = Bind(child);
+                changed = changed || replacement != child;
+                child = std::move(replacement);
+            }
+            if (auto call = std::dynamic_pointer_cast<FunctionCallNode>(node)) {
+                if (auto replacement = rebind(call->getName(), children)) return replacement;
+            }
+            if (!changed) return node;
+            auto rebuilt = node->withChildren(std::move(children));
+            return rebuilt ? rebuilt : node;
+        }
+    };
+
+    /**
+     * @brief Bind one-argument calls to registered lookup tables
+     *
+     * Every `name(key)` call whose name is a registered table (and not a built-in
+     * function) becomes a LookupNode holding the table, and a call with a literal
+     * key is replaced by the looked-up value.
+     */
+    inline ASTNodePtr BindLookupTables(const ASTNodePtr& ast, const LookupTables& tables) {
+        return CallBinder([&tables](const std::string& name, const std::vector<ASTNodePtr>& args) -> ASTNodePtr {
+            if (args.size() != 1 || IsStandardFunction(name, 1) || IsStringFunction(name, 1)) return nullptr;
+            auto table = tables.Find(name);
+            if (!table) return nullptr;
+            auto lookup = std::make_shared<LookupNode>(name, std::move(table), args[0]);
+            return CallBinder::IsLiteral(args[0]) ? CallBinder::Literal(lookup->evaluate(nullptr)) : lookup;
+        }).Bind(ast);
+    }
+
+    /**
+     * @brief Named polygons that BindGeoZones() resolves `within` calls against
+     *
+     * Usage example:
+     * @code
+     * GeoZones zones;
+     * zones.Add("downtown", {{40.70, -74.02}, {40.70, -73.97}, {40.75, -73.97}, {40.75, -74.02}});
+     * ASTNodePtr rule = BindGeoZones(Expression::Parse("within(lat, lon, \"downtown\")"), zones);
+     * @endcode
+     */
+    class GeoZones {
+        std::unordered_map<std::string, std::shared_ptr<const GeoZone>> zones;
+
+    public:
+        /**
+         * @brief Register a zone under a name, replacing any previous zone of that name
+         */
+        void Add(const std::string& name, std::shared_ptr<const GeoZone> zone) {
+            if (!zone) throw ExprException("Zone is null");
+            zones[name] = std::move(zone);
+        }
+
+        /**
+         * @brief Index a polygon of (latitude, longitude) vertices and register it
+         * @throws ExprException If the polygon is invalid (see GeoZone)
+         */
+        void Add(const std::string& name, const std::vector<std::pair<double, double>>& vertices) {
+            Add(name, std::make_shared<const GeoZone>(vertices));
+        }
+
+        /**
+         * @brief The zone registered under a name, or null
+         */
+        std::shared_ptr<const GeoZone> Find(const std::string& name) const {
+            const auto it = zones.find(name);
+            return it == zones.end() ? nullptr : it->second;
+        }
+
+        size_t size() const { return zones.size(); }
+    };
+
+    /**
+     * @brief Bind `within(lat, lon, "zone")` calls to registered zones
+     *
+     * Calls whose zone is not a string literal are left to the host.
+     *
+     * @throws ExprException If a literal zone name is not registered
+     */
+    inline ASTNodePtr BindGeoZones(const ASTNodePtr& ast, const GeoZones& zones) {
+        return CallBinder([&zones](const std::string& name, const std::vector<ASTNodePtr>& args) -> ASTNodePtr {
+            if (name != "within" || args.size() != 3) return nullptr;
+            auto literal = std::dynamic_pointer_cast<StringNode>(args[2]);
+            if (!literal) return nullptr;
+            auto zone = zones.Find(literal->getValue());
+            if (!zone) throw ExprException("Unknown zone: " + literal->getValue());
+            return std::make_shared<GeoWithinNode>(args[0], args[1], literal->getValue(), std::move(zone));
+        }).Bind(ast);
+    }
+
+    /**
+     * @brief Symbolic differentiation of expression trees
+     */
+    class SymbolicDifferentiator {
+        std::string variable;
+        Simplifier S{true};  // Derivatives are numeric, so every identity applies
+        std::unordered_map<const ASTNode*, ASTNodePtr> derivatives;
+        std::unordered_map<const ASTNode*, bool> dependent;
+
+        bool dependsOnVariable(const ASTNodePtr& node) {
+            const auto it = dependent.find(node.get());
+            if (it != dependent.end()) return it->second;
+            bool result = false;
+            if (auto reference = std::dynamic_pointer_cast<VariableNode>(node)) {
+                result = reference->getName() == variable;
+            } else {
+                for (const auto& child : node->getChildren()) result = result || dependsOnVariable(child);
+            }
+            dependent.emplace(node.get(), result);
+            return result;
+        }
+
+        static bool isZero(const ASTNodePtr& node) {
+            auto number = std::dynamic_pointer_cast<NumberNode>(node);
+            return number && number->getValue() == 0.0;
+        }
+
+        // A term whose derivative factor is zero vanishes, whatever the other factor holds
+        ASTNodePtr multiply(const ASTNodePtr& a, const ASTNodePtr& b) {
+            if (isZero(a) || isZero(b)) return Simplifier::Number(0.0);
+            return S.Binary(OperatorType::MUL, a, b);
+        }
+
+        ASTNodePtr divide(const ASTNodePtr& a, const ASTNodePtr& b) {
+            if (isZero(a)) return Simplifier::Number(0.0);
+            return S.Binary(OperatorType::DIV, a, b);
+        }
+
+        ASTNodePtr derive(const ASTNodePtr& node) {
+            const auto it = derivatives.find(node.get());
+            if (it != derivatives.end()) return it->second;
+            ASTNodePtr result = dependsOnVariable(node) ? deriveDependent(node) : Simplifier::Number(0.0);
+            derivatives.emplace(node.get(), result);
+            return result;
+        }
+
+        ASTNodePtr deriveDependent(const ASTNodePtr& node) {
+            if (std::dynamic_pointer_cast<VariableNode>(node)) return S.Number(1.0);
+            if (auto binary = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+                const ASTNodePtr a = binary->getLeft();
+                const ASTNodePtr b = binary->getRight();
+                switch (binary->getOperator()) {
+                    case OperatorType::ADD: return S.Binary(OperatorType::ADD, derive(a), derive(b));
+                    case OperatorType::SUB: return S.Binary(OperatorType::SUB, derive(a), derive(b));
+                    case OperatorType::MUL:
+                        return S.Binary(OperatorType::ADD, multiply(derive(a), b), multiply(a, derive(b)));
+                    case OperatorType::DIV:
+                        // a'/b - a*b'/(b*b)
+                        return S.Binary(OperatorType::SUB, divide(derive(a), b),
+                                         divide(multiply(a, derive(b)), S.Binary(OperatorType::MUL, b, b)));
+                    default:
+                        throw ExprException("Operator is not differentiable");
                 }
-                if (functionName == "sin") {
-                    outResult = Value(std::sin(x));
-                    return true;
+            }
+            if (auto unary = std::dynamic_pointer_cast<UnaryOpNode>(node)) {
+                if (unary->getOperator() != OperatorType::SUB) throw ExprException("Operator is not differentiable");
+                return S.Negate(derive(unary->getOperand()));
+            }
+            if (auto ternary = std::dynamic_pointer_cast<TernaryOpNode>(node)) {
+                return S.Ternary(ternary->getCondition(), derive(ternary->getTrueExpr()), derive(ternary->getFalseExpr()));
+            }
+            if (auto call = std::dynamic_pointer_cast<FunctionCallNode>(node)) {
+                const std::string& name = call->getName();
+                const auto& args = call->getArguments();
+                if (args.size() == 1) {
+                    const ASTNodePtr a = args[0];
+                    const ASTNodePtr da = derive(a);
+                    ASTNodePtr outer;
+                    if (name == "sin") outer = S.Call("cos", {a});
+                    else if (name == "cos") outer = S.Negate(S.Call("sin", {a}));
+                    else if (name == "tan") outer = S.Binary(OperatorType::ADD, S.Number(1.0), S.Binary(OperatorType::MUL, node, node));
+                    else if (name == "exp") outer = node;
+                    else if (name == "log") return divide(da, a);
+                    else if (name == "sqrt") return divide(da, S.Binary(OperatorType::MUL, S.Number(2.0), node));
+                    else if (name == "abs") {
+                        outer = S.Ternary(S.Binary(OperatorType::GT, a, S.Number(0.0)), S.Number(1.0),
+                                           S.Ternary(S.Binary(OperatorType::LT, a, S.Number(0.0)), S.Number(-1.0),
+                                                      S.Number(0.0)));
+                    }
+                    if (outer) return multiply(outer, da);
+                } else if (args.size() == 2) {
+                    const ASTNodePtr a = args[0];
+                    const ASTNodePtr b = args[1];
+                    if (name == "pow") {
+                        // b * pow(a, b - 1) * a' + pow(a, b) * log(a) * b'
+                        const ASTNodePtr da = derive(a);
+                        const ASTNodePtr db = derive(b);
+                        ASTNodePtr base = multiply(
+                            multiply(b, S.Call("pow", {a, S.Binary(OperatorType::SUB, b, S.Number(1.0))})), da);
+                        if (!dependsOnVariable(b)) return base;
+                        ASTNodePtr exponent = multiply(S.Binary(OperatorType::MUL, node, S.Call("log", {a})), db);
+                        return S.Binary(OperatorType::ADD, base, exponent);
+                    }
+                    if (name == "min") return S.Ternary(S.Binary(OperatorType::LE, a, b), derive(a), derive(b));
+                    if (name == "max") return S.Ternary(S.Binary(OperatorType::GE, a, b), derive(a), derive(b));
                 }
-                if (functionName == "cos") {
-                    outResult = Value(std::cos(x));
-                    return true;
+                throw ExprException("Function is not differentiable: " + name);
+            }
+            throw ExprException("Expression is not differentiable");
+        }
+
+    public:
+        explicit SymbolicDifferentiator(std::string name) : variable(std::move(name)) {}
+
+        /**
+         * @brief Derivative of an expression; shared subtrees are differentiated once
+         */
+        ASTNodePtr Derive(const ASTNodePtr& node) { return derive(node); }
+    };
+
+    /**
+     * @brief Build the derivative of an expression with respect to a variable
+     *
+     * The result is an ordinary expression tree: simplified while it is built,
+     * with common subexpressions merged, so it can be evaluated, batched or
+     * projected like any parsed expression. The chain rule covers +, -, *, /,
+     * unary minus, the ternary operator (the condition is kept) and the
+     * built-ins sin, cos, tan, exp, log, sqrt, pow, abs, min and max.
+     *
+     * Usage example:
+     * @code
+     * ASTNodePtr slope = Differentiate(Parse("3 * pow(x, 2) + y"), "x");  // 6 * x
+     * @endcode
+     * @throws ExprException If a non-differentiable operation depends on the variable
+     */
+    inline ASTNodePtr Differentiate(const ASTNodePtr& node, const std::string& variable) {
+        SymbolicDifferentiator differentiator(variable);
+        return EliminateCommonSubexpressions(differentiator.Derive(Simplifier(true).Simplify(node)));
+    }
+
+    /**
+     * @brief A boolean rule compiled into a reduced ordered binary decision diagram
+     *
+     * The rule's AND/OR/XOR/NOT structure (including ternaries, read as
+     * if-then-else) is separated from its atomic predicates: every other subtree,
+     * such as a comparison or a function call, becomes an atom, with structurally
+     * equal atoms merged. Each diagram node tests one atom and branches on the
+     * result, so a decision evaluates only the atoms along one path, each at most
+     * once. The atom order is the one giving the smallest diagram among a set of
+     * candidates (appearance order, its reverse, most-used first and seeded
+     * shuffles), refined by swapping neighbouring atoms.
+     *
+     * Atoms that are not on the taken path are not evaluated, so their side effects
+     * and errors do not occur. If an atom evaluates to null, the decision falls back
+     * to evaluating the rule itself so three-valued logic is preserved.
+     *
+     * Usage example:
+     * @code
+     * DecisionDiagram eligible(Parse("(age >= 18 && resident) || (age >= 16 && guardian && !banned)"));
+     * bool ok = eligible.Evaluate(&applicant);
+     * @endcode
+     */
+    class DecisionDiagram {
+    public:
+        static constexpr size_t MAX_NODES = size_t(1) << 20;
+
+        /**
+         * @param rule Boolean expression to compile
+         * @param orderings Number of candidate atom orders to try
+         * @throws ExprException If every candidate order exceeds MAX_NODES
+         */
+        explicit DecisionDiagram(const ASTNodePtr& rule, const size_t orderings = 8) {
+            CommonSubexpressionEliminator eliminator;
+            source = eliminator.Intern(rule);
+            std::unordered_map<const ASTNode*, uint32_t> ids;
+            std::vector<size_t> uses;
+            collect(source, ids, uses);
+
+            // Candidate orders: order[level] = atom id
+            std::vector<std::vector<uint32_t>> candidates;
+            std::vector<uint32_t> appearance(atoms.size());
+            for (uint32_t i = 0; i < appearance.size(); ++i) appearance[i] = i;
+            candidates.push_back(appearance);
+            candidates.emplace_back(appearance.rbegin(), appearance.rend());
+            std::vector<uint32_t> popular = appearance;
+            std::stable_sort(popular.begin(), popular.end(), [&](uint32_t a, uint32_t b) { return uses[a] > uses[b]; });
+            candidates.push_back(popular);
+            uint64_t seed = 0x9E3779B97F4A7C15ull;
+            while (candidates.size() < std::max<size_t>(orderings, 1) && atoms.size() > 2) {
+                std::vector<uint32_t> shuffled = appearance;
+                for (size_t i = shuffled.size(); i > 1; --i) {
+                    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                    std::swap(shuffled[i - 1], shuffled[(seed >> 33) % i]);
                 }
-                if (functionName == "tan") {
-                    outResult = Value(std::tan(x));
-                    return true;
+                candidates.push_back(std::move(shuffled));
+            }
+            candidates.resize(std::min(candidates.size(), std::max<size_t>(orderings, 1)));
+
+            std::unique_ptr<Builder> best;
+            std::vector<uint32_t> bestOrder;
+            for (const auto& order : candidates) {
+                auto built = build(ids, order);
+                if (built && (!best || built->size() < best->size())) {
+                    best = std::move(built);
+                    bestOrder = order;
                 }
-                if (functionName == "abs") {
-                    outResult = Value(std::abs(x));
-                    return true;
+            }
+            if (!best) throw ExprException("Decision diagram exceeds the node limit");
+
+            // Local search: keep swaps of neighbouring atoms that shrink the diagram
+            for (bool improved = true; improved;) {
+                improved = false;
+                for (size_t level = 0; level + 1 < bestOrder.size(); ++level) {
+                    std::vector<uint32_t> order = bestOrder;
+                    std::swap(order[level], order[level + 1]);
+                    auto built = build(ids, order);
+                    if (built && built->size() < best->size()) {
+                        best = std::move(built);
+                        bestOrder = std::move(order);
+                        improved = true;
+                    }
                 }
-                if (functionName == "log") {
-                    if (x <= 0) return false; // Domain error
-                    outResult = Value(std::log(x));
-                    return true;
+            }
+
+            std::vector<ASTNodePtr> ordered;
+            for (const uint32_t id : bestOrder) ordered.push_back(atoms[id]);
+            atoms = std::move(ordered);
+            nodes = std::move(best->nodes);
+            root = best->root;
+        }
+
+        /**
+         * @brief Decide the rule by walking the diagram
+         * @param tested Optional counter incremented once per atom evaluated
+         * @throws ExprException If an evaluated atom throws
+         */
+        bool Evaluate(IEnvironment* environment, EvaluationContext* context = nullptr, size_t* tested = nullptr) const {
+            uint32_t node = root;
+            while (node > TRUE_NODE) {
+                const Node& n = nodes[node];
+                const Value value = atoms[n.level]->evaluate(environment, context);
+                if (tested) ++*tested;
+                if (value.isNull()) return source->evaluate(environment, context).asBoolean();
+                node = value.asBoolean() ? n.high : n.low;
+            }
+            return node == TRUE_NODE;
+        }
+
+        /**
+         * @brief Atomic predicates in diagram order (level i tests atom i)
+         */
+        const std::vector<ASTNodePtr>& getAtoms() const { return atoms; }
+
+        /**
+         * @brief Number of decision nodes, excluding the two terminals
+         */
+        size_t getNodeCount() const { return nodes.size() - 2; }
+
+    private:
+        static constexpr uint32_t FALSE_NODE = 0;
+        static constexpr uint32_t TRUE_NODE = 1;
+        static constexpr uint32_t TERMINAL_LEVEL = std::numeric_limits<uint32_t>::max();
+
+        struct Node {
+            uint32_t level;
+            uint32_t low;
+            uint32_t high;
+        };
+
+        static uint64_t key(const uint32_t a, const uint32_t b, const uint32_t c) {
+            return (uint64_t(a) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(b) << 32 | c) * 0xC2B2AE3D27D4EB4Full;
+        }
+
+        // Builds one diagram for a fixed order with a unique table and a memoized ITE
+        struct Builder {
+            std::vector<Node> nodes{{TERMINAL_LEVEL, 0, 0}, {TERMINAL_LEVEL, 1, 1}};
+            std::unordered_multimap<uint64_t, uint32_t> unique;
+            std::unordered_multimap<uint64_t, std::pair<std::array<uint32_t, 3>, uint32_t>> computed;
+            uint32_t root = FALSE_NODE;
+
+            size_t size() const { return nodes.size(); }
+
+            uint32_t make(const uint32_t level, const uint32_t low, const uint32_t high) {
+                if (low == high) return low;
+                const uint64_t k = key(level, low, high);
+                for (auto range = unique.equal_range(k); range.first != range.second; ++range.first) {
+                    const Node& n = nodes[range.first->second];
+                    if (n.level == level && n.low == low && n.high == high) return range.first->second;
+                }
+                if (nodes.size() >= MAX_NODES) throw ExprException("Decision diagram exceeds the node limit");
+                nodes.push_back(Node{level, low, high});
+                unique.emplace(k, static_cast<uint32_t>(nodes.size() - 1));
+                return static_cast<uint32_t>(nodes.size() - 1);
+            }
+
+            uint32_t cofactor(const uint32_t f, const uint32_t level, const bool high) const {
+                if (nodes[f].level != level) return f;
+                return high ? nodes[f].high : nodes[f].low;
+            }
+
+            uint32_t ite(const uint32_t f, const uint32_t g, const uint32_t h) {
+                if (f == TRUE_NODE) return g;
+                if (f == FALSE_NODE) return h;
+                if (g == h) return g;
+                if (g == TRUE_NODE && h == FALSE_NODE) return f;
+                const uint64_t k = key(f, g, h);
+                for (auto range = computed.equal_range(k); range.first != range.second; ++range.first) {
+                    if (range.first->second.first == std::array<uint32_t, 3>{f, g, h}) return range.first->second.second;
+                }
+                const uint32_t level = std::min({nodes[f].level, nodes[g].level, nodes[h].level});
+                const uint32_t low = ite(cofactor(f, level, false), cofactor(g, level, false), cofactor(h, level, false));
+                const uint32_t high = ite(cofactor(f, level, true), cofactor(g, level, true), cofactor(h, level, true));
+                const uint32_t result = make(level, low, high);
+                computed.emplace(k, std::make_pair(std::array<uint32_t, 3>{f, g, h}, result));
+                return result;
+            }
+
+            // Drop intermediate results that are not reachable from the root
+            void compact() {
+                std::vector<uint32_t> remap(nodes.size(), TERMINAL_LEVEL);
+                std::vector<Node> kept(nodes.begin(), nodes.begin() + 2);
+                remap[FALSE_NODE] = FALSE_NODE;
+                remap[TRUE_NODE] = TRUE_NODE;
+                std::vector<uint32_t> stack{root};
+                std::vector<uint32_t> visited;
+                while (!stack.empty()) {
+                    const uint32_t n = stack.back();
+                    stack.pop_back();
+                    if (remap[n] != TERMINAL_LEVEL) continue;
+                    remap[n] = 0;  // Placeholder until numbered below
+                    visited.push_back(n);
+                    stack.push_back(nodes[n].low);
+                    stack.push_back(nodes[n].high);
+                }
+                // Children were created before their parents, so ascending ids keep that order
+                std::sort(visited.begin(), visited.end());
+                for (const uint32_t n : visited) {
+                    remap[n] = static_cast<uint32_t>(kept.size());
+                    kept.push_back(Node{nodes[n].level, remap[nodes[n].low], remap[nodes[n].high]});
+                }
+                root = remap[root];
+                nodes = std::move(kept);
+                unique.clear();
+                computed.clear();
+            }
+        };
+
+        ASTNodePtr source;
+        std::vector<ASTNodePtr> atoms;
+        std::vector<Node> nodes;
+        uint32_t root = FALSE_NODE;
+
+        static bool isConnective(const ASTNodePtr& node) {
+            if (auto binary = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+                const OperatorType op = binary->getOperator();
+                return op == OperatorType::AND || op == OperatorType::OR || op == OperatorType::XOR;
+            }
+            if (auto unary = std::dynamic_pointer_cast<UnaryOpNode>(node)) return unary->getOperator() == OperatorType::NOT;
+            return std::dynamic_pointer_cast<TernaryOpNode>(node) != nullptr;
+        }
+
+        static bool isConstant(const ASTNodePtr& node) {
+            return std::dynamic_pointer_cast<BooleanNode>(node) || std::dynamic_pointer_cast<NumberNode>(node);
+        }
+
+        void collect(const ASTNodePtr& node, std::unordered_map<const ASTNode*, uint32_t>& ids, std::vector<size_t>& uses) {
+            if (isConstant(node)) return;
+            if (isConnective(node)) {
+                for (const auto& child : node->getChildren()) collect(child, ids, uses);
+                return;
+            }
+            const auto it = ids.find(node.get());
+            if (it != ids.end()) {
+                ++uses[it->second];
+                return;
+            }
+            ids.emplace(node.get(), static_cast<uint32_t>(atoms.size()));
+            atoms.push_back(node);
+            uses.push_back(1);
+        }
+
+        uint32_t translate(Builder& builder, const ASTNodePtr& node, const std::unordered_map<const ASTNode*, uint32_t>& ids,
+                           const std::vector<uint32_t>& levels, std::unordered_map<const ASTNode*, uint32_t>& done) const {
+            const auto it = done.find(node.get());
+            if (it != done.end()) return it->second;
+            uint32_t result;
+            if (isConstant(node)) {
+                result = node->evaluate(nullptr).asBoolean() ? TRUE_NODE : FALSE_NODE;
+            } else if (auto binary = std::dynamic_pointer_cast<BinaryOpNode>(node); binary && isConnective(node)) {
+                const uint32_t l = translate(builder, binary->getLeft(), ids, levels, done);
+                const uint32_t r = translate(builder, binary->getRight(), ids, levels, done);
+                switch (binary->getOperator()) {
+                    case OperatorType::AND: result = builder.ite(l, r, FALSE_NODE); break;
+                    case OperatorType::OR: result = builder.ite(l, TRUE_NODE, r); break;
+                    default: result = builder.ite(l, builder.ite(r, FALSE_NODE, TRUE_NODE), r); break;
+                }
+            } else if (auto unary = std::dynamic_pointer_cast<UnaryOpNode>(node); unary && isConnective(node)) {
+                result = builder.ite(translate(builder, unary->getOperand(), ids, levels, done), FALSE_NODE, TRUE_NODE);
+            } else if (auto ternary = std::dynamic_pointer_cast<TernaryOpNode>(node)) {
+                const uint32_t c = translate(builder, ternary->getCondition(), ids, levels, done);
+                const uint32_t t = translate(builder, ternary->getTrueExpr(), ids, levels, done);
+                const uint32_t f = translate(builder, ternary->getFalseExpr(), ids, levels, done);
+                result = builder.ite(c, t, f);
+            } else {
+                result = builder.make(levels[ids.at(node.get())], FALSE_NODE, TRUE_NODE);
+            }
+            done.emplace(node.get(), result);
+            return result;
+        }
+
+        // Build the diagram for an order; null if it exceeds the node limit
+        std::unique_ptr<Builder> build(const std::unordered_map<const ASTNode*, uint32_t>& ids,
+                                       const std::vector<uint32_t>& order) const {
+            std::vector<uint32_t> levels(order.size());
+            for (uint32_t level = 0; level < order.size(); ++level) levels[order[level]] = level;
+            auto builder = std::make_unique<Builder>();
+            std::unordered_map<const ASTNode*, uint32_t> done;
+            try {
+                builder->root = translate(*builder, source, ids, levels, done);
+                builder->compact();
+            } catch (const ExprException&) {
+                return nullptr;
+            }
+            return builder;
+        }
+    };
+
+    /**
+     * @brief One observation made by AnalyzeRules()
+     */
+    struct RuleFinding {
+        enum class Kind {
+            UNSATISFIABLE,  // The rule can never match; dropped
+            EQUIVALENT,     // The rule matches exactly when `other` does; dropped
+            SUBSUMED,       // Whenever the rule matches, `other` matches too; dropped when pruning subsumed rules
+            SIMPLIFIED      // The rule was rewritten with fewer atoms; kept
+        };
+
+        Kind kind;
+        size_t rule;                                            // Index of the rule in the input
+        size_t other = std::numeric_limits<size_t>::max();      // Related rule for EQUIVALENT and SUBSUMED
+        std::string message;
+    };
+
+    /**
+     * @brief Pruned rule set and the findings that produced it
+     */
+    struct RuleSetReport {
+        std::vector<ASTNodePtr> rules;      // Remaining rules, possibly simplified
+        std::vector<size_t> sources;        // Input index of each remaining rule
+        std::vector<RuleFinding> findings;
+    };
+
+    /**
+     * @brief Rule normalization into disjunctions of constraint conjunctions
+     *
+     * Comparisons of a variable against a number become intervals, equality and
+     * inequality against a string become string constraints, and every other
+     * predicate is an opaque atom. Structurally equal atoms are the same atom,
+     * except host function calls, which are never assumed to repeat their result.
+     * Negations are pushed into the comparisons, which assumes the compared
+     * variables hold non-null numbers (or strings for string comparisons).
+     */
+    class RuleNormalizer {
+    public:
+        struct Range {
+            double lo = -std::numeric_limits<double>::infinity();
+            double hi = std::numeric_limits<double>::infinity();
+            bool loOpen = true;
+            bool hiOpen = true;
+
+            bool empty() const { return lo > hi || (lo == hi && (loOpen || hiOpen)); }
+
+            void intersect(const Range& other) {
+                if (other.lo > lo || (other.lo == lo && other.loOpen)) { lo = other.lo; loOpen = other.loOpen; }
+                if (other.hi < hi || (other.hi == hi && other.hiOpen)) { hi = other.hi; hiOpen = other.hiOpen; }
+            }
+
+            // Whether every value in `inner` lies in this range
+            bool contains(const Range& inner) const {
+                const bool low = inner.lo > lo || (inner.lo == lo && (!loOpen || inner.loOpen));
+                const bool high = inner.hi < hi || (inner.hi == hi && (!hiOpen || inner.hiOpen));
+                return low && high;
+            }
+        };
+
+        struct Text {
+            bool hasEqual = false;
+            std::string equal;
+            std::set<std::string> excluded;
+
+            bool empty() const { return hasEqual && excluded.count(equal) != 0; }
+        };
+
+        struct Term {
+            std::map<std::string, Range> ranges;
+            std::map<std::string, Text> texts;
+            std::map<const ASTNode*, bool> atoms;  // Opaque atom -> required truth value
+            bool unsatisfiable = false;
+
+            // Conjoin another term into this one
+            void conjoin(const Term& other) {
+                for (const auto& entry : other.ranges) {
+                    Range& range = ranges[entry.first];
+                    range.intersect(entry.second);
+                    unsatisfiable = unsatisfiable || range.empty();
+                }
+                for (const auto& entry : other.texts) {
+                    Text& text = texts[entry.first];
+                    if (entry.second.hasEqual) {
+                        if (text.hasEqual && text.equal != entry.second.equal) unsatisfiable = true;
+                        text.hasEqual = true;
+                        text.equal = entry.second.equal;
+                    }
+                    text.excluded.insert(entry.second.excluded.begin(), entry.second.excluded.end());
+                    unsatisfiable = unsatisfiable || text.empty();
+                }
+                for (const auto& entry : other.atoms) {
+                    const auto it = atoms.find(entry.first);
+                    if (it != atoms.end() && it->second != entry.second) unsatisfiable = true;
+                    atoms[entry.first] = entry.second;
+                }
+                unsatisfiable = unsatisfiable || other.unsatisfiable;
+            }
+
+            // Whether this term implies `weaker`
+            bool implies(const Term& weaker) const {
+                for (const auto& entry : weaker.ranges) {
+                    const auto it = ranges.find(entry.first);
+                    if (!entry.second.contains(it == ranges.end() ? Range() : it->second)) return false;
+                }
+                for (const auto& entry : weaker.texts) {
+                    const auto it = texts.find(entry.first);
+                    const Text text = it == texts.end() ? Text() : it->second;
+                    if (entry.second.hasEqual && (!text.hasEqual || text.equal != entry.second.equal)) return false;
+                    for (const auto& value : entry.second.excluded) {
+                        if (!(text.hasEqual && text.equal != value) && text.excluded.count(value) == 0) return false;
+                    }
+                }
+                for (const auto& entry : weaker.atoms) {
+                    const auto it = atoms.find(entry.first);
+                    if (it == atoms.end() || it->second != entry.second) return false;
+                }
+                return true;
+            }
+        };
+
+        using Disjunction = std::vector<Term>;
+
+        static constexpr size_t MAX_TERMS = 256;
+
+        /**
+         * @brief Normalize a rule; rules that expand past MAX_TERMS become a single opaque atom
+         */
+        Disjunction Normalize(const ASTNodePtr& rule) {
+            const ASTNodePtr node = eliminator.Intern(rule);
+            try {
+                return prune(expand(node, false));
+            } catch (const ExprException&) {
+                return {atom(node, true)};
+            }
+        }
+
+        /**
+         * @brief Whether a implies b (sound, not complete: every term of a implies some term of b)
+         */
+        static bool Implies(const Disjunction& a, const Disjunction& b) {
+            return std::all_of(a.begin(), a.end(), [&](const Term& term) {
+                return std::any_of(b.begin(), b.end(), [&](const Term& other) { return term.implies(other); });
+            });
+        }
+
+        /**
+         * @brief Rebuild an expression from a normalized rule
+         */
+        ASTNodePtr Build(const Disjunction& terms) const {
+            ASTNodePtr result;
+            for (const auto& term : terms) {
+                ASTNodePtr conjunction;
+                const auto conjoin = [&](ASTNodePtr part) {
+                    conjunction = conjunction ? std::make_shared<BinaryOpNode>(conjunction, OperatorType::AND, part) : part;
+                };
+                for (const auto& entry : term.ranges) {
+                    const auto variable = std::make_shared<VariableNode>(entry.first);
+                    const Range& range = entry.second;
+                    if (range.lo == range.hi && !range.loOpen && !range.hiOpen) {
+                        conjoin(std::make_shared<BinaryOpNode>(variable, OperatorType::EQ, std::make_shared<NumberNode>(range.lo)));
+                        continue;
+                    }
+                    if (range.lo > -std::numeric_limits<double>::infinity()) {
+                        conjoin(std::make_shared<BinaryOpNode>(variable, range.loOpen ? OperatorType::GT : OperatorType::GE,
+                                                               std::make_shared<NumberNode>(range.lo)));
+                    }
+                    if (range.hi < std::numeric_limits<double>::infinity()) {
+                        conjoin(std::make_shared<BinaryOpNode>(variable, range.hiOpen ? OperatorType::LT : OperatorType::LE,
+                                                               std::make_shared<NumberNode>(range.hi)));
+                    }
+                }
+                for (const auto& entry : term.texts) {
+                    const auto variable = std::make_shared<VariableNode>(entry.first);
+                    if (entry.second.hasEqual) {
+                        conjoin(std::make_shared<BinaryOpNode>(variable, OperatorType::EQ, std::make_shared<StringNode>(entry.second.equal)));
+                        continue;
+                    }
+                    for (const auto& value : entry.second.excluded) {
+                        conjoin(std::make_shared<BinaryOpNode>(variable, OperatorType::NE, std::make_shared<StringNode>(value)));
+                    }
+                }
+                for (const auto& entry : term.atoms) {
+                    const ASTNodePtr& node = owners.at(entry.first);
+                    conjoin(entry.second ? node : std::make_shared<UnaryOpNode>(OperatorType::NOT, node));
+                }
+                if (!conjunction) conjunction = std::make_shared<BooleanNode>(true);
+                result = result ? std::make_shared<BinaryOpNode>(result, OperatorType::OR, conjunction) : conjunction;
+            }
+            return result ? result : std::make_shared<BooleanNode>(false);
+        }
+
+        /**
+         * @brief Number of predicates in a rule (leaves below its boolean connectives)
+         */
+        static size_t CountAtoms(const ASTNodePtr& node) {
+            if (std::dynamic_pointer_cast<BooleanNode>(node)) return 0;
+            if (connective(node)) {
+                size_t count = 0;
+                for (const auto& child : node->getChildren()) count += CountAtoms(child);
+                return count;
+            }
+            return 1;
+        }
+
+    private:
+        CommonSubexpressionEliminator eliminator;
+        std::unordered_map<const ASTNode*, ASTNodePtr> owners;  // Opaque atoms by identity
+
+        static bool connective(const ASTNodePtr& node) {
+            if (auto binary = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+                const OperatorType op = binary->getOperator();
+                return op == OperatorType::AND || op == OperatorType::OR || op == OperatorType::XOR;
+            }
+            auto unary = std::dynamic_pointer_cast<UnaryOpNode>(node);
+            return unary && unary->getOperator() == OperatorType::NOT;
+        }
+
+        Term atom(const ASTNodePtr& node, const bool value) {
+            owners.emplace(node.get(), node);
+            Term term;
+            term.atoms[node.get()] = value;
+            return term;
+        }
+
+        static OperatorType negate(const OperatorType op) {
+            switch (op) {
+                case OperatorType::GT: return OperatorType::LE;
+                case OperatorType::GE: return OperatorType::LT;
+                case OperatorType::LT: return OperatorType::GE;
+                case OperatorType::LE: return OperatorType::GT;
+                case OperatorType::EQ: return OperatorType::NE;
+                default: return OperatorType::EQ;
+            }
+        }
+
+        static OperatorType mirror(const OperatorType op) {
+            switch (op) {
+                case OperatorType::GT: return OperatorType::LT;
+                case OperatorType::GE: return OperatorType::LE;
+                case OperatorType::LT: return OperatorType::GT;
+                case OperatorType::LE: return OperatorType::GE;
+                default: return op;
+            }
+        }
+
+        static Disjunction conjoin(const Disjunction& a, const Disjunction& b) {
+            if (a.size() * b.size() > MAX_TERMS) throw ExprException("Rule is too large to normalize");
+            Disjunction result;
+            for (const auto& x : a) {
+                for (const auto& y : b) {
+                    Term term = x;
+                    term.conjoin(y);
+                    if (!term.unsatisfiable) result.push_back(std::move(term));
+                }
+            }
+            return result;
+        }
+
+        static Disjunction disjoin(Disjunction a, const Disjunction& b) {
+            if (a.size() + b.size() > MAX_TERMS) throw ExprException("Rule is too large to normalize");
+            a.insert(a.end(), b.begin(), b.end());
+            return a;
+        }
+
+        // Constraint for `variable op constant`; false if the comparison is not of that form
+        static bool comparison(const BinaryOpNode& node, const bool negated, Disjunction& out) {
+            OperatorType op = node.getOperator();
+            if (op != OperatorType::GT && op != OperatorType::GE && op != OperatorType::LT && op != OperatorType::LE &&
+                op != OperatorType::EQ && op != OperatorType::NE) {
+                return false;
+            }
+            auto variable = std::dynamic_pointer_cast<VariableNode>(node.getLeft());
+            ASTNodePtr constant = node.getRight();
+            if (!variable) {
+                variable = std::dynamic_pointer_cast<VariableNode>(node.getRight());
+                constant = node.getLeft();
+                op = mirror(op);
+            }
+            if (!variable) return false;
+            if (negated) op = negate(op);
+            const std::string& name = variable->getName();
+
+            if (auto number = std::dynamic_pointer_cast<NumberNode>(constant)) {
+                const double c = number->getValue();
+                if (std::isnan(c)) return false;
+                Range range;
+                switch (op) {
+                    case OperatorType::GT: range.lo = c; break;
+                    case OperatorType::GE: range.lo = c; range.loOpen = false; break;
+                    case OperatorType::LT: range.hi = c; break;
+                    case OperatorType::LE: range.hi = c; range.hiOpen = false; break;
+                    case OperatorType::EQ: range.lo = range.hi = c; range.loOpen = range.hiOpen = false; break;
+                    default: {
+                        // x != c is x < c || x > c
+                        Term below, above;
+                        below.ranges[name].hi = c;
+                        above.ranges[name].lo = c;
+                        out = {below, above};
+                        return true;
+                    }
                 }
-                if (functionName == "exp") {
-                    outResult = Value(std::exp(x));
-                    return true;
+                Term term;
+                term.ranges[name] = range;
+                out = {term};
+                return true;
+            }
+            if (auto string = std::dynamic_pointer_cast<StringNode>(constant)) {
+                if (op != OperatorType::EQ && op != OperatorType::NE) return false;
+                Term term;
+                Text& text = term.texts[name];
+                if (op == OperatorType::EQ) {
+                    text.hasEqual = true;
+                    text.equal = string->getValue();
+                } else {
+                    text.excluded.insert(string->getValue());
                 }
-                if (functionName == "floor") {
-                    outResult = Value(std::floor(x));
-                    return true;
+                out = {term};
+                return true;
+            }
+            return false;
+        }
+
+        Disjunction expand(const ASTNodePtr& node, const bool negated) {
+            if (auto boolean = std::dynamic_pointer_cast<BooleanNode>(node)) {
+                if (boolean->getValue() != negated) return {Term()};
+                return {};
+            }
+            if (auto unary = std::dynamic_pointer_cast<UnaryOpNode>(node)) {
+                if (unary->getOperator() == OperatorType::NOT) return expand(unary->getOperand(), !negated);
+            }
+            if (auto binary = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+                const ASTNodePtr& l = binary->getLeft();
+                const ASTNodePtr& r = binary->getRight();
+                switch (binary->getOperator()) {
+                    case OperatorType::AND:
+                        return negated ? disjoin(expand(l, true), expand(r, true)) : conjoin(expand(l, false), expand(r, false));
+                    case OperatorType::OR:
+                        return negated ? conjoin(expand(l, true), expand(r, true)) : disjoin(expand(l, false), expand(r, false));
+                    case OperatorType::XOR:
+                        // a xor b = (a && !b) || (!a && b); its negation is (a && b) || (!a && !b)
+                        return disjoin(conjoin(expand(l, false), expand(r, !negated)), conjoin(expand(l, true), expand(r, negated)));
+                    default: {
+                        Disjunction constraint;
+                        if (comparison(*binary, negated, constraint)) return constraint;
+                        break;
+                    }
                 }
-                if (functionName == "ceil") {
-                    outResult = Value(std::ceil(x));
-                    return true;
+            }
+            return {atom(node, !negated)};
+        }
+
+        // Drop terms implied by another term; of equal terms the first is kept
+        static Disjunction prune(const Disjunction& terms) {
+            Disjunction kept;
+            for (size_t i = 0; i < terms.size(); ++i) {
+                bool redundant = false;
+                for (size_t j = 0; j < terms.size() && !redundant; ++j) {
+                    if (i == j || !terms[i].implies(terms[j])) continue;
+                    redundant = !terms[j].implies(terms[i]) || j < i;
                 }
-                if (functionName == "round") {
-                    outResult = Value(std::round(x));
-                    return true;
+                if (!redundant) kept.push_back(terms[i]);
+            }
+            return kept;
+        }
+    };
+
+    /**
+     * @brief Find unsatisfiable, duplicate and subsumed rules in a rule set
+     *
+     * Each rule is normalized (see RuleNormalizer) and compared with the others:
+     * rules that can never match are dropped, a rule equivalent to an earlier
+     * one is dropped in its favour, and, when pruneSubsumed is set, a rule that
+     * implies another rule is dropped, which is correct when the set is used as
+     * alternatives (an event matters if any rule matches). Remaining rules are
+     * replaced by their normalized form when it needs fewer predicates, e.g.
+     * `x > 5 && x > 10` becomes `x > 10`. The analysis is conservative: it only
+     * reports relationships it can prove.
+     *
+     * Usage example:
+     * @code
+     * RuleSetReport report = AnalyzeRules({Parse("x > 10"), Parse("x > 5 && x > 10"), Parse("x > 3 && x < 2")});
+     * // report.rules == {x > 10}; findings: rule 1 EQUIVALENT to rule 0, rule 2 UNSATISFIABLE
+     * @endcode
+     */
+    inline RuleSetReport AnalyzeRules(const std::vector<ASTNodePtr>& rules, const bool pruneSubsumed = true) {
+        RuleNormalizer normalizer;
+        std::vector<RuleNormalizer::Disjunction> forms;
+        for (const auto& rule : rules) forms.push_back(normalizer.Normalize(rule));
+
+        RuleSetReport report;
+        std::vector<bool> kept(rules.size(), false);
+        const auto describe = [](const size_t rule, const char* relation, const size_t other) {
+            return "rule " + std::to_string(rule) + relation + std::to_string(other);
+        };
+        for (size_t i = 0; i < rules.size(); ++i) {
+            if (forms[i].empty()) {
+                report.findings.push_back({RuleFinding::Kind::UNSATISFIABLE, i, std::numeric_limits<size_t>::max(),
+                                           "rule " + std::to_string(i) + " can never match"});
+                continue;
+            }
+            kept[i] = true;
+            for (size_t j = 0; j < i; ++j) {
+                if (kept[j] && RuleNormalizer::Implies(forms[i], forms[j]) && RuleNormalizer::Implies(forms[j], forms[i])) {
+                    report.findings.push_back({RuleFinding::Kind::EQUIVALENT, i, j, describe(i, " is equivalent to rule ", j)});
+                    kept[i] = false;
+                    break;
                 }
             }
+        }
 
-            return false; // Function not found or invalid arguments
-        } catch (...) {
-            return false; // Error occurred
+        // Implication between distinct classes is a strict order, so the maximal rules cover the dropped ones
+        std::vector<bool> subsumed(rules.size(), false);
+        for (size_t i = 0; i < rules.size(); ++i) {
+            if (!kept[i]) continue;
+            for (size_t j = 0; j < rules.size(); ++j) {
+                if (i == j || !kept[j] || !RuleNormalizer::Implies(forms[i], forms[j])) continue;
+                report.findings.push_back({RuleFinding::Kind::SUBSUMED, i, j, describe(i, " is subsumed by rule ", j)});
+                subsumed[i] = pruneSubsumed;
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < rules.size(); ++i) {
+            if (!kept[i] || subsumed[i]) continue;
+            ASTNodePtr rule = rules[i];
+            ASTNodePtr simplified = normalizer.Build(forms[i]);
+            if (RuleNormalizer::CountAtoms(simplified) < RuleNormalizer::CountAtoms(rule)) {
+                report.findings.push_back({RuleFinding::Kind::SIMPLIFIED, i, std::numeric_limits<size_t>::max(),
+                                           "rule " + std::to_string(i) + " simplified from " +
+                                               std::to_string(RuleNormalizer::CountAtoms(rule)) + " to " +
+                                               std::to_string(RuleNormalizer::CountAtoms(simplified)) + " predicates"});
+                rule = simplified;
+            }
+            report.rules.push_back(rule);
+            report.sources.push_back(i);
         }
+        return report;
     }
 
     /**
-     * @brief Enumeration of all supported operators
-     *
-     * This enum defines all arithmetic, comparison, and logical operators
-     * supported by the expression system. Operators are grouped by category
-     * for easier understanding and implementation.
+     * @brief Aggregate functions supported by GroupBy()
      */
-    enum class OperatorType {
-        ADD, SUB, MUL, DIV,           // 算术运算符: +, -, *, /
-        EQ, NE, GT, LT, GE, LE,       // 比较运算符: ==, !=, >, <, >=, <=
-        IN,                           // 包含运算符: in
-        AND, OR, XOR, NOT,            // 逻辑运算符: &&, ||, xor, !
-        TERNARY                       // 三元运算符: ? :
+    enum class AggregateFunction {
+        SUM,    // Sum of the values
+        COUNT,  // Number of rows (the expression is not evaluated)
+        MIN,    // Smallest value (NaN when every value is null)
+        MAX,    // Largest value (NaN when every value is null)
+        AVG     // Arithmetic mean (NaN when every value is null)
     };
 
     /**
-     * @brief AST node representing binary operations (operations with two operands)
-     *
-     * This node handles all binary operators including arithmetic, comparison,
-     * and logical operations. It evaluates both operands and applies the
-     * specified operator according to type compatibility rules.
+     * @brief One aggregate computed per group by GroupBy()
+     */
+    struct AggregateSpec {
+        AggregateFunction function;
+        ASTNodePtr expression;   // Numeric value expression; may be null for COUNT
+    };
+
+    /**
+     * @brief A group key together with its aggregate results
+     */
+    struct GroupAggregate {
+        Value key;
+        size_t rows = 0;
+        std::vector<double> values;   // One result per AggregateSpec, in order; null values are skipped
+    };
+
+    /**
+     * @brief Open-addressing hash table of group keys and running aggregates
      *
-     * Supported operations:
-     * - Arithmetic: 2 + 3, 5 * 4, 10 / 2, 7 - 1
-     * - Comparison: x == 5, age >= 18, score != 0
-     * - Logical: a && b, x || y, p xor q
+     * Slots hold only a hash and a group index and are probed linearly; keys and
+     * accumulators live in dense arrays in first-seen order, so probing touches
+     * one small array and results come out in a deterministic order. Numeric keys
+     * group -0 with 0 and all NaNs together.
      */
-    class BinaryOpNode final : public ASTNode {
-        ASTNodePtr left, right;
-        OperatorType op;
+    class AggregationTable {
     public:
-        BinaryOpNode(ASTNodePtr l, const OperatorType o, ASTNodePtr r)
-            : left(std::move(l)), right(std::move(r)), op(o) {}
+        struct Accumulator {
+            double sum = 0.0;
+            double min = std::numeric_limits<double>::infinity();
+            double max = -std::numeric_limits<double>::infinity();
+            size_t count = 0;   // Non-null values seen
 
-        Value evaluate(IEnvironment* environment) const override {
-            const Value lhs = left->evaluate(environment);
-            const Value rhs = right->evaluate(environment);
+            void add(const double v) {
+                ++count;
+                sum += v;
+                min = std::min(min, v);
+                max = std::max(max, v);
+            }
 
-            // Boolean logical operations - allow any types and convert to boolean
-            if (op == OperatorType::AND || op == OperatorType::OR || op == OperatorType::XOR) {
-                const bool a = lhs.asBoolean();
-                const bool b = rhs.asBoolean();
-                switch (op) {
-                    case OperatorType::AND: return Value(a && b);
-                    case OperatorType::OR: return Value(a || b);
-                    case OperatorType::XOR: return Value(a != b);
-                    default: break; // Should not reach here
-                }
+            void merge(const Accumulator& other) {
+                count += other.count;
+                sum += other.sum;
+                min = std::min(min, other.min);
+                max = std::max(max, other.max);
             }
+        };
 
-            // String operations
-            if (lhs.isString() || rhs.isString()) {
-                switch (op) {
-                    case OperatorType::ADD: {
-                        // 字符串连接：将两个操作数都转换为字符串
-                        return Value(lhs.asString() + rhs.asString());
-                    }
-                    case OperatorType::EQ: {
-                        // 字符串相等比较
-                        if (lhs.isString() && rhs.isString()) {
-                            return Value(lhs.asString() == rhs.asString());
-                        }
-                        // 类型不同时为不相等
-                        return Value(false);
-                    }
-                    case OperatorType::NE: {
-                        // 字符串不等比较
-                        if (lhs.isString() && rhs.isString()) {
-                            return Value(lhs.asString() != rhs.asString());
-                        }
-                        // 类型不同时为不相等
-                        return Value(true);
-                    }
-                    case OperatorType::GT:
-                    case OperatorType::LT:
-                    case OperatorType::GE:
-                    case OperatorType::LE: {
-                        // 字符串比较：两个操作数都必须是字符串
-                        if (lhs.isString() && rhs.isString()) {
-                            const std::string& a = lhs.asString();
-                            const std::string& b = rhs.asString();
-                            switch (op) {
-                                case OperatorType::GT: return Value(a > b);
-                                case OperatorType::LT: return Value(a < b);
-                                case OperatorType::GE: return Value(a >= b);
-                                case OperatorType::LE: return Value(a <= b);
-                                default: break;
-                            }
-                        }
-                        throw ExprException("String comparison operators require two string operands");
-                    }
-                    case OperatorType::IN: {
-                        // 字符串包含检查：检查左操作数是否包含在右操作数中
-                        if (lhs.isString() && rhs.isString()) {
-                            const std::string& needle = lhs.asString();
-                            const std::string& haystack = rhs.asString();
-                            return Value(haystack.find(needle) != std::string::npos);
-                        }
-                        throw ExprException("in operator requires two string operands");
-                    }
-                    default:
-                        throw ExprException("Unsupported string operator");
-                }
+    private:
+        struct Slot {
+            uint64_t hash;
+            uint32_t group;
+        };
+        static constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
+
+        size_t width;
+        std::vector<Slot> slots;
+        std::vector<Value> keys;
+        std::vector<uint64_t> hashes;
+        std::vector<size_t> rowCounts;
+        std::vector<Accumulator> accumulators;
+
+        static uint64_t mix(uint64_t h) {
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h;
+        }
+
+        static uint64_t hashNumber(double v) {
+            if (v == 0.0) v = 0.0;
+            if (std::isnan(v)) v = std::numeric_limits<double>::quiet_NaN();
+            uint64_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            return mix(bits);
+        }
+
+        static uint64_t hashString(const std::string_view v) {
+            return mix(static_cast<uint64_t>(std::hash<std::string_view>{}(v)) ^ 0x5bd1e995ULL);
+        }
+
+        static uint64_t hashBoolean(const bool v) {
+            return mix(v ? 0x9e3779b97f4a7c15ULL : 0x7f4a7c159e3779b9ULL);
+        }
+
+        static bool numbersEqual(const double a, const double b) {
+            return a == b || (std::isnan(a) && std::isnan(b));
+        }
+
+        static bool keysEqual(const Value& a, const Value& b) {
+            if (a.type != b.type) return false;
+            if (a.isNumber()) return numbersEqual(a.data.number, b.data.number);
+            return a == b;
+        }
+
+        void grow() {
+            std::vector<Slot> old(slots.empty() ? 16 : slots.size() * 2, Slot{0, EMPTY});
+            old.swap(slots);
+            for (uint32_t g = 0; g < keys.size(); ++g) place(hashes[g], g);
+        }
+
+        void place(const uint64_t hash, const uint32_t group) {
+            const size_t mask = slots.size() - 1;
+            size_t i = hash & mask;
+            while (slots[i].group != EMPTY) i = (i + 1) & mask;
+            slots[i] = Slot{hash, group};
+        }
+
+        template <typename Equals, typename MakeKey>
+        size_t findOrInsert(const uint64_t hash, Equals equals, MakeKey makeKey) {
+            if ((keys.size() + 1) * 2 > slots.size()) grow();
+            const size_t mask = slots.size() - 1;
+            for (size_t i = hash & mask;; i = (i + 1) & mask) {
+                const Slot& slot = slots[i];
+                if (slot.group == EMPTY) break;
+                if (slot.hash == hash && equals(keys[slot.group])) return slot.group;
             }
+            if (keys.size() >= EMPTY) throw ExprException("Too many groups");
+            const auto group = static_cast<uint32_t>(keys.size());
+            keys.push_back(makeKey());
+            hashes.push_back(hash);
+            rowCounts.push_back(0);
+            accumulators.resize(accumulators.size() + width);
+            place(hash, group);
+            return group;
+        }
 
-            // 数值运算
-            if (lhs.isNumber() && rhs.isNumber()) {
-                const double a = lhs.asNumber();
-                const double b = rhs.asNumber();
-                switch (op) {
-                    case OperatorType::ADD: return Value(a + b);
-                    case OperatorType::SUB: return Value(a - b);
-                    case OperatorType::MUL: return Value(a * b);
-                    case OperatorType::DIV:
-                        if (b == 0) throw ExprException("Division by zero");
-                        return Value(a / b);
-                    case OperatorType::GT: return Value(a > b);
-                    case OperatorType::LT: return Value(a < b);
-                    case OperatorType::GE: return Value(a >= b);
-                    case OperatorType::LE: return Value(a <= b);
-                    case OperatorType::EQ: return Value(a == b);
-                    case OperatorType::NE: return Value(a != b);
-                    default:
-                        throw ExprException("Unsupported numeric operator");
+    public:
+        explicit AggregationTable(const size_t aggregateCount) : width(aggregateCount) {}
+
+        /**
+         * @brief Hash a group key with the same function used for batch rows
+         */
+        static uint64_t HashKey(const Value& key) {
+            if (key.isNumber()) return hashNumber(key.data.number);
+            if (key.isBoolean()) return hashBoolean(key.data.boolean);
+            if (key.isNull()) return 0;
+            return hashString(key.asStringView());
+        }
+
+        /**
+         * @brief Find (or create) the group for one row of a key column
+         */
+        size_t Group(const Column& column, const size_t row) {
+            if (!column.isValid(row)) return Group(Value::Null());
+            switch (column.getKind()) {
+                case Column::Kind::NUMBER: {
+                    const double v = column.numberAt(row);
+                    return findOrInsert(hashNumber(v),
+                        [&](const Value& k) { return k.isNumber() && numbersEqual(k.data.number, v); },
+                        [&] { return Value(v); });
                 }
-            }
-            // Strict boolean operations (equality/inequality) require both to be boolean
-            else if (lhs.isBoolean() && rhs.isBoolean()) {
-                const bool a = lhs.asBoolean();
-                const bool b = rhs.asBoolean();
-                switch (op) {
-                    case OperatorType::EQ: return Value(a == b);
-                    case OperatorType::NE: return Value(a != b);
-                    default:
-                        throw ExprException("Unsupported boolean operator");
+                case Column::Kind::BOOLEAN: {
+                    const bool v = column.booleanAt(row);
+                    return findOrInsert(hashBoolean(v),
+                        [&](const Value& k) { return k.isBoolean() && k.data.boolean == v; },
+                        [&] { return Value(v); });
+                }
+                case Column::Kind::STRING:
+                case Column::Kind::DICTIONARY: {
+                    const std::string& v = column.stringAt(row);
+                    return findOrInsert(hashString(v),
+                        [&](const Value& k) { return k.isString() && k.asStringView() == v; },
+                        [&] { return Value(v); });
                 }
+                default:
+                    return Group(column.at(row));
             }
+        }
 
-            throw ExprException("Unsupported operand types");
+        /**
+         * @brief Find (or create) the group for a key value
+         */
+        size_t Group(const Value& key) {
+            return findOrInsert(HashKey(key),
+                [&](const Value& k) { return keysEqual(k, key); },
+                [&] { return key.Owned(); });
         }
-    };
 
-    /**
-     * @brief AST node representing unary operations (operations with one operand)
-     *
-     * This node handles unary operators that operate on a single value:
-     * - Logical NOT: !condition, not flag
-     * - Arithmetic negation: -number, -expression
-     *
-     * Examples: !true, -42, -(x + y), not visible
-     */
-    class UnaryOpNode final : public ASTNode {
-        ASTNodePtr operand;
-        OperatorType op;
-    public:
-        UnaryOpNode(const OperatorType o, ASTNodePtr operand)
-            : operand(std::move(operand)), op(o) {}
+        void CountRow(const size_t group) { ++rowCounts[group]; }
+        Accumulator& At(const size_t group, const size_t aggregate) { return accumulators[group * width + aggregate]; }
+        const Accumulator& At(const size_t group, const size_t aggregate) const { return accumulators[group * width + aggregate]; }
 
-        Value evaluate(IEnvironment* environment) const override {
-            const Value val = operand->evaluate(environment);
+        size_t size() const { return keys.size(); }
+        const Value& KeyAt(const size_t group) const { return keys[group]; }
+        size_t RowsAt(const size_t group) const { return rowCounts[group]; }
 
-            switch (op) {
-                case OperatorType::NOT:
-                    // NOT operator can work with any type - convert to boolean first
-                    return Value(!val.asBoolean());
-                case OperatorType::SUB: // Negation
-                    if (!val.isNumber()) throw ExprException("Negation can only be used with numbers");
-                    return Value(-val.asNumber());
-                default:
-                    throw ExprException("Unsupported unary operator");
+        /**
+         * @brief Fold another table's partial aggregates into this one
+         */
+        void Merge(const AggregationTable& other) {
+            for (size_t g = 0; g < other.size(); ++g) {
+                const size_t group = Group(other.keys[g]);
+                rowCounts[group] += other.rowCounts[g];
+                for (size_t a = 0; a < width; ++a) At(group, a).merge(other.accumulators[g * width + a]);
             }
         }
     };
 
     /**
-     * @brief AST node representing ternary operations (condition ? true_expr : false_expr)
-     *
-     * This node handles the ternary conditional operator (? :).
-     * The condition is evaluated using asBoolean() to support any value type.
+     * @brief Group the rows of a batch by a key expression and aggregate value expressions
+     * @param key Expression producing the group key (number, boolean or string)
+     * @param aggregates Aggregates to compute per group
+     * @param batch Input rows
+     * @param environment Optional environment for variables not in the batch and host functions;
+     *        must be thread-safe when threads > 1
+     * @param context Optional budget and cancellation context; with several threads each worker
+     *        gets its own copy of the budget and shares the cancellation token
+     * @param threads Number of worker threads (0 uses the hardware concurrency)
+     * @return One entry per distinct key, in order of first appearance
+     * @throws ExprException If a value expression is not numeric or evaluation fails
      *
-     * Example: 
-     * - condition ? value1 : value2
+     * Key and value expressions are evaluated together as a fused Projection in batch
+     * mode. Each worker aggregates a contiguous range of rows into its own
+     * AggregationTable, and the partial tables are merged at the end.
      */
-    class TernaryOpNode final : public ASTNode {
-        ASTNodePtr condition;
-        ASTNodePtr trueExpr;
-        ASTNodePtr falseExpr;
-        OperatorType op;
-    public:
-        TernaryOpNode(ASTNodePtr cond, ASTNodePtr trueExpr, ASTNodePtr falseExpr, OperatorType op)
-            : condition(std::move(cond)), trueExpr(std::move(trueExpr)), falseExpr(std::move(falseExpr)), op(op) {}
+    inline std::vector<GroupAggregate> GroupBy(const ASTNodePtr& key, const std::vector<AggregateSpec>& aggregates,
+                                               const Batch& batch, IEnvironment* environment = nullptr,
+                                               EvaluationContext* context = nullptr, size_t threads = 1) {
+        std::vector<ASTNodePtr> expressions{key};
+        std::vector<size_t> columnOf(aggregates.size(), 0);
+        for (size_t a = 0; a < aggregates.size(); ++a) {
+            if (aggregates[a].function == AggregateFunction::COUNT) continue;
+            if (!aggregates[a].expression) throw ExprException("Aggregate requires a value expression");
+            columnOf[a] = expressions.size();
+            expressions.push_back(aggregates[a].expression);
+        }
+        const Projection projection(expressions);
+
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = std::max<size_t>(1, std::min(threads, batch.size() / Projection::DEFAULT_CHUNK_SIZE + 1));
+
+        const auto aggregateRange = [&](AggregationTable& table, const size_t begin, const size_t end,
+                                        EvaluationContext* workerContext) {
+            for (size_t chunk = begin; chunk < end; chunk += Projection::DEFAULT_CHUNK_SIZE) {
+                const size_t count = std::min(Projection::DEFAULT_CHUNK_SIZE, end - chunk);
+                const std::vector<Column> columns = projection.Evaluate(batch, chunk, count, environment, workerContext);
+                for (size_t a = 0; a < aggregates.size(); ++a) {
+                    if (columnOf[a] != 0 && columns[columnOf[a]].getKind() != Column::Kind::NUMBER) {
+                        throw ExprException("Aggregate value expressions must be numeric");
+                    }
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    const size_t group = table.Group(columns[0], i);
+                    table.CountRow(group);
+                    for (size_t a = 0; a < aggregates.size(); ++a) {
+                        // SQL semantics: null values are skipped by SUM, MIN, MAX and AVG
+                        if (columnOf[a] != 0 && columns[columnOf[a]].isValid(i)) {
+                            table.At(group, a).add(columns[columnOf[a]].numberAt(i));
+                        }
+                    }
+                }
+            }
+        };
 
-        Value evaluate(IEnvironment* environment) const override {
-            switch (op) {
-                case OperatorType::TERNARY: {
-                    // Standard ternary: condition ? trueExpr : falseExpr
-                    const Value condValue = condition->evaluate(environment);
-                    if (condValue.asBoolean()) {
-                        return trueExpr->evaluate(environment);
-                    } else {
-                        return falseExpr->evaluate(environment);
+        std::vector<AggregationTable> partials(threads, AggregationTable(aggregates.size()));
+        if (threads == 1) {
+            aggregateRange(partials[0], 0, batch.size(), context);
+        } else {
+            std::vector<std::thread> workers;
+            std::vector<std::exception_ptr> errors(threads);
+            const size_t perThread = (batch.size() + threads - 1) / threads;
+            for (size_t t = 0; t < threads; ++t) {
+                workers.emplace_back([&, t] {
+                    try {
+                        std::unique_ptr<EvaluationContext> local;
+                        if (context) local.reset(new EvaluationContext(context->GetBudget(), context->GetCancellationToken()));
+                        const size_t begin = std::min(batch.size(), t * perThread);
+                        aggregateRange(partials[t], begin, std::min(batch.size(), begin + perThread), local.get());
+                    } catch (...) {
+                        errors[t] = std::current_exception();
                     }
+                });
+            }
+            for (auto& worker : workers) worker.join();
+            for (const auto& error : errors) {
+                if (error) std::rethrow_exception(error);
+            }
+            for (size_t t = 1; t < threads; ++t) partials[0].Merge(partials[t]);
+        }
+
+        const AggregationTable& table = partials[0];
+        std::vector<GroupAggregate> results(table.size());
+        for (size_t g = 0; g < table.size(); ++g) {
+            GroupAggregate& result = results[g];
+            result.key = table.KeyAt(g);
+            result.rows = table.RowsAt(g);
+            result.values.resize(aggregates.size());
+            for (size_t a = 0; a < aggregates.size(); ++a) {
+                const auto& acc = table.At(g, a);
+                switch (aggregates[a].function) {
+                    case AggregateFunction::SUM: result.values[a] = acc.sum; break;
+                    case AggregateFunction::COUNT: result.values[a] = static_cast<double>(result.rows); break;
+                    // An all-null group has no extremes; report NaN like AVG instead of the infinite seeds
+                    case AggregateFunction::MIN: result.values[a] = acc.count ? acc.min : std::nan(""); break;
+                    case AggregateFunction::MAX: result.values[a] = acc.count ? acc.max : std::nan(""); break;
+                    case AggregateFunction::AVG: result.values[a] = acc.sum / static_cast<double>(acc.count); break;
                 }
-                default:
-                    throw ExprException("Unsupported ternary operator");
             }
         }
+        return results;
+    }
+
+    /**
+     * @brief Tuning knobs for a StreamingStage
+     */
+    struct StageOptions {
+        size_t queueCapacity = 4096;                               // Events buffered before Push() blocks
+        size_t maxBatchRows = 256;                                 // Largest micro-batch
+        std::chrono::microseconds maxLatency{1000};                // Longest an event waits for its batch to fill
+        size_t workers = 2;                                        // Evaluation threads
     };
 
     /**
-     * @brief AST node representing function calls
-     *
-     * This node stores a function name and a list of argument expressions.
-     * During evaluation, it evaluates all arguments and delegates to the
-     * IEnvironment to perform the actual function Call.
-     *
-     * Examples: max(a, b), sqrt(x), distance(x1, y1, x2, y2)
+     * @brief The results of all rules for one event, emitted in push order
      */
-    class FunctionCallNode final : public ASTNode {
-        std::string name;
-        std::vector<ASTNodePtr> args;
-    public:
-        FunctionCallNode(const std::string& n, std::vector<ASTNodePtr> a)
-            : name(n), args(std::move(a)) {}
+    struct StageResult {
+        uint64_t sequence = 0;          // Number returned by Push()
+        std::vector<Value> values;      // One value per rule; empty when error is set
+        std::string error;              // Evaluation error for this event, if any
+    };
 
-        Value evaluate(IEnvironment* environment) const override {
-            std::vector<Value> evaluatedArgs;
-            for (const auto& arg : args) {
-                evaluatedArgs.push_back(arg->evaluate(environment));
-            }
-            
-            // First try standard mathematical functions (works without environment)
-            Value standardResult;
-            if (CallStandardFunctions(name, evaluatedArgs, standardResult)) {
-                return standardResult;
+    /**
+     * @brief Counters and latency distribution of a StreamingStage
+     */
+    struct StageMetrics {
+        static constexpr size_t BUCKETS = 40;
+
+        uint64_t eventsIn = 0;
+        uint64_t eventsOut = 0;
+        uint64_t batches = 0;
+        uint64_t errors = 0;
+        uint64_t sinkErrors = 0;                    // Sink calls that threw; the stage keeps going
+        uint64_t blockedPushes = 0;                 // Pushes that waited for queue space
+        std::chrono::nanoseconds maxLatency{0};     // Push to emit
+        uint64_t latencyBuckets[BUCKETS] = {};      // Bucket b counts latencies in [2^b, 2^(b+1)) ns
+
+        double averageBatchRows() const { return batches ? static_cast<double>(eventsOut) / batches : 0.0; }
+
+        /**
+         * @brief Upper bound of the latency below which the given fraction of events fell
+         */
+        std::chrono::nanoseconds LatencyPercentile(const double fraction) const {
+            uint64_t total = 0;
+            for (const uint64_t count : latencyBuckets) total += count;
+            if (total == 0) return std::chrono::nanoseconds(0);
+            const auto target = static_cast<uint64_t>(std::ceil(fraction * static_cast<double>(total)));
+            uint64_t seen = 0;
+            for (size_t b = 0; b < BUCKETS; ++b) {
+                seen += latencyBuckets[b];
+                if (seen >= target) return std::min(maxLatency, std::chrono::nanoseconds(int64_t(1) << (b + 1)));
             }
-            
-            // If not a standard function, require environment
-            if (!environment) throw ExprException("Function call requires IEnvironment");
-            return environment->Call(name, evaluatedArgs);
+            return maxLatency;
         }
     };
 
     /**
-     * @brief Recursive descent parser for expression strings
+     * @brief A pipeline stage that evaluates rules over a continuous stream of events
      *
-     * This class implements a complete expression parser using the recursive
-     * descent parsing technique. It supports operator precedence, associativity,
-     * and proper error reporting.
+     * Events are pushed into a bounded multi-producer/multi-consumer queue; Push()
+     * blocks while the queue is full, which propagates backpressure upstream. Worker
+     * threads drain the queue in micro-batches, cut when maxBatchRows events are
+     * collected or when the oldest event has waited maxLatency, and evaluate them with
+     * a fused Projection. Results reach the sink in push order, one call at a time,
+     * so the sink may push into a downstream stage. If a micro-batch fails, its
+     * events are re-evaluated one by one so an error only affects its own event.
+     * Exceptions thrown by the sink are counted in sinkErrors and dropped.
      *
-     * Grammar (in order of precedence, highest to lowest):
-     * - Primary: numbers, booleans, variables, function calls, parentheses
-     * - Unary: !, not, - (unary minus)
-     * - Multiplicative: *, /
-     * - Additive: +, -
-     * - Relational: <, >, <=, >=
-     * - Equality: ==, !=
-     * - Logical XOR: xor
-     * - Logical AND: &&, and
-     * - Logical OR: ||, or
-     * - Ternary conditional: ? :
+     * @note The sink must not call Close() or destroy the stage: Close() joins the
+     *       worker that is running the sink, which would deadlock.
      *
-     * The parser is designed to be used once per expression string and
-     * produces an AST that can be evaluated multiple times efficiently.
+     * Usage example:
+     * @code
+     * StreamingStage stage({Parse("latency > 250"), Parse("bytes / 1024")}, {"latency", "bytes"}, {},
+     *                      [](const StageResult& result) { forward(result); });
+     * stage.Push({Value(312.0), Value(4096.0)});
+     * stage.Close();
+     * @endcode
      */
-    class Parser {
-        std::string expr;
-        size_t pos = 0;
-        std::vector<Token>* tokens = nullptr;  // Optional token collection
+    class StreamingStage {
+    public:
+        using Sink = std::function<void(const StageResult&)>;
 
-        void addToken(TokenType type, size_t start, size_t length, const std::string& text) {
-            if (tokens) {
-                tokens->emplace_back(type, start, length, text);
+        /**
+         * @param rules Expressions evaluated for every event
+         * @param columns Variable names bound to the values of each event, in order
+         * @param options Queue, batching and threading parameters
+         * @param sink Receives results in push order
+         * @param environment Optional environment for host functions (shared by the workers)
+         */
+        StreamingStage(const std::vector<ASTNodePtr>& rules, std::vector<std::string> columns, StageOptions options,
+                       Sink sink, IEnvironment* environment = nullptr)
+            : projection(rules), names(std::move(columns)), settings(options), output(std::move(sink)), env(environment) {
+            if (settings.queueCapacity == 0 || settings.maxBatchRows == 0) throw ExprException("Invalid StreamingStage options");
+            for (size_t w = 0; w < std::max<size_t>(1, settings.workers); ++w) {
+                threads.emplace_back([this] { work(); });
             }
         }
 
-        void addToken(TokenType type, size_t start, size_t length) {
-            if (tokens && start + length <= expr.length()) {
-                addToken(type, start, length, expr.substr(start, length));
+        ~StreamingStage() { Close(); }
+
+        StreamingStage(const StreamingStage&) = delete;
+        StreamingStage& operator=(const StreamingStage&) = delete;
+
+        /**
+         * @brief Enqueue an event, waiting while the queue is full
+         * @return The event's sequence number
+         * @throws ExprException If the event has the wrong number of values or the stage is closed
+         */
+        uint64_t Push(std::vector<Value> event) {
+            uint64_t sequence;
+            if (!enqueue(event, true, sequence)) throw ExprException("StreamingStage is closed");
+            return sequence;
+        }
+
+        /**
+         * @brief Enqueue an event only if there is room
+         * @return false when the queue is full or the stage is closed
+         */
+        bool TryPush(std::vector<Value> event, uint64_t* sequence = nullptr) {
+            uint64_t assigned;
+            if (!enqueue(event, false, assigned)) return false;
+            if (sequence) *sequence = assigned;
+            return true;
+        }
+
+        /**
+         * @brief Stop accepting events, process everything queued and join the workers
+         * @note Must not be called from the sink, which runs on a worker thread
+         */
+        void Close() {
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                if (closed && threads.empty()) return;
+                closed = true;
             }
+            notEmpty.notify_all();
+            notFull.notify_all();
+            for (auto& thread : threads) thread.join();
+            threads.clear();
         }
 
-        void skipWhitespace() {
-            size_t start = pos;
-            while (pos < expr.size() && std::isspace(expr[pos])) ++pos;
-            if (tokens && pos > start) {
-                addToken(TokenType::WHITESPACE, start, pos - start);
+        StageMetrics GetMetrics() const {
+            std::lock_guard<std::mutex> lock(emitMutex);
+            StageMetrics snapshot = metrics;
+            snapshot.eventsIn = pushed.load();
+            snapshot.blockedPushes = blocked.load();
+            return snapshot;
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Event {
+            uint64_t sequence;
+            Clock::time_point arrival;
+            std::vector<Value> values;
+        };
+
+        Projection projection;
+        std::vector<std::string> names;
+        StageOptions settings;
+        Sink output;
+        IEnvironment* env;
+
+        std::mutex queueMutex;
+        std::condition_variable notEmpty;
+        std::condition_variable notFull;
+        std::deque<Event> queue;
+        uint64_t nextSequence = 0;
+        bool closed = false;
+        // Producers never take emitMutex, which a slow sink may hold
+        std::atomic<uint64_t> pushed{0};
+        std::atomic<uint64_t> blocked{0};
+
+        mutable std::mutex emitMutex;
+        std::map<uint64_t, std::pair<StageResult, Clock::time_point>> pending;
+        uint64_t nextEmit = 0;
+        StageMetrics metrics;
+
+        std::vector<std::thread> threads;
+
+        bool enqueue(std::vector<Value>& values, const bool wait, uint64_t& sequence) {
+            if (values.size() != names.size()) throw ExprException("Event has the wrong number of values");
+            // Queued events outlive the caller's buffers
+            for (auto& value : values) {
+                if (value.isBorrowed()) value = value.Owned();
             }
+            std::unique_lock<std::mutex> lock(queueMutex);
+            if (queue.size() >= settings.queueCapacity && !closed) {
+                if (!wait) return false;
+                ++blocked;
+                notFull.wait(lock, [this] { return queue.size() < settings.queueCapacity || closed; });
+            }
+            if (closed) return false;
+            sequence = nextSequence++;
+            queue.push_back(Event{sequence, Clock::now(), std::move(values)});
+            lock.unlock();
+            ++pushed;
+            notEmpty.notify_one();
+            return true;
         }
 
-        bool match(const std::string& str) {
-            skipWhitespace();
-            if (pos + str.length() <= expr.size() &&
-                expr.substr(pos, str.length()) == str) {
-                addToken(TokenType::OPERATOR, pos, str.length(), str);
-                pos += str.length();
-                return true;
+        // Collect the next micro-batch; empty only once the stage is closed and drained
+        std::vector<Event> take() {
+            std::vector<Event> batch;
+            std::unique_lock<std::mutex> lock(queueMutex);
+            notEmpty.wait(lock, [this] { return !queue.empty() || closed; });
+            if (queue.empty()) return batch;
+            const Clock::time_point deadline = queue.front().arrival + settings.maxLatency;
+            for (;;) {
+                while (!queue.empty() && batch.size() < settings.maxBatchRows) {
+                    batch.push_back(std::move(queue.front()));
+                    queue.pop_front();
+                }
+                if (batch.size() >= settings.maxBatchRows || closed || Clock::now() >= deadline) break;
+                notEmpty.wait_until(lock, deadline, [this] { return !queue.empty() || closed; });
             }
-            return false;
+            lock.unlock();
+            notFull.notify_all();
+            return batch;
         }
 
-        bool match(const char c) {
-            skipWhitespace();
-            if (pos < expr.size() && expr[pos] == c) {
-                TokenType type = (c == '(' || c == ')') ? TokenType::PARENTHESIS :
-                                (c == ',') ? TokenType::COMMA : TokenType::OPERATOR;
-                addToken(type, pos, 1, std::string(1, c));
-                ++pos;
-                return true;
+        void work() {
+            for (;;) {
+                std::vector<Event> events = take();
+                if (events.empty()) return;
+                emit(evaluate(events), events);
             }
-            return false;
         }
 
-        char peek() {
-            skipWhitespace();
-            if (pos >= expr.size()) return '\0';
-            return expr[pos];
+        std::vector<StageResult> evaluate(const std::vector<Event>& events) const {
+            std::vector<StageResult> results(events.size());
+            for (size_t i = 0; i < events.size(); ++i) results[i].sequence = events[i].sequence;
+
+            Batch batch(events.size());
+            for (size_t c = 0; c < names.size(); ++c) {
+                std::vector<Value> column(events.size());
+                for (size_t i = 0; i < events.size(); ++i) column[i] = events[i].values[c];
+                batch.Add(names[c], Column::Values(std::move(column)));
+            }
+            try {
+                const std::vector<Column> columns = projection.Evaluate(batch, env);
+                for (size_t i = 0; i < events.size(); ++i) {
+                    for (const auto& column : columns) results[i].values.push_back(column.at(i));
+                }
+            } catch (const std::exception&) {
+                // Isolate the failing events by evaluating them one at a time
+                for (size_t i = 0; i < events.size(); ++i) {
+                    try {
+                        const std::vector<Column> columns = projection.Evaluate(batch, i, 1, env);
+                        results[i].values.clear();
+                        for (const auto& column : columns) results[i].values.push_back(column.at(0));
+                    } catch (const std::exception& e) {
+                        results[i].values.clear();
+                        results[i].error = e.what();
+                    }
+                }
+            }
+            return results;
         }
 
-        std::string peekString(const size_t len) {
-            skipWhitespace();
-            if (pos + len > expr.size()) return "";
-            return expr.substr(pos, len);
+        void emit(std::vector<StageResult> results, const std::vector<Event>& events) {
+            std::lock_guard<std::mutex> lock(emitMutex);
+            ++metrics.batches;
+            for (size_t i = 0; i < results.size(); ++i) {
+                const uint64_t sequence = results[i].sequence;
+                pending.emplace(sequence, std::make_pair(std::move(results[i]), events[i].arrival));
+            }
+            // Sink calls happen under the lock, so results leave strictly in order
+            for (auto it = pending.find(nextEmit); it != pending.end(); it = pending.find(nextEmit)) {
+                const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - it->second.second);
+                metrics.maxLatency = std::max(metrics.maxLatency, latency);
+                size_t bucket = 0;
+                while (bucket + 1 < StageMetrics::BUCKETS && (int64_t(1) << (bucket + 1)) <= latency.count()) ++bucket;
+                ++metrics.latencyBuckets[bucket];
+                ++metrics.eventsOut;
+                if (!it->second.first.error.empty()) ++metrics.errors;
+                if (output) {
+                    // A throwing sink must not kill the worker or leave later results pending
+                    try {
+                        output(it->second.first);
+                    } catch (...) {
+                        ++metrics.sinkErrors;
+                    }
+                }
+                pending.erase(it);
+                ++nextEmit;
+            }
         }
+    };
 
-        char consume() {
-            skipWhitespace();
-            if (pos >= expr.size()) throw ExprException("Unexpected end of expression");
-            char c = expr[pos];
-            addToken(TokenType::OPERATOR, pos, 1, std::string(1, c));
-            return expr[pos++];
+    /**
+     * @brief CPUs grouped by NUMA node
+     */
+    struct NumaTopology {
+        std::vector<std::vector<int>> nodes;  // CPU ids of each node
+
+        /**
+         * @brief Read the topology from sysfs, or return one node holding every CPU
+         */
+        static NumaTopology Detect() {
+            NumaTopology topology;
+#if EXPRESSIONKIT_HAS_THREAD_AFFINITY
+            for (int node = 0; node < 1024; ++node) {
+                std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                if (!file) continue;
+                std::string list;
+                std::getline(file, list);
+                std::vector<int> cpus;
+                try {
+                    cpus = ParseCpuList(list);
+                } catch (const ExprException&) {
+                    // An unreadable topology is treated like a missing one
+                    topology.nodes.clear();
+                    break;
+                }
+                if (!cpus.empty()) topology.nodes.push_back(std::move(cpus));
+            }
+#endif
+            if (topology.nodes.empty()) {
+                std::vector<int> cpus(std::max(1u, std::thread::hardware_concurrency()));
+                for (size_t i = 0; i < cpus.size(); ++i) cpus[i] = static_cast<int>(i);
+                topology.nodes.push_back(std::move(cpus));
+            }
+            return topology;
         }
 
-        // 解析三元表达式（最低优先级）
-        ASTNodePtr parseTernaryExpression() {
-            auto condition = parseOrExpression();
-            if (match("?")) {
-                auto trueExpr = parseTernaryExpression(); // Right associative
-                if (!match(":")) {
-                    throw ExprException("Expected ':' in ternary expression");
+        /**
+         * @brief Parse a kernel CPU list such as "0-3,8-11"
+         * @throws ExprException If the list is malformed
+         */
+        static std::vector<int> ParseCpuList(const std::string& list) {
+            const auto cpuAt = [&list](const size_t pos, size_t& used) {
+                if (pos >= list.size() || !std::isdigit(static_cast<unsigned char>(list[pos]))) {
+                    throw ExprException("Invalid CPU list: " + list);
                 }
-                auto falseExpr = parseTernaryExpression(); // Right associative
-                return std::make_shared<TernaryOpNode>(condition, trueExpr, falseExpr, OperatorType::TERNARY);
+                try {
+                    return std::stoi(list.substr(pos), &used);
+                } catch (const std::out_of_range&) {
+                    throw ExprException("Invalid CPU list: " + list);
+                }
+            };
+            std::vector<int> cpus;
+            size_t pos = 0;
+            while (pos < list.size() && !std::isspace(static_cast<unsigned char>(list[pos]))) {
+                size_t used;
+                const int first = cpuAt(pos, used);
+                pos += used;
+                int last = first;
+                if (pos < list.size() && list[pos] == '-') {
+                    last = cpuAt(pos + 1, used);
+                    pos += used + 1;
+                }
+                if (last < first) throw ExprException("Invalid CPU list: " + list);
+                for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+                if (pos < list.size() && list[pos] == ',') ++pos;
             }
-            return condition;
+            return cpus;
         }
 
-        // 解析逻辑表达式（最低优先级）
-        ASTNodePtr parseOrExpression() {
-            auto left = parseAndExpression();
-            while (match("||") || match("or")) {
-                auto right = parseAndExpression();
-                left = std::make_shared<BinaryOpNode>(left, OperatorType::OR, right);
+        size_t size() const { return nodes.size(); }
+
+        /**
+         * @brief Node owning a CPU (0 if unknown)
+         */
+        size_t NodeOf(const int cpu) const {
+            for (size_t node = 0; node < nodes.size(); ++node) {
+                if (std::find(nodes[node].begin(), nodes[node].end(), cpu) != nodes[node].end()) return node;
             }
-            return left;
+            return 0;
         }
+    };
 
-        // 解析与表达式
-        ASTNodePtr parseAndExpression() {
-            auto left = parseXorExpression();
-            while (match("&&") || match("and")) {
-                auto right = parseXorExpression();
-                left = std::make_shared<BinaryOpNode>(left, OperatorType::AND, right);
+    /**
+     * @brief Restrict the calling thread to a set of CPUs
+     * @return false if affinity is unsupported on this platform or the call failed
+     */
+    inline bool PinCurrentThread(const std::vector<int>& cpus) {
+#if EXPRESSIONKIT_HAS_THREAD_AFFINITY
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (const int cpu : cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpus;
+        return false;
+#endif
+    }
+
+    /**
+     * @brief Named rule registry with optional per-NUMA-node replicas
+     *
+     * With replication enabled, every rule is deep-copied once per node by a thread
+     * pinned to that node, so each replica's nodes are allocated in that node's
+     * memory. Get() returns the replica of the calling thread's node: threads started
+     * by RunPinned() know their node, other threads are mapped through the CPU they
+     * currently run on. Look rules up once per thread rather than per evaluation.
+     *
+     * Usage example:
+     * @code
+     * RuleRegistry registry;
+     * registry.Add("fraud", "amount > 1000 && country != home");
+     * registry.RunPinned(4, [&](size_t node, size_t thread) {
+     *     ASTNodePtr rule = registry.Get("fraud");  // Local to this thread's node
+     *     process(rule, partitions[node * 4 + thread]);
+     * });
+     * @endcode
+     */
+    class RuleRegistry {
+        NumaTopology topology;
+        std::vector<std::unordered_map<std::string, ASTNodePtr>> replicas;  // One map per node, or one in total
+        mutable std::mutex mutex;
+
+        static size_t& localNode() {
+            static thread_local size_t node = std::numeric_limits<size_t>::max();
+            return node;
+        }
+
+        // Run task(node) once per node on a thread pinned to that node and wait for all of them
+        template <typename F>
+        void onEachNode(const size_t threadsPerNode, F task) const {
+            std::vector<std::thread> threads;
+            std::vector<std::exception_ptr> errors(topology.size() * threadsPerNode);
+            for (size_t node = 0; node < topology.size(); ++node) {
+                for (size_t t = 0; t < threadsPerNode; ++t) {
+                    threads.emplace_back([&, node, t] {
+                        PinCurrentThread(topology.nodes[node]);
+                        localNode() = node;
+                        try {
+                            task(node, t);
+                        } catch (...) {
+                            errors[node * threadsPerNode + t] = std::current_exception();
+                        }
+                    });
+                }
+            }
+            for (auto& thread : threads) thread.join();
+            for (const auto& error : errors) {
+                if (error) std::rethrow_exception(error);
             }
-            return left;
         }
 
-        // 解析异或表达式
-        ASTNodePtr parseXorExpression() {
-            auto left = parseEqualityExpression();
-            while (match("xor")) {
-                auto right = parseEqualityExpression();
-                left = std::make_shared<BinaryOpNode>(left, OperatorType::XOR, right);
+    public:
+        /**
+         * @param replicate Keep one copy of every rule per NUMA node
+         * @param numa CPU layout used for pinning and replica selection
+         */
+        explicit RuleRegistry(const bool replicate = true, NumaTopology numa = NumaTopology::Detect())
+            : topology(std::move(numa)) {
+            if (topology.nodes.empty()) throw ExprException("NUMA topology has no nodes");
+            replicas.resize(replicate ? topology.size() : 1);
+        }
+
+        /**
+         * @brief Register a rule under a name, replacing any previous rule of that name
+         */
+        void Add(const std::string& name, const ASTNodePtr& rule) {
+            std::vector<ASTNodePtr> copies(replicas.size(), rule);
+            if (replicas.size() > 1) {
+                onEachNode(1, [&](const size_t node, size_t) { copies[node] = CloneExpression(rule); });
             }
-            return left;
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t node = 0; node < replicas.size(); ++node) replicas[node][name] = std::move(copies[node]);
         }
 
-        // 解析相等性表达式
-        ASTNodePtr parseEqualityExpression() {
-            auto left = parseRelationalExpression();
-            while (true) {
-                if (match("==")) {
-                    auto right = parseRelationalExpression();
-                    left = std::make_shared<BinaryOpNode>(left, OperatorType::EQ, right);
-                } else if (match("!=")) {
-                    auto right = parseRelationalExpression();
-                    left = std::make_shared<BinaryOpNode>(left, OperatorType::NE, right);
-                } else {
-                    break;
+        /**
+         * @brief Parse and register a rule
+         * @throws ExprException If the expression does not parse
+         */
+        void Add(const std::string& name, const std::string& expression) { Add(name, Parser(expression).parse()); }
+
+        /**
+         * @brief The replica of a rule for the calling thread's node
+         * @throws ExprException If no rule has that name
+         */
+        ASTNodePtr Get(const std::string& name) const { return Get(name, CurrentNode()); }
+
+        /**
+         * @brief The replica of a rule for a specific node
+         * @throws ExprException If no rule has that name
+         */
+        ASTNodePtr Get(const std::string& name, const size_t node) const {
+            std::lock_guard<std::mutex> lock(mutex);
+            const auto& rules = replicas[replicas.size() == 1 ? 0 : node % replicas.size()];
+            const auto it = rules.find(name);
+            if (it == rules.end()) throw ExprException("Unknown rule: " + name);
+            return it->second;
+        }
+
+        bool Contains(const std::string& name) const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return replicas[0].count(name) != 0;
+        }
+
+        /**
+         * @brief Node of the calling thread
+         */
+        size_t CurrentNode() const {
+            if (localNode() != std::numeric_limits<size_t>::max()) return localNode();
+#if EXPRESSIONKIT_HAS_THREAD_AFFINITY
+            const int cpu = sched_getcpu();
+            if (cpu >= 0) return topology.NodeOf(cpu);
+#endif
+            return 0;
+        }
+
+        /**
+         * @brief Run a task on threadsPerNode threads pinned to every node and wait for them
+         *
+         * Inside the task, Get() returns the replicas of the thread's own node.
+         * @throws The first exception thrown by any task
+         */
+        void RunPinned(const size_t threadsPerNode, const std::function<void(size_t node, size_t thread)>& task) const {
+            onEachNode(threadsPerNode, task);
+        }
+
+        const NumaTopology& getTopology() const { return topology; }
+        size_t getReplicaCount() const { return replicas.size(); }
+    };
+
+#if EXPRESSIONKIT_HAS_PROCESS_POOL
+    /**
+     * @brief Evaluate fused rules over numeric batches in forked worker processes
+     *
+     * The coordinator compiles the rules once into a Projection and forks the
+     * workers, which inherit the compiled image copy-on-write, so no process
+     * parses anything or serializes an AST. Input columns and results live in one
+     * anonymous shared mapping: the coordinator copies each batch in once, workers
+     * claim row chunks from a lock-free ring, evaluate them against columns that
+     * borrow the shared memory, write results in place and report through a second
+     * ring. Each worker has its own copy of the environment, so host functions
+     * that are not thread-safe are isolated.
+     *
+     * Inputs must be numeric columns, named in the constructor; their validity
+     * bitmaps are shipped with them, so null inputs stay null. Results are
+     * returned as numbers (true is 1, null is NaN). Construct the pool before the
+     * process starts other threads, as with any use of fork().
+     *
+     * Usage example:
+     * @code
+     * ProcessPool pool({Parse("price * qty"), Parse("price > 100")}, {"price", "qty"}, 4, &environment);
+     * std::vector<Column> results = pool.Evaluate(batch);
+     * @endcode
+     */
+    class ProcessPool {
+    public:
+        static constexpr size_t CHUNK_ROWS = 4096;
+        static constexpr size_t DEFAULT_ARENA_BYTES = size_t(64) << 20;
+
+        /**
+         * @brief Compile the rules and start the workers
+         * @param rules Expressions evaluated for every row
+         * @param columns Names of the numeric input columns, in the order batches provide them
+         * @param workers Number of worker processes (0 uses the hardware concurrency)
+         * @param environment Environment each worker copies for host functions; may be null
+         * @param arenaBytes Size of the shared data region; larger batches are processed in rounds
+         * @throws ExprException If shared memory or the workers cannot be created
+         */
+        ProcessPool(const std::vector<ASTNodePtr>& rules, std::vector<std::string> columns, size_t workers,
+                    IEnvironment* environment = nullptr, const size_t arenaBytes = DEFAULT_ARENA_BYTES)
+            : projection(rules), names(std::move(columns)), ruleCount(rules.size()) {
+            if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+            // Per row: a double per input and result, and a validity bit per input; plus a flag
+            // and a partial bitmap byte per input
+            const size_t fixedBytes = 2 * names.size();
+            const size_t rowBytes = sizeof(double) * std::max<size_t>(1, names.size() + ruleCount) + (names.size() + 7) / 8;
+            roundRows = arenaBytes > fixedBytes ? (arenaBytes - fixedBytes) / rowBytes : 0;
+            if (roundRows == 0) throw ExprException("ProcessPool arena is too small");
+            mappingBytes = sizeof(Shared) + arenaBytes;
+            void* memory = mmap(nullptr, mappingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) throw ExprException("ProcessPool could not map shared memory");
+            shared = new (memory) Shared();
+            arena = reinterpret_cast<double*>(static_cast<char*>(memory) + sizeof(Shared));
+
+            for (size_t w = 0; w < workers; ++w) {
+                const pid_t pid = fork();
+                if (pid < 0) {
+                    shutdown();
+                    throw ExprException("ProcessPool could not start a worker");
                 }
+                if (pid == 0) work(environment);   // Never returns
+                children.push_back(pid);
             }
-            return left;
         }
 
-        // 解析关系表达式
-        ASTNodePtr parseRelationalExpression() {
-            auto left = parseAdditiveExpression();
-            while (true) {
-                if (match(">=")) {
-                    auto right = parseAdditiveExpression();
-                    left = std::make_shared<BinaryOpNode>(left, OperatorType::GE, right);
-                } else if (match("<=")) {
-                    auto right = parseAdditiveExpression();
-                    left = std::make_shared<BinaryOpNode>(left, OperatorType::LE, right);
-                } else if (match(">")) {
-                    auto right = parseAdditiveExpression();
-                    left = std::make_shared<BinaryOpNode>(left, OperatorType::GT, right);
-                } else if (match("<")) {
-                    auto right = parseAdditiveExpression();
-                    left = std::make_shared<BinaryOpNode>(left, OperatorType::LT, right);
-                } else if (match("in")) {
-                    auto right = parseAdditiveExpression();
-                    left = std::make_shared<BinaryOpNode>(left, OperatorType::IN, right);
-                } else {
-                    break;
+        ~ProcessPool() { shutdown(); }
+
+        ProcessPool(const ProcessPool&) = delete;
+        ProcessPool& operator=(const ProcessPool&) = delete;
+
+        /**
+         * @brief Evaluate every rule for every row of the batch
+         * @return One column per rule
+         * @throws ExprException If an input column is missing or not numeric, a rule fails, or a worker dies
+         */
+        std::vector<Column> Evaluate(const Batch& batch) {
+            if (broken) throw ExprException("ProcessPool has lost a worker");
+            std::vector<const Column*> inputs;
+            for (const auto& name : names) {
+                const Column* column = batch.Find(name);
+                if (!column || column->getKind() != Column::Kind::NUMBER) {
+                    throw ExprException("ProcessPool input '" + name + "' must be a numeric column");
                 }
+                inputs.push_back(column);
             }
-            return left;
-        }
 
-        // 解析加减表达式
-        ASTNodePtr parseAdditiveExpression() {
-            auto left = parseMultiplicativeExpression();
-            while (peek() == '+' || peek() == '-') {
-                const char op = consume();
-                auto right = parseMultiplicativeExpression();
-                OperatorType opType = (op == '+') ? OperatorType::ADD : OperatorType::SUB;
-                left = std::make_shared<BinaryOpNode>(left, opType, right);
+            std::vector<std::vector<double>> results(ruleCount, std::vector<double>(batch.size()));
+            for (size_t begin = 0; begin < batch.size(); begin += roundRows) {
+                const size_t rows = std::min(roundRows, batch.size() - begin);
+                runRound(inputs, begin, rows, results);
             }
-            return left;
+            std::vector<Column> columns;
+            for (auto& result : results) columns.push_back(Column::Numbers(std::move(result)));
+            return columns;
         }
 
-        // 解析乘除表达式
-        ASTNodePtr parseMultiplicativeExpression() {
-            auto left = parseUnaryExpression();
-            while (peek() == '*' || peek() == '/') {
-                const char op = consume();
-                auto right = parseUnaryExpression();
-                OperatorType opType = (op == '*') ? OperatorType::MUL : OperatorType::DIV;
-                left = std::make_shared<BinaryOpNode>(left, opType, right);
+        size_t getWorkerCount() const { return children.size(); }
+
+    private:
+        static constexpr size_t MAX_TASKS = 1024;
+
+        /**
+         * Bounded multi-producer/multi-consumer queue of task ids (Vyukov's design):
+         * each cell's sequence number says whether it is ready to be written or read,
+         * so producers and consumers only contend on a compare-and-swap of their index.
+         */
+        struct Ring {
+            struct Cell {
+                std::atomic<uint64_t> sequence;
+                uint32_t value;
+            };
+            alignas(64) std::atomic<uint64_t> head;
+            alignas(64) std::atomic<uint64_t> tail;
+            Cell cells[MAX_TASKS];
+
+            Ring() : head(0), tail(0) {
+                for (size_t i = 0; i < MAX_TASKS; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
             }
-            return left;
-        }
 
-        // 解析一元表达式
-        ASTNodePtr parseUnaryExpression() {
-            if (match("!") || match("not")) {
-                auto operand = parseUnaryExpression();
-                return std::make_shared<UnaryOpNode>(OperatorType::NOT, operand);
+            bool push(const uint32_t value) {
+                uint64_t position = tail.load(std::memory_order_relaxed);
+                for (;;) {
+                    Cell& cell = cells[position % MAX_TASKS];
+                    const uint64_t sequence = cell.sequence.load(std::memory_order_acquire);
+                    if (sequence == position) {
+                        if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                            cell.value = value;
+                            cell.sequence.store(position + 1, std::memory_order_release);
+                            return true;
+                        }
+                    } else if (sequence < position) {
+                        return false;   // Full
+                    } else {
+                        position = tail.load(std::memory_order_relaxed);
+                    }
+                }
             }
 
-            if (match("-")) {
-                auto operand = parseUnaryExpression();
-                return std::make_shared<UnaryOpNode>(OperatorType::SUB, operand);
+            bool pop(uint32_t& value) {
+                uint64_t position = head.load(std::memory_order_relaxed);
+                for (;;) {
+                    Cell& cell = cells[position % MAX_TASKS];
+                    const uint64_t sequence = cell.sequence.load(std::memory_order_acquire);
+                    if (sequence == position + 1) {
+                        if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                            value = cell.value;
+                            cell.sequence.store(position + MAX_TASKS, std::memory_order_release);
+                            return true;
+                        }
+                    } else if (sequence < position + 1) {
+                        return false;   // Empty
+                    } else {
+                        position = head.load(std::memory_order_relaxed);
+                    }
+                }
             }
+        };
 
-            return parsePrimaryExpression();
+        struct Task {
+            uint64_t begin;   // First row within the round
+            uint64_t rows;
+            uint32_t failed;
+            char error[256];
+        };
+
+        struct Shared {
+            Ring submissions;
+            Ring completions;
+            std::atomic<uint32_t> stopping{0};
+            uint64_t roundRows = 0;   // Stride of the column and result arrays in the arena
+            Task tasks[MAX_TASKS];
+        };
+
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "ProcessPool requires lock-free 64-bit atomics");
+
+        Projection projection;
+        std::vector<std::string> names;
+        size_t ruleCount;
+        size_t roundRows = 0;
+        size_t mappingBytes = 0;
+        Shared* shared = nullptr;
+        double* arena = nullptr;
+        std::vector<pid_t> children;
+        bool broken = false;
+
+        // Arena layout for a round of n rows: the input columns and results as doubles, then a
+        // flag per input saying whether it has nulls, then the inputs' validity bitmaps
+        uint8_t* validityFlags(const size_t rows) const {
+            return reinterpret_cast<uint8_t*>(arena + (names.size() + ruleCount) * rows);
         }
 
-        // 解析基本表达式
-        ASTNodePtr parsePrimaryExpression() {
-            if (match('(')) {
-                auto expr = parseTernaryExpression();
-                if (!match(')')) throw ExprException("Missing closing parenthesis");
-                return expr;
-            }
+        uint8_t* validityBits(const size_t column, const size_t rows) const {
+            return validityFlags(rows) + names.size() + column * ((rows + 7) / 8);
+        }
 
-            if (std::isdigit(peek()) || peek() == '.') {
-                size_t start = pos;
-                std::string num;
-                while (pos < expr.size() && (std::isdigit(expr[pos]) || expr[pos] == '.')) {
-                    num += expr[pos++];
-                }
-                addToken(TokenType::NUMBER, start, pos - start, num);
-                return std::make_shared<NumberNode>(std::stod(num));
+        static void pause(unsigned& spins) {
+            if (++spins < 64) return;
+            if (spins < 256) {
+                sched_yield();
+            } else {
+                const timespec delay{0, 50000};
+                nanosleep(&delay, nullptr);
             }
+        }
 
-            // 解析字符串字面量
-            if (peek() == '"') {
-                size_t start = pos;
-                ++pos; // 跳过开始的引号
-                std::string str;
-                
-                while (pos < expr.size() && expr[pos] != '"') {
-                    if (expr[pos] == '\\' && pos + 1 < expr.size()) {
-                        // 处理转义序列
-                        ++pos; // 跳过反斜杠
-                        switch (expr[pos]) {
-                            case 'n': str += '\n'; break;
-                            case 't': str += '\t'; break;
-                            case 'r': str += '\r'; break;
-                            case '\\': str += '\\'; break;
-                            case '"': str += '"'; break;
-                            default:
-                                // 未知转义序列，保留原字符
-                                str += '\\';
-                                str += expr[pos];
-                                break;
+        [[noreturn]] void work(IEnvironment* environment) {
+            unsigned spins = 0;
+            for (;;) {
+                uint32_t id;
+                if (!shared->submissions.pop(id)) {
+                    if (shared->stopping.load(std::memory_order_acquire)) _exit(0);
+                    pause(spins);
+                    continue;
+                }
+                spins = 0;
+                Task& task = shared->tasks[id];
+                try {
+                    const size_t stride = shared->roundRows;
+                    const uint8_t* flags = validityFlags(stride);
+                    Batch batch(task.rows);
+                    for (size_t c = 0; c < names.size(); ++c) {
+                        Column column = Column::Borrow(arena + c * stride + task.begin, task.rows);
+                        if (flags[c]) column = column.withValidity(validityBits(c, stride), task.begin);
+                        batch.Add(names[c], std::move(column));
+                    }
+                    const std::vector<Column> outputs = projection.Evaluate(batch, environment);
+                    for (size_t r = 0; r < ruleCount; ++r) {
+                        double* out = arena + (names.size() + r) * stride + task.begin;
+                        for (size_t i = 0; i < task.rows; ++i) {
+                            const Value value = outputs[r].at(i);
+                            if (value.isString()) throw ExprException("ProcessPool rules must produce numbers or booleans");
+                            out[i] = value.isNull() ? std::numeric_limits<double>::quiet_NaN() : value.asNumber();
                         }
-                        ++pos;
-                    } else {
-                        str += expr[pos++];
                     }
+                    task.failed = 0;
+                } catch (const std::exception& e) {
+                    task.failed = 1;
+                    std::strncpy(task.error, e.what(), sizeof(task.error) - 1);
+                    task.error[sizeof(task.error) - 1] = '\0';
                 }
-                
-                if (pos >= expr.size()) {
-                    throw ExprException("Unterminated string literal");
-                }
-                
-                ++pos; // Skip the closing quote
-                addToken(TokenType::STRING, start, pos - start, "\"" + str + "\"");
-                return std::make_shared<StringNode>(str);
+                while (!shared->completions.push(id)) pause(spins);
             }
+        }
 
-            if (std::isalpha(peek())) {
-                size_t start = pos;
-                std::string ident;
-                while (pos < expr.size() && (std::isalnum(expr[pos]) || expr[pos] == '.' || expr[pos] == '_')) {
-                    ident += expr[pos++];
+        void runRound(const std::vector<const Column*>& inputs, const size_t begin, const size_t rows,
+                      std::vector<std::vector<double>>& results) {
+            shared->roundRows = rows;
+            uint8_t* flags = validityFlags(rows);
+            for (size_t c = 0; c < inputs.size(); ++c) {
+                double* destination = arena + c * rows;
+                for (size_t i = 0; i < rows; ++i) destination[i] = inputs[c]->numberAt(begin + i);
+                flags[c] = inputs[c]->hasValidity() ? 1 : 0;
+                if (!flags[c]) continue;
+                uint8_t* bits = validityBits(c, rows);
+                std::fill(bits, bits + (rows + 7) / 8, uint8_t(0));
+                for (size_t i = 0; i < rows; ++i) {
+                    if (inputs[c]->isValid(begin + i)) bits[i >> 3] |= static_cast<uint8_t>(1u << (i & 7));
                 }
+            }
 
-                if (match('(')) {
-                    std::vector<ASTNodePtr> args;
-                    if (!match(')')) {
-                        do {
-                            args.push_back(parseTernaryExpression());
-                        } while (match(','));
-                        if (!match(')')) throw ExprException("Missing closing parenthesis in function call");
-                    }
-                    addToken(TokenType::IDENTIFIER, start, ident.length(), ident);
-                    return std::make_shared<FunctionCallNode>(ident, args);
-                }
+            const size_t chunk = std::max(CHUNK_ROWS, (rows + MAX_TASKS - 1) / MAX_TASKS);
+            size_t tasks = 0;
+            for (size_t first = 0; first < rows; first += chunk, ++tasks) {
+                Task& task = shared->tasks[tasks];
+                task.begin = first;
+                task.rows = std::min(chunk, rows - first);
+                task.failed = 0;
+                shared->submissions.push(static_cast<uint32_t>(tasks));
+            }
 
-                if (ident == "true") {
-                    addToken(TokenType::BOOLEAN, start, ident.length(), ident);
-                    return std::make_shared<BooleanNode>(true);
+            std::string error;
+            unsigned spins = 0;
+            for (size_t done = 0; done < tasks;) {
+                uint32_t id;
+                if (shared->completions.pop(id)) {
+                    if (shared->tasks[id].failed && error.empty()) error = shared->tasks[id].error;
+                    ++done;
+                    spins = 0;
+                    continue;
                 }
-                if (ident == "false") {
-                    addToken(TokenType::BOOLEAN, start, ident.length(), ident);
-                    return std::make_shared<BooleanNode>(false);
+                for (const pid_t child : children) {
+                    int status;
+                    if (waitpid(child, &status, WNOHANG) == child) {
+                        broken = true;
+                        throw ExprException("ProcessPool worker exited unexpectedly");
+                    }
                 }
-
-                addToken(TokenType::IDENTIFIER, start, ident.length(), ident);
-                return std::make_shared<VariableNode>(ident);
+                pause(spins);
             }
+            if (!error.empty()) throw ExprException(error);
 
-            throw ExprException("Unrecognized expression");
+            for (size_t r = 0; r < ruleCount; ++r) {
+                const double* source = arena + (inputs.size() + r) * rows;
+                std::copy(source, source + rows, results[r].begin() + static_cast<std::ptrdiff_t>(begin));
+            }
         }
 
-    public:
-        explicit Parser(const std::string& expression) : expr(expression) {}
-        explicit Parser(const std::string& expression, std::vector<Token>* tokenVector) 
-            : expr(expression), tokens(tokenVector) {}
-
-        ASTNodePtr parse() {
-            pos = 0;
-            auto result = parseTernaryExpression();
-            skipWhitespace();
-            if (pos < expr.size()) throw ExprException("Incomplete expression parsing");
-            return result;
+        void shutdown() {
+            if (!shared) return;
+            shared->stopping.store(1, std::memory_order_release);
+            for (const pid_t child : children) {
+                if (broken) kill(child, SIGKILL);
+                int status;
+                waitpid(child, &status, 0);
+            }
+            children.clear();
+            shared->~Shared();
+            munmap(shared, mappingBytes);
+            shared = nullptr;
         }
     };
+#endif // EXPRESSIONKIT_HAS_PROCESS_POOL
 
     /**
      * @brief Main expression toolkit class for parsing and evaluating expressions
@@ -1042,7 +8488,7 @@ namespace ExpressionKit {
          * - Functions: max(a, b), sqrt(x)
          */
         static Value Eval(const std::string& expression, IEnvironment* environment = nullptr) {
-            return Parse(expression)->evaluate(environment);
+            return Parse(expression)->evaluate(environment).Owned();
         }
 
         /**
@@ -1057,7 +8503,22 @@ namespace ExpressionKit {
          * tokens that can be used for syntax highlighting or other analysis.
          */
         static Value Eval(const std::string& expression, IEnvironment* environment, std::vector<Token>* tokens) {
-            return Parse(expression, tokens)->evaluate(environment);
+            return Parse(expression, tokens)->evaluate(environment).Owned();
+        }
+
+        /**
+         * @brief Evaluate an expression string under a budget
+         * @param expression The expression string to evaluate
+         * @param environment Optional environment for variable and function resolution
+         * @param context Budget and cancellation context; its counters are reset first
+         * @return The evaluation result
+         * @throws ExprException If parsing fails or evaluation encounters an error
+         * @throws ExprAbortedException If the budget is exceeded or the evaluation is cancelled
+         */
+        static Value Eval(const std::string& expression, IEnvironment* environment, EvaluationContext& context) {
+            auto ast = Parse(expression);
+            context.Reset();
+            return ast->evaluate(environment, &context).Owned();
         }
 
         /**
@@ -1089,6 +8550,25 @@ namespace ExpressionKit {
             return parser.parse();
         }
 
+        /**
+         * @brief Evaluate a parsed expression for every row of a batch
+         * @param ast The parsed expression
+         * @param batch Named input columns
+         * @param environment Optional environment for variables not in the batch and host functions
+         * @param context Optional budget and cancellation context
+         * @return One result per row
+         * @throws ExprException If evaluation of any row fails
+         *
+         * Arithmetic, comparison and logical operators run as columnar kernels over
+         * numeric and boolean columns; other nodes fall back to row-by-row evaluation.
+         */
+        static Column EvaluateBatch(const ASTNodePtr& ast, const Batch& batch,
+                                    IEnvironment* environment = nullptr, EvaluationContext* context = nullptr) {
+            BatchEvaluation evaluation(batch, environment, context);
+            Column result = evaluation.Evaluate(ast);
+            return result.isConstant() ? Column::Values(std::vector<Value>(batch.size(), result.at(0))) : result;
+        }
+
         /**
          * @brief Call standard mathematical functions
          * @param functionName The name of the function to call
@@ -1120,6 +8600,303 @@ namespace ExpressionKit {
         return Expression::Eval(expression, environment, tokens);
     }
 
+    /**
+     * @brief Evaluate an expression string under a budget (namespace-level convenience function)
+     */
+    inline Value Eval(const std::string& expression, IEnvironment* environment, EvaluationContext& context) {
+        return Expression::Eval(expression, environment, context);
+    }
+
+    /**
+     * @brief Evaluate a parsed expression for every row of a batch (namespace-level convenience function)
+     */
+    inline Column EvaluateBatch(const ASTNodePtr& ast, const Batch& batch,
+                                IEnvironment* environment = nullptr, EvaluationContext* context = nullptr) {
+        return Expression::EvaluateBatch(ast, batch, environment, context);
+    }
+
+    /**
+     * @brief Import one Arrow array as a column
+     * @param schema Schema describing the array
+     * @param array The array data
+     * @param parentOffset Extra row offset inherited from an enclosing struct array
+     * @throws ExprException For unsupported formats
+     *
+     * float64 data and validity bitmaps are borrowed without copying; the array
+     * must stay alive (not released) for as long as the column is used. Other
+     * numeric types are widened to double, booleans are unpacked, utf8 strings are
+     * copied, and dictionary-encoded utf8 arrays become DICTIONARY columns.
+     */
+    inline Column ImportArrowColumn(const ArrowSchema& schema, const ArrowArray& array, const int64_t parentOffset = 0) {
+        const std::string format = schema.format ? schema.format : "";
+        const std::string name = schema.name ? schema.name : "";
+        const auto rows = static_cast<size_t>(array.length);
+        const auto offset = static_cast<size_t>(array.offset + parentOffset);
+        const void* const* buffers = array.buffers;
+        const auto* validity = array.null_count != 0 && buffers ? static_cast<const uint8_t*>(buffers[0]) : nullptr;
+
+        const auto integerAt = [](const std::string& type, const void* data, const size_t i) -> int64_t {
+            switch (type.empty() ? '\0' : type[0]) {
+                case 'c': return static_cast<const int8_t*>(data)[i];
+                case 'C': return static_cast<const uint8_t*>(data)[i];
+                case 's': return static_cast<const int16_t*>(data)[i];
+                case 'S': return static_cast<const uint16_t*>(data)[i];
+                case 'i': return static_cast<const int32_t*>(data)[i];
+                case 'I': return static_cast<const uint32_t*>(data)[i];
+                case 'l': return static_cast<const int64_t*>(data)[i];
+                case 'L': return static_cast<int64_t>(static_cast<const uint64_t*>(data)[i]);
+                default: throw ExprException("Unsupported Arrow integer format '" + type + "'");
+            }
+        };
+        const auto isInteger = [](const std::string& type) {
+            return type.size() == 1 && std::string("cCsSiIlL").find(type[0]) != std::string::npos;
+        };
+        const auto readStrings = [](const std::string& type, const ArrowArray& source, const size_t first, const size_t count) {
+            std::vector<std::string> out(count);
+            const char* chars = static_cast<const char*>(source.buffers[2]);
+            for (size_t i = 0; i < count; ++i) {
+                int64_t begin, end;
+                if (type == "u") {
+                    const auto* offsets = static_cast<const int32_t*>(source.buffers[1]);
+                    begin = offsets[first + i];
+                    end = offsets[first + i + 1];
+                } else {
+                    const auto* offsets = static_cast<const int64_t*>(source.buffers[1]);
+                    begin = offsets[first + i];
+                    end = offsets[first + i + 1];
+                }
+                out[i].assign(chars + begin, static_cast<size_t>(end - begin));
+            }
+            return out;
+        };
+
+        Column column;
+        if (schema.dictionary) {
+            const std::string valueFormat = schema.dictionary->format ? schema.dictionary->format : "";
+            if (!isInteger(format) || (valueFormat != "u" && valueFormat != "U") || !array.dictionary) {
+                throw ExprException("Unsupported Arrow dictionary encoding for column '" + name + "'");
+            }
+            const ArrowArray& values = *array.dictionary;
+            auto entries = readStrings(valueFormat, values, static_cast<size_t>(values.offset), static_cast<size_t>(values.length));
+            std::vector<uint32_t> codes(rows);
+            for (size_t i = 0; i < rows; ++i) {
+                const bool valid = !validity || ((validity[(offset + i) >> 3] >> ((offset + i) & 7)) & 1);
+                const int64_t code = valid ? integerAt(format, buffers[1], offset + i) : 0;
+                // Codes must index the dictionary; this also rejects 64-bit codes that do not fit
+                if (valid && (code < 0 || static_cast<uint64_t>(code) >= entries.size())) {
+                    throw ExprException("Dictionary code out of range");
+                }
+                codes[i] = static_cast<uint32_t>(code);
+            }
+            if (entries.empty() && rows > 0) entries.emplace_back();
+            column = Column::Dictionary(std::move(codes), std::move(entries));
+        } else if (format == "g") {
+            column = Column::Borrow(static_cast<const double*>(buffers[1]) + offset, rows);
+        } else if (format == "f") {
+            const auto* data = static_cast<const float*>(buffers[1]);
+            std::vector<double> out(rows);
+            for (size_t i = 0; i < rows; ++i) out[i] = data[offset + i];
+            column = Column::Numbers(std::move(out));
+        } else if (isInteger(format)) {
+            std::vector<double> out(rows);
+            for (size_t i = 0; i < rows; ++i) out[i] = static_cast<double>(integerAt(format, buffers[1], offset + i));
+            column = Column::Numbers(std::move(out));
+        } else if (format == "b") {
+            const auto* bits = static_cast<const uint8_t*>(buffers[1]);
+            std::vector<uint64_t> words((rows + 63) / 64, 0);
+            for (size_t i = 0; i < rows; ++i) {
+                words[i >> 6] |= static_cast<uint64_t>((bits[(offset + i) >> 3] >> ((offset + i) & 7)) & 1) << (i & 63);
+            }
+            column = Column::Bits(std::move(words), rows);
+        } else if (format == "u" || format == "U") {
+            column = Column::Strings(readStrings(format, array, offset, rows));
+        } else {
+            throw ExprException("Unsupported Arrow format '" + format + "' for column '" + name + "'");
+        }
+        return validity ? column.withValidity(validity, offset) : column;
+    }
+
+    /**
+     * @brief Import an Arrow record batch (a struct array) with one column per child
+     *
+     * Columns are named after the child schemas, so expression variables bind to
+     * Arrow fields by name. See ImportArrowColumn for ownership rules.
+     */
+    inline Batch ImportArrow(const ArrowSchema& schema, const ArrowArray& array) {
+        if (!schema.format || std::string(schema.format) != "+s") {
+            throw ExprException("Arrow record batch must be a struct array");
+        }
+        if (array.null_count != 0) throw ExprException("Arrow record batch must not have top-level nulls");
+        if (schema.n_children != array.n_children) throw ExprException("Arrow schema does not match array");
+        Batch batch(static_cast<size_t>(array.length));
+        for (int64_t i = 0; i < array.n_children; ++i) {
+            const ArrowSchema& child = *schema.children[i];
+            batch.Add(child.name ? child.name : "", ImportArrowColumn(child, *array.children[i], array.offset));
+        }
+        return batch;
+    }
+
+    /**
+     * @brief Export a column as an Arrow array
+     * @param column Column to export (NUMBER, BOOLEAN, STRING, DICTIONARY or a uniform VALUE column)
+     * @param schema Receives the schema; released through its release callback
+     * @param array Receives the data; released through its release callback
+     * @param name Field name written into the schema
+     * @throws ExprException If the column mixes value types
+     *
+     * Numeric columns are exported as float64 without copying (the exported array
+     * keeps the column's data alive) unless they borrow data without an owner, in
+     * which case the values are copied; booleans as bit-packed "b" and strings as
+     * utf8. Null rows are exported as the array's validity bitmap, and a column
+     * that is entirely null uses the null format "n".
+     */
+    inline void ExportArrow(const Column& column, ArrowSchema* schema, ArrowArray* array, const std::string& name = "") {
+        struct ExportedArray {
+            Column column;
+            std::vector<double> numbers;
+            std::vector<uint8_t> bits;
+            std::vector<uint8_t> validity;
+            std::vector<int32_t> offsets;
+            std::string chars;
+            const void* buffers[3] = {nullptr, nullptr, nullptr};
+        };
+        struct ExportedSchema {
+            std::string name;
+        };
+
+        const size_t rows = column.size();
+        auto exported = std::unique_ptr<ExportedArray>(new ExportedArray());
+        exported->column = column;
+        const char* format;
+        int64_t bufferCount = 2;
+        Column::Kind kind = column.getKind();
+        bool allNull = kind == Column::Kind::VALUE;
+        if (kind == Column::Kind::VALUE) {
+            // Constant and boxed columns: every non-null value must share one type
+            auto type = Value::NIL;
+            for (size_t i = 0; i < rows; ++i) {
+                const Value value = column.at(i);
+                if (value.isNull()) continue;
+                if (type != Value::NIL && value.type != type) throw ExprException("Cannot export a column of mixed types to Arrow");
+                type = value.type;
+            }
+            allNull = type == Value::NIL;
+            kind = type == Value::BOOLEAN ? Column::Kind::BOOLEAN : type == Value::STRING ? Column::Kind::STRING : Column::Kind::NUMBER;
+        }
+        if (allNull) {
+            format = "n";
+            bufferCount = 0;
+        } else switch (kind) {
+            case Column::Kind::NUMBER:
+            case Column::Kind::VALUE: {
+                format = "g";
+                if (column.getKind() == Column::Kind::NUMBER && !column.isConstant() && column.ownsData()) {
+                    exported->buffers[1] = column.numberData();
+                } else {
+                    exported->numbers.assign(rows, 0.0);
+                    for (size_t i = 0; i < rows; ++i) {
+                        const Value value = column.at(i);
+                        if (!value.isNull()) exported->numbers[i] = value.asNumber();
+                    }
+                    exported->buffers[1] = exported->numbers.data();
+                }
+                break;
+            }
+            case Column::Kind::BOOLEAN: {
+                format = "b";
+                exported->bits.assign((rows + 63) / 64 * 8, 0);
+                if (column.getKind() == Column::Kind::BOOLEAN) {
+                    for (size_t w = 0; w < (rows + 63) / 64; ++w) {
+                        const uint64_t word = column.booleanWord(w);
+                        for (size_t k = 0; k < 8; ++k) exported->bits[w * 8 + k] = static_cast<uint8_t>(word >> (8 * k));
+                    }
+                } else {
+                    for (size_t i = 0; i < rows; ++i) {
+                        if (column.at(i).asBoolean()) exported->bits[i >> 3] |= static_cast<uint8_t>(1u << (i & 7));   // Null is false
+                    }
+                }
+                exported->buffers[1] = exported->bits.data();
+                break;
+            }
+            default: {
+                format = "u";
+                bufferCount = 3;
+                exported->offsets.resize(rows + 1, 0);
+                for (size_t i = 0; i < rows; ++i) {
+                    if (column.getKind() != Column::Kind::VALUE) {
+                        exported->chars += column.stringAt(i);
+                    } else if (!column.at(i).isNull()) {
+                        exported->chars += column.at(i).asStringView();
+                    }
+                    if (exported->chars.size() > static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+                        throw ExprException("String column too large for Arrow utf8 export");
+                    }
+                    exported->offsets[i + 1] = static_cast<int32_t>(exported->chars.size());
+                }
+                exported->buffers[1] = exported->offsets.data();
+                exported->buffers[2] = exported->chars.data();
+                break;
+            }
+        }
+
+        int64_t nullCount = 0;
+        if (allNull) {
+            nullCount = static_cast<int64_t>(rows);
+        } else if (column.hasValidity() || column.getKind() == Column::Kind::VALUE) {
+            exported->validity.assign((rows + 7) / 8, 0);
+            for (size_t i = 0; i < rows; ++i) {
+                if (!column.at(i).isNull()) {
+                    exported->validity[i >> 3] |= static_cast<uint8_t>(1u << (i & 7));
+                } else {
+                    ++nullCount;
+                }
+            }
+            exported->buffers[0] = exported->validity.data();
+        }
+
+        *array = ArrowArray{};
+        array->length = static_cast<int64_t>(rows);
+        array->null_count = nullCount;
+        array->n_buffers = bufferCount;
+        array->buffers = exported->buffers;
+        array->release = [](ArrowArray* self) {
+            delete static_cast<ExportedArray*>(self->private_data);
+            self->release = nullptr;
+        };
+        array->private_data = exported.release();
+
+        auto exportedSchema = new ExportedSchema{name};
+        *schema = ArrowSchema{};
+        schema->format = format;
+        schema->name = exportedSchema->name.c_str();
+        schema->flags = nullCount > 0 ? ARROW_FLAG_NULLABLE : 0;
+        schema->release = [](ArrowSchema* self) {
+            delete static_cast<ExportedSchema*>(self->private_data);
+            self->release = nullptr;
+        };
+        schema->private_data = exportedSchema;
+    }
+
+    /**
+     * @brief Evaluate a parsed expression over an Arrow record batch and export the result
+     * @param ast The parsed expression
+     * @param inputSchema Schema of the input struct array
+     * @param input Input struct array; variables bind to its fields by name
+     * @param outputSchema Receives the result schema
+     * @param output Receives the result array
+     * @param environment Optional environment for variables not in the batch and host functions
+     * @param context Optional budget and cancellation context
+     *
+     * Arrow nulls become null values, which propagate through the expression
+     * (with three-valued logic for && and ||) and are exported as result nulls.
+     */
+    inline void EvaluateArrow(const ASTNodePtr& ast, const ArrowSchema& inputSchema, const ArrowArray& input,
+                              ArrowSchema* outputSchema, ArrowArray* output,
+                              IEnvironment* environment = nullptr, EvaluationContext* context = nullptr) {
+        const Batch batch = ImportArrow(inputSchema, input);
+        ExportArrow(Expression::EvaluateBatch(ast, batch, environment, context), outputSchema, output);
+    }
+
     /**
      * @brief Parse an expression string into an Abstract Syntax Tree (namespace-level convenience function)
      */
@@ -40,7 +40,7 @@
  *
  * - Interface-based variable and function access through Environment abstraction
  * - Pre-parsed AST support for efficient repeated evaluation
- * - Support for numbers, booleans, strings, variables, and function calls
+ * - Support for numbers, booleans, strings, null, variables, and function calls
  * - Comprehensive operator support (arithmetic, comparison, logical)
  * - Type-safe value system with automatic conversions
  * - Exception-based error handling
@@ -67,6 +67,7 @@ public enum TokenType: Int, CaseIterable {
     case comma = 6        // Function argument separator: ,
     case whitespace = 7   // Spaces, tabs (optional for highlighting)
     case unknown = 8      // Unrecognized tokens
+    case nullValue = 9    // Null literal: null
 }
 
 /// Token structure for syntax highlighting and analysis
@@ -131,6 +132,7 @@ public struct Value {
         case number = 0
         case boolean = 1
         case string = 2
+        case null = 3
     }
     
     /// The type of this value
@@ -141,6 +143,7 @@ public struct Value {
         case number(Double)
         case boolean(Bool)
         case string(String)
+        case null
         
         /// Get the number value (for testing)
         public var number: Double {
@@ -202,6 +205,14 @@ public struct Value {
         self.data = .string(value)
     }
     
+    private init(type: ValueType, data: Data) {
+        self.type = type
+        self.data = data
+    }
+    
+    /// The null value, used for missing data
+    public static let null = Value(type: .null, data: .null)
+    
     // MARK: - Static factory methods for backward compatibility
     
     /// Create a numeric value (backward compatibility)
@@ -230,6 +241,9 @@ public struct Value {
     /// Check if this value is a string
     public var isString: Bool { type == .string }
     
+    /// Check if this value is null
+    public var isNull: Bool { type == .null }
+    
     // MARK: - Convenience properties for backward compatibility
     
     /// Get the number value if this is a number (backward compatibility)
@@ -294,16 +308,22 @@ public struct Value {
             throw ExpressionError.typeError("Cannot convert string '\(str)' to number")
         case .boolean(let bool):
             return bool ? 1.0 : 0.0
+        case .null:
+            throw ExpressionError.typeError("value is null")
         }
     }
     
     /// Convert to boolean with automatic type conversion (internal use)
+    ///
+    /// Null is treated as false, so a null condition takes the false branch
     internal func toBoolean() throws -> Bool {
         switch data {
         case .boolean(let value):
             return value
         case .number(let num):
             return num != 0.0
+        case .null:
+            return false
         case .string(let str):
             // Convert string to boolean with intuitive rules
             if str.isEmpty { return false }
@@ -328,6 +348,8 @@ public struct Value {
             return String(num)
         case .boolean(let bool):
             return bool ? "true" : "false"
+        case .null:
+            return "null"
         }
     }
     
@@ -349,6 +371,8 @@ extension Value: Equatable {
                 return a == b
             case (.string(let a), .string(let b)):
                 return a == b
+            case (.null, .null):
+                return true
             default:
                 return false
             }
@@ -366,6 +390,8 @@ extension Value: CustomStringConvertible {
             return String(value)
         case .string(let value):
             return value
+        case .null:
+            return "null"
         }
     }
 }
@@ -433,7 +459,7 @@ protocol ASTNode {
 /// This node holds a constant numeric value and returns it during evaluation.
 /// Examples: 42, 3.14, -2.5
 class NumberNode: ASTNode {
-    private let value: Double
+    let value: Double
     
     init(_ value: Double) {
         self.value = value
@@ -465,7 +491,7 @@ class BooleanNode: ASTNode {
 /// This node holds a constant string value and returns it during evaluation.
 /// Examples: "hello", "world", "Hello, \"World\"!"
 class StringNode: ASTNode {
-    private let value: String
+    let value: String
     
     init(_ value: String) {
         self.value = value
@@ -476,6 +502,16 @@ class StringNode: ASTNode {
     }
 }
 
+/// AST node representing the null literal
+///
+/// This node returns the null value used for missing data.
+/// Example: null
+class NullNode: ASTNode {
+    func evaluate(_ environment: IEnvironment?) throws -> Value {
+        return .null
+    }
+}
+
 /// AST node representing a variable reference
 ///
 /// This node stores a variable name and delegates to the IEnvironment during
@@ -512,7 +548,17 @@ class VariableNode: ASTNode {
 /// - floor(x): Returns the largest integer less than or equal to x
 /// - ceil(x): Returns the smallest integer greater than or equal to x
 /// - round(x): Returns x rounded to the nearest integer
+/// - isnull(x): Returns whether x is null
+/// - coalesce(a, b, ...): Returns the first argument that is not null
 public func callStandardFunctions(_ functionName: String, args: [Value]) throws -> Value? {
+    // Null handling
+    if functionName == "isnull" && args.count == 1 {
+        return Value(args[0].isNull)
+    }
+    if functionName == "coalesce" && !args.isEmpty {
+        return args.first(where: { !$0.isNull }) ?? .null
+    }
+    
     // Two-argument functions
     if functionName == "min" && args.count == 2 {
         let a = try args[0].toNumber()
@@ -569,6 +615,120 @@ public func callStandardFunctions(_ functionName: String, args: [Value]) throws
     return nil // Function not found or invalid arguments
 }
 
+/// Whether name and arity select one of the standard mathematical functions
+///
+/// These functions return null for null arguments; isnull and coalesce are not included.
+func isStandardFunction(_ functionName: String, arity: Int) -> Bool {
+    if arity == 2 {
+        return functionName == "min" || functionName == "max" || functionName == "pow"
+    }
+    guard arity == 1 else { return false }
+    let unary = ["sqrt", "sin", "cos", "tan", "abs", "log", "exp", "floor", "ceil", "round"]
+    return unary.contains(functionName)
+}
+
+/// ASCII case-insensitive comparison and search
+///
+/// Bytes are folded to lower case on the fly; non-ASCII bytes compare exactly.
+enum AsciiCase {
+    static func fold(_ b: UInt8) -> UInt8 {
+        return b >= 0x41 && b <= 0x5A ? b | 0x20 : b
+    }
+    
+    /// Whether a and b are equal ignoring ASCII case
+    static func equals(_ a: String, _ b: String) -> Bool {
+        return a.utf8.count == b.utf8.count && a.utf8.elementsEqual(b.utf8) { fold($0) == fold($1) }
+    }
+    
+    /// Whether haystack contains needle ignoring ASCII case
+    static func contains(_ haystack: String, _ needle: String) -> Bool {
+        let folded = needle.utf8.map(fold)
+        if folded.isEmpty { return true }
+        let bytes = haystack.utf8.map(fold)
+        if folded.count > bytes.count { return false }
+        for i in 0...(bytes.count - folded.count) where bytes[i] == folded[0] {
+            if bytes[i..<(i + folded.count)].elementsEqual(folded) { return true }
+        }
+        return false
+    }
+}
+
+/// Whether name and arity select one of the built-in string functions
+func isStringFunction(_ functionName: String, arity: Int) -> Bool {
+    if arity == 1 {
+        return functionName == "len" || functionName == "lower" || functionName == "upper" || functionName == "trim"
+    }
+    if arity == 2 {
+        return functionName == "starts_with" || functionName == "ends_with" || functionName == "substr" ||
+               functionName == "ieq" || functionName == "icontains"
+    }
+    return arity == 3 && functionName == "substr"
+}
+
+/// Call the built-in string functions
+///
+/// These functions work on the UTF-8 bytes of their arguments, matching the C++ implementation:
+/// - len(s): Returns the length of s in bytes
+/// - substr(s, start[, length]): Returns the bytes of s from start (0-based), clamped to the string
+/// - starts_with(s, prefix), ends_with(s, suffix): Return whether s begins or ends with the given string
+/// - lower(s), upper(s): Return s with ASCII letters converted
+/// - trim(s): Returns s without leading and trailing ASCII whitespace
+/// - ieq(a, b): Returns whether a equals b ignoring ASCII case
+/// - icontains(s, needle): Returns whether s contains needle ignoring ASCII case
+///
+/// - Returns: The function result, or nil if the name and arity are not a string function or an
+///   argument has another type; such calls are left to the host
+/// - Throws: ExpressionError if substr gets a start or length that is not finite
+public func callStringFunctions(_ functionName: String, args: [Value]) throws -> Value? {
+    guard isStringFunction(functionName, arity: args.count) else { return nil }
+    guard case .string(let s) = args[0].data else { return nil }
+    let bytes = Array(s.utf8)
+    
+    switch functionName {
+    case "len":
+        return Value(Double(bytes.count))
+    case "trim":
+        let space = { (b: UInt8) -> Bool in b == 0x20 || (b >= 0x09 && b <= 0x0D) }
+        var begin = 0
+        var end = bytes.count
+        while begin < end && space(bytes[begin]) { begin += 1 }
+        while end > begin && space(bytes[end - 1]) { end -= 1 }
+        return Value(String(decoding: bytes[begin..<end], as: UTF8.self))
+    case "substr":
+        for arg in args.dropFirst() {
+            guard let number = arg.numberValue else { return nil }
+            if !number.isFinite {
+                throw ExpressionError.domainError("substr requires a finite start and length")
+            }
+        }
+        let start = try args[1].asNumber()
+        let begin = start > 0 ? Int(Swift.min(start, Double(bytes.count))) : 0
+        var count = bytes.count - begin
+        if args.count == 3 {
+            let length = try args[2].asNumber()
+            count = length > 0 ? Int(Swift.min(length, Double(count))) : 0
+        }
+        return Value(String(decoding: bytes[begin..<(begin + count)], as: UTF8.self))
+    case "starts_with", "ends_with":
+        guard case .string(let affix) = args[1].data else { return nil }
+        if functionName == "starts_with" {
+            return Value(s.utf8.starts(with: affix.utf8))
+        }
+        return Value(s.utf8.reversed().starts(with: affix.utf8.reversed()))
+    case "ieq", "icontains":
+        guard case .string(let other) = args[1].data else { return nil }
+        return Value(functionName == "ieq" ? AsciiCase.equals(s, other) : AsciiCase.contains(s, other))
+    default:
+        // lower and upper convert ASCII letters only
+        let upper = functionName == "upper"
+        let converted = bytes.map { (b: UInt8) -> UInt8 in
+            if upper { return b >= 0x61 && b <= 0x7A ? b - 0x20 : b }
+            return b >= 0x41 && b <= 0x5A ? b + 0x20 : b
+        }
+        return Value(String(decoding: converted, as: UTF8.self))
+    }
+}
+
 /// Enumeration of all supported operators
 ///
 /// This enum defines all arithmetic, comparison, and logical operators
@@ -607,6 +767,19 @@ class BinaryOpNode: ASTNode {
         let lhs = try left.evaluate(environment)
         let rhs = try right.evaluate(environment)
         
+        // Null propagates, except where a known operand decides && (false) or || (true)
+        if lhs.isNull || rhs.isNull {
+            if op == .and || op == .or {
+                let decisive = op == .or
+                let lhsDecides = try !lhs.isNull && lhs.toBoolean() == decisive
+                let rhsDecides = try !rhs.isNull && rhs.toBoolean() == decisive
+                if lhsDecides || rhsDecides {
+                    return Value(decisive)
+                }
+            }
+            return .null
+        }
+        
         // Boolean logical operations - allow any types and convert to boolean
         if op == .and || op == .or || op == .xor {
             let a = try lhs.toBoolean()
@@ -731,9 +904,11 @@ class UnaryOpNode: ASTNode {
         switch op {
         case .not:
             // NOT operator can work with any type - convert to boolean first
+            if val.isNull { return .null }
             let boolVal = try val.toBoolean()
             return Value(!boolVal)
         case .sub: // Negation
+            if val.isNull { return .null }
             if !val.isNumber {
                 throw ExpressionError.typeError("Negation can only be used with numbers")
             }
@@ -804,19 +979,694 @@ class FunctionCallNode: ASTNode {
             evaluatedArgs.append(try arg.evaluate(environment))
         }
         
-        // First try standard mathematical functions (works without environment)
+        // Standard functions return null for null arguments; host functions see the nulls
+        let builtIn = isStandardFunction(name, arity: evaluatedArgs.count) || isStringFunction(name, arity: evaluatedArgs.count)
+        if builtIn && evaluatedArgs.contains(where: { $0.isNull }) {
+            return .null
+        }
+        
+        // First try the standard mathematical and string functions (work without environment)
+        if let stringResult = try callStringFunctions(name, args: evaluatedArgs) {
+            return stringResult
+        }
         if let standardResult = try callStandardFunctions(name, args: evaluatedArgs) {
             return standardResult
         }
         
         // If not a standard function, require environment
-        guard let environment = environment else {
-            throw ExpressionError.evaluationError("Function call requires IEnvironment")
+        if isStringFunction(name, arity: evaluatedArgs.count) {
+            return try callHostFunction(name, args: evaluatedArgs, environment: environment,
+                                        unavailable: "\(name) requires string arguments")
         }
-        return try environment.call(name, args: evaluatedArgs)
+        return try callHostFunction(name, args: evaluatedArgs, environment: environment)
     }
 }
 
+/// Call a function through the environment
+/// - Parameter unavailable: Error message used when there is no environment
+/// - Throws: ExpressionError if there is no environment or the call fails
+func callHostFunction(_ name: String, args: [Value], environment: IEnvironment?,
+                      unavailable: String = "Function call requires IEnvironment") throws -> Value {
+    guard let environment = environment else {
+        throw ExpressionError.evaluationError(unavailable)
+    }
+    return try environment.call(name, args: args)
+}
+
+/// Regular expression compiled ahead of time into a deterministic automaton
+///
+/// This is the Swift translation of the C++ `Regex` class. Supported syntax:
+/// literals, `.`, character classes (`[a-z]`, `[^0-9]`), the escapes
+/// `\d \w \s \D \W \S \n \t \r`, grouping with `(...)` or `(?:...)`, alternation
+/// `|`, the quantifiers `* + ?` and `{m}`, `{m,}`, `{m,n}`, and the anchors `^`
+/// and `$`, which match the start and end of the subject wherever they appear
+/// (so `^abc|xyz$` anchors each branch on its own). There are no backreferences
+/// or lookaround, so every pattern has a DFA.
+///
+/// The pattern is parsed, translated into a Thompson NFA and determinized by
+/// subset construction over byte equivalence classes when it is compiled.
+/// Matching then walks the UTF-8 bytes of the subject with one table lookup per
+/// byte and no backtracking. Unanchored patterns search for a match anywhere in
+/// the subject.
+final class CompiledRegex {
+    static let maxStates = 4096
+    
+    private static let dead: Int32 = 0
+    
+    private struct Node {
+        enum Kind { case set, concat, alternate, repetition, empty, start, end }
+        let kind: Kind
+        var set = -1
+        var first = -1
+        var second = -1
+        var min = 0
+        var max = 0   // -1 means unbounded
+        
+        init(_ kind: Kind) {
+            self.kind = kind
+        }
+    }
+    
+    private struct NfaState {
+        var epsilon: [Int] = []
+        var set = -1
+        var next = -1
+        var anchor = Node.Kind.empty   // .start or .end: continues at `next` only at that end of the subject
+    }
+    
+    /// The source pattern
+    let pattern: String
+    private var classOf = [UInt8](repeating: 0, count: 256)
+    private var classCount = 0
+    private var start: Int32 = 0
+    private var matchesEmpty = false
+    private var transitions: [Int32] = []
+    private var accepting: [UInt8] = []        // A match ends here whatever follows
+    private var acceptingAtEnd: [UInt8] = []   // A match ends here if the subject ends here
+    
+    // Parsing and NFA construction state, only used while compiling
+    private var body: [UInt8] = []
+    private var pos = 0
+    private var nodes: [Node] = []
+    private var sets: [[Bool]] = []
+    private var nfa: [NfaState] = []
+    
+    /// Compile a pattern
+    /// - Throws: ExpressionError if the pattern is malformed or its DFA exceeds maxStates
+    init(_ pattern: String) throws {
+        self.pattern = pattern
+        try compile()
+    }
+    
+    /// Check whether the pattern matches (anywhere in) the subject
+    func matches(_ subject: String) -> Bool {
+        if subject.utf8.isEmpty { return matchesEmpty }
+        var state = start
+        if accepting[Int(state)] != 0 { return true }
+        for byte in subject.utf8 {
+            state = transitions[Int(state) * classCount + Int(classOf[Int(byte)])]
+            if state == CompiledRegex.dead { return false }
+            if accepting[Int(state)] != 0 { return true }
+        }
+        return acceptingAtEnd[Int(state)] != 0
+    }
+    
+    /// Number of DFA states, including the dead state
+    var stateCount: Int { accepting.count }
+    
+    private func fail(_ message: String) -> ExpressionError {
+        return ExpressionError.parseError("Invalid regular expression '\(pattern)': \(message)")
+    }
+    
+    private func peek(_ c: Unicode.Scalar) -> Bool {
+        return pos < body.count && body[pos] == UInt8(ascii: c)
+    }
+    
+    private func addNode(_ node: Node) -> Int {
+        nodes.append(node)
+        return nodes.count - 1
+    }
+    
+    private func addSet(_ set: [Bool]) -> Int {
+        sets.append(set)
+        var node = Node(.set)
+        node.set = sets.count - 1
+        return addNode(node)
+    }
+    
+    private static func isDigit(_ b: Int) -> Bool { b >= 0x30 && b <= 0x39 }
+    private static func isWord(_ b: Int) -> Bool { isDigit(b) || (b >= 0x41 && b <= 0x5A) || (b >= 0x61 && b <= 0x7A) || b == 0x5F }
+    private static func isSpace(_ b: Int) -> Bool { b == 0x20 || (b >= 0x09 && b <= 0x0D) }
+    
+    private static func escapeSet(_ c: UInt8) -> (set: [Bool], isClass: Bool) {
+        let test: ((Int) -> Bool)?
+        switch c {
+        case UInt8(ascii: "d"): test = { CompiledRegex.isDigit($0) }
+        case UInt8(ascii: "D"): test = { !CompiledRegex.isDigit($0) }
+        case UInt8(ascii: "w"): test = { CompiledRegex.isWord($0) }
+        case UInt8(ascii: "W"): test = { !CompiledRegex.isWord($0) }
+        case UInt8(ascii: "s"): test = { CompiledRegex.isSpace($0) }
+        case UInt8(ascii: "S"): test = { !CompiledRegex.isSpace($0) }
+        default: test = nil
+        }
+        if let test = test {
+            return ((0..<256).map(test), true)
+        }
+        var set = [Bool](repeating: false, count: 256)
+        let literal: UInt8 = c == UInt8(ascii: "n") ? 0x0A : c == UInt8(ascii: "t") ? 0x09 : c == UInt8(ascii: "r") ? 0x0D : c
+        set[Int(literal)] = true
+        return (set, false)
+    }
+    
+    private func parseAlternation() throws -> Int {
+        var left = try parseConcatenation()
+        while peek("|") {
+            pos += 1
+            var node = Node(.alternate)
+            node.first = left
+            node.second = try parseConcatenation()
+            left = addNode(node)
+        }
+        return left
+    }
+    
+    private func parseConcatenation() throws -> Int {
+        var result = -1
+        while pos < body.count && !peek("|") && !peek(")") {
+            let item = try parseRepeat()
+            if result < 0 {
+                result = item
+            } else {
+                var node = Node(.concat)
+                node.first = result
+                node.second = item
+                result = addNode(node)
+            }
+        }
+        return result < 0 ? addNode(Node(.empty)) : result
+    }
+    
+    private func parseNumber() throws -> Int {
+        guard pos < body.count && CompiledRegex.isDigit(Int(body[pos])) else {
+            throw fail("expected a number")
+        }
+        var value = 0
+        while pos < body.count && CompiledRegex.isDigit(Int(body[pos])) {
+            value = value * 10 + Int(body[pos] - UInt8(ascii: "0"))
+            pos += 1
+            if value > 1000 { throw fail("repetition count too large") }
+        }
+        return value
+    }
+    
+    private func parseRepeat() throws -> Int {
+        var atom = try parseAtom()
+        while pos < body.count {
+            var node = Node(.repetition)
+            node.first = atom
+            if peek("*") {
+                node.min = 0; node.max = -1; pos += 1
+            } else if peek("+") {
+                node.min = 1; node.max = -1; pos += 1
+            } else if peek("?") {
+                node.min = 0; node.max = 1; pos += 1
+            } else if peek("{") {
+                pos += 1
+                node.min = try parseNumber()
+                node.max = node.min
+                if peek(",") {
+                    pos += 1
+                    node.max = try peek("}") ? -1 : parseNumber()
+                }
+                if !peek("}") { throw fail("missing '}'") }
+                pos += 1
+                if node.max >= 0 && node.max < node.min { throw fail("invalid repetition range") }
+            } else {
+                break
+            }
+            atom = addNode(node)
+        }
+        return atom
+    }
+    
+    private func parseClass() throws -> Int {
+        var set = [Bool](repeating: false, count: 256)
+        var negate = false
+        if peek("^") {
+            negate = true
+            pos += 1
+        }
+        var firstItem = true
+        while pos < body.count && (!peek("]") || firstItem) {
+            firstItem = false
+            let low: Int
+            if peek("\\") && pos + 1 < body.count {
+                let escaped = CompiledRegex.escapeSet(body[pos + 1])
+                pos += 2
+                if escaped.isClass {
+                    for b in 0..<256 where escaped.set[b] { set[b] = true }
+                    continue
+                }
+                low = escaped.set.firstIndex(of: true) ?? 0
+            } else {
+                low = Int(body[pos])
+                pos += 1
+            }
+            var high = low
+            if pos + 1 < body.count && peek("-") && body[pos + 1] != UInt8(ascii: "]") {
+                pos += 1
+                if peek("\\") && pos + 1 < body.count {
+                    let escaped = CompiledRegex.escapeSet(body[pos + 1])
+                    if escaped.isClass { throw fail("invalid class range") }
+                    high = escaped.set.firstIndex(of: true) ?? 0
+                    pos += 2
+                } else {
+                    high = Int(body[pos])
+                    pos += 1
+                }
+                if high < low { throw fail("invalid class range") }
+            }
+            for b in low...high { set[b] = true }
+        }
+        if pos >= body.count { throw fail("missing ']'") }
+        pos += 1
+        if negate { set = set.map { !$0 } }
+        return addSet(set)
+    }
+    
+    private func parseAtom() throws -> Int {
+        let c = Unicode.Scalar(body[pos])
+        if c == "(" {
+            pos += 1
+            if peek("?") && pos + 1 < body.count && body[pos + 1] == UInt8(ascii: ":") { pos += 2 }
+            let inner = try parseAlternation()
+            if !peek(")") { throw fail("missing ')'") }
+            pos += 1
+            return inner
+        }
+        if c == "[" {
+            pos += 1
+            return try parseClass()
+        }
+        if c == "*" || c == "+" || c == "?" || c == "{" { throw fail("nothing to repeat") }
+        pos += 1
+        if c == "^" || c == "$" { return addNode(Node(c == "^" ? .start : .end)) }
+        if c == "." {
+            var set = [Bool](repeating: true, count: 256)
+            set[0x0A] = false
+            return addSet(set)
+        }
+        if c == "\\" {
+            if pos >= body.count { throw fail("trailing backslash") }
+            let escaped = CompiledRegex.escapeSet(body[pos])
+            pos += 1
+            return addSet(escaped.set)
+        }
+        var set = [Bool](repeating: false, count: 256)
+        set[Int(c.value)] = true
+        return addSet(set)
+    }
+    
+    private func addState() throws -> Int {
+        if nfa.count >= CompiledRegex.maxStates * 16 { throw fail("pattern is too complex") }
+        nfa.append(NfaState())
+        return nfa.count - 1
+    }
+    
+    // Build NFA states for a node so that a match continues at `out`; returns the entry state
+    private func build(_ index: Int, _ out: Int) throws -> Int {
+        let node = nodes[index]
+        switch node.kind {
+        case .empty:
+            return out
+        case .start, .end:
+            let state = try addState()
+            nfa[state].anchor = node.kind
+            nfa[state].next = out
+            return state
+        case .set:
+            let state = try addState()
+            nfa[state].set = node.set
+            nfa[state].next = out
+            return state
+        case .concat:
+            return try build(node.first, build(node.second, out))
+        case .alternate:
+            let a = try build(node.first, out)
+            let b = try build(node.second, out)
+            let state = try addState()
+            nfa[state].epsilon = [a, b]
+            return state
+        case .repetition:
+            var tail = out
+            if node.max < 0 {
+                let loop = try addState()
+                let entry = try build(node.first, loop)
+                nfa[loop].epsilon = [entry, out]
+                tail = loop
+            } else {
+                for _ in node.min..<node.max {
+                    let entry = try build(node.first, tail)
+                    let state = try addState()
+                    nfa[state].epsilon = [entry, out]
+                    tail = state
+                }
+            }
+            for _ in 0..<node.min {
+                tail = try build(node.first, tail)
+            }
+            return tail
+        }
+    }
+    
+    // Epsilon closure of a set of NFA states, sorted; anchors are crossed only where they hold
+    private func closeOver(_ initial: [Int], atStart: Bool, atEnd: Bool) -> [Int] {
+        var states = initial
+        var seen = [Bool](repeating: false, count: nfa.count)
+        for s in states { seen[s] = true }
+        var i = 0
+        while i < states.count {
+            let state = nfa[states[i]]
+            var targets = state.epsilon
+            if (state.anchor == .start && atStart) || (state.anchor == .end && atEnd) {
+                targets.append(state.next)
+            }
+            for next in targets where !seen[next] {
+                seen[next] = true
+                states.append(next)
+            }
+            i += 1
+        }
+        return states.sorted()
+    }
+    
+    private func compile() throws {
+        body = Array(pattern.utf8)
+        let root = try parseAlternation()
+        if pos != body.count { throw fail("unmatched ')'") }
+        
+        let match = try addState()
+        let entry = try build(root, match)
+        
+        // Partition bytes into classes that every character set treats alike
+        var signatures: [[Bool]: UInt8] = [:]
+        for b in 0..<256 {
+            let signature = sets.map { $0[b] }
+            if let cls = signatures[signature] {
+                classOf[b] = cls
+            } else {
+                classOf[b] = UInt8(signatures.count)
+                signatures[signature] = classOf[b]
+            }
+        }
+        classCount = signatures.count
+        var representative = [Int](repeating: 0, count: classCount)
+        for b in stride(from: 255, through: 0, by: -1) {
+            representative[Int(classOf[b])] = b
+        }
+        
+        // Subset construction; DFA state 0 is the dead (empty) state
+        // Only states that read a byte, wait for the end or accept matter once a byte was read
+        let automaton = nfa
+        func productive(_ states: [Int]) -> [Int] {
+            return states.filter { automaton[$0].set >= 0 || automaton[$0].anchor == .end || $0 == match }
+        }
+        // Matches may begin at every position, but only the first one satisfies `^`
+        let startSet = productive(closeOver([entry], atStart: true, atEnd: false))
+        let restartSet = productive(closeOver([entry], atStart: false, atEnd: false))
+        matchesEmpty = closeOver([entry], atStart: true, atEnd: true).contains(match)
+        var ids: [[Int]: Int32] = [:]
+        var pending: [[Int]] = []
+        func idOf(_ states: [Int]) throws -> Int32 {
+            if let id = ids[states] { return id }
+            if ids.count >= CompiledRegex.maxStates { throw fail("pattern is too complex") }
+            let id = Int32(ids.count)
+            ids[states] = id
+            pending.append(states)
+            accepting.append(states.contains(match) ? 1 : 0)
+            acceptingAtEnd.append(closeOver(states, atStart: false, atEnd: true).contains(match) ? 1 : 0)
+            transitions.append(contentsOf: repeatElement(CompiledRegex.dead, count: classCount))
+            return id
+        }
+        _ = try idOf([])
+        start = try idOf(startSet)
+        var current = 1
+        while current < pending.count {
+            let states = pending[current]
+            for cls in 0..<classCount {
+                let byte = representative[cls]
+                var next: [Int] = []
+                for s in states where nfa[s].set >= 0 && sets[nfa[s].set][byte] {
+                    next.append(nfa[s].next)
+                }
+                next.append(contentsOf: restartSet)
+                let unique = Array(Set(next))
+                let closed = unique.isEmpty ? unique : productive(closeOver(unique, atStart: false, atEnd: false))
+                let target = try closed.isEmpty ? CompiledRegex.dead : idOf(closed)
+                transitions[current * classCount + cls] = target
+            }
+            current += 1
+        }
+        
+        body = []
+        nodes = []
+        sets = []
+        nfa = []
+    }
+}
+
+/// AST node for the `matches(subject, pattern)` built-in
+///
+/// A literal pattern is compiled into a CompiledRegex once when the expression
+/// is parsed. Non-literal patterns are compiled on each evaluation. Arguments
+/// that are not strings go to a host function named `matches`.
+class RegexMatchNode: ASTNode {
+    private let subject: ASTNode
+    private let pattern: ASTNode
+    private let compiled: CompiledRegex?
+    
+    init(_ subject: ASTNode, _ pattern: ASTNode) throws {
+        self.subject = subject
+        self.pattern = pattern
+        if let literal = pattern as? StringNode {
+            self.compiled = try CompiledRegex(literal.value)
+        } else {
+            self.compiled = nil
+        }
+    }
+    
+    func evaluate(_ environment: IEnvironment?) throws -> Value {
+        let value = try subject.evaluate(environment)
+        if let compiled = compiled, value.isString {
+            return try Value(compiled.matches(value.asString()))
+        }
+        let source = try pattern.evaluate(environment)
+        if (!value.isNull && !value.isString) || (!source.isNull && !source.isString) {
+            return try callHostFunction("matches", args: [value, source], environment: environment,
+                                        unavailable: value.isString || value.isNull ? "matches requires a string pattern"
+                                                                                    : "matches requires a string subject")
+        }
+        if value.isNull || source.isNull { return .null }
+        let regex = try compiled ?? CompiledRegex(source.asString())
+        return try Value(regex.matches(value.asString()))
+    }
+}
+
+/// Fast, seedable 64-bit hash that is stable across processes and platforms
+///
+/// Swift translation of the C++ StableHash, giving the same values: a
+/// wyhash-style function that reads input as little-endian words and mixes them
+/// with 64x64->128-bit multiplies. Strings hash their UTF-8 bytes, numbers hash
+/// their IEEE-754 bits (with -0 and NaN canonicalized) and booleans hash like 1
+/// and 0. Not suitable for cryptographic use.
+enum StableHash {
+    private static let secret: [UInt64] = [
+        0xa0761d6478bd642f, 0xe7037ed1a0b428db, 0x8ebc6af09c88c6e3, 0x589965cc75374cc3
+    ]
+    
+    static func bytes(_ data: [UInt8], seed: UInt64 = 0) -> UInt64 {
+        let length = data.count
+        var seed = seed ^ mix(seed ^ secret[0], secret[1])
+        var a: UInt64 = 0
+        var b: UInt64 = 0
+        if length <= 16 {
+            if length >= 4 {
+                let shift = (length >> 3) << 2
+                a = (read32(data, 0) << 32) | read32(data, shift)
+                b = (read32(data, length - 4) << 32) | read32(data, length - 4 - shift)
+            } else if length > 0 {
+                a = (UInt64(data[0]) << 16) | (UInt64(data[length >> 1]) << 8) | UInt64(data[length - 1])
+            }
+        } else {
+            var p = 0
+            var i = length
+            if i > 48 {
+                var lane1 = seed
+                var lane2 = seed
+                repeat {
+                    seed = mix(read64(data, p) ^ secret[1], read64(data, p + 8) ^ seed)
+                    lane1 = mix(read64(data, p + 16) ^ secret[2], read64(data, p + 24) ^ lane1)
+                    lane2 = mix(read64(data, p + 32) ^ secret[3], read64(data, p + 40) ^ lane2)
+                    p += 48
+                    i -= 48
+                } while i > 48
+                seed ^= lane1 ^ lane2
+            }
+            while i > 16 {
+                seed = mix(read64(data, p) ^ secret[1], read64(data, p + 8) ^ seed)
+                p += 16
+                i -= 16
+            }
+            a = read64(data, p + i - 16)
+            b = read64(data, p + i - 8)
+        }
+        return finish(a, b, seed, length)
+    }
+    
+    static func string(_ s: String, seed: UInt64 = 0) -> UInt64 {
+        return bytes(Array(s.utf8), seed: seed)
+    }
+    
+    static func number(_ value: Double, seed: UInt64 = 0) -> UInt64 {
+        var v = value
+        if v == 0 { v = 0 }
+        if v.isNaN { v = .nan }
+        let bits = v.bitPattern
+        // The 8-byte case of bytes() with the words already in register order
+        return finish((bits << 32) | (bits >> 32), bits, seed ^ mix(seed ^ secret[0], secret[1]), 8)
+    }
+    
+    /// Hash a string, number or boolean
+    /// - Throws: ExpressionError for null
+    static func of(_ value: Value, seed: UInt64 = 0) throws -> UInt64 {
+        switch value.data {
+        case .number(let v):
+            return number(v, seed: seed)
+        case .boolean(let flag):
+            return number(flag ? 1 : 0, seed: seed)
+        case .string(let s):
+            return string(s, seed: seed)
+        case .null:
+            throw ExpressionError.typeError("Cannot hash null")
+        }
+    }
+    
+    /// Map a hash onto [0, buckets) without division, using its high bits
+    static func bucket(_ hash: UInt64, _ buckets: UInt64) -> UInt64 {
+        return hash.multipliedFullWidth(by: buckets).high
+    }
+    
+    private static func mix(_ a: UInt64, _ b: UInt64) -> UInt64 {
+        let product = a.multipliedFullWidth(by: b)
+        return product.low ^ product.high
+    }
+    
+    private static func finish(_ a: UInt64, _ b: UInt64, _ seed: UInt64, _ length: Int) -> UInt64 {
+        let product = (a ^ secret[1]).multipliedFullWidth(by: b ^ seed)
+        return mix(product.low ^ secret[0] ^ UInt64(length), product.high ^ secret[1])
+    }
+    
+    private static func read64(_ data: [UInt8], _ offset: Int) -> UInt64 {
+        var v: UInt64 = 0
+        for k in 0..<8 { v |= UInt64(data[offset + k]) << (8 * k) }
+        return v
+    }
+    
+    private static func read32(_ data: [UInt8], _ offset: Int) -> UInt64 {
+        var v: UInt64 = 0
+        for k in 0..<4 { v |= UInt64(data[offset + k]) << (8 * k) }
+        return v
+    }
+}
+
+/// AST node for the hash64(value[, seed]) and bucket(value, n[, seed]) built-ins
+///
+/// hash64 returns the top 53 bits of StableHash.of, so the result is an exact
+/// integer; bucket maps the full hash onto [0, n). Seeds and bucket counts out
+/// of range go to a host function of the same name.
+class HashNode: ASTNode {
+    private let name: String
+    private let args: [ASTNode]  // value, [bucket count,] [seed]
+    
+    init(_ name: String, _ args: [ASTNode]) {
+        self.name = name
+        self.args = args
+    }
+    
+    /// Whether name and arity refer to hash64(value[, seed]) or bucket(value, n[, seed])
+    static func isHashFunction(_ name: String, arity: Int) -> Bool {
+        if name == "hash64" { return arity == 1 || arity == 2 }
+        return name == "bucket" && (arity == 2 || arity == 3)
+    }
+    
+    private static func validBuckets(_ n: Double) -> Bool {
+        return n >= 1 && n <= 9007199254740992.0 && n == n.rounded(.down)
+    }
+    
+    // Seeds must fit an Int64: [-2^63, 2^63)
+    private static func validSeed(_ seed: Double) -> Bool {
+        return seed >= -9223372036854775808.0 && seed < 9223372036854775808.0
+    }
+    
+    /// Whether a call fits the built-in; non-literal parameters are checked on evaluation
+    static func accepts(_ name: String, _ args: [ASTNode]) -> Bool {
+        guard isHashFunction(name, arity: args.count) else { return false }
+        for a in 1..<args.count {
+            if args[a] is StringNode || args[a] is BooleanNode { return false }
+            if let number = args[a] as? NumberNode {
+                let valid = name == "bucket" && a == 1 ? validBuckets(number.value) : validSeed(number.value)
+                if !valid { return false }
+            }
+        }
+        return true
+    }
+    
+    func evaluate(_ environment: IEnvironment?) throws -> Value {
+        var values: [Value] = []
+        for arg in args {
+            let value = try arg.evaluate(environment)
+            if value.isNull { return .null }
+            values.append(value)
+        }
+        var buckets: UInt64 = 0
+        var seed: UInt64 = 0
+        var next = 1
+        if name == "bucket" {
+            guard case .number(let n) = values[next].data, HashNode.validBuckets(n) else {
+                return try callHostFunction(name, args: values, environment: environment,
+                                            unavailable: "bucket requires a positive integer bucket count")
+            }
+            buckets = UInt64(n)
+            next += 1
+        }
+        if next < values.count {
+            guard case .number(let s) = values[next].data, HashNode.validSeed(s) else {
+                return try callHostFunction(name, args: values, environment: environment,
+                                            unavailable: "\(name) requires a numeric seed")
+            }
+            seed = UInt64(bitPattern: Int64(s))
+        }
+        let hash = try StableHash.of(values[0], seed: seed)
+        return Value(Double(name == "bucket" ? StableHash.bucket(hash, buckets) : hash >> 11))
+    }
+}
+
+/// Create the AST node for a function call
+///
+/// Built-ins that need their own node type (`matches`, `hash64` and `bucket`)
+/// are recognized here; everything else becomes a FunctionCallNode.
+func makeFunctionCallNode(_ name: String, _ args: [ASTNode]) throws -> ASTNode {
+    // Literal arguments of the wrong type leave the call to the host
+    let numeric = { (arg: ASTNode) -> Bool in arg is NumberNode || arg is BooleanNode }
+    if name == "matches" && args.count == 2 && !numeric(args[0]) && !numeric(args[1]) {
+        return try RegexMatchNode(args[0], args[1])
+    }
+    if HashNode.accepts(name, args) {
+        return HashNode(name, args)
+    }
+    return FunctionCallNode(name, args)
+}
+
 /// Recursive descent parser for expression strings
 ///
 /// This class implements a complete expression parser using the recursive
@@ -1151,7 +2001,7 @@ class Parser {
                     }
                 }
                 addToken(.identifier, start: start, length: ident.count, text: ident)
-                return FunctionCallNode(ident, args)
+                return try makeFunctionCallNode(ident, args)
             }
             
             // Check for boolean literals
@@ -1163,6 +2013,10 @@ class Parser {
                 addToken(.boolean, start: start, length: ident.count, text: ident)
                 return BooleanNode(false)
             }
+            if ident == "null" {
+                addToken(.nullValue, start: start, length: ident.count, text: ident)
+                return NullNode()
+            }
             
             // Variable
             addToken(.identifier, start: start, length: ident.count, text: ident)
@@ -994,6 +994,202 @@ final class ExpressionKitTests: XCTestCase {
         XCTAssertEqual(try Expression.eval("isPremium || (quantity * price > 200)", environment: env as EnvironmentProtocol), .boolean(true))
     }
 
+    // MARK: - Null Value Tests
+    
+    func testNullPropagation() throws {
+        XCTAssertEqual(try Expression.eval("null"), .null)
+        XCTAssertTrue(try Expression.eval("null + 1").isNull)
+        XCTAssertTrue(try Expression.eval("null == null").isNull)
+        XCTAssertTrue(try Expression.eval("\"a\" + null").isNull)
+        XCTAssertTrue(try Expression.eval("-null").isNull)
+        XCTAssertTrue(try Expression.eval("sqrt(null)").isNull)
+        XCTAssertTrue(try Expression.eval("max(1, null)").isNull)
+        XCTAssertEqual(try Expression.eval("null ? 1 : 2"), .number(2.0))
+    }
+    
+    func testThreeValuedLogic() throws {
+        XCTAssertEqual(try Expression.eval("null && false"), .boolean(false))
+        XCTAssertEqual(try Expression.eval("false && null"), .boolean(false))
+        XCTAssertEqual(try Expression.eval("null || true"), .boolean(true))
+        XCTAssertTrue(try Expression.eval("null && true").isNull)
+        XCTAssertTrue(try Expression.eval("null || false").isNull)
+        XCTAssertTrue(try Expression.eval("null xor true").isNull)
+        XCTAssertTrue(try Expression.eval("!null").isNull)
+    }
+    
+    func testNullFunctions() throws {
+        let env = SimpleEnvironment()
+        env.setValue(.null, for: "missing")
+        env.setValue(.number(3.0), for: "present")
+        XCTAssertEqual(try Expression.eval("isnull(missing)", environment: env as EnvironmentProtocol), .boolean(true))
+        XCTAssertEqual(try Expression.eval("isnull(present)", environment: env as EnvironmentProtocol), .boolean(false))
+        XCTAssertEqual(try Expression.eval("coalesce(missing, present, 4)", environment: env as EnvironmentProtocol), .number(3.0))
+        XCTAssertTrue(try Expression.eval("coalesce(missing, null)", environment: env as EnvironmentProtocol).isNull)
+        XCTAssertEqual(Value.null.description, "null")
+    }
+    
+    func testNullToken() throws {
+        var tokens: [Token]? = []
+        _ = try Expression.parse("null", tokens: &tokens)
+        XCTAssertEqual(tokens?.first?.type, .nullValue)
+        XCTAssertEqual(TokenType.nullValue.rawValue, 9)
+    }
+    
+    // MARK: - Regular Expression Tests
+    
+    func testMatches() throws {
+        XCTAssertEqual(try Expression.eval("matches(\"order 1234\", \"\\d+\")"), .boolean(true))
+        XCTAssertEqual(try Expression.eval("matches(\"abc\", \"^b\")"), .boolean(false))
+        XCTAssertEqual(try Expression.eval("matches(\"ababab\", \"^(ab){2,3}$\")"), .boolean(true))
+        XCTAssertEqual(try Expression.eval("matches(\"ab\", \"^(ab){2,3}$\")"), .boolean(false))
+        XCTAssertEqual(try Expression.eval("matches(\"x-y\", \"^[a-z]-[^0-9]$\")"), .boolean(true))
+        XCTAssertEqual(try Expression.eval("matches(\"GET\", \"^(GET|HEAD)$\")"), .boolean(true))
+        XCTAssertEqual(try Expression.eval("matches(\"a\\nb\", \"a.b\")"), .boolean(false))
+        XCTAssertTrue(try Expression.eval("matches(null, \"a\")").isNull)
+        
+        let env = SimpleEnvironment()
+        env.setValue(.string("user@corp.com"), for: "email")
+        env.setValue(.string("^\\w+@corp\\.com$"), for: "pattern")
+        let compiled = try Expression.parse("matches(email, \"^\\w+@corp\\.com$\")")
+        XCTAssertEqual(try compiled.evaluate(env as EnvironmentProtocol), .boolean(true))
+        XCTAssertEqual(try Expression.eval("matches(email, pattern)", environment: env as EnvironmentProtocol), .boolean(true))
+        
+        let regex = try CompiledRegex("^(a|b)*c$")
+        XCTAssertTrue(regex.matches("abbac"))
+        XCTAssertFalse(regex.matches("abbacd"))
+    }
+    
+    func testRegexAnchorsPerBranch() throws {
+        let either = try CompiledRegex("^abc|xyz$")
+        XCTAssertTrue(either.matches("abc123"))
+        XCTAssertTrue(either.matches("123xyz"))
+        XCTAssertFalse(either.matches("1abc"))
+        XCTAssertFalse(either.matches("xyz1"))
+        XCTAssertTrue(try CompiledRegex("a|^b").matches("bx"))
+        XCTAssertFalse(try CompiledRegex("a|^b").matches("xb"))
+        XCTAssertTrue(try CompiledRegex("(^a)").matches("ab"))
+        XCTAssertFalse(try CompiledRegex("(^a)").matches("ba"))
+        XCTAssertTrue(try CompiledRegex("(^|,)x(,|$)").matches("a,x,b"))
+        XCTAssertFalse(try CompiledRegex("(^|,)x(,|$)").matches("ax"))
+        XCTAssertTrue(try CompiledRegex("^$").matches(""))
+        XCTAssertFalse(try CompiledRegex("^$").matches("a"))
+        XCTAssertFalse(try CompiledRegex("a^b").matches("ab"))
+    }
+    
+    func testMatchesErrors() {
+        // Malformed literal patterns fail when the expression is parsed
+        XCTAssertThrowsError(try Expression.parse("matches(s, \"(a\")"))
+        XCTAssertThrowsError(try Expression.parse("matches(s, \"*a\")"))
+        
+        // Arguments that are not strings go to the host
+        XCTAssertThrowsError(try Expression.eval("matches(1, 2)")) { error in
+            XCTAssertEqual(error.localizedDescription, "Evaluation failed: Function call requires IEnvironment")
+        }
+        XCTAssertThrowsError(try Expression.eval("matches(\"a\", 1 + 1)")) { error in
+            XCTAssertEqual(error.localizedDescription, "Evaluation failed: matches requires a string pattern")
+        }
+    }
+    
+    // MARK: - String Function Tests
+    
+    func testStringFunctions() throws {
+        XCTAssertEqual(try Expression.eval("len(\"hello\")"), .number(5.0))
+        XCTAssertEqual(try Expression.eval("len(\"é\")"), .number(2.0))
+        XCTAssertEqual(try Expression.eval("substr(\"/api/v1/users\", 0, 5)"), .string("/api/"))
+        XCTAssertEqual(try Expression.eval("substr(\"hello\", 3)"), .string("lo"))
+        XCTAssertEqual(try Expression.eval("substr(\"hello\", -2, 100)"), .string("hello"))
+        XCTAssertEqual(try Expression.eval("substr(\"hello\", 9)"), .string(""))
+        XCTAssertEqual(try Expression.eval("starts_with(\"/api/v1\", \"/api\")"), .boolean(true))
+        XCTAssertEqual(try Expression.eval("ends_with(\"db.internal\", \".internal\")"), .boolean(true))
+        XCTAssertEqual(try Expression.eval("ends_with(\"a\", \"ba\")"), .boolean(false))
+        XCTAssertEqual(try Expression.eval("lower(\"POST\")"), .string("post"))
+        XCTAssertEqual(try Expression.eval("upper(\"Mixed 1\")"), .string("MIXED 1"))
+        XCTAssertEqual(try Expression.eval("trim(\"  tag \\t\")"), .string("tag"))
+        XCTAssertTrue(try Expression.eval("len(null)").isNull)
+        
+        let env = SimpleEnvironment()
+        env.setValue(.string("/api/v1/users"), for: "path")
+        XCTAssertEqual(try Expression.eval("substr(path, 0, 5) == \"/api/\" && len(path) > 10", environment: env as EnvironmentProtocol), .boolean(true))
+        
+        env.setValue(.number(.nan), for: "nan")
+        env.setValue(.number(.infinity), for: "inf")
+        XCTAssertThrowsError(try Expression.eval("substr(path, nan)", environment: env as EnvironmentProtocol)) { error in
+            XCTAssertEqual(error.localizedDescription, "Domain error: substr requires a finite start and length")
+        }
+        XCTAssertThrowsError(try Expression.eval("substr(path, 1, inf)", environment: env as EnvironmentProtocol))
+        
+        // Arguments of other types are left to the host
+        XCTAssertThrowsError(try Expression.eval("len(1)")) { error in
+            XCTAssertEqual(error.localizedDescription, "Evaluation failed: len requires string arguments")
+        }
+        env.setValue(.number(5), for: "x")
+        for source in ["len(x)", "lower(x)", "substr(\"abc\", \"1\")", "starts_with(x, \"5\")", "ends_with(path, x)"] {
+            XCTAssertThrowsError(try Expression.eval(source, environment: env as EnvironmentProtocol)) { error in
+                XCTAssertEqual(error.localizedDescription, "Unknown function: " + source.prefix(while: { $0 != "(" }))
+            }
+        }
+    }
+    
+    func testCaseInsensitiveFunctions() throws {
+        XCTAssertEqual(try Expression.eval("ieq(\"Content-Type\", \"content-type\")"), .boolean(true))
+        XCTAssertEqual(try Expression.eval("ieq(\"abc\", \"abd\")"), .boolean(false))
+        XCTAssertEqual(try Expression.eval("ieq(\"É\", \"é\")"), .boolean(false))   // Only ASCII letters fold
+        XCTAssertEqual(try Expression.eval("icontains(\"Mozilla/5.0 Googlebot\", \"BOT\")"), .boolean(true))
+        XCTAssertEqual(try Expression.eval("icontains(\"curl\", \"\")"), .boolean(true))
+        XCTAssertEqual(try Expression.eval("icontains(\"bo\", \"bot\")"), .boolean(false))
+        XCTAssertTrue(try Expression.eval("icontains(null, \"bot\")").isNull)
+        
+        // Arguments of other types are left to the host
+        XCTAssertThrowsError(try Expression.eval("ieq(\"a\", 1)")) { error in
+            XCTAssertEqual(error.localizedDescription, "Evaluation failed: ieq requires string arguments")
+        }
+        let env = SimpleEnvironment()
+        env.setValue(.number(5), for: "x")
+        XCTAssertThrowsError(try Expression.eval("icontains(x, \"bot\")", environment: env as EnvironmentProtocol)) { error in
+            XCTAssertEqual(error.localizedDescription, "Unknown function: icontains")
+        }
+        XCTAssertThrowsError(try Expression.eval("ieq(\"a\", x)", environment: env as EnvironmentProtocol)) { error in
+            XCTAssertEqual(error.localizedDescription, "Unknown function: ieq")
+        }
+    }
+    
+    // MARK: - Hash Function Tests
+    
+    func testStableHash() throws {
+        // Values are pinned to the C++ implementation, so both assign the same buckets
+        XCTAssertEqual(StableHash.string(""), 290873116282709081)
+        XCTAssertEqual(StableHash.string("user-42"), 5920384170201156578)
+        XCTAssertEqual(StableHash.string("user-42", seed: 7), 8576418107070394579)
+        XCTAssertEqual(StableHash.string("0123456789abcdef0123456789abcdef0123456789abcdef0123456789"), 17316826463253119515)
+        XCTAssertEqual(StableHash.number(42.0), 3432788146909067790)
+        XCTAssertEqual(StableHash.number(-0.0), StableHash.number(0.0))
+        
+        let env = SimpleEnvironment()
+        env.setValue(.string("user-42"), for: "user")
+        env.setValue(.number(42.0), for: "id")
+        XCTAssertEqual(try Expression.eval("hash64(user)", environment: env as EnvironmentProtocol), .number(2890812583106033.0))
+        XCTAssertEqual(try Expression.eval("bucket(user, 100)", environment: env as EnvironmentProtocol), .number(32.0))
+        XCTAssertEqual(try Expression.eval("hash64(true) == hash64(1)"), .boolean(true))
+        XCTAssertEqual(try Expression.eval("hash64(id) != hash64(\"42\")", environment: env as EnvironmentProtocol), .boolean(true))
+        XCTAssertEqual(try Expression.eval("hash64(user, 1) != hash64(user, 2)", environment: env as EnvironmentProtocol), .boolean(true))
+        XCTAssertEqual(try Expression.eval("isnull(bucket(null, 10))"), .boolean(true))
+        XCTAssertTrue(try Expression.eval("hash64(user, -9223372036854775808)", environment: env as EnvironmentProtocol).isNumber)
+    }
+    
+    func testHashParametersOutOfRange() {
+        // Literal parameters out of range make an ordinary function call
+        XCTAssertThrowsError(try Expression.eval("bucket(\"u\", 0)")) { error in
+            XCTAssertEqual(error.localizedDescription, "Evaluation failed: Function call requires IEnvironment")
+        }
+        // Computed ones are passed to the host, with a specific message when there is none
+        XCTAssertThrowsError(try Expression.eval("bucket(\"u\", 1 - 1)")) { error in
+            XCTAssertEqual(error.localizedDescription, "Evaluation failed: bucket requires a positive integer bucket count")
+        }
+        XCTAssertThrowsError(try Expression.eval("hash64(\"u\", \"s\" + \"\")")) { error in
+            XCTAssertEqual(error.localizedDescription, "Evaluation failed: hash64 requires a numeric seed")
+        }
+    }
+    
     // MARK: - Helper Methods
     
     private func measureTime<T>(_ operation: () throws -> T) rethrows -> TimeInterval {